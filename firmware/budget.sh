@@ -0,0 +1,362 @@
+#!/bin/sh
+#
+# Flash, RAM and interrupt cycle budget of the firmware.
+#
+# usage: budget.sh elf budgetfile [update] [isr objects...]
+#
+# Reports the size of every function and variable, the totals and the static
+# worst case cycle count of the interrupt handlers in the given object files,
+# along with the longest they run with interrupts disabled.
+# The totals and the interrupt figures are checked against the budget file,
+# which lists a baseline (the last accepted value) and a hard limit per figure
+# ("-" for none). Exceeding either fails, a figure without a baseline only
+# warns. The per symbol sizes are printed to find what grew, not checked.
+# With "update" the baselines are replaced by the current values, keeping the
+# limits.
+
+ELF="$1"
+BUDGET="$2"
+shift 2
+UPDATE=0
+if [ "$1" = "update" ]; then
+	UPDATE=1
+	shift
+fi
+ISR_OBJECTS="$*"
+
+NM=${NM:-avr-nm}
+SIZE=${SIZE:-avr-size}
+OBJDUMP=${OBJDUMP:-avr-objdump}
+USB_LATENCY=${USB_LATENCY:-25} # cycles V-USB tolerates the USB interrupt to be blocked at 12 MHz
+
+set -e
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+
+# per symbol sizes, data lives in flash and RAM
+echo "Flash and RAM per symbol:"
+$NM --size-sort -S -t d "$ELF" | awk '
+	NF == 4 {
+		size = $2 + 0
+		type = $3
+		if( type ~ /[Tt]/ )      { flash = size; ram = 0 }
+		else if( type ~ /[Dd]/ ) { flash = size; ram = size }
+		else if( type ~ /[Bb]/ ) { flash = 0;    ram = size }
+		else next
+		printf "  %-32s %6d %6d\n", $4, flash, ram
+	}
+	BEGIN { printf "  %-32s %6s %6s\n", "symbol", "flash", "ram" }
+'
+
+
+# totals from the sections
+$SIZE -A "$ELF" | awk '
+	$1 == ".text"   { text = $2 }
+	$1 == ".data"   { data = $2 }
+	$1 == ".bss"    { bss = $2 }
+	$1 == ".noinit" { noinit = $2 }
+	END {
+		print "flash", text + data
+		print "ram", data + bss + noinit
+	}
+' > "$TMP/current"
+
+
+# Longest path through each handler, from the interrupt response to reti, and the longest
+# window it runs with interrupts disabled: from the response or a cli to the instruction
+# after a sei, or to reti. Writing SREG restores the interrupt state it was read with.
+# Handlers must not loop or call, otherwise there is no static bound. They may jump to the
+# start of another function, which is followed like the rest of the handler.
+$OBJDUMP -d "$ELF" > "$TMP/disassembly"
+for OBJECT in $ISR_OBJECTS; do
+	$NM "$OBJECT" | awk '$2 == "T" && $3 ~ /^__vector_[0-9]+$/ { print $3 }'
+done | sort -u | while read -r VECTOR; do
+	awk -v vector="$VECTOR" -v latency="$USB_LATENCY" '
+		function hex( s,    i, n, c ) {
+			n = 0
+			s = tolower( s )
+			gsub( / /, "", s )
+			sub( /^0x/, "", s )
+			for( i = 1; i <= length( s ); ++i )
+			{
+				c = index( "0123456789abcdef", substr( s, i, 1 ) )
+				if( !c )
+					break
+				n = n * 16 + c - 1
+			}
+			return n
+		}
+		function fail( message ) {
+			print "Error: " vector ": " message > "/dev/stderr"
+			failed = 1
+			exit 1
+		}
+		function max( a, b ) { return a > b ? a : b }
+		# cycles of the instruction when it does not branch, AVRe core (ATtiny)
+		function cycles( m ) {
+			if( m ~ /^(ret|reti)$/ )                                  return 4
+			if( m ~ /^(rcall|icall|lpm|elpm)$/ )                      return 3
+			if( m ~ /^(adiw|sbiw|ld|ldd|lds|st|std|sts|push|pop|rjmp|ijmp|cbi|sbi)$/ ) return 2
+			return 1
+		}
+		# instructions following i and the cycles to get there, -1 stands for falling off the end
+		function successors( i,    m, t ) {
+			m = mnemonic[i]
+			if( m ~ /^(call|rcall|icall|eicall|ijmp|eijmp)$/ )
+				fail( m " at 0x" sprintf( "%x", address[i] ) " has no static bound" )
+			if( m ~ /^(ret|reti)$/ )
+				return 0
+			if( m ~ /^(cpse|sbrc|sbrs|sbic|sbis)$/ )
+			{
+				if( i + 1 > last[owner[i]] )
+					fail( m " at 0x" sprintf( "%x", address[i] ) " skips out of the handler" )
+				next_index[1] = i + 1;   next_cycles[1] = 1
+				next_index[2] = i + 2 > last[owner[i]] ? -1 : i + 2
+				next_cycles[2] = 1 + words[i + 1]
+				return 2
+			}
+			if( m ~ /^(rjmp|jmp)$/ || m ~ /^br/ )
+			{
+				if( target[i] < 0 || !( target[i] in index_of ) )
+					fail( m " at 0x" sprintf( "%x", address[i] ) " leaves the handler" )
+				t = index_of[target[i]]
+				if( owner[t] != owner[i] && t != first[owner[t]] )
+					fail( m " at 0x" sprintf( "%x", address[i] ) " leaves the handler" )
+				if( owner[t] == owner[i] && t <= i )
+					fail( "loop at 0x" sprintf( "%x", address[i] ) " has no static bound" )
+				next_index[1] = t;       next_cycles[1] = m == "jmp" ? 3 : 2
+				if( m ~ /^br/ )
+				{ # not taken falls through
+					next_index[2] = i + 1 > last[owner[i]] ? -1 : i + 1
+					next_cycles[2] = 1
+					return 2
+				}
+				return 1
+			}
+			next_index[1] = i + 1 > last[owner[i]] ? -1 : i + 1
+			next_cycles[1] = cycles( m )
+			return 1
+		}
+		# functions the handler runs through, each after the ones it jumps to
+		function visit( f,    i, n, targets, list ) {
+			if( visiting[f] )
+				fail( "loop through " f " has no static bound" )
+			if( f in visited )
+				return
+			visiting[f] = 1
+			targets = ""
+			for( i = first[f]; i <= last[f]; ++i )
+				for( n = successors( i ); n > 0; --n )
+					if( next_index[n] >= 0 && owner[next_index[n]] != f )
+						targets = targets " " owner[next_index[n]]
+			for( n = split( targets, list, " " ); n > 0; --n )
+				visit( list[n] )
+			visiting[f] = 0
+			visited[f] = 1
+			order[functions++] = f
+		}
+		BEGIN { count = 0; functions = 0 }
+		/^[0-9a-f]+ <[^>]+>:$/ {
+			inside = $2
+			gsub( /[<>:]/, "", inside )
+			first[inside] = count
+			next
+		}
+		inside != "" && /^$/ { inside = "" }
+		inside != "" && /^ *[0-9a-f]+:\t/ {
+			owner[count] = inside
+			last[inside] = count
+			split( $0, field, "\t" )
+			address[count] = hex( field[1] )
+			index_of[address[count]] = count
+			words[count] = split( field[2], bytes, " " ) / 2
+			mnemonic[count] = field[3]
+			operands[count] = field[4]
+			target[count] = -1
+			if( match( $0, /; 0x[0-9a-f]+/ ) )
+				target[count] = hex( substr( $0, RSTART + 2, RLENGTH - 2 ) )
+			count++
+		}
+		END {
+			if( failed )
+				exit 1
+			if( !( vector in last ) )
+				fail( "not found in the disassembly" )
+			visit( vector )
+
+			# Whether each instruction may run with interrupts disabled or enabled, the handler
+			# starts disabled. Every instruction only jumps forward or to a function visited
+			# after this one, so both are known when an instruction is reached in that order.
+			disabled[first[vector]] = 1
+			for( o = functions - 1; o >= 0; --o )
+			{
+				for( i = first[order[o]]; i <= last[order[o]]; ++i )
+				{
+					m = mnemonic[i]
+					off = disabled[i]; on = enabled[i]
+					if( m == "cli" || m == "sei" )
+					{
+						kind[i] = m
+						off = m == "cli"; on = m == "sei"
+					}
+					else if( m == "in" && operands[i] ~ /^r[0-9]+, 0x3f/ )
+					{
+						split( operands[i], operand, ", " )
+						saved_disabled[operand[1]] += off
+						saved_enabled[operand[1]] += on
+					}
+					else if( m == "out" && operands[i] ~ /^0x3f, r[0-9]+/ )
+					{
+						split( operands[i], operand, ", " )
+						known = operand[2] in saved_disabled
+						off = !known || saved_disabled[operand[2]]
+						on = !known || saved_enabled[operand[2]]
+						kind[i] = off ? "cli" : "sei" # may disable, or enables
+					}
+					for( n = successors( i ); n > 0; --n )
+					{
+						disabled[next_index[n]] += off
+						enabled[next_index[n]] += on
+					}
+				}
+			}
+
+			# Walk backwards. total: cycles to the end. With interrupts enabled, windowed: longest
+			# window on the way. With them disabled, rest: cycles until the open window closes,
+			# and later: longest window after it. pending_*: the same for the instruction after a
+			# sei, which still runs disabled.
+			for( o = 0; o < functions; ++o )
+			{
+				for( i = last[order[o]]; i >= first[order[o]]; --i )
+				{
+					m = mnemonic[i]
+					n = successors( i )
+					if( !n )
+					{ # ret or reti, reti enables interrupts
+						total[i] = rest[i] = pending_rest[i] = cycles( m )
+						windowed[i] = later[i] = pending_later[i] = 0
+						continue
+					}
+					total[i] = windowed[i] = rest[i] = later[i] = pending_rest[i] = pending_later[i] = 0
+					for( ; n > 0; --n )
+					{
+						s = next_index[n]
+						c = next_cycles[n]
+						total[i] = max( total[i], c + total[s] )
+						if( kind[i] == "cli" )
+						{
+							windowed[i] = max( windowed[i], max( c + rest[s], later[s] ) )
+							rest[i] = max( rest[i], c + rest[s] )
+							later[i] = max( later[i], later[s] )
+							pending_rest[i] = max( pending_rest[i], c + rest[s] )
+							pending_later[i] = max( pending_later[i], later[s] )
+						}
+						else
+						{
+							windowed[i] = max( windowed[i], windowed[s] )
+							if( kind[i] == "sei" )
+							{
+								rest[i] = max( rest[i], c + pending_rest[s] )
+								later[i] = max( later[i], pending_later[s] )
+							}
+							else
+							{
+								rest[i] = max( rest[i], c + rest[s] )
+								later[i] = max( later[i], later[s] )
+							}
+							pending_rest[i] = max( pending_rest[i], c )
+							pending_later[i] = max( pending_later[i], windowed[s] )
+						}
+					}
+				}
+			}
+
+			# the interrupt response and the rjmp in the vector table come first, disabled
+			v = first[vector]
+			blocking = max( 4 + 2 + rest[v], later[v] )
+			printf "cycles:%s %d\n", vector, 4 + 2 + total[v]
+			printf "blocking:%s %d\n", vector, blocking
+			if( blocking > latency )
+				printf "Warning: %s blocks the USB interrupt for %d cycles, V-USB tolerates %d\n", vector, blocking, latency > "/dev/stderr"
+		}
+' "$TMP/disassembly"
+done >> "$TMP/current"
+
+
+# compare with the budget file
+echo
+echo "Budget:"
+touch "$BUDGET"
+awk -v update="$UPDATE" -v out="$TMP/budget" '
+	FNR == NR {
+		if( $0 ~ /^#/ || NF < 3 )
+		{
+			if( $0 ~ /^#/ && $0 !~ /^# figure/ )
+				header = header $0 "\n"
+			next
+		}
+		baseline[$1] = $2
+		limit[$1] = $3
+		order[known++] = $1
+		next
+	}
+	{
+		value[$1] = $2
+		if( !( $1 in limit ) )
+		{
+			limit[$1] = "-"
+			baseline[$1] = "-"
+			order[known++] = $1
+		}
+	}
+	END {
+		printf "  %-28s %8s %8s %8s\n", "figure", "current", "baseline", "limit"
+		status = 0
+		for( i = 0; i < known; ++i )
+		{
+			name = order[i]
+			if( !( name in value ) )
+			{
+				printf "  %-28s %8s %8s %8s  (gone)\n", name, "-", baseline[name], limit[name]
+				continue
+			}
+			note = ""
+			if( limit[name] != "-" && value[name] > limit[name] + 0 )
+				note = "  OVER LIMIT"
+			else if( baseline[name] != "-" && value[name] > baseline[name] + 0 )
+				note = "  REGRESSION +" ( value[name] - baseline[name] )
+			else if( baseline[name] != "-" && value[name] < baseline[name] + 0 )
+				note = "  improved -" ( baseline[name] - value[name] )
+			else if( baseline[name] == "-" )
+			{
+				note = "  no baseline"
+				missing++
+			}
+			if( note ~ /OVER|REGRESSION/ && !( update && note !~ /OVER/ ) )
+				status = 1
+			printf "  %-28s %8d %8s %8s%s\n", name, value[name], baseline[name], limit[name], note
+		}
+		fflush()
+		if( missing && !update )
+			printf "Warning: %d figures have no baseline, run make budget-baseline on an accepted build\n", missing > "/dev/stderr"
+		if( update )
+		{
+			printf "%s", header > out
+			printf "%-28s %8s %8s\n", "# figure", "baseline", "limit" > out
+			for( i = 0; i < known; ++i )
+				if( order[i] in value )
+					printf "%-28s %8d %8s\n", order[i], value[order[i]], limit[order[i]] > out
+		}
+		exit status
+	}
+' "$BUDGET" "$TMP/current" || STATUS=$?
+
+if [ -n "$STATUS" ]; then
+	echo "Error: Firmware is over budget!" >&2
+	exit 1
+fi
+if [ "$UPDATE" = 1 ]; then
+	cp "$TMP/budget" "$BUDGET"
+	echo "Updated $BUDGET"
+fi
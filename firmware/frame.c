@@ -0,0 +1,18 @@
+#include "frame.h"
+
+#include <util/atomic.h>
+
+
+volatile uint16_t frameBase = 0;
+volatile uint8_t frameSofCount = 0;
+
+
+void frame_update( void )
+{
+	ATOMIC_BLOCK( ATOMIC_RESTORESTATE )
+	{
+		uint8_t count = usbSofCount;
+		frameBase += (uint8_t)( count - frameSofCount );
+		frameSofCount = count;
+	}
+}
@@ -0,0 +1,31 @@
+#ifndef _FRAME_H_
+#define _FRAME_H_
+
+
+#include <stdint.h>
+
+#include "usbdrv/usbdrv.h"
+
+
+// Number of USB frames since power-on, counted from the keep-alive the host sends to
+// low speed devices every millisecond (V-USB's 8 bit usbSofCount) and extended to 16 bits.
+// It is local to the device - low speed devices never see the bus frame number - the host
+// learns it through SERVUSB_REPORT_ID_FRAME.
+
+// frame number and usbSofCount when frame_update() last ran
+extern volatile uint16_t frameBase;
+extern volatile uint8_t frameSofCount;
+
+
+// needs to run at least every 255 frames, from the main loop
+void frame_update( void );
+
+
+// call with interrupts disabled
+static inline uint16_t frame_now( void )
+{
+	return frameBase + (uint8_t)( usbSofCount - frameSofCount );
+}
+
+
+#endif
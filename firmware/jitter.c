@@ -0,0 +1,21 @@
+#include "jitter.h"
+
+#include <string.h>
+
+#include <util/atomic.h>
+
+
+#define JITTER_TICK_NS ( (uint16_t)( 64 * 1000000000.0 / (F_CPU) + 0.5 ) ) // Timer0 runs at CK/64
+
+
+struct jitter jitter = { JITTER_TICK_NS };
+
+
+void jitter_reset( void )
+{
+	ATOMIC_BLOCK( ATOMIC_RESTORESTATE )
+	{
+		memset( &jitter, 0, sizeof(jitter) );
+		jitter.tickNs = JITTER_TICK_NS;
+	}
+}
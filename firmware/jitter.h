@@ -0,0 +1,74 @@
+#ifndef _JITTER_H_
+#define _JITTER_H_
+
+
+#include <stdint.h>
+
+
+// How far the pulses came out from their programmed length, readable by the host through
+// SERVUSB_REPORT_ID_JITTER and cleared by writing it. The Timer0 ISR ends a pulse (a channel
+// with PPM) when the counter matches its last stage; whatever held off the ISR (mostly the
+// USB interrupt) shows as TCNT0 having moved on, which lengthens that pulse and, with the
+// next pulse started in the same ISR, shortens the next one. Measured in Timer0 ticks (64
+// cycles). The layout is the report payload (little endian).
+
+#define JITTER_BINS   8    // pulses off by 0, 1, 2, 3, 4-7, 8-15, 16-31 and 32 or more ticks
+#define JITTER_MISSED 0xff // end of a pulse whose stage was set too late, it took 256 ticks more
+
+struct jitter
+{
+	uint16_t tickNs;                 // length of a tick in nanoseconds
+	uint16_t pulses;                 // pulses measured, stops at 65535 together with the histogram
+	uint16_t histogram[JITTER_BINS]; // pulses per deviation, either direction
+	int8_t shortest;                 // largest deviation towards a shorter pulse (negative)
+	int8_t longest;                  // largest deviation towards a longer pulse
+};
+
+// modified by the Timer0 ISR - read it with interrupts disabled
+extern struct jitter jitter;
+
+
+// clears the measurement
+void jitter_reset( void );
+
+
+// Ticks the counter already moved on from the compare match which called the ISR. In CTC
+// mode the counter clears on the tick after the match, so a late ISR sees it counting up
+// from 0 again.
+static inline uint8_t jitter_late( uint8_t count, uint8_t compare )
+{
+	return count == compare ? 0 : count + 1;
+}
+
+
+// Adds a completed pulse, off by the ticks its end was late minus the ticks its start was
+// late. Called once from the Timer0 ISR, so it ends up inlined there without any loop.
+static inline void jitter_measure( uint8_t endLate, uint8_t startLate )
+{
+	if( jitter.pulses == 0xffff )
+		return; // full, the ratios stay as they were
+	jitter.pulses++;
+
+	int16_t deviation = (int16_t)endLate - startLate;
+	uint8_t magnitude = deviation < 0 ? -deviation : deviation;
+	uint8_t bin;
+	if( magnitude < 4 )
+		bin = magnitude;
+	else if( magnitude < 8 )
+		bin = 4;
+	else if( magnitude < 16 )
+		bin = 5;
+	else if( magnitude < 32 )
+		bin = 6;
+	else
+		bin = 7;
+	jitter.histogram[bin]++;
+
+	if( deviation > jitter.longest )
+		jitter.longest = deviation > 127 ? 127 : deviation;
+	if( deviation < jitter.shortest )
+		jitter.shortest = deviation < -128 ? -128 : deviation;
+}
+
+
+#endif
@@ -9,15 +9,31 @@
 
 #include "usbdrv/usbdrv.h"
 #include "servo.h"
+#include "stats.h"
+#include "jitter.h"
+#include "poweron.h"
+#include "status.h"
+#ifdef SERVUSB_COUNT_SOF
+#include "frame.h"
+#endif
 
 
 #define SERVUSB_REPORT_ID_CONTROL 0x01
 #define SERVUSB_REPORT_ID_DATA    0x02
+#define SERVUSB_REPORT_ID_STATS   0x03
+#define SERVUSB_REPORT_ID_FRAME   0x04 // frame counting builds only
+#define SERVUSB_REPORT_ID_POWER_ON 0x05
+#define SERVUSB_REPORT_ID_JITTER  0x06
+#define SERVUSB_REPORT_ID_STATUS  0x07
 
 #define SERVUSB_CONTROL_ENABLE_BIT 0x01
 
+// Vendor requests without a data stage, the values travel in wValue and wIndex
+#define SERVUSB_REQUEST_SET_ENABLED   0x01 // wValue low byte as the control report
+#define SERVUSB_REQUEST_SET_POSITIONS 0x02 // up to three positions in wValue low, high and wIndex low, their number in wIndex high
 
-PROGMEM const char usbHidReportDescriptor[40] =
+
+PROGMEM const char usbHidReportDescriptor[USB_CFG_HID_REPORT_DESCRIPTOR_LENGTH] =
 {
 	0x06, 0x00, 0xff,                // USAGE_PAGE (Generic Desktop)
 	0x09, 0x01,                      // USAGE (Vendor Usage 1)
@@ -33,14 +49,98 @@ PROGMEM const char usbHidReportDescriptor[40] =
 	0x26, 0xff, 0x00,                //   LOGICAL_MAXIMUM (255)
 	0x75, 0x08,                      //   REPORT_SIZE (8)
 	0x85, SERVUSB_REPORT_ID_DATA,    //   REPORT_ID (SERVUSB_REPORT_ID_DATA)
-	0x95, 0x01,                      //   REPORT_COUNT (1)
+	0x95, SERVO_CHANNELS,            //   REPORT_COUNT (SERVO_CHANNELS)
+	0x09, 0x00,                      //   USAGE (Undefined)
+	0xb2, 0x02, 0x01,                //   FEATURE (Data,Var,Abs,Buf)
+	0x15, 0x00,                      //   LOGICAL_MINIMUM (0)
+	0x26, 0xff, 0x00,                //   LOGICAL_MAXIMUM (255)
+	0x75, 0x08,                      //   REPORT_SIZE (8)
+	0x85, SERVUSB_REPORT_ID_STATS,   //   REPORT_ID (SERVUSB_REPORT_ID_STATS)
+	0x95, sizeof(struct stats),      //   REPORT_COUNT (sizeof(struct stats))
+	0x09, 0x00,                      //   USAGE (Undefined)
+	0xb2, 0x03, 0x01,                //   FEATURE (Cnst,Var,Abs,Buf)
+	0x15, 0x00,                      //   LOGICAL_MINIMUM (0)
+	0x26, 0xff, 0x00,                //   LOGICAL_MAXIMUM (255)
+	0x75, 0x08,                      //   REPORT_SIZE (8)
+	0x85, SERVUSB_REPORT_ID_POWER_ON,//   REPORT_ID (SERVUSB_REPORT_ID_POWER_ON)
+	0x95, POWERON_SIZE,              //   REPORT_COUNT (POWERON_SIZE)
+	0x09, 0x00,                      //   USAGE (Undefined)
+	0xb2, 0x02, 0x01,                //   FEATURE (Data,Var,Abs,Buf)
+	0x15, 0x00,                      //   LOGICAL_MINIMUM (0)
+	0x26, 0xff, 0x00,                //   LOGICAL_MAXIMUM (255)
+	0x75, 0x08,                      //   REPORT_SIZE (8)
+	0x85, SERVUSB_REPORT_ID_JITTER,  //   REPORT_ID (SERVUSB_REPORT_ID_JITTER)
+	0x95, sizeof(struct jitter),     //   REPORT_COUNT (sizeof(struct jitter))
 	0x09, 0x00,                      //   USAGE (Undefined)
 	0xb2, 0x02, 0x01,                //   FEATURE (Data,Var,Abs,Buf)
+	0x15, 0x00,                      //   LOGICAL_MINIMUM (0)
+	0x26, 0xff, 0x00,                //   LOGICAL_MAXIMUM (255)
+	0x75, 0x08,                      //   REPORT_SIZE (8)
+	0x85, SERVUSB_REPORT_ID_STATUS,  //   REPORT_ID (SERVUSB_REPORT_ID_STATUS)
+	0x95, sizeof(struct status),     //   REPORT_COUNT (sizeof(struct status))
+	0x09, 0x00,                      //   USAGE (Undefined)
+	0xb2, 0x03, 0x01,                //   FEATURE (Cnst,Var,Abs,Buf)
+#ifdef SERVUSB_COUNT_SOF
+	0x15, 0x00,                      //   LOGICAL_MINIMUM (0)
+	0x26, 0xff, 0x00,                //   LOGICAL_MAXIMUM (255)
+	0x75, 0x08,                      //   REPORT_SIZE (8)
+	0x85, SERVUSB_REPORT_ID_FRAME,   //   REPORT_ID (SERVUSB_REPORT_ID_FRAME)
+	0x95, 4 + SERVO_CHANNELS,        //   REPORT_COUNT (4 + SERVO_CHANNELS)
+	0x09, 0x00,                      //   USAGE (Undefined)
+	0xb2, 0x02, 0x01,                //   FEATURE (Data,Var,Abs,Buf)
+#endif
 	0xc0                             // END_COLLECTION
 };
 
 
 static uint8_t currentReportID = 0;
+static uint8_t currentOffset = 0;       // bytes of the current report already sent to or received from the host
+static uint16_t currentLength = 0;      // bytes the host is going to send
+
+static union
+{ // consistent copy of the counters, the pulse jitter or the status, those reports are sent in chunks of 8 bytes
+	struct stats stats;
+	struct jitter jitter;
+	struct status status;
+} snapshot;
+static uint8_t snapshotSize = 0;
+
+
+// USB_CFG_DEVICE_VERSION lists the minor number first
+#define BCD( version ) BCD_( version )
+#define BCD_( minor, major ) ( (major) << 8 | (minor) )
+
+
+// called with interrupts disabled, so the positions pulsed and the schedule go together
+static void takeStatus( struct status * status )
+{
+	status->version = BCD( USB_CFG_DEVICE_VERSION );
+	status->clockKHz = F_CPU / 1000;
+	status->frameUs = SERVO_FRAME_US;
+	status->minUs = SERVO_MIN_US;
+	status->maxUs = SERVO_MAX_US;
+	status->flags = 0;
+#ifdef SERVUSB_PPM
+	status->flags |= STATUS_FLAG_PPM;
+#endif
+#ifdef SERVUSB_RC_OSCILLATOR
+	status->flags |= STATUS_FLAG_RC_OSCILLATOR;
+#endif
+#ifdef SERVUSB_COUNT_SOF
+	status->flags |= STATUS_FLAG_COUNT_SOF;
+	status->scheduled = servo_getScheduled();
+#else
+	status->scheduled = 0;
+#endif
+	status->control = servo_isEnabled() ? SERVUSB_CONTROL_ENABLE_BIT : 0x00;
+	status->channels = SERVO_CHANNELS;
+	for( uint8_t i = 0; i < SERVO_CHANNELS; ++i )
+	{
+		status->commanded[i] = servo_getCommanded( i );
+		status->pulsed[i] = servo_getPosition( i );
+	}
+}
+
 
 // called when the host requests a chunk of data from the device
 uint8_t usbFunctionRead( uint8_t * data, uint8_t len )
@@ -53,10 +153,51 @@ uint8_t usbFunctionRead( uint8_t * data, uint8_t len )
 		if( servo_isEnabled() )
 			data[1] |= SERVUSB_CONTROL_ENABLE_BIT;
 		return 2;
-	case SERVUSB_REPORT_ID_DATA:
-		data[1] = servo_getPosition();
-		return 2;
+	case SERVUSB_REPORT_ID_DATA: // in chunks of 8 bytes with more than 7 channels
+	{
+		uint8_t i = 0;
+		for( ; i < len && currentOffset <= SERVO_CHANNELS; ++i, ++currentOffset )
+			data[i] = currentOffset ? servo_getPosition( currentOffset - 1 ) : currentReportID;
+		return i;
 	}
+	case SERVUSB_REPORT_ID_STATS:
+	case SERVUSB_REPORT_ID_JITTER:
+	case SERVUSB_REPORT_ID_STATUS:
+	{ // taken by usbFunctionSetup()
+		const uint8_t * report = (const uint8_t *)&snapshot;
+		uint8_t i = 0;
+		for( ; i < len && currentOffset <= snapshotSize; ++i, ++currentOffset )
+			data[i] = currentOffset ? report[currentOffset - 1] : currentReportID;
+		return i;
+	}
+	case SERVUSB_REPORT_ID_POWER_ON: // in chunks of 8 bytes with more than 6 channels
+	{
+		uint8_t i = 0;
+		for( ; i < len && currentOffset <= POWERON_SIZE; ++i, ++currentOffset )
+			data[i] = currentOffset ? poweron_get( currentOffset - 1 ) : currentReportID;
+		return i;
+	}
+#ifdef SERVUSB_COUNT_SOF
+	case SERVUSB_REPORT_ID_FRAME:
+	{ // current frame, frame of the last servo update and the positions pulsed
+		uint16_t frame;
+		ATOMIC_BLOCK( ATOMIC_RESTORESTATE )
+		{
+			frame = frame_now();
+		}
+		uint16_t update = servo_getUpdateFrame();
+		data[1] = frame;
+		data[2] = frame >> 8;
+		data[3] = update;
+		data[4] = update >> 8;
+		uint8_t i = 5;
+		for( ; i < len && i < 5 + SERVO_CHANNELS; ++i )
+			data[i] = servo_getPosition( i - 5 );
+		return i;
+	}
+#endif
+	}
+	stats.unknownReports++;
 	return 0;
 }
 
@@ -64,17 +205,53 @@ uint8_t usbFunctionRead( uint8_t * data, uint8_t len )
 // called when the host sends a chunk of data to the device
 uint8_t usbFunctionWrite( uint8_t * data, uint8_t len )
 {
-	if( len < 2 )
+	if( !currentOffset && len < 2 )
+	{
+		stats.stalls++;
 		return 0xff; // stall
+	}
 	switch( currentReportID )
 	{
 	case SERVUSB_REPORT_ID_CONTROL:
 		servo_setEnabled( data[1] & SERVUSB_CONTROL_ENABLE_BIT );
 		return 1; // end of transfer
-	case SERVUSB_REPORT_ID_DATA:
-		servo_setPosition( data[1] );
+	case SERVUSB_REPORT_ID_DATA: // a shorter report only sets the first servos, more than 7 come in chunks of 8 bytes
+		for( uint8_t i = currentOffset ? 0 : 1; i < len; ++i )
+			servo_setPosition( currentOffset + i - 1, data[i] );
+		currentOffset += len;
+		return currentOffset >= currentLength; // end of transfer after the last chunk
+	case SERVUSB_REPORT_ID_STATS:
+	case SERVUSB_REPORT_ID_STATUS:
+		return 1; // end of transfer - read only
+	case SERVUSB_REPORT_ID_JITTER: // any write starts a new measurement
+		jitter_reset();
 		return 1; // end of transfer
+	case SERVUSB_REPORT_ID_POWER_ON: // saved by the main loop, a shorter report keeps the positions of the other servos
+		for( uint8_t i = currentOffset ? 0 : 1; i < len; ++i )
+			poweron_set( currentOffset + i - 1, data[i] );
+		currentOffset += len;
+		return currentOffset >= currentLength; // end of transfer after the last chunk
+#ifdef SERVUSB_COUNT_SOF
+	case SERVUSB_REPORT_ID_FRAME:
+	{ // frame to apply the positions in, bytes 3 and 4 are ignored, servos missing from a short report keep their position
+		if( len < 6 )
+		{
+			stats.stalls++;
+			return 0xff; // stall
+		}
+		uint8_t values[SERVO_CHANNELS];
+		for( uint8_t i = 0; i < SERVO_CHANNELS; ++i )
+			values[i] = 5 + i < len ? data[5 + i] : servo_getPosition( i );
+		if( !servo_schedule( data[1] | data[2] << 8, values ) )
+		{
+			stats.stalls++;
+			return 0xff; // stall - schedule full
+		}
+		return 1; // end of transfer
+	}
+#endif
 	}
+	stats.unknownReports++;
 	return 1; // end of transfer
 }
 
@@ -87,34 +264,95 @@ usbMsgLen_t usbFunctionSetup( uint8_t data[8] )
 		switch( rq->bRequest )
 		{
 		case USBRQ_HID_GET_REPORT:
+			stats.getReports++;
+			currentReportID = rq->wValue.bytes[0];
+			currentOffset = 0;
+			if( currentReportID == SERVUSB_REPORT_ID_STATS )
+			{
+				ATOMIC_BLOCK( ATOMIC_RESTORESTATE )
+				{
+					snapshot.stats = stats;
+				}
+				snapshotSize = sizeof(snapshot.stats);
+			} else if( currentReportID == SERVUSB_REPORT_ID_JITTER ) {
+				ATOMIC_BLOCK( ATOMIC_RESTORESTATE )
+				{
+					snapshot.jitter = jitter;
+				}
+				snapshotSize = sizeof(snapshot.jitter);
+			} else if( currentReportID == SERVUSB_REPORT_ID_STATUS ) {
+				ATOMIC_BLOCK( ATOMIC_RESTORESTATE )
+				{
+					takeStatus( &snapshot.status );
+				}
+				snapshotSize = sizeof(snapshot.status);
+			}
+			return USB_NO_MSG; // calls usbFunctionRead()
 		case USBRQ_HID_SET_REPORT:
+			stats.setReports++;
 			currentReportID = rq->wValue.bytes[0];
-			return USB_NO_MSG; // calls usbFunctionRead() on USBRQ_HID_GET_REPORT or usbFunctionWrite() on USBRQ_HID_SET_REPORT
+			currentOffset = 0;
+			currentLength = rq->wLength.word;
+			return USB_NO_MSG; // calls usbFunctionWrite()
+		}
+	} else if( (rq->bmRequestType & USBRQ_TYPE_MASK) == USBRQ_TYPE_VENDOR ) {
+		// the same as writing the control or a short data report, but done with the SETUP packet
+		switch( rq->bRequest )
+		{
+		case SERVUSB_REQUEST_SET_ENABLED:
+			stats.setReports++;
+			servo_setEnabled( rq->wValue.bytes[0] & SERVUSB_CONTROL_ENABLE_BIT );
+			break;
+		case SERVUSB_REQUEST_SET_POSITIONS:
+		{
+			stats.setReports++;
+			uint8_t count = rq->wIndex.bytes[1];
+			if( count > 0 )
+				servo_setPosition( 0, rq->wValue.bytes[0] );
+			if( count > 1 )
+				servo_setPosition( 1, rq->wValue.bytes[1] );
+			if( count > 2 )
+				servo_setPosition( 2, rq->wIndex.bytes[0] );
+			break;
+		}
+		default:
+			stats.unknownReports++;
 		}
-	} else {
-		// ignore vendor type requests, we don't use any
 	}
-	return 0;
+	return 0; // no data stage
 }
 
 
 int main( void )
 {
+	uint8_t resetFlags = MCUSR;
+	MCUSR = 0; // the watchdog stays on while WDRF is set
 	wdt_disable();
 	servo_init();
+	poweron_init();
 	usbInit();
 
-	usbDeviceDisconnect(); // enforce re-enumeration, do this while interrupts are disabled!
-	uint8_t i = 0;
-	while( --i ) // fake USB disconnect for > 250 ms
-		_delay_ms(1);
-	usbDeviceConnect();
+	// Only a host which knew the device before the reset needs to see it disconnect. After
+	// power-up there is none, so the servos get going and the host can enumerate right away.
+	if( !( resetFlags & _BV(PORF) ) )
+	{
+		usbDeviceDisconnect(); // enforce re-enumeration, do this while interrupts are disabled!
+		uint8_t i = 0;
+		while( --i ) // fake USB disconnect for > 250 ms
+			_delay_ms(1);
+		usbDeviceConnect();
+	}
 
 	sei();
 
 	while( 1 )
 	{
 		usbPoll();
+		poweron_update();
+#ifdef SERVUSB_COUNT_SOF
+		frame_update();
+#endif
+		stats.polls++;
 	}
 
 	return 0;
@@ -0,0 +1,54 @@
+#include "osccal.h"
+
+#include <stdint.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "usbdrv/usbdrv.h"
+
+
+// usbMeasureFrameLength() counts in units of 7 CPU cycles, a frame lasts 1 ms minus the
+// time until the driver notices it (about 1499 units at 10.5 MHz per its documentation)
+#define OSCCAL_TARGET ( (int16_t)( 1499 * (double)(F_CPU) / 10.5e6 + 0.5 ) )
+
+
+static int16_t deviation( void )
+{
+	int16_t d = usbMeasureFrameLength() - OSCCAL_TARGET;
+	return d < 0 ? -d : d;
+}
+
+
+void osccal_calibrate( void )
+{
+	cli(); // usbMeasureFrameLength() busy waits on the data lines
+
+	// binary search for the value just below the target frequency - higher is faster
+	uint8_t trial = 0;
+	for( uint8_t step = 128; step; step >>= 1 )
+	{
+		OSCCAL = trial + step;
+		if( (int16_t)usbMeasureFrameLength() < OSCCAL_TARGET )
+			trial += step;
+	}
+
+	// the result is within one step, pick the best of its neighbours
+	uint8_t best = trial;
+	int16_t bestDeviation = INT16_MAX;
+	for( uint8_t value = trial ? trial - 1 : 0; ; ++value )
+	{
+		OSCCAL = value;
+		int16_t d = deviation();
+		if( d < bestDeviation )
+		{
+			bestDeviation = d;
+			best = value;
+		}
+		if( value == 255 || value == trial + 1 )
+			break;
+	}
+	OSCCAL = best;
+
+	sei();
+}
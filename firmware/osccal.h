@@ -0,0 +1,11 @@
+#ifndef _OSCCAL_H_
+#define _OSCCAL_H_
+
+
+// Tunes the internal RC oscillator to F_CPU against the 1 ms USB frame period.
+// Called from the USB reset hook, when the host has just started sending frames.
+// Blocks all interrupts for up to about 12 ms.
+void osccal_calibrate( void );
+
+
+#endif
@@ -0,0 +1,64 @@
+#include "poweron.h"
+
+#include <avr/eeprom.h>
+
+
+#define POWERON_MAGIC 0xa5 // cleared before the state changes and written after it, so blank or half written EEPROM isn't used
+
+
+static uint8_t stored[1 + POWERON_SIZE] EEMEM; // magic, then the state
+static uint8_t state[POWERON_SIZE];
+static bool dirty = false;
+
+
+void poweron_init( void )
+{
+	bool valid = eeprom_read_byte( &stored[0] ) == POWERON_MAGIC;
+	for( uint8_t i = 0; i < POWERON_SIZE; ++i )
+		state[i] = valid ? eeprom_read_byte( &stored[1 + i] ) : 0;
+	dirty = false;
+
+	for( uint8_t i = 0; i < SERVO_CHANNELS; ++i )
+		servo_setPosition( i, state[1 + i] );
+	servo_setEnabled( state[0] & POWERON_ENABLE_BIT );
+}
+
+
+uint8_t poweron_get( uint8_t index )
+{
+	return index < POWERON_SIZE ? state[index] : 0;
+}
+
+
+void poweron_set( uint8_t index, uint8_t value )
+{
+	if( index >= POWERON_SIZE || state[index] == value )
+		return;
+	state[index] = value;
+	dirty = true;
+}
+
+
+void poweron_update( void )
+{
+	if( !dirty || !eeprom_is_ready() )
+		return;
+	// an interrupt can make the timed write sequence fail, so compare with what is really there
+	for( uint8_t i = 0; i < POWERON_SIZE; ++i )
+	{
+		if( eeprom_read_byte( &stored[1 + i] ) != state[i] )
+		{
+			if( eeprom_read_byte( &stored[0] ) == POWERON_MAGIC )
+				eeprom_write_byte( &stored[0], 0xff ); // a power loss from here on starts up blank
+			else
+				eeprom_write_byte( &stored[1 + i], state[i] );
+			return;
+		}
+	}
+	if( eeprom_read_byte( &stored[0] ) != POWERON_MAGIC )
+	{
+		eeprom_write_byte( &stored[0], POWERON_MAGIC );
+		return;
+	}
+	dirty = false;
+}
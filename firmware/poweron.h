@@ -0,0 +1,31 @@
+#ifndef _POWERON_H_
+#define _POWERON_H_
+
+
+#include <stdint.h>
+
+#include "servo.h"
+
+
+// What the servos do right after power-up, before any host shows up: the enable state
+// and a position per servo, kept in EEPROM and set through SERVUSB_REPORT_ID_POWER_ON.
+// Blank EEPROM leaves them disabled at position 0.
+
+#define POWERON_SIZE       ( 1 + SERVO_CHANNELS ) // control bits, then the positions
+#define POWERON_ENABLE_BIT 0x01                   // as SERVUSB_CONTROL_ENABLE_BIT
+
+
+// loads the stored state and applies it, call after servo_init()
+void poweron_init( void );
+
+// byte of the state as laid out above, 0 past the end
+uint8_t poweron_get( uint8_t index );
+// changes a byte of the state, which poweron_update() then saves - ignored past the end
+void poweron_set( uint8_t index, uint8_t value );
+
+// Writes at most one changed byte to EEPROM, from the main loop. Each write takes 3.4 ms,
+// which the main loop spends polling USB instead of waiting.
+void poweron_update( void );
+
+
+#endif
@@ -0,0 +1,174 @@
+#include "servo.h"
+#include "stats.h"
+#include "jitter.h"
+#include "timer0.h"
+
+#include <stdint.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+
+// PPM as taken by the trainer port of RC transmitters: every frame starts with a
+// separator pulse, each channel lasts from the start of its separator pulse to the
+// start of the next one (1 to 2 ms), a last separator pulse closes the frame and the
+// remaining time is the sync gap (at least 6.2 ms with 8 channels). Pulses are positive,
+// the pin idles low.
+
+#define CPU_CYCLE_S             ( 1.0 / (F_CPU) )               // The time for one CPU cycle in seconds
+#define PPM_FRAME_S             ( SERVO_FRAME_US / 1e6 )        // Time between PPM frames in seconds
+#define PPM_FRAME_CPU_CYCLES    ( PPM_FRAME_S / CPU_CYCLE_S )   // The number of CPU cycles passing between two frames
+#define PPM_PULSE_S             ( 0.0003 )                      // Length of the separator pulses in seconds
+#define PPM_MIN_S               ( SERVO_MIN_US / 1e6 )          // Shortest channel in seconds
+#define PPM_MAX_S               ( SERVO_MAX_US / 1e6 )          // Longest channel in seconds
+
+#define PPM_FRAME_CPU_CYCLES_2048 ( PPM_FRAME_CPU_CYCLES / 2048 )                     // Using a prescaler of 2048
+#define PPM_PULSE_64            ( (uint8_t)( PPM_PULSE_S / CPU_CYCLE_S / 64 + 0.5 ) ) // Using a prescaler of 64
+#define PPM_GAP_MIN_64          ( (uint16_t)( PPM_MIN_S / CPU_CYCLE_S / 64 + 0.5 ) - PPM_PULSE_64 )
+#define PPM_RANGE_64            ( (uint16_t)( ( PPM_MAX_S - PPM_MIN_S ) / CPU_CYCLE_S / 64 ) ) // Timer0 ticks encoding the position
+
+// The gap after a separator pulse is waited for in as many compare matches as needed
+// to fit into 8 bits, each one taking a tick of its own in CTC mode.
+#define PPM_GAP_STAGES          ( ( PPM_GAP_MIN_64 + PPM_RANGE_64 - 1 ) / 256 + 1 )
+#define PPM_MAX_GAP_STAGES      2 // enough up to 16.5 MHz
+
+#define PPM_PIN                 _BV(PB0)
+
+
+static volatile uint8_t positions[SERVO_CHANNELS];
+static volatile uint8_t gaps[SERVO_CHANNELS][PPM_MAX_GAP_STAGES]; // compare values after each separator pulse
+
+
+void servo_init( void )
+{
+	DDRB |= PPM_PIN;               // PPM pin as output
+
+	// Timer/Counter1 - Starts a frame every PPM_FRAME_S
+	TCCR1 = 0
+	      | _BV(CTC1)              // Clear Timer/Counter on Compare Match (with OCR1C)
+	      | _BV(CS13) | _BV(CS12)  // Prescaler: CK/2048
+	      ;
+	OCR1A = PPM_FRAME_CPU_CYCLES_2048; // Compare match on PPM_FRAME_CPU_CYCLES (match triggers interrupt)
+	OCR1C = PPM_FRAME_CPU_CYCLES_2048; // Compare match on PPM_FRAME_CPU_CYCLES (match causes reset)
+
+	// Timer/Counter0 - Times the pulses and gaps of a frame
+	TCCR0A = 0
+	       | _BV(WGM01)            // CTC (TOP = OCRA)
+	       ;
+	TCCR0B = 0                     // initially disabled (no clock source)
+	       ;
+	OCR0A = PPM_PULSE_64 - 1;      // first separator pulse when timer enables
+	TIMSK |= _BV(OCIE0A);          // enable interrupt
+
+	for( uint8_t i = 0; i < SERVO_CHANNELS; ++i )
+		servo_setPosition( i, 0 );
+}
+
+
+void servo_setPosition( uint8_t channel, uint8_t position )
+{
+	if( channel >= SERVO_CHANNELS )
+		return;
+	uint16_t gap = PPM_GAP_MIN_64 + ( (uint32_t)PPM_RANGE_64 * position ) / 255;
+	ATOMIC_BLOCK( ATOMIC_RESTORESTATE )
+	{ // all stages of a gap must belong to the same position
+		positions[channel] = position;
+		for( uint8_t i = 0; i < PPM_GAP_STAGES; ++i )
+		{
+			uint8_t part = gap / ( PPM_GAP_STAGES - i );
+			gaps[channel][i] = part - 1; // the compare match takes a tick
+			gap -= part;
+		}
+	}
+}
+
+
+uint8_t servo_getPosition( uint8_t channel )
+{
+	if( channel >= SERVO_CHANNELS )
+		return 0;
+	return positions[channel];
+}
+
+
+uint8_t servo_getCommanded( uint8_t channel )
+{
+	return servo_getPosition( channel ); // PPM has no schedule
+}
+
+
+// Timer/Counter1 Compare Match A interrupt - called each frame, interruptible like the one in servo.c
+ISR( TIM1_COMPA_vect, ISR_NOBLOCK )
+{
+	bool overrun;
+	ATOMIC_BLOCK( ATOMIC_FORCEON )
+	{ // the last separator pulse of the previous frame may end just before, but not in between
+		overrun = TCCR0B & ( _BV(CS01) | _BV(CS00) ); // previous frame has not ended yet
+
+		// start the first separator pulse
+		PORTB  |= PPM_PIN;               // set PPM pin - timer0 interrupt will clear it
+		TCCR0B |= _BV(CS01) | _BV(CS00); // enable timer0 by setting prescaler to CK/64
+	}
+	stats.frames++;
+	if( overrun )
+		stats.overruns++;
+}
+
+
+// PPM pulse train generator, called for each Timer0 compare match with interrupts enabled
+// like the one in servo.c
+static inline void pulse( void )
+{
+	static uint8_t channel = 0; // channel whose separator pulse or gap is in progress
+	static uint8_t stage = 0;   // 0 during the separator pulse, then the number of gap stages waited for
+	static uint8_t started = 0; // ticks late the separator pulse of the channel started, it shortens the channel
+	static bool missed = false; // a gap stage was set after the counter had passed it
+
+	uint8_t late = jitter_late( TCNT0, OCR0A );
+	if( late )
+		stats.latePulses++; // the counter already moved on from the compare match
+
+	if( !stage )
+	{ // separator pulse completed
+		PORTB &= ~PPM_PIN;
+		if( channel == SERVO_CHANNELS )
+		{ // frame completed - stop timer and prepare for next frame, the sync gap follows
+			channel = 0;
+			started = 0; // the first separator pulse starts together with the timer
+			TCCR0B &= ~( _BV(CS01) | _BV(CS00) | _BV(CS02) ); // disable timer0 (no clock source)
+			OCR0A = PPM_PULSE_64 - 1;                         // first separator pulse when timer reenables
+			TCNT0 = 0;                                        // start counting from zero again
+			return;
+		}
+	}
+
+	if( stage < PPM_GAP_STAGES )
+	{ // wait for the next part of the gap
+		uint8_t compare = gaps[channel][stage];
+		OCR0A = compare;
+		if( late > compare )
+			missed = true; // the channel gets a whole counter cycle longer
+		stage++;
+		return;
+	}
+
+	// gap completed - separator pulse of the next channel, or the closing one
+	PORTB |= PPM_PIN;
+	OCR0A = PPM_PULSE_64 - 1;
+	uint8_t endLate = missed ? JITTER_MISSED : late;
+	uint8_t startLate = started;
+	missed = false;
+	started = late;
+	stage = 0;
+	channel++;
+
+	jitter_measure( endLate, startLate ); // a channel lasts from one rising edge to the next
+}
+
+
+TIMER0_ISR
+{
+	pulse();
+	timer0_unmask(); // a compare match meanwhile is pending and comes in right away
+}
@@ -1,30 +1,65 @@
 #include "servo.h"
+#include "stats.h"
+#include "jitter.h"
+#include "timer0.h"
+#ifdef SERVUSB_COUNT_SOF
+#include "frame.h"
+#endif
 
 #include <stdint.h>
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <util/atomic.h>
 
 
 #define CPU_CYCLE_S             ( 1.0 / (F_CPU) )               // The time for one CPU cycle in seconds
-#define SERVO_CYCLE_S           ( 0.02 )                        // Time between servo updates in seconds (nominal 20ms)
+#define SERVO_CYCLE_S           ( SERVO_FRAME_US / 1e6 )        // Time between servo updates in seconds (nominal 20ms)
 #define SERVO_CPU_CYCLES        ( SERVO_CYCLE_S / CPU_CYCLE_S ) // The number of CPU cycles passing between two servo updates
-#define SERVO_MIN_S             ( 0.0008 )                      // Minimum pulse length in seconds
-#define SERVO_MAX_S             ( 0.00216 )                     // Maximum pulse length in seconds
+#define SERVO_MIN_S             ( SERVO_MIN_US / 1e6 )          // Minimum pulse length in seconds
+#define SERVO_MAX_S             ( SERVO_MAX_US / 1e6 )          // Maximum pulse length in seconds
 #define SERVO_MIN_CPU_CYCLES    ( SERVO_MIN_S / CPU_CYCLE_S )   // Minimum pulse length in CPU cycles
 #define SERVO_MAX_CPU_CYCLES    ( SERVO_MAX_S / CPU_CYCLE_S )   // Maximum pulse length in CPU cycles
 
 #define SERVO_CPU_CYCLES_2048   ( SERVO_CPU_CYCLES / 2048 )     // Using a prescaler of 2048
 #define SERVO_MIN_CPU_CYCLES_64 ( SERVO_MIN_CPU_CYCLES / 64 )   // Using a prescaler of 64
 #define SERVO_MAX_CPU_CYCLES_64 ( SERVO_MAX_CPU_CYCLES / 64 )   // Using a prescaler of 64
+#define SERVO_RANGE_64          ( (uint16_t)( SERVO_MAX_CPU_CYCLES_64 - SERVO_MIN_CPU_CYCLES_64 ) ) // Timer0 ticks encoding the position
 
+// The position is waited for in as many compare matches as needed to fit into 8 bits
+// (one at 12 MHz, two at 16.5 MHz). Every compare match in CTC mode adds a tick, which
+// is taken off the initial delay so the pulse length doesn't depend on the clock.
+#define SERVO_PULSE_STAGES      ( SERVO_RANGE_64 / 256 + 1 )
+#define SERVO_MAX_PULSE_STAGES  2
+#define SERVO_BEGIN_64          ( (uint8_t)( SERVO_MIN_CPU_CYCLES_64 - ( SERVO_PULSE_STAGES - 1 ) ) )
 
-static volatile uint8_t scaledPosition = 0;
+// a single servo build always pulses the first one, which saves indexing in the ISR
+#define CHANNEL ( SERVO_CHANNELS > 1 ? channel : 0 )
+
+
+// The setpoint being pulsed and, with frame counting, a ring of the scheduled ones
+// following it. Applying one only moves the index, which keeps the ISR short.
+#ifdef SERVUSB_COUNT_SOF
+#define SETPOINTS ( 1 + SERVO_SCHEDULE )
+#define CURRENT   current
+static volatile uint8_t current = 0;
+static volatile uint8_t scheduled = 0;         // setpoints after the current one
+static volatile uint16_t due[SETPOINTS];       // frame of each setpoint
+static volatile uint16_t updateFrame = 0;
+#else
+#define SETPOINTS 1
+#define CURRENT   0
+#endif
+
+static volatile uint8_t positions[SETPOINTS][SERVO_CHANNELS];
+static volatile uint8_t stages[SETPOINTS][SERVO_CHANNELS][SERVO_MAX_PULSE_STAGES]; // compare values after SERVO_BEGIN_64
+static const uint8_t pins[3] = { _BV(PB0), _BV(PB3), _BV(PB4) };
 
 
 void servo_init( void )
 {
-	DDRB |= _BV(DDB0); // servo pin as output (OC0A)
+	for( uint8_t i = 0; i < SERVO_CHANNELS; ++i )
+		DDRB |= pins[i]; // servo pins as output
 
 	// Timer/Counter1 - Generates servo update interrupts (every SERVO_CYCLE_S)
 	TCCR1 = 0
@@ -35,62 +70,214 @@ void servo_init( void )
 	OCR1C = SERVO_CPU_CYCLES_2048; // Compare match on SERVO_CPU_CYCLES (match causes reset)
 //	TIMSK |= _BV(OCIE1A);          // enable interrupt
 
-	// Timer/Counter0 - Generates a pulse on the servo pin (between SERVO_MIN_CPU_CYCLES and SERVO_MAX_CPU_CYCLES)
+	// Timer/Counter0 - Generates the pulses on the servo pins (between SERVO_MIN_CPU_CYCLES and SERVO_MAX_CPU_CYCLES each)
 	TCCR0A = 0
 	       | _BV(WGM01)            // CTC (TOP = OCRA)
 	       ;
 	TCCR0B = 0                     // initially disabled (no clock source)
 	       ;
+	OCR0A = SERVO_BEGIN_64;        // delay for SERVO_MIN_CPU_CYCLES_64 when timer enables
 	TIMSK |= _BV(OCIE0A);          // enable interrupt
+
+#ifdef SERVUSB_COUNT_SOF
+	scheduled = 0;
+#endif
+	for( uint8_t i = 0; i < SERVO_CHANNELS; ++i )
+		servo_setPosition( i, 0 );
 }
 
 
-void servo_setPosition( uint8_t position )
+static void setStages( volatile uint8_t * stage, uint8_t position )
 {
-	scaledPosition = ( (uint16_t)(SERVO_MAX_CPU_CYCLES_64 - SERVO_MIN_CPU_CYCLES_64) * (uint16_t)position ) / 255;
+	uint16_t scaled = ( (uint32_t)SERVO_RANGE_64 * position ) / 255;
+	for( uint8_t i = 0; i < SERVO_PULSE_STAGES; ++i )
+	{
+		uint8_t part = scaled / ( SERVO_PULSE_STAGES - i );
+		stage[i] = part;
+		scaled -= part;
+	}
 }
 
 
-uint8_t servo_getPosition( void )
+void servo_setPosition( uint8_t channel, uint8_t position )
 {
-	return (scaledPosition * 255) / (uint16_t)(SERVO_MAX_CPU_CYCLES_64 - SERVO_MIN_CPU_CYCLES_64);
+	if( channel >= SERVO_CHANNELS )
+		return;
+	ATOMIC_BLOCK( ATOMIC_RESTORESTATE )
+	{ // both halves of a pulse must belong to the same position
+		positions[CURRENT][channel] = position;
+		setStages( stages[CURRENT][channel], position );
+	}
 }
 
 
-// Timer/Counter1 Compare Match A interrupt - called each servo update
-ISR( TIM1_COMPA_vect )
+uint8_t servo_getPosition( uint8_t channel )
+{
+	if( channel >= SERVO_CHANNELS )
+		return 0;
+	return positions[CURRENT][channel];
+}
+
+
+uint8_t servo_getCommanded( uint8_t channel )
+{
+	if( channel >= SERVO_CHANNELS )
+		return 0;
+#ifdef SERVUSB_COUNT_SOF
+	uint8_t slot;
+	ATOMIC_BLOCK( ATOMIC_RESTORESTATE )
+	{
+		slot = current + scheduled;
+	}
+	if( slot >= SETPOINTS )
+		slot -= SETPOINTS;
+	return positions[slot][channel];
+#else
+	return positions[CURRENT][channel];
+#endif
+}
+
+
+#ifdef SERVUSB_COUNT_SOF
+bool servo_schedule( uint16_t frame, const uint8_t * values )
+{
+	uint8_t slot, count;
+	ATOMIC_BLOCK( ATOMIC_RESTORESTATE )
+	{
+		slot = current + scheduled + 1;
+		count = scheduled;
+	}
+	if( count >= SERVO_SCHEDULE )
+		return false;
+	if( slot >= SETPOINTS )
+		slot -= SETPOINTS;
+
+	// the ISR doesn't look at the slot before it is counted as scheduled
+	due[slot] = frame;
+	for( uint8_t i = 0; i < SERVO_CHANNELS; ++i )
+	{
+		positions[slot][i] = values[i];
+		setStages( stages[slot][i], values[i] );
+	}
+	ATOMIC_BLOCK( ATOMIC_RESTORESTATE )
+	{
+		scheduled++;
+	}
+	return true;
+}
+
+
+uint16_t servo_getUpdateFrame( void )
 {
-	// start pulse
-	PORTB  |= _BV(PB0);              // set servo pin - timer0 interrupt will clear it
-	TCCR0B |= _BV(CS01) | _BV(CS00); // enable timer0 by setting prescaler to CK/64
+	uint16_t frame;
+	ATOMIC_BLOCK( ATOMIC_RESTORESTATE )
+	{
+		frame = updateFrame;
+	}
+	return frame;
 }
 
 
-// Timer/Counter0 Compare Match A interrupt - servo pulse generator
-ISR( TIM0_COMPA_vect )
+uint8_t servo_getScheduled( void )
 {
-	#define MODE_BEGIN 0 // wait SERVO_MIN_CPU_CYCLES_64
-	#define MODE_PULSE 1 // wait additional time to encode position (scaledPosition)
+	return scheduled;
+}
+#endif
 
-	static uint8_t mode = MODE_BEGIN;
 
-	// switch to next mode
-	switch( mode )
+// Timer/Counter1 Compare Match A interrupt - called each servo update
+//
+// Interruptible right from its first instruction, so it never holds off the USB interrupt
+// with its prologue. Starting late only moves the whole frame, the pulse is timed by
+// Timer0 from the moment it starts. The scheduled setpoint is applied afterwards, long
+// before the first stage of the pulse reads it.
+ISR( TIM1_COMPA_vect, ISR_NOBLOCK )
+{
+	bool overrun;
+#ifdef SERVUSB_COUNT_SOF
+	uint16_t frame;
+#endif
+	ATOMIC_BLOCK( ATOMIC_FORCEON )
+	{ // the last pulse of the previous frame may end just before, but not in between
+		overrun = TCCR0B & ( _BV(CS01) | _BV(CS00) ); // previous pulses have not ended yet
+
+		// start pulse of the first servo
+		PORTB  |= pins[0];               // set servo pin - timer0 interrupt will clear it
+		TCCR0B |= _BV(CS01) | _BV(CS00); // enable timer0 by setting prescaler to CK/64
+#ifdef SERVUSB_COUNT_SOF
+		frame = frame_now();
+#endif
+	}
+	stats.frames++;
+	if( overrun )
+		stats.overruns++;
+
+#ifdef SERVUSB_COUNT_SOF
+	// the next scheduled setpoint takes over once its frame has come
+	updateFrame = frame;
+	if( scheduled )
 	{
-	case MODE_BEGIN: // waited for SERVO_MIN_CPU_CYCLES_64 - now wait for scaledPosition
-		mode = MODE_PULSE;
-		OCR0A = scaledPosition;
-		break;
-	case MODE_PULSE: // pulse completed - clear servo pin, stop timer and prepare for next pulse
-		PORTB &= ~_BV(PB0);
-		mode = MODE_BEGIN;
-		// prepare for next interrupt
+		uint8_t next = current + 1 < SETPOINTS ? current + 1 : 0;
+		if( (int16_t)( frame - due[next] ) >= 0 )
+		{
+			current = next;
+			scheduled--;
+		}
+	}
+#endif
+}
+
+
+// Servo pulse generator, called for each Timer0 compare match with interrupts enabled and
+// the compare interrupt masked (see timer0.h). The USB interrupt coming in before the edges
+// delays them like it does when it holds off the compare interrupt, which shows as jitter.
+static inline void pulse( void )
+{
+	static uint8_t channel = 0; // servo whose pulse is in progress
+	static uint8_t stage = 0;   // number of stages of its position already waited for
+	static uint8_t started = 0; // ticks late its pulse started, it shortens the pulse
+	static bool missed = false; // a stage was set after the counter had passed it
+
+	uint8_t late = jitter_late( TCNT0, OCR0A );
+	if( late )
+		stats.latePulses++; // the counter already moved on from the compare match
+
+	if( stage < SERVO_PULSE_STAGES )
+	{ // waited for SERVO_BEGIN_64 or a stage - now wait for the next part of the position
+		uint8_t compare = stages[CURRENT][CHANNEL][stage];
+		OCR0A = compare;
+		if( late > compare )
+			missed = true; // the pulse gets a whole counter cycle longer
+		stage++;
+		return;
+	}
+
+	// pulse completed - clear servo pin
+	PORTB &= ~pins[CHANNEL];
+	uint8_t endLate = missed ? JITTER_MISSED : late;
+	uint8_t startLate = started;
+	missed = false;
+	stage = 0;
+	if( SERVO_CHANNELS > 1 && ++channel < SERVO_CHANNELS )
+	{ // start the next servo right away, the counter clears on the next tick which adds one
+		PORTB |= pins[channel];
+		OCR0A = SERVO_BEGIN_64 - 1;
+		started = late;
+	} else {
+		// all pulses completed - stop timer and prepare for next frame
+		channel = 0;
+		started = 0; // the first pulse starts together with the timer
 		TCCR0B &= ~( _BV(CS01) | _BV(CS00) | _BV(CS02) ); // disable timer0 (no clock source)
-		OCR0A = SERVO_MIN_CPU_CYCLES_64;                  // delay for SERVO_MIN_CPU_CYCLES_64 when timer reenables
+		OCR0A = SERVO_BEGIN_64;                           // delay for SERVO_MIN_CPU_CYCLES_64 when timer reenables
 		TCNT0 = 0;                                        // start counting from zero again
-		break;
 	}
 
-	#undef MODE_BEGIN
-	#undef MODE_PULSE
+	jitter_measure( endLate, startLate );
+}
+
+
+TIMER0_ISR
+{
+	pulse();
+	timer0_unmask(); // a compare match meanwhile is pending and comes in right away
 }
@@ -8,10 +8,66 @@
 #include <avr/io.h>
 
 
+#ifdef SERVUSB_PPM
+
+// Channels of the PPM stream on PB0 (ppm.c), which replaces the servo pulses.
+#ifndef SERVO_CHANNELS
+#define SERVO_CHANNELS 8
+#endif
+
+#if SERVO_CHANNELS < 1 || SERVO_CHANNELS > 8
+#error "SERVO_CHANNELS must be 1 to 8 for PPM"
+#endif
+#ifdef SERVUSB_COUNT_SOF
+#error "Scheduled setpoints are not supported for PPM"
+#endif
+
+#define SERVO_FRAME_US 22500 // time between PPM frames
+#define SERVO_MIN_US   1000  // shortest channel (position 0)
+#define SERVO_MAX_US   2000  // longest channel (position 255)
+
+#else
+
+// Number of servo outputs, pulsed one after the other in each frame on PB0, PB3 and PB4.
+// PB3 and PB4 are only free without a crystal (SERVUSB_RC_OSCILLATOR).
+#ifndef SERVO_CHANNELS
+#define SERVO_CHANNELS 1
+#endif
+
+#if SERVO_CHANNELS < 1 || SERVO_CHANNELS > 3
+#error "SERVO_CHANNELS must be 1 to 3"
+#endif
+#if SERVO_CHANNELS > 1 && !defined(SERVUSB_RC_OSCILLATOR)
+#error "More than one servo needs the crystal pins (build with SERVUSB_RC_OSCILLATOR)"
+#endif
+
+#define SERVO_FRAME_US 20000 // time between servo updates
+#define SERVO_MIN_US   800   // pulse length of position 0
+#define SERVO_MAX_US   2160  // pulse length of position 255
+
+#endif
+
+
 void servo_init( void );
 
-void servo_setPosition( uint8_t position );
-uint8_t servo_getPosition( void );
+void servo_setPosition( uint8_t channel, uint8_t position );
+uint8_t servo_getPosition( uint8_t channel );
+// the latest position set or scheduled, which differs from the one pulsed while it waits for its frame
+uint8_t servo_getCommanded( uint8_t channel );
+
+#ifdef SERVUSB_COUNT_SOF
+#define SERVO_SCHEDULE 4 // setpoints which can wait for their frame
+
+// Sets all servos at the first servo update in or after the given frame (see frame.h), so
+// the host knows exactly when they move. Setpoints are applied in the order scheduled, one
+// per servo update. Returns false if the schedule is full.
+bool servo_schedule( uint16_t frame, const uint8_t * positions );
+
+// frame in which the last servo update started
+uint16_t servo_getUpdateFrame( void );
+// setpoints waiting for their frame
+uint8_t servo_getScheduled( void );
+#endif
 
 
 static inline void servo_enable( void )
@@ -0,0 +1,4 @@
+#include "stats.h"
+
+
+struct stats stats;
@@ -0,0 +1,26 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+
+#include <stdint.h>
+
+
+// Firmware counters, readable by the host through SERVUSB_REPORT_ID_STATS.
+// All counters wrap around. The layout is the report payload (little endian).
+struct stats
+{
+	uint16_t setReports;     // HID SET_REPORT and vendor set requests handled
+	uint16_t getReports;     // HID GET_REPORT requests handled
+	uint16_t stalls;         // SET_REPORT data stages stalled for being too short
+	uint16_t unknownReports; // reads and writes of report IDs and vendor requests which don't exist
+	uint32_t frames;         // servo updates started by Timer/Counter1
+	uint16_t latePulses;     // pulse edges handled at least one Timer/Counter0 tick late (pulse got longer)
+	uint16_t overruns;       // servo updates started while the previous pulse was still running
+	uint32_t polls;          // iterations of the main loop
+};
+
+// modified by the main loop and by the servo ISRs - read multi-byte members with interrupts disabled
+extern struct stats stats;
+
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef _STATUS_H_
+#define _STATUS_H_
+
+
+#include <stdint.h>
+
+#include "servo.h"
+
+
+// Everything the host polls about a device in a single transfer, readable through
+// SERVUSB_REPORT_ID_STATUS: the enable bit and positions as the control and data reports
+// have them, plus what the firmware is and how it was built. The layout is the report
+// payload (little endian), without padding on either side.
+
+#define STATUS_FLAG_PPM           0x01 // PPM stream instead of servo pulses (ppm.c)
+#define STATUS_FLAG_RC_OSCILLATOR 0x02 // running on the calibrated internal oscillator
+#define STATUS_FLAG_COUNT_SOF     0x04 // USB frame counting, positions can be scheduled
+
+struct status
+{
+	uint16_t version;   // firmware version as bcdDevice, 0x0102 is 1.02
+	uint16_t clockKHz;  // F_CPU
+	uint16_t frameUs;   // SERVO_FRAME_US
+	uint16_t minUs;     // SERVO_MIN_US
+	uint16_t maxUs;     // SERVO_MAX_US
+	uint8_t flags;      // STATUS_FLAG_*
+	uint8_t control;    // as SERVUSB_REPORT_ID_CONTROL
+	uint8_t channels;   // SERVO_CHANNELS
+	uint8_t scheduled;  // setpoints waiting for their frame
+	uint8_t commanded[SERVO_CHANNELS]; // latest positions set or scheduled
+	uint8_t pulsed[SERVO_CHANNELS];    // positions of the pulses going out now
+};
+
+
+#endif
@@ -0,0 +1,34 @@
+#include "timer0.h"
+
+
+#ifdef __AVR__
+ISR( TIM0_COMPA_vect, ISR_NAKED )
+{
+	__asm__ __volatile__
+	(
+		"push r24"              "\n\t"
+		"in r24, __SREG__"      "\n\t"
+		"push r24"              "\n\t"
+		"in r24, %[timsk]"      "\n\t"
+		"andi r24, %[mask]"     "\n\t"
+		"out %[timsk], r24"     "\n\t"
+		"pop r24"               "\n\t"
+		"out __SREG__, r24"     "\n\t"
+		"pop r24"               "\n\t"
+		"sei"                   "\n\t"
+		"rjmp __vector_timer0"  "\n\t" // still with interrupts disabled, they are on after it
+		:
+		: [timsk] "I" ( _SFR_IO_ADDR(TIMSK) ), [mask] "M" ( (uint8_t)~_BV(OCIE0A) )
+	);
+}
+#else
+// the same in C, for the simulator
+void __vector_timer0( void );
+
+ISR( TIM0_COMPA_vect )
+{
+	TIMSK &= ~_BV(OCIE0A);
+	sei();
+	__vector_timer0();
+}
+#endif
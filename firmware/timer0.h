@@ -0,0 +1,26 @@
+#ifndef _TIMER0_H_
+#define _TIMER0_H_
+
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+
+// Entry of the Timer0 compare interrupt, which servo.c and ppm.c time their edges with.
+//
+// V-USB tolerates the USB interrupt being held off for 25 cycles at 12 MHz, less than the
+// prologue of a handler written in C. The vector in timer0.c saves nothing but r24 and SREG
+// to mask the Timer0 compare interrupt, so it can't run into itself, enables interrupts and
+// continues in the handler - 22 cycles from the interrupt response to the first instruction
+// the USB interrupt can come in after. The handler is defined with TIMER0_ISR, runs with
+// interrupts enabled and calls timer0_unmask() when it is done.
+#define TIMER0_ISR ISR( __vector_timer0 )
+
+
+static inline void timer0_unmask( void )
+{
+	TIMSK |= _BV(OCIE0A);
+}
+
+
+#endif
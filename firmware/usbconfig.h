@@ -39,6 +39,13 @@ section at the end of this file).
  * interrupt, the USB interrupt will also be triggered at Start-Of-Frame
  * markers every millisecond.]
  */
+#ifdef SERVUSB_COUNT_SOF
+/* Frame counting swaps the data lines, D- has to be on INT0 (PB2). */
+#undef  USB_CFG_DMINUS_BIT
+#define USB_CFG_DMINUS_BIT      2
+#undef  USB_CFG_DPLUS_BIT
+#define USB_CFG_DPLUS_BIT       1
+#endif
 #define USB_CFG_CLOCK_KHZ       (F_CPU/1000)
 /* Clock rate of the AVR in kHz. Legal values are 12000, 12800, 15000, 16000,
  * 16500, 18000 and 20000. The 12.8 MHz and 16.5 MHz versions of the code
@@ -159,6 +166,12 @@ section at the end of this file).
  * proceed, do a return after doing your things. One possible application
  * (besides debugging) is to flash a status LED on each packet.
  */
+#ifdef SERVUSB_RC_OSCILLATOR
+#ifndef __ASSEMBLER__
+extern void osccal_calibrate(void);
+#endif
+#define USB_RESET_HOOK(resetStarts)     if(!resetStarts){osccal_calibrate();}
+#endif
 /* #define USB_RESET_HOOK(resetStarts)     if(!resetStarts){hadUsbReset();} */
 /* This macro is a hook if you need to know when an USB RESET occurs. It has
  * one parameter which distinguishes between the start of RESET state and its
@@ -168,7 +181,11 @@ section at the end of this file).
 /* This macro (if defined) is executed when a USB SET_ADDRESS request was
  * received.
  */
+#ifdef SERVUSB_COUNT_SOF
+#define USB_COUNT_SOF                   1
+#else
 #define USB_COUNT_SOF                   0
+#endif
 /* define this macro to 1 if you need the global variable "usbSofCount" which
  * counts SOF packets. This feature requires that the hardware interrupt is
  * connected to D- instead of D+.
@@ -200,7 +217,11 @@ section at the end of this file).
  * usbFunctionWrite(). Use the global usbCurrentDataToken and a static variable
  * for each control- and out-endpoint to check for duplicate packets.
  */
+#ifdef SERVUSB_RC_OSCILLATOR
+#define USB_CFG_HAVE_MEASURE_FRAME_LENGTH   1
+#else
 #define USB_CFG_HAVE_MEASURE_FRAME_LENGTH   0
+#endif
 /* define this macro to 1 if you want the function usbMeasureFrameLength()
  * compiled in. This function can be used to calibrate the AVR's RC oscillator.
  */
@@ -235,8 +256,10 @@ section at the end of this file).
  * with libusb: 0x16c0/0x5dc.  Use this VID/PID pair ONLY if you understand
  * the implications!
  */
-#define USB_CFG_DEVICE_VERSION  0x00, 0x01
+#define USB_CFG_DEVICE_VERSION  0x02, 0x01
 /* Version number of the device: Minor number first, then major number.
+ * 1.01 added the vendor requests (SERVUSB_REQUEST_* in main.c).
+ * 1.02 added the status report (SERVUSB_REPORT_ID_STATUS in main.c).
  */
 #define USB_CFG_VENDOR_NAME     'p', 'r', 'o', 'v', 'i', 's', 'o', 'r', 'i', 's', 'c', 'h', '@', 'o', 'n', 'l', 'i', 'n', 'e', '.', 'd', 'e'
 #define USB_CFG_VENDOR_NAME_LEN 22
@@ -276,7 +299,11 @@ section at the end of this file).
  * HID class is 3, no subclass and protocol required (but may be useful!)
  * CDC class is 2, use subclass 2 and protocol 1 for ACM
  */
-#define USB_CFG_HID_REPORT_DESCRIPTOR_LENGTH    40
+#ifdef SERVUSB_COUNT_SOF
+#define USB_CFG_HID_REPORT_DESCRIPTOR_LENGTH    120
+#else
+#define USB_CFG_HID_REPORT_DESCRIPTOR_LENGTH    104
+#endif
 /* Define this to the length of the HID report descriptor, if you implement
  * an HID device. Otherwise don't define it or define it to 0.
  * If you use this define, you must add a PROGMEM character array named
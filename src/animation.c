@@ -0,0 +1,335 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include "animation.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+
+#define ANIMATION_LANES 4 // SIMD width in floats, arrays are padded to a multiple of it
+#define ANIMATION_ALIGNMENT 16
+
+
+struct keyframe
+{
+	float time;
+	float value;
+	enum animation_interpolation interpolation;
+};
+
+
+struct track
+{
+	struct keyframe * keyframes;
+	unsigned int count;
+	unsigned int capacity;
+	unsigned int next; // keyframe ending the current segment, count if past the end
+};
+
+
+struct animation
+{
+	unsigned int channels;
+	unsigned int padded;   // channels rounded up to ANIMATION_LANES
+	uint16_t maximum;
+	struct track * tracks; // only touched when a segment ends
+
+	// current segment of each channel: value = ((a * u + b) * u + c) * u + d, with u = (time - start) * scale clamped to [0,1]
+	float * end;
+	float * start;
+	float * scale;
+	float * a;
+	float * b;
+	float * c;
+	float * d;
+	uint16_t * positions;
+};
+
+
+static float * allocateLanes( unsigned int count )
+{
+	void * memory;
+	if( posix_memalign( &memory, ANIMATION_ALIGNMENT, count * sizeof(float) ) )
+		return NULL;
+	memset( memory, 0, count * sizeof(float) );
+	return memory;
+}
+
+
+struct animation * animation_create( unsigned int channels, uint16_t maximum )
+{
+	struct animation * animation = calloc( 1, sizeof(struct animation) );
+	if( !animation )
+		return NULL;
+	animation->channels = channels;
+	animation->padded = ( channels + ANIMATION_LANES - 1 ) / ANIMATION_LANES * ANIMATION_LANES;
+	animation->maximum = maximum;
+	animation->tracks = calloc( channels ? channels : 1, sizeof(struct track) );
+	animation->positions = calloc( animation->padded ? animation->padded : 1, sizeof(uint16_t) );
+	float ** lanes[] = { &animation->end, &animation->start, &animation->scale, &animation->a, &animation->b, &animation->c, &animation->d };
+	bool failed = !animation->tracks || !animation->positions;
+	for( unsigned int i = 0; i < sizeof(lanes) / sizeof(lanes[0]); ++i )
+		failed |= !( *lanes[i] = allocateLanes( animation->padded ? animation->padded : ANIMATION_LANES ) );
+	if( failed )
+	{
+		animation_destroy( animation );
+		return NULL;
+	}
+	for( unsigned int i = 0; i < animation->padded; ++i )
+		animation->end[i] = INFINITY; // nothing to advance until keyframes are added
+	return animation;
+}
+
+
+void animation_destroy( struct animation * animation )
+{
+	if( animation->tracks )
+		for( unsigned int i = 0; i < animation->channels; ++i )
+			free( animation->tracks[i].keyframes );
+	free( animation->tracks );
+	free( animation->positions );
+	free( animation->end );
+	free( animation->start );
+	free( animation->scale );
+	free( animation->a );
+	free( animation->b );
+	free( animation->c );
+	free( animation->d );
+	free( animation );
+}
+
+
+unsigned int animation_getChannels( const struct animation * animation )
+{
+	return animation->channels;
+}
+
+
+bool animation_isAnimated( const struct animation * animation, unsigned int channel )
+{
+	return channel < animation->channels && animation->tracks[channel].count;
+}
+
+
+float animation_getDuration( const struct animation * animation )
+{
+	float duration = 0;
+	for( unsigned int i = 0; i < animation->channels; ++i )
+	{
+		const struct track * track = &animation->tracks[i];
+		if( track->count && track->keyframes[track->count - 1].time > duration )
+			duration = track->keyframes[track->count - 1].time;
+	}
+	return duration;
+}
+
+
+// Catmull-Rom tangent at a keyframe in value per second, one sided at the ends of the track
+static float tangent( const struct track * track, unsigned int k )
+{
+	unsigned int before = k > 0 ? k - 1 : k;
+	unsigned int after = k + 1 < track->count ? k + 1 : k;
+	float dt = track->keyframes[after].time - track->keyframes[before].time;
+	if( dt <= 0 )
+		return 0;
+	return ( track->keyframes[after].value - track->keyframes[before].value ) / dt;
+}
+
+
+// sets up the segment of a channel which ends at keyframe track->next
+static void startSegment( struct animation * animation, unsigned int channel )
+{
+	const struct track * track = &animation->tracks[channel];
+	if( !track->next || track->next >= track->count )
+	{ // before the first or after the last keyframe - hold its value
+		const struct keyframe * hold = &track->keyframes[track->next ? track->count - 1 : 0];
+		animation->start[channel] = 0;
+		animation->end[channel] = track->next ? INFINITY : hold->time;
+		animation->scale[channel] = 0;
+		animation->a[channel] = animation->b[channel] = animation->c[channel] = 0;
+		animation->d[channel] = hold->value;
+		return;
+	}
+
+	const struct keyframe * k0 = &track->keyframes[track->next - 1];
+	const struct keyframe * k1 = &track->keyframes[track->next];
+	float duration = k1->time - k0->time;
+	float p0 = k0->value;
+	float p1 = k1->value;
+	float m0, m1; // tangents scaled to the segment, i.e. per unit of u
+	switch( k0->interpolation )
+	{
+	case ANIMATION_CUBIC:
+		m0 = tangent( track, track->next - 1 ) * duration;
+		m1 = tangent( track, track->next ) * duration;
+		break;
+	case ANIMATION_EASE:
+		m0 = m1 = 0;
+		break;
+	default:
+		m0 = m1 = p1 - p0;
+		break;
+	}
+	// cubic Hermite basis expanded into polynomial coefficients
+	animation->start[channel] = k0->time;
+	animation->end[channel] = k1->time;
+	animation->scale[channel] = duration > 0 ? 1 / duration : 0;
+	animation->a[channel] = 2 * p0 + m0 - 2 * p1 + m1;
+	animation->b[channel] = -3 * p0 - 2 * m0 + 3 * p1 - m1;
+	animation->c[channel] = m0;
+	animation->d[channel] = p0;
+}
+
+
+int animation_addKeyframe( struct animation * animation, unsigned int channel, float time, float value, enum animation_interpolation interpolation )
+{
+	if( channel >= animation->channels )
+		return -1;
+	struct track * track = &animation->tracks[channel];
+	if( track->count && time < track->keyframes[track->count - 1].time )
+		return -1;
+	if( track->count == track->capacity )
+	{
+		unsigned int capacity = track->capacity ? 2 * track->capacity : 8;
+		struct keyframe * keyframes = realloc( track->keyframes, capacity * sizeof(struct keyframe) );
+		if( !keyframes )
+			return -1;
+		track->keyframes = keyframes;
+		track->capacity = capacity;
+	}
+	track->keyframes[track->count].time = time;
+	track->keyframes[track->count].value = value;
+	track->keyframes[track->count].interpolation = interpolation;
+	track->count++;
+	track->next = 0;
+	startSegment( animation, channel );
+	return 0;
+}
+
+
+int animation_load( struct animation * animation, const char * path )
+{
+	FILE * file = fopen( path, "r" );
+	if( !file )
+	{
+		fprintf( stderr, "Error: Unable to open animation %s!\n", path );
+		return -1;
+	}
+	char line[256];
+	unsigned int number = 0;
+	int err = 0;
+	while( !err && fgets( line, sizeof(line), file ) )
+	{
+		number++;
+		char * comment = strchr( line, '#' );
+		if( comment )
+			*comment = 0;
+		unsigned int channel;
+		float time, value;
+		char mode[16] = "linear";
+		int fields = sscanf( line, "%u %f %f %15s", &channel, &time, &value, mode );
+		if( fields <= 0 )
+			continue; // empty line
+		enum animation_interpolation interpolation = ANIMATION_LINEAR;
+		if( !strcmp( mode, "cubic" ) )
+			interpolation = ANIMATION_CUBIC;
+		else if( !strcmp( mode, "ease" ) )
+			interpolation = ANIMATION_EASE;
+		else if( strcmp( mode, "linear" ) )
+			fields = 0;
+		if( fields >= 3 && channel >= animation->channels )
+		{
+			fprintf( stderr, "Error: Channel %u in %s line %u has no servo, there are %u!\n", channel, path, number, animation->channels );
+			err = -1;
+		}
+		else if( fields < 3 || animation_addKeyframe( animation, channel, time, value, interpolation ) )
+		{
+			fprintf( stderr, "Error: Invalid keyframe in %s line %u!\n", path, number );
+			err = -1;
+		}
+	}
+	fclose( file );
+	return err;
+}
+
+
+// moves channels whose segment ended on to the next one - rare compared to ticks
+static void advance( struct animation * animation, float time )
+{
+	for( unsigned int i = 0; i < animation->channels; ++i )
+	{
+		if( time < animation->end[i] )
+			continue;
+		struct track * track = &animation->tracks[i];
+		while( track->next < track->count && track->keyframes[track->next].time <= time )
+			track->next++;
+		startSegment( animation, i );
+	}
+}
+
+
+#if defined(__GNUC__)
+
+typedef float vfloat __attribute__((vector_size(ANIMATION_LANES * sizeof(float))));
+typedef int32_t vint __attribute__((vector_size(ANIMATION_LANES * sizeof(int32_t))));
+
+
+static inline vfloat blend( vint mask, vfloat ifTrue, vfloat ifFalse )
+{
+	return (vfloat)( ( (vint)ifTrue & mask ) | ( (vint)ifFalse & ~mask ) );
+}
+
+
+static void evaluate( struct animation * animation, float time )
+{
+	const vfloat zero = { 0 };
+	const vfloat one = zero + 1;
+	const vfloat half = zero + 0.5f;
+	const vfloat maximum = zero + animation->maximum;
+	const vfloat now = zero + time;
+	for( unsigned int i = 0; i < animation->padded; i += ANIMATION_LANES )
+	{
+		vfloat u = ( now - *(const vfloat *)&animation->start[i] ) * *(const vfloat *)&animation->scale[i];
+		u = blend( u < zero, zero, u );
+		u = blend( u > one, one, u );
+		vfloat value = ( ( *(const vfloat *)&animation->a[i] * u + *(const vfloat *)&animation->b[i] ) * u + *(const vfloat *)&animation->c[i] ) * u + *(const vfloat *)&animation->d[i];
+		value += half; // round to nearest when truncating
+		value = blend( value < zero, zero, value );
+		value = blend( value > maximum, maximum, value );
+		vint quantized = __builtin_convertvector( value, vint );
+		for( unsigned int lane = 0; lane < ANIMATION_LANES; ++lane )
+			animation->positions[i + lane] = quantized[lane];
+	}
+}
+
+#else
+
+static void evaluate( struct animation * animation, float time )
+{
+	for( unsigned int i = 0; i < animation->padded; ++i )
+	{
+		float u = ( time - animation->start[i] ) * animation->scale[i];
+		u = u < 0 ? 0 : u > 1 ? 1 : u;
+		float value = ( ( animation->a[i] * u + animation->b[i] ) * u + animation->c[i] ) * u + animation->d[i] + 0.5f;
+		value = value < 0 ? 0 : value > animation->maximum ? animation->maximum : value;
+		animation->positions[i] = value;
+	}
+}
+
+#endif
+
+
+void animation_evaluate( struct animation * animation, float time )
+{
+	advance( animation, time );
+	evaluate( animation, time );
+}
+
+
+const uint16_t * animation_getPositions( const struct animation * animation )
+{
+	return animation->positions;
+}
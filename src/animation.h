@@ -0,0 +1,52 @@
+#ifndef _ANIMATION_H_
+#define _ANIMATION_H_
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+// Keyframe animation of many channels at once.
+//
+// Every segment between two keyframes is turned into a cubic polynomial over the
+// normalized segment time when it starts, so linear, cubic and eased segments are
+// evaluated by the same branch free kernel. The current segments are stored as
+// structure of arrays and evaluated for all channels per tick with SIMD.
+
+
+enum animation_interpolation
+{
+	ANIMATION_LINEAR, // straight line to the next keyframe
+	ANIMATION_CUBIC,  // Catmull-Rom spline through the neighbouring keyframes
+	ANIMATION_EASE,   // starts and stops with zero velocity (smoothstep)
+};
+
+
+struct animation;
+
+
+// Positions are quantized to 0-maximum (255 for the current firmware).
+struct animation * animation_create( unsigned int channels, uint16_t maximum );
+void animation_destroy( struct animation * animation );
+
+// Keyframes of a channel must be added in ascending time (seconds). The interpolation
+// applies to the segment starting at this keyframe. Returns 0 or -1 on invalid input.
+int animation_addKeyframe( struct animation * animation, unsigned int channel, float time, float value, enum animation_interpolation interpolation );
+
+// Reads lines of "channel time value [linear|cubic|ease]", # starts a comment.
+// Returns 0 or -1 after printing the reason.
+int animation_load( struct animation * animation, const char * path );
+
+unsigned int animation_getChannels( const struct animation * animation );
+// false for a channel without keyframes, whose position means nothing
+bool animation_isAnimated( const struct animation * animation, unsigned int channel );
+// time of the last keyframe of all channels
+float animation_getDuration( const struct animation * animation );
+
+// Evaluates all channels at the given time, which must not go backwards between calls.
+void animation_evaluate( struct animation * animation, float time );
+// results of the last animation_evaluate(), one per channel
+const uint16_t * animation_getPositions( const struct animation * animation );
+
+
+#endif
@@ -0,0 +1,163 @@
+#define _DEFAULT_SOURCE
+
+#include "bridge.h"
+#include "latency.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <linux/input.h>
+
+
+static volatile sig_atomic_t running;
+
+
+static void stop( int signal )
+{
+	running = 0;
+}
+
+
+static uint8_t mapToPosition( int32_t value, int32_t min, int32_t max )
+{
+	if( min == max )
+		return 0;
+	int64_t position = ( (int64_t)value - min ) * 255 / ( (int64_t)max - min );
+	if( position < 0 )
+		return 0;
+	if( position > 255 )
+		return 255;
+	return position;
+}
+
+
+static int64_t eventTime( const struct input_event * event )
+{
+	return (int64_t)event->input_event_sec * 1000000000 + (int64_t)event->input_event_usec * 1000;
+}
+
+
+int bridge_run( struct servusb * servusb, const struct bridge_config * config )
+{
+	int fd = open( config->device, O_RDONLY | O_NONBLOCK | O_CLOEXEC );
+	if( fd < 0 )
+	{
+		fprintf( stderr, "Error: Unable to open %s: %s\n", config->device, strerror(errno) );
+		return LIBUSB_ERROR_NOT_FOUND;
+	}
+
+	// event timestamps on the same clock as latency_now()
+	int clock = CLOCK_MONOTONIC;
+	if( ioctl( fd, EVIOCSCLOCKID, &clock ) < 0 )
+	{
+		fprintf( stderr, "Error: Unable to select monotonic event timestamps: %s\n", strerror(errno) );
+		close( fd );
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+	}
+
+	struct input_absinfo absinfo;
+	if( ioctl( fd, EVIOCGABS(config->axis), &absinfo ) < 0 )
+	{
+		fprintf( stderr, "Error: %s has no absolute axis %u: %s\n", config->device, config->axis, strerror(errno) );
+		close( fd );
+		return LIBUSB_ERROR_NOT_FOUND;
+	}
+	int32_t min = config->haveRange ? config->min : absinfo.minimum;
+	int32_t max = config->haveRange ? config->max : absinfo.maximum;
+
+	int epoll = epoll_create1( EPOLL_CLOEXEC );
+	struct epoll_event watch = { .events = EPOLLIN };
+	if( epoll < 0 || epoll_ctl( epoll, EPOLL_CTL_ADD, fd, &watch ) < 0 )
+	{
+		fprintf( stderr, "Error: Unable to poll %s: %s\n", config->device, strerror(errno) );
+		if( epoll >= 0 )
+			close( epoll );
+		close( fd );
+		return LIBUSB_ERROR_OTHER;
+	}
+
+	struct sigaction action;
+	memset( &action, 0, sizeof(action) );
+	action.sa_handler = stop; // no SA_RESTART - epoll_wait() returns on the signal
+	sigaction( SIGINT, &action, NULL );
+	sigaction( SIGTERM, &action, NULL );
+	running = 1;
+
+	printf( "Bridging axis %u of %s (%d to %d) to servo on bus %d, device %d.\n", config->axis, config->device, min, max, servusb->bus, servusb->dev );
+
+	struct latency latency;
+	latency_reset( &latency );
+	uint64_t events = 0;
+	int err = 0;
+	int sent = -1;    // last position sent, -1 before the first transfer
+	int32_t value = absinfo.value;
+	int64_t valueTime = 0;
+	bool changed = true; // send the current position right away
+	while( running )
+	{
+		// coalesce everything queued since the last transfer - only the newest value is sent
+		struct input_event buffer[64];
+		ssize_t length;
+		while( ( length = read( fd, buffer, sizeof(buffer) ) ) > 0 )
+		{
+			for( size_t i = 0; i < length / sizeof(buffer[0]); ++i )
+			{
+				if( buffer[i].type != EV_ABS || buffer[i].code != config->axis )
+					continue;
+				value = buffer[i].value;
+				valueTime = eventTime( &buffer[i] );
+				changed = true;
+				events++;
+			}
+		}
+		if( length < 0 && errno != EAGAIN && errno != EINTR )
+		{
+			fprintf( stderr, "Error: Unable to read from %s: %s\n", config->device, strerror(errno) );
+			err = LIBUSB_ERROR_IO;
+			break;
+		}
+
+		int position = mapToPosition( value, min, max );
+		if( changed && position != sent )
+		{
+			err = servusb_setPosition( servusb, position );
+			if( err < 0 )
+				break;
+			if( sent < 0 )
+			{
+				err = servusb_setEnabled( servusb, true );
+				if( err < 0 )
+					break;
+			}
+			if( valueTime )
+				latency_add( &latency, latency_now() - valueTime );
+			sent = position;
+		}
+		changed = false;
+		err = 0;
+
+		struct epoll_event event;
+		if( epoll_wait( epoll, &event, 1, -1 ) < 0 && errno != EINTR )
+		{
+			fprintf( stderr, "Error: Unable to poll %s: %s\n", config->device, strerror(errno) );
+			err = LIBUSB_ERROR_OTHER;
+			break;
+		}
+	}
+
+	printf( "%llu axis events, %llu transfers.\n", (unsigned long long)events, (unsigned long long)latency.count );
+	latency_print( &latency, "Event to transfer complete" );
+
+	signal( SIGINT, SIG_DFL );
+	signal( SIGTERM, SIG_DFL );
+	close( epoll );
+	close( fd );
+	return err;
+}
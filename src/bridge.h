@@ -0,0 +1,26 @@
+#ifndef _BRIDGE_H_
+#define _BRIDGE_H_
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "servusb.h"
+
+
+struct bridge_config
+{
+	const char * device; // /dev/input/event*
+	uint16_t axis;       // ABS_* code
+	bool haveRange;      // if false, the axis' own minimum and maximum are used
+	int32_t min;         // input value mapped to position 0
+	int32_t max;         // input value mapped to position 255, may be less than min to invert
+};
+
+
+// Forwards an evdev axis to the servo until SIGINT or SIGTERM, then prints the
+// input event to transfer complete latency. Returns a negative libusb error code on failure.
+int bridge_run( struct servusb * servusb, const struct bridge_config * config );
+
+
+#endif
@@ -0,0 +1,104 @@
+#define _DEFAULT_SOURCE
+
+#include "devcache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+
+struct line
+{
+	int selectorBus;
+	int selectorDev;
+	struct devcache_entry entry;
+};
+
+
+static int cachePath( char path[PATH_MAX] )
+{
+	const char * cache = getenv( "XDG_CACHE_HOME" );
+	if( cache && cache[0] )
+		return snprintf( path, PATH_MAX, "%s/servusb-devices", cache ) < PATH_MAX ? 0 : -1;
+	const char * home = getenv( "HOME" );
+	if( !home || !home[0] )
+		return -1;
+	return snprintf( path, PATH_MAX, "%s/.cache/servusb-devices", home ) < PATH_MAX ? 0 : -1;
+}
+
+
+static int load( const char * path, struct line lines[DEVCACHE_ENTRIES] )
+{
+	FILE * file = fopen( path, "r" );
+	if( !file )
+		return 0;
+	int count = 0;
+	char text[128];
+	while( count < DEVCACHE_ENTRIES && fgets( text, sizeof(text), file ) )
+	{
+		struct line * line = &lines[count];
+		if( text[0] == '#' )
+			continue;
+		if( sscanf( text, "%d %d %d %d %31s", &line->selectorBus, &line->selectorDev, &line->entry.bus, &line->entry.dev, line->entry.port ) == 5 )
+			count++;
+	}
+	fclose( file );
+	return count;
+}
+
+
+int devcache_lookup( int bus, int dev, struct devcache_entry * found )
+{
+	char path[PATH_MAX];
+	struct line lines[DEVCACHE_ENTRIES];
+	if( cachePath( path ) )
+		return -1;
+	int count = load( path, lines );
+	for( int i = 0; i < count; ++i )
+	{
+		if( lines[i].selectorBus == bus && lines[i].selectorDev == dev )
+		{
+			*found = lines[i].entry;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+
+void devcache_store( int bus, int dev, const struct devcache_entry * found )
+{
+	char path[PATH_MAX];
+	char temporary[PATH_MAX + 4];
+	struct line lines[DEVCACHE_ENTRIES];
+	if( cachePath( path ) )
+		return;
+	int count = load( path, lines );
+
+	// most recent first, replaces what the selector found before
+	FILE * file = NULL;
+	snprintf( temporary, sizeof(temporary), "%s.new", path );
+	if( !( file = fopen( temporary, "w" ) ) )
+	{ // the first time ~/.cache may not be there yet
+		char * slash = strrchr( path, '/' );
+		*slash = 0;
+		mkdir( path, 0700 );
+		*slash = '/';
+		if( !( file = fopen( temporary, "w" ) ) )
+			return;
+	}
+	fprintf( file, "# ServUSB devices - selector bus, selector dev, bus, dev, port\n" );
+	fprintf( file, "%d %d %d %d %s\n", bus, dev, found->bus, found->dev, found->port );
+	for( int i = 0, written = 1; i < count && written < DEVCACHE_ENTRIES; ++i )
+	{
+		if( lines[i].selectorBus == bus && lines[i].selectorDev == dev )
+			continue;
+		fprintf( file, "%d %d %d %d %s\n", lines[i].selectorBus, lines[i].selectorDev, lines[i].entry.bus, lines[i].entry.dev, lines[i].entry.port );
+		written++;
+	}
+	// replaced at once, concurrent invocations see either the old or the new cache
+	if( fclose( file ) || rename( temporary, path ) )
+		remove( temporary );
+}
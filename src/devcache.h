@@ -0,0 +1,33 @@
+#ifndef _DEVCACHE_H_
+#define _DEVCACHE_H_
+
+
+#include "servusb.h"
+
+
+// Which ServUSB a selector found last time, so opening it again needs no enumeration.
+//
+// The cache lives in $XDG_CACHE_HOME/servusb-devices (~/.cache by default) as lines of
+// "selector bus, selector dev, bus, dev, port", most recently used first. Entries are
+// only hints - whoever uses one checks the descriptor of the device it names.
+
+
+#define DEVCACHE_ENTRIES 16
+
+
+struct devcache_entry
+{
+	int bus;
+	int dev;
+	char port[SERVUSB_PORT_MAX];
+};
+
+
+// Returns 0 and fills in found if bus and dev (-1 matches any) found a device before, otherwise -1.
+int devcache_lookup( int bus, int dev, struct devcache_entry * found );
+
+// Remembers what bus and dev found, silently does nothing if the cache can't be written.
+void devcache_store( int bus, int dev, const struct devcache_entry * found );
+
+
+#endif
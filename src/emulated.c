@@ -0,0 +1,167 @@
+#include "emulated.h"
+#include "latency.h"
+
+#include <string.h>
+
+
+#define EMULATED_BUS 0
+#define EMULATED_DEV 1
+#define EMULATED_PORT "emulated"
+#define EMULATED_VERSION 0x0102 // firmware with the status report
+#define EMULATED_CHANNELS 1    // the stock crystal build
+
+
+static struct
+{
+	struct kinematics * kinematics;
+	int64_t (*now)( void );
+	bool open;
+	bool enabled;
+	uint8_t positions[EMULATED_CHANNELS];
+} device = { NULL, latency_now };
+
+
+void emulated_setClock( int64_t (*now)( void ) )
+{
+	device.now = now ? now : latency_now;
+}
+
+
+struct kinematics * emulated_getKinematics( void )
+{
+	if( !device.kinematics )
+		device.kinematics = kinematics_create( EMULATED_CHANNELS, kinematics_findType( "standard", NULL ) );
+	return device.kinematics;
+}
+
+
+static bool matches( int bus, int dev )
+{
+	return ( bus < 0 || bus == EMULATED_BUS ) && ( dev < 0 || dev == EMULATED_DEV );
+}
+
+
+static int emulated_list( int bus, int dev, struct servusb_address * addresses, int max )
+{
+	if( !matches( bus, dev ) || max < 1 )
+		return 0;
+	addresses[0].bus = EMULATED_BUS;
+	addresses[0].dev = EMULATED_DEV;
+	return 1;
+}
+
+
+static int emulated_open( struct servusb * servusb )
+{
+	if( !matches( servusb->bus, servusb->dev ) || ( servusb->port[0] && strcmp( servusb->port, EMULATED_PORT ) ) )
+		return LIBUSB_ERROR_NOT_FOUND;
+	if( !emulated_getKinematics() )
+		return LIBUSB_ERROR_NO_MEM;
+	servusb->bus = EMULATED_BUS;
+	servusb->dev = EMULATED_DEV;
+	strcpy( servusb->port, EMULATED_PORT );
+	device.open = true;
+	return 0;
+}
+
+
+static void emulated_close( struct servusb * servusb )
+{
+	device.open = false;
+}
+
+
+// the servos only follow while they get pulses
+static void drive( unsigned int first, unsigned int count )
+{
+	if( !device.enabled )
+		return;
+	int64_t now = device.now();
+	for( unsigned int i = first; i < first + count; ++i )
+		kinematics_command( device.kinematics, i, now, device.positions[i] );
+}
+
+
+static int emulated_setFeature( struct servusb * servusb, unsigned char * data, uint16_t length )
+{
+	if( !device.open )
+		return LIBUSB_ERROR_NO_DEVICE;
+	if( length < 2 )
+		return LIBUSB_ERROR_PIPE; // stalled like the firmware does
+	switch( data[0] )
+	{
+	case SERVUSB_REPORT_ID_CONTROL:
+	{
+		bool enabled = data[1] & SERVUSB_CONTROL_ENABLE_BIT;
+		bool starting = enabled && !device.enabled;
+		device.enabled = enabled;
+		if( starting )
+			drive( 0, EMULATED_CHANNELS );
+		break;
+	}
+	case SERVUSB_REPORT_ID_DATA:
+	{ // a shorter report only sets the first servos, positions of servos it doesn't have are dropped
+		unsigned int count = length - 1 < EMULATED_CHANNELS ? length - 1 : EMULATED_CHANNELS;
+		memcpy( device.positions, data + 1, count );
+		drive( 0, count );
+		break;
+	}
+	}
+	return length;
+}
+
+
+static int emulated_getFeature( struct servusb * servusb, unsigned char * data, uint16_t length )
+{
+	if( !device.open )
+		return LIBUSB_ERROR_NO_DEVICE;
+	if( !length )
+		return 0;
+	switch( data[0] )
+	{
+	case SERVUSB_REPORT_ID_CONTROL:
+		if( length > 1 )
+			data[1] = device.enabled ? SERVUSB_CONTROL_ENABLE_BIT : 0x00;
+		return length < 2 ? length : 2;
+	case SERVUSB_REPORT_ID_DATA:
+	{
+		unsigned int count = length - 1 < EMULATED_CHANNELS ? length - 1 : EMULATED_CHANNELS;
+		memcpy( data + 1, device.positions, count );
+		return 1 + count;
+	}
+	case SERVUSB_REPORT_ID_STATUS:
+	{ // 1 + sizeof(struct status) of the firmware, which doesn't schedule without SOF=1
+		unsigned char status[15 + 2 * EMULATED_CHANNELS] =
+		{
+			SERVUSB_REPORT_ID_STATUS,
+			EMULATED_VERSION & 0xff, EMULATED_VERSION >> 8,
+			12000 & 0xff, 12000 >> 8,
+			20000 & 0xff, 20000 >> 8,
+			800 & 0xff, 800 >> 8,
+			2160 & 0xff, 2160 >> 8,
+			0x00,
+			device.enabled ? SERVUSB_CONTROL_ENABLE_BIT : 0x00,
+			EMULATED_CHANNELS,
+			0,
+		};
+		memcpy( status + 15, device.positions, EMULATED_CHANNELS );
+		memcpy( status + 15 + EMULATED_CHANNELS, device.positions, EMULATED_CHANNELS );
+		unsigned int count = length < sizeof(status) ? length : sizeof(status);
+		memcpy( data, status, count );
+		return count;
+	}
+	}
+	return 0; // no such report, as the firmware answers
+}
+
+
+const struct servusb_transport servusb_transport_emulated =
+{
+	"emulated",
+	emulated_list,
+	emulated_open,
+	emulated_close,
+	emulated_setFeature,
+	emulated_getFeature,
+	NULL,
+};
@@ -0,0 +1,23 @@
+#ifndef _EMULATED_H_
+#define _EMULATED_H_
+
+
+#include "servusb.h"
+#include "kinematics.h"
+
+
+// A ServUSB without hardware (transport "emulated"): bus 0, device 1 at port "emulated", the
+// stock crystal build with one servo (positions for more servos are ignored). Its reports drive the kinematics model instead of servos, so
+// tools and tests run against a plant which moves like the real thing. A disabled servo
+// doesn't follow its setpoints until it is enabled again.
+
+
+// Replaces latency_now() as the clock of the plant - a clock driven by the caller makes
+// every run come out the same. NULL goes back to latency_now().
+void emulated_setClock( int64_t (*now)( void ) );
+
+// the plant, created with servos of the "standard" type when the device is first opened
+struct kinematics * emulated_getKinematics( void );
+
+
+#endif
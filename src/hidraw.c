@@ -0,0 +1,246 @@
+#define _DEFAULT_SOURCE
+
+#include "servusb.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <linux/hidraw.h>
+
+
+#define SYSFS_HIDRAW "/sys/class/hidraw"
+
+#define BUS_USB 0x03
+
+
+static int errnoToLibusb( int error )
+{
+	switch( error )
+	{
+	case ENOENT:
+	case ENODEV:
+	case ENXIO:     return LIBUSB_ERROR_NO_DEVICE;
+	case EACCES:
+	case EPERM:     return LIBUSB_ERROR_ACCESS;
+	case EBUSY:     return LIBUSB_ERROR_BUSY;
+	case ETIMEDOUT: return LIBUSB_ERROR_TIMEOUT;
+	case EPIPE:     return LIBUSB_ERROR_PIPE;
+	case EINTR:     return LIBUSB_ERROR_INTERRUPTED;
+	case ENOMEM:    return LIBUSB_ERROR_NO_MEM;
+	case EINVAL:    return LIBUSB_ERROR_INVALID_PARAM;
+	}
+	return LIBUSB_ERROR_IO;
+}
+
+
+static int readSysfsInt( const char * path, int * value )
+{
+	FILE * file = fopen( path, "r" );
+	if( !file )
+		return -1;
+	int matched = fscanf( file, "%d", value );
+	fclose( file );
+	return matched == 1 ? 0 : -1;
+}
+
+
+// the HID device's uevent contains e.g. HID_ID=0003:000016C0:000005DF
+static bool isServUSB( const char * name )
+{
+	char path[PATH_MAX];
+	snprintf( path, sizeof(path), SYSFS_HIDRAW "/%s/device/uevent", name );
+	FILE * file = fopen( path, "r" );
+	if( !file )
+		return false;
+	char line[256];
+	bool found = false;
+	while( !found && fgets( line, sizeof(line), file ) )
+	{
+		unsigned int bus, vendor, product;
+		if( sscanf( line, "HID_ID=%x:%x:%x", &bus, &vendor, &product ) == 3 )
+			found = bus == BUS_USB && vendor == SERVUSB_VENDOR_ID && product == SERVUSB_PRODUCT_ID;
+	}
+	fclose( file );
+	return found;
+}
+
+
+struct hidraw
+{
+	struct servusb_address address;
+	char name[NAME_MAX + 1];
+	char port[SERVUSB_PORT_MAX];
+};
+
+
+// the USB device's directory is named after its port path, e.g. /sys/devices/.../1-1.2
+static int readPort( const char * name, char port[SERVUSB_PORT_MAX] )
+{
+	char path[PATH_MAX];
+	char resolved[PATH_MAX];
+	snprintf( path, sizeof(path), SYSFS_HIDRAW "/%s/device/../..", name );
+	if( !realpath( path, resolved ) )
+		return -1;
+	const char * base = strrchr( resolved, '/' );
+	base = base ? base + 1 : resolved;
+	if( strlen( base ) >= SERVUSB_PORT_MAX )
+		return -1;
+	strcpy( port, base );
+	return 0;
+}
+
+
+// finds up to max ServUSBs matching bus and dev (-1 matches any) or, if given, at port,
+// returns the number found
+static int scan( int bus, int dev, const char * port, struct hidraw * found, int max )
+{
+	DIR * dir = opendir( SYSFS_HIDRAW );
+	if( !dir )
+	{
+		fprintf( stderr, "Error: Unable to list hidraw devices: %s\n", strerror(errno) );
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+	}
+
+	int count = 0;
+	struct dirent * entry;
+	while( count < max && (entry = readdir( dir )) )
+	{
+		if( strncmp( entry->d_name, "hidraw", 6 ) || !isServUSB( entry->d_name ) )
+			continue;
+
+		// the USB device is two levels above the HID device: <usb device>/<interface>/<hid device>
+		char path[PATH_MAX];
+		int bnum, dnum;
+		snprintf( path, sizeof(path), SYSFS_HIDRAW "/%s/device/../../busnum", entry->d_name );
+		if( readSysfsInt( path, &bnum ) )
+			continue;
+		snprintf( path, sizeof(path), SYSFS_HIDRAW "/%s/device/../../devnum", entry->d_name );
+		if( readSysfsInt( path, &dnum ) )
+			continue;
+
+		if( readPort( entry->d_name, found[count].port ) )
+			continue;
+
+		if( port && port[0] )
+		{
+			if( strcmp( port, found[count].port ) )
+				continue; // reconnecting and it's not at the same port - continue with next device
+		}
+		else if( (bus != -1 && bus != bnum) || (dev != -1 && dev != dnum))
+			continue; // bus and/or device number given and it doesn't match - continue with next device
+
+		found[count].address.bus = bnum;
+		found[count].address.dev = dnum;
+		strcpy( found[count].name, entry->d_name );
+		count++;
+	}
+	closedir( dir );
+	return count;
+}
+
+
+static int hidraw_list( int bus, int dev, struct servusb_address * addresses, int max )
+{
+	struct hidraw * found = calloc( max > 0 ? max : 1, sizeof(struct hidraw) );
+	if( !found )
+		return LIBUSB_ERROR_NO_MEM;
+	int64_t start = trace_begin();
+	int count = scan( bus, dev, NULL, found, max );
+	trace_end( TRACE_ENUMERATE, start, count );
+	for( int i = 0; i < count; ++i )
+		addresses[i] = found[i].address;
+	free( found );
+	return count;
+}
+
+
+static int hidraw_open( struct servusb * servusb )
+{
+	struct hidraw found;
+	int64_t start = trace_begin();
+	int count = scan( servusb->bus, servusb->dev, servusb->port, &found, 1 );
+	trace_end( TRACE_ENUMERATE, start, count );
+	if( count < 0 )
+		return count;
+	if( !count )
+		return LIBUSB_ERROR_NOT_FOUND;
+
+	char path[PATH_MAX];
+	snprintf( path, sizeof(path), "/dev/%s", found.name );
+	start = trace_begin();
+	servusb->fd = open( path, O_RDWR | O_CLOEXEC );
+	trace_end( TRACE_OPEN, start, servusb->fd < 0 ? errnoToLibusb( errno ) : 0 );
+	if( servusb->fd < 0 )
+	{
+		int err = errnoToLibusb( errno );
+		fprintf( stderr, "Error: Unable to open %s: %s\n", path, strerror(errno) );
+		return err;
+	}
+	servusb->bus = found.address.bus;
+	servusb->dev = found.address.dev;
+	strcpy( servusb->port, found.port );
+	return 0;
+}
+
+
+static void hidraw_close( struct servusb * servusb )
+{
+	int64_t start = trace_begin();
+	close( servusb->fd );
+	trace_end( TRACE_CLOSE, start, 0 );
+}
+
+
+static int hidraw_setFeature( struct servusb * servusb, unsigned char * data, uint16_t length )
+{
+	int64_t start = trace_begin();
+	int transferred = ioctl( servusb->fd, HIDIOCSFEATURE(length), data );
+	trace_end( TRACE_SET_REPORT, start, transferred < 0 ? errnoToLibusb( errno ) : data[0] );
+	if( transferred < 0 )
+	{
+		int err = errnoToLibusb( errno );
+		fprintf( stderr, "Error: Transfer failed: %s (%d)\n", strerror(errno), err );
+		return err;
+	}
+	if( transferred != length )
+	{ // the device is there, it didn't take the whole report
+		fprintf( stderr, "Error: Incomplete transfer - sent %d bytes but expected %d\n", transferred, length );
+		return LIBUSB_ERROR_PIPE;
+	}
+	return transferred;
+}
+
+
+static int hidraw_getFeature( struct servusb * servusb, unsigned char * data, uint16_t length )
+{
+	int64_t start = trace_begin();
+	int transferred = ioctl( servusb->fd, HIDIOCGFEATURE(length), data );
+	trace_end( TRACE_GET_REPORT, start, transferred < 0 ? errnoToLibusb( errno ) : data[0] );
+	if( transferred < 0 )
+	{
+		int err = errnoToLibusb( errno );
+		fprintf( stderr, "Error: Transfer failed: %s (%d)\n", strerror(errno), err );
+		return err;
+	}
+	return transferred; // a shorter report is the firmware's answer, the caller checks the length
+}
+
+
+const struct servusb_transport servusb_transport_hidraw =
+{
+	"hidraw",
+	hidraw_list,
+	hidraw_open,
+	hidraw_close,
+	hidraw_setFeature,
+	hidraw_getFeature,
+	NULL,
+};
@@ -0,0 +1,233 @@
+#include "kinematics.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+
+#define KINEMATICS_PENDING 8 // setpoints a servo has not seen yet, more than its delay covers at the servo frame rate
+
+
+// Data sheets give the speed as seconds per 60 degrees at 4.8 V, the 255 positions span
+// about 180 degrees. The delay is a servo frame of 20 ms and the reaction of the servo.
+static const struct kinematics_type types[] =
+{
+	{ "standard", 85 / 0.20f, 1.0f, 0.020f + 0.005f },
+	{ "micro",    85 / 0.12f, 2.0f, 0.020f + 0.005f },
+	{ "digital",  85 / 0.08f, 0.5f, 0.020f + 0.002f },
+};
+
+
+// moving from from to to at the slew rate, starting at begin
+struct motion
+{
+	int64_t begin;
+	float from;
+	float to;
+};
+
+
+struct setpoint
+{
+	int64_t seen; // when the servo picks it up
+	float position;
+};
+
+
+struct servo
+{
+	struct kinematics_type type;
+	struct motion motion; // following the setpoints seen so far
+	struct setpoint pending[KINEMATICS_PENDING];
+	unsigned int first;
+	unsigned int count;
+};
+
+
+struct kinematics
+{
+	unsigned int channels;
+	struct servo * servos;
+};
+
+
+const struct kinematics_type * kinematics_findType( const char * name, struct kinematics_type * custom )
+{
+	for( unsigned int i = 0; i < sizeof(types) / sizeof(types[0]); ++i )
+		if( !strcmp( types[i].name, name ) )
+			return &types[i];
+
+	struct kinematics_type parsed = { "custom", 0, 0, types[0].delay };
+	int fields = sscanf( name, "%f,%f,%f", &parsed.slewRate, &parsed.deadband, &parsed.delay );
+	if( fields < 2 || parsed.slewRate <= 0 || parsed.deadband < 0 || parsed.delay < 0 )
+		return NULL;
+	*custom = parsed;
+	return custom;
+}
+
+
+struct kinematics * kinematics_create( unsigned int channels, const struct kinematics_type * type )
+{
+	struct kinematics * kinematics = calloc( 1, sizeof(struct kinematics) );
+	if( !kinematics )
+		return NULL;
+	kinematics->channels = channels;
+	kinematics->servos = calloc( channels ? channels : 1, sizeof(struct servo) );
+	if( !kinematics->servos )
+	{
+		kinematics_destroy( kinematics );
+		return NULL;
+	}
+	for( unsigned int i = 0; i < channels; ++i )
+	{
+		kinematics->servos[i].type = *type;
+		kinematics_reset( kinematics, i, 127 );
+	}
+	return kinematics;
+}
+
+
+void kinematics_destroy( struct kinematics * kinematics )
+{
+	free( kinematics->servos );
+	free( kinematics );
+}
+
+
+void kinematics_setType( struct kinematics * kinematics, unsigned int channel, const struct kinematics_type * type )
+{
+	if( channel < kinematics->channels )
+		kinematics->servos[channel].type = *type;
+}
+
+
+void kinematics_reset( struct kinematics * kinematics, unsigned int channel, float position )
+{
+	if( channel >= kinematics->channels )
+		return;
+	struct servo * servo = &kinematics->servos[channel];
+	servo->motion.begin = 0;
+	servo->motion.from = servo->motion.to = position;
+	servo->count = 0;
+}
+
+
+static float distance( float a, float b )
+{
+	return a > b ? a - b : b - a;
+}
+
+
+static float evaluate( const struct kinematics_type * type, const struct motion * motion, int64_t time )
+{
+	if( time <= motion->begin )
+		return motion->from;
+	float moved = type->slewRate * ( time - motion->begin ) / 1e9f;
+	if( moved >= distance( motion->from, motion->to ) )
+		return motion->to;
+	return motion->to > motion->from ? motion->from + moved : motion->from - moved;
+}
+
+
+// the servo sees a setpoint - a running motor keeps following, a resting one only starts beyond the deadband
+static void apply( const struct kinematics_type * type, struct motion * motion, const struct setpoint * setpoint )
+{
+	float position = evaluate( type, motion, setpoint->seen );
+	bool moving = position != motion->to;
+	if( !moving && distance( position, setpoint->position ) <= type->deadband )
+		return;
+	motion->begin = setpoint->seen;
+	motion->from = position;
+	motion->to = setpoint->position;
+}
+
+
+// the motion after all setpoints the servo has seen at the given time, INT64_MAX for all
+static struct motion project( const struct servo * servo, int64_t time )
+{
+	struct motion motion = servo->motion;
+	for( unsigned int i = 0; i < servo->count; ++i )
+	{
+		const struct setpoint * setpoint = &servo->pending[( servo->first + i ) % KINEMATICS_PENDING];
+		if( setpoint->seen > time )
+			break;
+		apply( &servo->type, &motion, setpoint );
+	}
+	return motion;
+}
+
+
+void kinematics_command( struct kinematics * kinematics, unsigned int channel, int64_t time, float position )
+{
+	if( channel >= kinematics->channels )
+		return;
+	struct servo * servo = &kinematics->servos[channel];
+
+	// setpoints seen by now won't change anymore, the oldest is taken early if there are too many
+	while( servo->count && ( servo->pending[servo->first].seen <= time || servo->count == KINEMATICS_PENDING ) )
+	{
+		apply( &servo->type, &servo->motion, &servo->pending[servo->first] );
+		servo->first = ( servo->first + 1 ) % KINEMATICS_PENDING;
+		servo->count--;
+	}
+	struct setpoint * setpoint = &servo->pending[( servo->first + servo->count ) % KINEMATICS_PENDING];
+	setpoint->seen = time + (int64_t)( servo->type.delay * 1e9f );
+	setpoint->position = position;
+	servo->count++;
+}
+
+
+float kinematics_getPosition( const struct kinematics * kinematics, unsigned int channel, int64_t time )
+{
+	if( channel >= kinematics->channels )
+		return 0;
+	const struct servo * servo = &kinematics->servos[channel];
+	struct motion motion = project( servo, time );
+	return evaluate( &servo->type, &motion, time );
+}
+
+
+int64_t kinematics_getArrival( const struct kinematics * kinematics, unsigned int channel )
+{
+	if( channel >= kinematics->channels )
+		return 0;
+	const struct servo * servo = &kinematics->servos[channel];
+	struct motion motion = project( servo, INT64_MAX );
+	return motion.begin + (int64_t)( distance( motion.from, motion.to ) / servo->type.slewRate * 1e9f );
+}
+
+
+int64_t kinematics_getSettled( const struct kinematics * kinematics )
+{
+	int64_t settled = 0;
+	for( unsigned int i = 0; i < kinematics->channels; ++i )
+	{
+		int64_t arrival = kinematics_getArrival( kinematics, i );
+		if( arrival > settled )
+			settled = arrival;
+	}
+	return settled;
+}
+
+
+float kinematics_plan( const struct kinematics * kinematics, int64_t time, const float * targets, unsigned int count, struct animation * animation, float start )
+{
+	if( count > kinematics->channels )
+		count = kinematics->channels;
+	float duration = 0;
+	for( unsigned int i = 0; i < count; ++i )
+	{
+		float needed = distance( kinematics_getPosition( kinematics, i, time ), targets[i] ) / kinematics->servos[i].type.slewRate;
+		if( needed > duration )
+			duration = needed;
+	}
+	for( unsigned int i = 0; i < count; ++i )
+	{
+		float from = kinematics_getPosition( kinematics, i, time );
+		if( animation_addKeyframe( animation, i, start, from, ANIMATION_LINEAR ) ||
+			animation_addKeyframe( animation, i, start + duration, targets[i], ANIMATION_LINEAR ) )
+			return -1;
+	}
+	return duration;
+}
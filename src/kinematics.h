@@ -0,0 +1,64 @@
+#ifndef _KINEMATICS_H_
+#define _KINEMATICS_H_
+
+
+#include <stdint.h>
+
+#include "animation.h"
+
+
+// Where the servos are, as opposed to what they were commanded.
+//
+// A servo picks up a new setpoint with its next pulse and reacts after its own dead time
+// (together the delay), then turns at its maximum speed (the slew rate) until it is there.
+// Setpoints closer to where a servo stands than its deadband don't move it. Motion is
+// piecewise linear, so the model is evaluated in closed form for any time and only has
+// to be told about the setpoints - times are CLOCK_MONOTONIC nanoseconds (latency_now()).
+// Positions are on the 0-255 scale of the firmware.
+
+
+struct kinematics_type
+{
+	const char * name;
+	float slewRate; // positions per second
+	float deadband; // positions either side of the servo which don't make it move
+	float delay;    // seconds from sending a setpoint to the servo starting to move
+};
+
+
+struct kinematics;
+
+
+// Looks up a named type ("standard", "micro" or "digital") or parses "rate,deadband[,delay]"
+// into custom. Returns NULL if neither fits.
+const struct kinematics_type * kinematics_findType( const char * name, struct kinematics_type * custom );
+
+// All servos start out of type at rest at 127, until told better by kinematics_reset().
+struct kinematics * kinematics_create( unsigned int channels, const struct kinematics_type * type );
+void kinematics_destroy( struct kinematics * kinematics );
+
+// the type is copied, a servo changing its type keeps moving as before until its next setpoint
+void kinematics_setType( struct kinematics * kinematics, unsigned int channel, const struct kinematics_type * type );
+// puts a servo at rest at a known position
+void kinematics_reset( struct kinematics * kinematics, unsigned int channel, float position );
+
+// a setpoint sent at the given time, setpoints must not go backwards in time
+void kinematics_command( struct kinematics * kinematics, unsigned int channel, int64_t time, float position );
+
+// where the servo is at the given time, which may be any time after its last setpoint
+float kinematics_getPosition( const struct kinematics * kinematics, unsigned int channel, int64_t time );
+// when the servo reaches its last setpoint, or stopped short of it within the deadband
+int64_t kinematics_getArrival( const struct kinematics * kinematics, unsigned int channel );
+// when all servos have arrived
+int64_t kinematics_getSettled( const struct kinematics * kinematics );
+
+// Plans the shortest move of the first count servos from where they are at the given time
+// to the targets which has them all arrive at once: the one taking longest goes at its slew
+// rate, the others slower. Adds linear keyframes for it to the animation, with time at
+// start seconds of the animation, and returns the duration in seconds or -1 if the keyframes
+// don't fit after those already there. Played at the servo frame rate the setpoints keep
+// just ahead of the servos, which arrive within the delay and a frame after the end.
+float kinematics_plan( const struct kinematics * kinematics, int64_t time, const float * targets, unsigned int count, struct animation * animation, float start );
+
+
+#endif
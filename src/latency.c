@@ -0,0 +1,65 @@
+#define _DEFAULT_SOURCE
+
+#include "latency.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+
+int64_t latency_now( void )
+{
+	struct timespec now;
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+
+void latency_reset( struct latency * latency )
+{
+	memset( latency, 0, sizeof(*latency) );
+}
+
+
+void latency_add( struct latency * latency, int64_t nanoseconds )
+{
+	if( !latency->count || nanoseconds < latency->min )
+		latency->min = nanoseconds;
+	if( !latency->count || nanoseconds > latency->max )
+		latency->max = nanoseconds;
+	latency->count++;
+	latency->sum += nanoseconds;
+
+	uint64_t microseconds = nanoseconds > 0 ? nanoseconds / 1000 : 0;
+	unsigned int bucket = 0;
+	while( microseconds && bucket < LATENCY_BUCKETS - 1 )
+	{
+		microseconds >>= 1;
+		bucket++;
+	}
+	latency->buckets[bucket]++;
+}
+
+
+void latency_print( const struct latency * latency, const char * name )
+{
+	if( !latency->count )
+	{
+		printf( "%s: no samples\n", name );
+		return;
+	}
+	printf( "%s: %llu samples, min %.1f us, avg %.1f us, max %.1f us\n", name,
+		(unsigned long long)latency->count,
+		latency->min / 1000.0,
+		(double)latency->sum / latency->count / 1000.0,
+		latency->max / 1000.0 );
+	for( unsigned int i = 0; i < LATENCY_BUCKETS; ++i )
+	{
+		if( !latency->buckets[i] )
+			continue;
+		if( i == LATENCY_BUCKETS - 1 )
+			printf( "  >= %8lu us: %llu\n", 1ul << ( i - 1 ), (unsigned long long)latency->buckets[i] );
+		else
+			printf( "  < %9lu us: %llu\n", 1ul << i, (unsigned long long)latency->buckets[i] );
+	}
+}
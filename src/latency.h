@@ -0,0 +1,32 @@
+#ifndef _LATENCY_H_
+#define _LATENCY_H_
+
+
+#include <stdint.h>
+
+
+#define LATENCY_BUCKETS 24 // powers of two microseconds, the last one collects everything above
+
+
+// Latency statistics - fixed size, no allocation when adding samples.
+struct latency
+{
+	uint64_t count;
+	int64_t min;  // in nanoseconds
+	int64_t max;  // in nanoseconds
+	int64_t sum;  // in nanoseconds
+	uint64_t buckets[LATENCY_BUCKETS];
+};
+
+
+// CLOCK_MONOTONIC in nanoseconds
+int64_t latency_now( void );
+
+void latency_reset( struct latency * latency );
+void latency_add( struct latency * latency, int64_t nanoseconds );
+
+// prints count, min/avg/max and a histogram to stdout
+void latency_print( const struct latency * latency, const char * name );
+
+
+#endif
@@ -6,92 +6,343 @@
 
 #include <unistd.h>
 #include <getopt.h>
-#include <libusb.h>
+#include <time.h>
 
+#include "servusb.h"
+#include "trace.h"
+#include "timing.h"
+#ifdef SERVUSB_HAVE_RECORDER
+#include "recorder.h"
+#endif
+#ifdef SERVUSB_HAVE_EVDEV
+#include "bridge.h"
+#endif
+#ifdef SERVUSB_HAVE_SHM
+#include "shmserver.h"
+#include "servusb_shm.h"
+#endif
+#ifdef SERVUSB_HAVE_UDP
+#include "udpserver.h"
+#endif
+#ifdef SERVUSB_HAVE_RTLOOP
+#include "rtloop.h"
+#include "player.h"
+#endif
+#ifdef SERVUSB_HAVE_KINEMATICS
+#include "kinematics.h"
+#include "latency.h"
+#endif
 
-#define SERVUSB_VENDOR_ID  0x16c0
-#define SERVUSB_PRODUCT_ID 0x05df
 
-#define SERVUSB_CONFIGURATION 1
-#define SERVUSB_INTERFACE 0
-
-#define SERVUSB_REPORT_ID_CONTROL 0x01
-#define SERVUSB_REPORT_ID_DATA    0x02
+static uint16_t get_uint16( const unsigned char * data )
+{
+	return data[0] | data[1] << 8;
+}
 
-#define SERVUSB_CONTROL_ENABLE_BIT 0x01
 
+static uint32_t get_uint32( const unsigned char * data )
+{
+	return get_uint16( data ) | (uint32_t)get_uint16( data + 2 ) << 16;
+}
 
-#define USBRQ_HID_GET_REPORT    0x01
-#define USBRQ_HID_SET_REPORT    0x09
 
-#define USB_HID_REPORT_TYPE_INPUT   1
-#define USB_HID_REPORT_TYPE_OUTPUT  2
-#define USB_HID_REPORT_TYPE_FEATURE 3
+// reads and prints the firmware counters (see struct stats in firmware/stats.h)
+static int print_stats( struct servusb * servusb )
+{
+	unsigned char data[21] = { SERVUSB_REPORT_ID_STATS };
+	int transferred = servusb_getFeature( servusb, data, sizeof(data) );
+	if( transferred < 0 )
+		return transferred;
+	if( transferred < (int)sizeof(data) )
+		return LIBUSB_ERROR_NOT_SUPPORTED; // firmware without the report
+	printf( "SET_REPORT requests:  %u\n", get_uint16( data + 1 ) );
+	printf( "GET_REPORT requests:  %u\n", get_uint16( data + 3 ) );
+	printf( "Stalled writes:       %u\n", get_uint16( data + 5 ) );
+	printf( "Unknown report IDs:   %u\n", get_uint16( data + 7 ) );
+	printf( "Servo frames:         %u\n", get_uint32( data + 9 ) );
+	printf( "Late pulse edges:     %u\n", get_uint16( data + 13 ) );
+	printf( "Overrun frames:       %u\n", get_uint16( data + 15 ) );
+	printf( "Main loop iterations: %u\n", get_uint32( data + 17 ) );
+	return transferred;
+}
 
 
-static int usb_setFeature( libusb_device_handle * device, unsigned char * data, uint16_t length )
+// reads, prints and clears the pulse jitter histogram
+static int print_jitter( struct servusb * servusb )
 {
-	int transferred = libusb_control_transfer( device,
-		LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_INTERFACE, // request type
-		USBRQ_HID_SET_REPORT,                                                        // request
-		USB_HID_REPORT_TYPE_FEATURE << 8 | data[0],                                 // value report type|id
-		0,                                                                         // index
-		data, length,
-		1000
-		);
+	static const char * bins[] = { "0", "1", "2", "3", "4-7", "8-15", "16-31", "32+" };
+	struct servusb_jitter jitter;
+	int transferred = servusb_getJitter( servusb, &jitter );
 	if( transferred < 0 )
-	{
-		fprintf( stderr, "Error: Transfer failed: %s (%d)\n", libusb_strerror(transferred), transferred );
 		return transferred;
-	}
-	if( transferred != length )
+	double tick = jitter.tickNs / 1000.0; // microseconds
+	printf( "Pulses measured:      %u%s\n", jitter.pulses, jitter.pulses == 0xffff ? " (full)" : "" );
+	for( unsigned int i = 0; i < sizeof(bins) / sizeof(bins[0]); ++i )
 	{
-		fprintf( stderr, "Error: Incomplete transfer - sent %d bytes but expected %d\n", transferred, length );
-		return LIBUSB_ERROR_IO;
+		unsigned int count = jitter.histogram[i];
+		printf( "Off by %5s ticks:    %u (%.1f%%)\n", bins[i], count, jitter.pulses ? 100.0 * count / jitter.pulses : 0.0 );
 	}
+	printf( "Tick:                 %.2f us\n", tick );
+	printf( "Shortest:             %.1f us\n", jitter.shortest * tick );
+	printf( "Longest:              %+.1f us\n", jitter.longest * tick );
 	return transferred;
 }
 
 
+#define STATUS_MAX_DEVICES 64
+
+
+static void print_positions( const uint8_t * positions, unsigned int count )
+{
+	for( unsigned int i = 0; i < count; ++i )
+		printf( i ? ",%u" : "%u", positions[i] );
+}
+
+
+// one line per matching device, each read with a single transfer
+static int print_status( const struct servusb_transport * transport, int bus, int dev )
+{
+	struct servusb_address addresses[STATUS_MAX_DEVICES];
+	int found = servusb_list( transport, bus, dev, addresses, STATUS_MAX_DEVICES );
+	if( found < 0 )
+		return found;
+	if( !found )
+	{
+		fprintf( stderr, "Error: Could not find ServUSB!\n" );
+		return LIBUSB_ERROR_NOT_FOUND;
+	}
+
+	int failed = 0;
+	for( int i = 0; i < found; ++i )
+	{
+		struct servusb * servusb;
+		int err = servusb_open( &servusb, transport, addresses[i].bus, addresses[i].dev );
+		if( err )
+		{
+			failed = err;
+			continue;
+		}
+		struct servusb_status status;
+		err = servusb_getStatus( servusb, &status );
+		servusb_close( servusb );
+		if( err < 0 )
+		{
+			fprintf( stderr, "Error: Failed to read the status of servo on bus %d, device %d, the firmware may be too old!\n", addresses[i].bus, addresses[i].dev );
+			failed = err;
+			continue;
+		}
+		printf( "Bus %d, device %d: %s, positions ", addresses[i].bus, addresses[i].dev, status.enabled ? "enabled" : "disabled" );
+		print_positions( status.commanded, status.channels );
+		if( memcmp( status.commanded, status.pulsed, status.channels ) )
+		{
+			printf( " (pulsing " );
+			print_positions( status.pulsed, status.channels );
+			printf( ")" );
+		}
+		if( status.scheduled )
+			printf( ", %u scheduled", status.scheduled );
+		printf( ", firmware %x.%02x, %u %s at %.2f MHz%s%s, %.1f ms frames of %u-%u us\n",
+			status.version >> 8, status.version & 0xff,
+			status.channels, status.flags & SERVUSB_STATUS_PPM ? "PPM channels" : "servos",
+			status.clockKHz / 1000.0, status.flags & SERVUSB_STATUS_RC_OSCILLATOR ? " (RC)" : "",
+			status.flags & SERVUSB_STATUS_COUNT_SOF ? " counting frames" : "",
+			status.frameUs / 1000.0, status.minUs, status.maxUs );
+	}
+	return failed;
+}
+
+
+#ifdef SERVUSB_HAVE_KINEMATICS
+// Where the servos start from: at their last setpoint if they were enabled, otherwise
+// nobody knows and they are assumed at the end of their range farthest from the target.
+static struct kinematics * wait_begin( struct servusb * servusb, const struct kinematics_type * type, const uint8_t * targets, unsigned int count )
+{
+	struct kinematics * kinematics = kinematics_create( count, type );
+	if( !kinematics )
+		return NULL;
+	unsigned char control[2] = { SERVUSB_REPORT_ID_CONTROL };
+	unsigned char data[1 + SERVUSB_MAX_CHANNELS] = { SERVUSB_REPORT_ID_DATA };
+	bool known = servusb_getFeature( servusb, control, sizeof(control) ) >= 2 && ( control[1] & SERVUSB_CONTROL_ENABLE_BIT )
+		&& servusb_getFeature( servusb, data, 1 + count ) >= (int)( 1 + count );
+	for( unsigned int i = 0; i < count; ++i )
+		kinematics_reset( kinematics, i, known ? data[1 + i] : targets[i] < 128 ? 255 : 0 );
+	return kinematics;
+}
+
+
+// sleeps until the servos got to the setpoints sent at the given time
+static void wait_arrival( struct kinematics * kinematics, int64_t sent, const uint8_t * targets, unsigned int count )
+{
+	for( unsigned int i = 0; i < count; ++i )
+		kinematics_command( kinematics, i, sent, targets[i] );
+	int64_t settled = kinematics_getSettled( kinematics );
+	int64_t remaining = settled - latency_now();
+	printf( "Waiting %.0f ms for the servos to arrive.\n", remaining > 0 ? remaining / 1e6 : 0.0 );
+	if( remaining > 0 )
+	{
+		struct timespec pause = { remaining / 1000000000, remaining % 1000000000 };
+		nanosleep( &pause, NULL );
+	}
+	kinematics_destroy( kinematics );
+}
+#endif
+
+
 struct arguments
 {
 	int bus;
 	int dev;
 	int enable;
-	unsigned int position;
+	int stats;
+	bool jitter;           // print and clear the pulse jitter histogram
+	bool status;           // print the status of all matching devices
+	int positions[SERVUSB_MAX_CHANNELS];
+	unsigned int channels; // number of positions given
+	int at;                // frames from now to apply the positions in, 0 for right away
+	bool powerOn;          // store enable/disable as the power-on state instead
+#ifdef SERVUSB_HAVE_KINEMATICS
+	const struct kinematics_type * wait; // servo type to wait for after moving, NULL for not waiting
+	struct kinematics_type waitCustom;
+#endif
+	const struct servusb_transport * transport;
+#ifdef SERVUSB_HAVE_EVDEV
+	struct bridge_config bridge;
+#endif
+#ifdef SERVUSB_HAVE_SHM
+	struct shmserver_config shm;
+	int lane;              // with --shm, the lane to write into a running server instead of serving, -1 for serving
+	int lease;             // of the lane in milliseconds, -1 until released
+#endif
+#ifdef SERVUSB_HAVE_UDP
+	struct udpserver_config udp;
+#endif
+#ifdef SERVUSB_HAVE_RTLOOP
+	struct rtloop_config loop;
+	const char * animation;
+#endif
 };
 
 
+static void flush_trace( void )
+{
+	trace_flush();
+}
+
+
+static int64_t runBegin = 0;
+static const char * timingFile = NULL; // runs so far, for --timing=file
+
+
+static void print_timing( void )
+{
+	timing_print( runBegin, timingFile );
+}
+
+
+#ifdef SERVUSB_HAVE_KINEMATICS
+#define TRANSPORTS "libusb|hidraw|emulated"
+#else
+#define TRANSPORTS "libusb|hidraw"
+#endif
+
 void print_usage( int argc, char ** argv )
 {
 	printf
 	(
 		"This is the ServUSB command line interface - ServUSB is a servo for the Universal Serial Bus.\n"
-		"Usage: %s [-d] [--disable] [-e position] [--enable=position] [-s [[bus]:][devnum]] [--select=[[bus]:][devnum]]\n",
+		"Usage: %s [-d] [--disable] [-e position[,position...]] [--enable=position[,position...]] [-i] [--stats] [-j] [--jitter] [-S] [--status] [-s [[bus]:][devnum]] [--select=[[bus]:][devnum]]\n"
+		"          [-F frames] [--at=frames] [-p] [--power-on] [-t " TRANSPORTS "] [--transport=" TRANSPORTS "] [-T file[.json]] [--trace=file[.json]]\n"
+		"          [-M[file]] [--timing[=file]]\n"
+#ifdef SERVUSB_HAVE_EVDEV
+		"          [-b /dev/input/eventN] [--bridge=/dev/input/eventN] [-a axis] [--axis=axis] [-r min:max] [--range=min:max]\n"
+#endif
+#ifdef SERVUSB_HAVE_SHM
+		"          [-m name] [--shm=name] [-f] [--fixed-rate] [-L lane[,milliseconds]] [--lane=lane[,milliseconds]]\n"
+#endif
+#ifdef SERVUSB_HAVE_UDP
+		"          [-u [host:]port] [--udp=[host:]port]\n"
+#endif
+#ifdef SERVUSB_HAVE_RECORDER
+		"          [-R file] [--record=file]\n"
+#endif
+#ifdef SERVUSB_HAVE_KINEMATICS
+		"          [-w standard|micro|digital|rate,deadband[,delay]] [--wait=standard|micro|digital|rate,deadband[,delay]]\n"
+#endif
+#ifdef SERVUSB_HAVE_RTLOOP
+		"          [-A file] [--animate=file]\n"
+		"          [-n microseconds] [--interval=microseconds] [-P priority] [--priority=priority] [-c cpu] [--cpu=cpu] [-l] [--mlock]\n"
+#endif
+		,
 		argv[0]
 	);
 }
 
 int main( int argc, char ** argv )
 {
+	runBegin = latency_now();
+	bool timing = false;
+
 	// argument parsing
 	struct arguments arguments = {0};
 	arguments.bus = -1;
 	arguments.dev = -1;
 	arguments.enable = -1;
-	arguments.position = 127;
+	arguments.positions[0] = 127;
+	arguments.channels = 1;
+	arguments.transport = &servusb_transport_libusb;
+#ifdef SERVUSB_HAVE_SHM
+	arguments.lane = -1;
+	arguments.lease = -1;
+#endif
+#ifdef SERVUSB_HAVE_RTLOOP
+	arguments.loop.cpu = -1;
+#endif
 
 	static struct option long_options[] =
 	{
-		{ "disable", no_argument,       0, 'd' },
-		{ "enable",  required_argument, 0, 'e' },
-		{ "select",  required_argument, 0, 's' },
-		{ 0,         0,                 0, 0   }
+		{ "disable",   no_argument,       0, 'd' },
+		{ "enable",    required_argument, 0, 'e' },
+		{ "stats",     no_argument,       0, 'i' },
+		{ "jitter",    no_argument,       0, 'j' },
+		{ "status",    no_argument,       0, 'S' },
+		{ "select",    required_argument, 0, 's' },
+		{ "at",        required_argument, 0, 'F' },
+		{ "power-on",  no_argument,       0, 'p' },
+		{ "transport", required_argument, 0, 't' },
+		{ "trace",     required_argument, 0, 'T' },
+		{ "timing",    optional_argument, 0, 'M' },
+#ifdef SERVUSB_HAVE_EVDEV
+		{ "bridge",    required_argument, 0, 'b' },
+		{ "axis",      required_argument, 0, 'a' },
+		{ "range",     required_argument, 0, 'r' },
+#endif
+#ifdef SERVUSB_HAVE_SHM
+		{ "shm",       required_argument, 0, 'm' },
+		{ "fixed-rate", no_argument,      0, 'f' },
+		{ "lane",      required_argument, 0, 'L' },
+#endif
+#ifdef SERVUSB_HAVE_UDP
+		{ "udp",       required_argument, 0, 'u' },
+#endif
+#ifdef SERVUSB_HAVE_RECORDER
+		{ "record",    required_argument, 0, 'R' },
+#endif
+#ifdef SERVUSB_HAVE_KINEMATICS
+		{ "wait",      required_argument, 0, 'w' },
+#endif
+#ifdef SERVUSB_HAVE_RTLOOP
+		{ "animate",   required_argument, 0, 'A' },
+		{ "interval",  required_argument, 0, 'n' },
+		{ "priority",  required_argument, 0, 'P' },
+		{ "cpu",       required_argument, 0, 'c' },
+		{ "mlock",     no_argument,       0, 'l' },
+#endif
+		{ 0,           0,                 0, 0   }
 	};
 
 	int opt = 0;
 	int option_index = 0;
-	while( ( opt = getopt_long( argc, argv, "de:s:", long_options, &option_index ) ) != -1 )
+	while( ( opt = getopt_long( argc, argv, "de:ijSs:F:pt:T:M::b:a:r:m:fL:u:R:w:A:n:P:c:l", long_options, &option_index ) ) != -1 )
 	{
 		switch( opt )
 		{
@@ -99,9 +350,30 @@ int main( int argc, char ** argv )
 			arguments.enable = 0;
 			break;
 		case 'e':
-			arguments.position = atoi( optarg );
+		{ // one position per servo of the device
+			char * next = optarg;
+			arguments.channels = 0;
+			do
+			{
+				if( arguments.channels == SERVUSB_MAX_CHANNELS )
+				{
+					fprintf( stderr, "At most %d servo positions!\n", SERVUSB_MAX_CHANNELS );
+					return EXIT_FAILURE;
+				}
+				arguments.positions[arguments.channels++] = strtol( next, &next, 10 );
+			} while( *next++ == ',' );
 			arguments.enable = 1;
 			break;
+		}
+		case 'i':
+			arguments.stats = 1;
+			break;
+		case 'j':
+			arguments.jitter = true;
+			break;
+		case 'S':
+			arguments.status = true;
+			break;
 		case 's':
 		{ // shamelessly stolen from usbutil's lsusb.c ;)
 			char * cp;
@@ -119,136 +391,350 @@ int main( int argc, char ** argv )
 			}
 			break;
 		}
+		case 'F':
+			arguments.at = atoi( optarg );
+			if( arguments.at < 1 || arguments.at > 30000 )
+			{
+				fprintf( stderr, "Frames need to be within 1-30000!\n" );
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'p':
+			arguments.powerOn = true;
+			break;
+		case 't':
+			arguments.transport = servusb_findTransport( optarg );
+			if( !arguments.transport )
+			{
+				fprintf( stderr, "Unknown transport \"%s\"!\n", optarg );
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'T':
+			if( trace_enable( optarg, 65536 ) )
+				return EXIT_FAILURE;
+			atexit( flush_trace );
+			break;
+		case 'M':
+			timing = true;
+			timingFile = optarg;
+			break;
+#ifdef SERVUSB_HAVE_EVDEV
+		case 'b':
+			arguments.bridge.device = optarg;
+			break;
+		case 'a':
+			arguments.bridge.axis = strtoul( optarg, NULL, 0 );
+			break;
+		case 'r':
+			if( sscanf( optarg, "%d:%d", &arguments.bridge.min, &arguments.bridge.max ) != 2 )
+			{
+				fprintf( stderr, "Range needs to be given as min:max!\n" );
+				return EXIT_FAILURE;
+			}
+			arguments.bridge.haveRange = true;
+			break;
+#endif
+#ifdef SERVUSB_HAVE_SHM
+		case 'm':
+			arguments.shm.name = optarg;
+			break;
+		case 'f':
+			arguments.shm.fixedRate = true;
+			break;
+		case 'L':
+		{ // lane[,lease]
+			char * next;
+			arguments.lane = strtol( optarg, &next, 10 );
+			if( *next == ',' )
+				arguments.lease = strtol( next + 1, &next, 10 );
+			if( *next || arguments.lane < 0 || arguments.lane >= SERVUSB_SHM_LANES || arguments.lease < -1 )
+			{
+				fprintf( stderr, "Lane needs to be within 0-%d, optionally followed by a lease in milliseconds!\n", SERVUSB_SHM_LANES - 1 );
+				return EXIT_FAILURE;
+			}
+			break;
+		}
+#endif
+#ifdef SERVUSB_HAVE_UDP
+		case 'u':
+		{ // [host:]port, an IPv6 host in brackets
+			char * colon = strrchr( optarg, ':' );
+			arguments.udp.port = optarg;
+			if( colon )
+			{
+				*colon = 0;
+				arguments.udp.port = colon + 1;
+				arguments.udp.host = optarg;
+				if( *optarg == '[' && colon[-1] == ']' )
+				{
+					colon[-1] = 0;
+					arguments.udp.host = optarg + 1;
+				}
+			}
+			break;
+		}
+#endif
+#ifdef SERVUSB_HAVE_RECORDER
+		case 'R':
+			if( recorder_open( optarg, 65536 ) )
+				return EXIT_FAILURE;
+			atexit( recorder_close );
+			break;
+#endif
+#ifdef SERVUSB_HAVE_KINEMATICS
+		case 'w':
+			arguments.wait = kinematics_findType( optarg, &arguments.waitCustom );
+			if( !arguments.wait )
+			{
+				fprintf( stderr, "Unknown servo type \"%s\", give a name or slew rate and deadband in positions!\n", optarg );
+				return EXIT_FAILURE;
+			}
+			break;
+#endif
+#ifdef SERVUSB_HAVE_RTLOOP
+		case 'A':
+			arguments.animation = optarg;
+			break;
+		case 'n':
+			arguments.loop.period = strtoul( optarg, NULL, 10 );
+			break;
+		case 'P':
+			arguments.loop.priority = atoi( optarg );
+			break;
+		case 'c':
+			arguments.loop.cpu = atoi( optarg );
+			break;
+		case 'l':
+			arguments.loop.lock = true;
+			break;
+#endif
 		default:
 			print_usage( argc, argv );
 			return EXIT_FAILURE;
 		}
 	}
-	if( arguments.enable < 0 )
-	{
-		fprintf( stderr, "Need to either to enable or disable the servo!\n" );
-		return EXIT_FAILURE;
+	if( timing )
+	{ // the phases are what the trace recorded, printed on the way out
+		if( !trace_enabled && trace_enable( NULL, 65536 ) )
+			return EXIT_FAILURE;
+		atexit( print_timing );
 	}
-	if( arguments.position < 0 || arguments.position > 255 )
+	bool bridge = false;
+#ifdef SERVUSB_HAVE_EVDEV
+	bridge = arguments.bridge.device;
+#endif
+	bool shm = false;
+#ifdef SERVUSB_HAVE_SHM
+	shm = arguments.shm.name;
+	arguments.shm.loop = arguments.loop;
+	if( !arguments.shm.loop.period ) // fixed rate follows the servo's 20 ms frame, otherwise check for changes every millisecond
+		arguments.shm.loop.period = arguments.shm.fixedRate ? 20000 : 1000;
+#endif
+	bool udp = false;
+#ifdef SERVUSB_HAVE_UDP
+	udp = arguments.udp.port;
+#endif
+	bool animation = false;
+#ifdef SERVUSB_HAVE_RTLOOP
+	animation = arguments.animation;
+	if( !arguments.loop.period ) // one update per servo frame
+		arguments.loop.period = 20000;
+#endif
+#ifdef SERVUSB_HAVE_SHM
+	if( arguments.lane >= 0 && ( !shm || arguments.stats || arguments.jitter || arguments.status || arguments.powerOn || arguments.at || arguments.channels > 1
+		|| ( arguments.enable < 0 && arguments.lease ) ) )
 	{
-		fprintf( stderr, "Servo position out of range (0-255)!\n" );
+		fprintf( stderr, "A lane takes --shm and a single position with --enable or --disable, or a lease of 0 to release it!\n" );
 		return EXIT_FAILURE;
 	}
-
-	// init libusb
-	int err;
-	libusb_context * ctx;
-	err = libusb_init( &ctx );
-	if( err )
+#endif
+	if( arguments.enable < 0 && !arguments.stats && !arguments.jitter && !arguments.status && !bridge && !shm && !udp && !animation )
 	{
-		fprintf( stderr, "Error: Unable to initialize libusb: %s (%d)\n", libusb_strerror(err), err );
+		fprintf( stderr, "Need to either to enable or disable the servo or to read its statistics, jitter or status!\n" );
 		return EXIT_FAILURE;
 	}
-
-	// get USB device
-	libusb_device_handle * device = NULL;
-	libusb_device ** list;
-	ssize_t num_devs = libusb_get_device_list( ctx, &list );
-	if( num_devs < 0 )
+	if( arguments.powerOn && ( arguments.enable < 0 || arguments.at ) )
 	{
-		err = num_devs;
-		fprintf( stderr, "Error: Could not get any devices: %s (%d)\n", libusb_strerror(err), err );
-		libusb_exit( ctx );
+		fprintf( stderr, "The power-on state needs to be given with --enable or --disable!\n" );
 		return EXIT_FAILURE;
 	}
-
-	for( int i = 0; i < num_devs; ++i )
+	for( unsigned int i = 0; i < arguments.channels; ++i )
 	{
-		libusb_device * dev = list[i];
-		uint8_t bnum = libusb_get_bus_number( dev );
-		uint8_t dnum = libusb_get_device_address( dev );
-
-		if( (arguments.bus != -1 && arguments.bus != bnum) || (arguments.dev != -1 && arguments.dev != dnum))
-			continue; // bus and/or device number given and it doesn't match - continue with next device
-
-		struct libusb_device_descriptor desc;
-		libusb_get_device_descriptor( dev, &desc );
-		if( (desc.idVendor != SERVUSB_VENDOR_ID) || (desc.idProduct != SERVUSB_PRODUCT_ID) )
-			continue; // device is not ServUSB - continue with next device
-
-		arguments.bus = bnum;
-		arguments.dev = dnum;
-		err = libusb_open( dev, &device );
-		if( err )
+		if( arguments.positions[i] < 0 || arguments.positions[i] > 255 )
 		{
-			fprintf( stderr, "Error: Unable to open usb device: %s (%d)\n", libusb_strerror(err), err );
-			libusb_free_device_list( list, 0 );
-			libusb_exit( ctx );
+			fprintf( stderr, "Servo position out of range (0-255)!\n" );
 			return EXIT_FAILURE;
 		}
-		break;
 	}
-	libusb_free_device_list( list, 0 );
-	if( !device )
-	{
-		if( arguments.dev < 0 && arguments.bus < 0 )
-			fprintf( stderr, "Error: Could not find ServUSB!\n" );
+
+	if( arguments.status )
+	{ // polls all matching devices
+		if( print_status( arguments.transport, arguments.bus, arguments.dev ) < 0 )
+			return EXIT_FAILURE;
+		return EXIT_SUCCESS;
+	}
+#ifdef SERVUSB_HAVE_SHM
+	if( shm && arguments.lane >= 0 )
+	{ // arbitrated by a running server instead of whoever comes last
+		bool enabled = arguments.enable > 0;
+		int written = shmserver_submit( arguments.shm.name, arguments.bus, arguments.dev, arguments.lane, arguments.lease, arguments.positions[0], enabled );
+		if( written < 0 )
+			return EXIT_FAILURE;
+		if( !arguments.lease )
+			printf( "Released lane %d of %d servos.\n", arguments.lane, written );
+		else if( arguments.lease < 0 )
+			printf( "Lane %d of %d servos %s at position %d until released.\n", arguments.lane, written, enabled ? "enabled" : "disabled", arguments.positions[0] );
 		else
-			fprintf( stderr, "Error: Could not find ServUSB on bus %d device %d!\n", arguments.bus, arguments.dev );
-		libusb_exit( ctx );
-		return EXIT_FAILURE;
+			printf( "Lane %d of %d servos %s at position %d for %d ms.\n", arguments.lane, written, enabled ? "enabled" : "disabled", arguments.positions[0], arguments.lease );
+		return EXIT_SUCCESS;
 	}
-
-	libusb_detach_kernel_driver( device, SERVUSB_INTERFACE );
-	err = libusb_set_configuration( device, SERVUSB_CONFIGURATION );
-	if( err )
-	{
-		fprintf( stderr, "Warning: Could not set configuration: %s (%d)\n", libusb_strerror(err), err );
+	if( shm )
+	{ // serves all matching devices
+		if( shmserver_run( arguments.transport, arguments.bus, arguments.dev, &arguments.shm ) < 0 )
+			return EXIT_FAILURE;
+		return EXIT_SUCCESS;
 	}
-	err = libusb_claim_interface( device, SERVUSB_INTERFACE );
-	if( err )
-	{
-		fprintf( stderr, "Warning: Could not claim interface: %s (%d)\n", libusb_strerror(err), err );
+#endif
+#ifdef SERVUSB_HAVE_UDP
+	if( udp )
+	{ // device n of the datagrams is the n-th matching device
+		if( udpserver_run( arguments.transport, arguments.bus, arguments.dev, &arguments.udp ) < 0 )
+			return EXIT_FAILURE;
+		return EXIT_SUCCESS;
+	}
+#endif
+#ifdef SERVUSB_HAVE_RTLOOP
+	if( animation )
+	{ // channel n drives the n-th matching device
+		if( player_run( arguments.transport, arguments.bus, arguments.dev, arguments.animation, &arguments.loop ) < 0 )
+			return EXIT_FAILURE;
+		return EXIT_SUCCESS;
 	}
+#endif
+
+	// get USB device
+	struct servusb * servusb;
+	if( servusb_open( &servusb, arguments.transport, arguments.bus, arguments.dev ) )
+		return EXIT_FAILURE;
+	arguments.bus = servusb->bus;
+	arguments.dev = servusb->dev;
 
 	// execute command and exit
 	int transferred;
-	if( arguments.enable )
+	if( arguments.stats )
 	{
-		printf( "Enabling servo on bus %d, device %d and moving into position %d.\n", arguments.bus, arguments.dev, arguments.position );
+		printf( "Statistics of servo on bus %d, device %d:\n", arguments.bus, arguments.dev );
+		transferred = print_stats( servusb );
+		if( transferred < 0 )
 		{
-			unsigned char data[2] = { SERVUSB_REPORT_ID_DATA, arguments.position };
-			transferred = usb_setFeature( device, data, sizeof(data) );
-			if( transferred < 0 )
-			{
-				fprintf( stderr, "Error: Failed to set position!\n" );
-				libusb_close( device );
-				libusb_exit( ctx );
-				return EXIT_FAILURE;
-			}
+			fprintf( stderr, "Error: Failed to read statistics!\n" );
+			servusb_close( servusb );
+			return EXIT_FAILURE;
+		}
+	}
+	if( arguments.jitter )
+	{
+		printf( "Pulse jitter of servo on bus %d, device %d since the last reading:\n", arguments.bus, arguments.dev );
+		transferred = print_jitter( servusb );
+		if( transferred < 0 )
+		{
+			fprintf( stderr, "Error: Failed to read the pulse jitter, the firmware may be too old!\n" );
+			servusb_close( servusb );
+			return EXIT_FAILURE;
 		}
+	}
+	if( arguments.powerOn )
+	{ // kept by the device, the servos don't move now
+		uint8_t positions[SERVUSB_MAX_CHANNELS];
+		for( unsigned int i = 0; i < arguments.channels; ++i )
+			positions[i] = arguments.positions[i];
+		bool enabled = arguments.enable > 0;
+		printf( "Servo on bus %d, device %d powers up %s.\n", arguments.bus, arguments.dev, enabled ? "enabled" : "disabled" );
+		transferred = servusb_setPowerOn( servusb, enabled, positions, enabled ? arguments.channels : 0 );
+		bool stored;
+		uint8_t read[SERVUSB_MAX_CHANNELS];
+		if( transferred >= 0 )
+			transferred = servusb_getPowerOn( servusb, &stored, read, enabled ? arguments.channels : 0 );
+		if( transferred >= 0 && ( stored != enabled || ( enabled && memcmp( read, positions, arguments.channels ) ) ) )
+			transferred = LIBUSB_ERROR_IO;
+		if( transferred < 0 )
 		{
-			unsigned char data[2] = { SERVUSB_REPORT_ID_CONTROL, SERVUSB_CONTROL_ENABLE_BIT };
-			transferred = usb_setFeature( device, data, sizeof(data) );
-			if( transferred < 0 )
+			fprintf( stderr, "Error: Failed to store the power-on state, the firmware may be too old!\n" );
+			servusb_close( servusb );
+			return EXIT_FAILURE;
+		}
+	} else if( arguments.enable > 0 ) {
+		printf( "Enabling servo on bus %d, device %d and moving into position %d", arguments.bus, arguments.dev, arguments.positions[0] );
+		uint8_t positions[SERVUSB_MAX_CHANNELS];
+		for( unsigned int i = 0; i < arguments.channels; ++i )
+		{
+			if( i )
+				printf( ",%d", arguments.positions[i] );
+			positions[i] = arguments.positions[i];
+		}
+#ifdef SERVUSB_HAVE_KINEMATICS
+		struct kinematics * kinematics = arguments.wait ? wait_begin( servusb, arguments.wait, positions, arguments.channels ) : NULL;
+#endif
+		if( arguments.at )
+		{ // the device applies them in a frame of its own clock
+			struct servusb_frame frame;
+			transferred = servusb_getFrame( servusb, &frame );
+			if( transferred >= 0 )
 			{
-				fprintf( stderr, "Error: Failed to enable servo!\n" );
-				libusb_close( device );
-				libusb_exit( ctx );
-				return EXIT_FAILURE;
+				uint16_t due = frame.frame + arguments.at;
+				printf( " in frame %u (now %u, last servo update in %u).\n", due, frame.frame, frame.update );
+				transferred = servusb_schedulePositions( servusb, due, positions, arguments.channels );
+			} else {
+				printf( ".\n" );
+				fprintf( stderr, "Error: Failed to read the frame number, the firmware needs to be built with SOF=1!\n" );
 			}
+		} else {
+			printf( ".\n" );
+			if( arguments.channels > 1 )
+				transferred = servusb_setPositions( servusb, positions, arguments.channels );
+			else // the report of the single servo firmware
+				transferred = servusb_setPosition( servusb, positions[0] );
+		}
+		if( transferred < 0 )
+		{
+			fprintf( stderr, "Error: Failed to set position!\n" );
+			servusb_close( servusb );
+			return EXIT_FAILURE;
+		}
+		transferred = servusb_setEnabled( servusb, true );
+		if( transferred < 0 )
+		{
+			fprintf( stderr, "Error: Failed to enable servo!\n" );
+			servusb_close( servusb );
+			return EXIT_FAILURE;
 		}
-	} else {
+#ifdef SERVUSB_HAVE_KINEMATICS
+		if( kinematics ) // a scheduled setpoint waits for its frame, frames are milliseconds
+			wait_arrival( kinematics, latency_now() + arguments.at * 1000000ll, positions, arguments.channels );
+#endif
+	} else if( arguments.enable == 0 ) {
 		printf( "Disabling servo on bus %d, device %d.\n", arguments.bus, arguments.dev );
+		transferred = servusb_setEnabled( servusb, false );
+		if( transferred < 0 )
 		{
-			unsigned char data[2] = { SERVUSB_REPORT_ID_CONTROL, 0x00 };
-			transferred = usb_setFeature( device, data, sizeof(data) );
-			if( transferred < 0 )
-			{
-				fprintf( stderr, "Error: Failed to disable servo!\n" );
-				libusb_close( device );
-				libusb_exit( ctx );
-				return EXIT_FAILURE;
-			}
+			fprintf( stderr, "Error: Failed to disable servo!\n" );
+			servusb_close( servusb );
+			return EXIT_FAILURE;
+		}
+	}
+#ifdef SERVUSB_HAVE_EVDEV
+	if( bridge )
+	{
+		if( bridge_run( servusb, &arguments.bridge ) < 0 )
+		{
+			fprintf( stderr, "Error: Bridge failed!\n" );
+			servusb_close( servusb );
+			return EXIT_FAILURE;
 		}
 	}
+#endif
 
-	libusb_close( device );
-	libusb_exit( ctx );
+	servusb_close( servusb );
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,119 @@
+#define _DEFAULT_SOURCE
+
+#include "player.h"
+#include "animation.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+
+
+#define PLAYER_MAX_DEVICES 64
+
+
+struct player
+{
+	struct animation * animation;
+	struct servusb * devices[PLAYER_MAX_DEVICES];
+	int sent[PLAYER_MAX_DEVICES]; // last position sent, -1 before the first (and for servos without keyframes)
+	unsigned int count;
+	int64_t start;
+	float duration;
+	int running;
+	int err;
+};
+
+
+static int * stopFlag;
+
+
+static void stop( int signal )
+{
+	*stopFlag = 0;
+}
+
+
+static void cycle( void * user )
+{
+	struct player * player = user;
+	float time = ( latency_now() - player->start ) / 1e9f;
+	animation_evaluate( player->animation, time );
+	const uint16_t * positions = animation_getPositions( player->animation );
+	for( unsigned int i = 0; i < player->count; ++i )
+	{
+		if( positions[i] == player->sent[i] || !animation_isAnimated( player->animation, i ) )
+			continue; // a servo the file doesn't move is left alone, not sent to 0 and enabled
+		int err = servusb_setPosition( player->devices[i], positions[i] );
+		if( err >= 0 && player->sent[i] < 0 )
+			err = servusb_setEnabled( player->devices[i], true );
+		if( err < 0 )
+		{
+			player->err = err;
+			player->running = 0;
+			return;
+		}
+		player->sent[i] = positions[i];
+	}
+	if( time > player->duration )
+		player->running = 0;
+}
+
+
+int player_run( const struct servusb_transport * transport, int bus, int dev, const char * path, const struct rtloop_config * loop )
+{
+	struct player player;
+	memset( &player, 0, sizeof(player) );
+
+	struct servusb_address addresses[PLAYER_MAX_DEVICES];
+	int found = servusb_list( transport, bus, dev, addresses, PLAYER_MAX_DEVICES );
+	if( found < 0 )
+		return found;
+
+	player.animation = animation_create( found, 255 );
+	if( !player.animation )
+		return LIBUSB_ERROR_NO_MEM;
+	if( animation_load( player.animation, path ) )
+	{
+		animation_destroy( player.animation );
+		return LIBUSB_ERROR_NOT_FOUND;
+	}
+	player.duration = animation_getDuration( player.animation );
+
+	int err = 0;
+	for( int i = 0; i < found; ++i )
+	{
+		err = servusb_open( &player.devices[i], transport, addresses[i].bus, addresses[i].dev );
+		if( err )
+			break;
+		player.sent[i] = -1;
+		player.count++;
+	}
+
+	if( !err )
+	{
+		printf( "Playing %s (%.2f s) on %u servos.\n", path, player.duration, player.count );
+		struct sigaction action;
+		memset( &action, 0, sizeof(action) );
+		action.sa_handler = stop; // no SA_RESTART - the loop checks the flag when the timer read is interrupted
+		stopFlag = &player.running;
+		sigaction( SIGINT, &action, NULL );
+		sigaction( SIGTERM, &action, NULL );
+
+		struct rtloop_stats stats;
+		player.running = 1;
+		player.start = latency_now();
+		rtloop_prepare( loop );
+		err = rtloop_run( loop, cycle, &player, &player.running, &stats );
+		if( !err )
+			err = player.err;
+		rtloop_print( &stats );
+
+		signal( SIGINT, SIG_DFL );
+		signal( SIGTERM, SIG_DFL );
+	}
+
+	for( unsigned int i = 0; i < player.count; ++i )
+		servusb_close( player.devices[i] );
+	animation_destroy( player.animation );
+	return err;
+}
@@ -0,0 +1,16 @@
+#ifndef _PLAYER_H_
+#define _PLAYER_H_
+
+
+#include "servusb.h"
+#include "rtloop.h"
+
+
+// Plays a keyframe animation file (see animation_load()) on the ServUSBs matching bus
+// and dev (-1 matches any) - channel n drives the n-th device found. The animation is
+// evaluated every period of the loop and changed positions are sent.
+// Runs until the animation ends or SIGINT/SIGTERM. Returns a negative libusb error code on failure.
+int player_run( const struct servusb_transport * transport, int bus, int dev, const char * path, const struct rtloop_config * loop );
+
+
+#endif
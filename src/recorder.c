@@ -0,0 +1,245 @@
+#define _DEFAULT_SOURCE
+
+#include "recorder.h"
+#include "servusb.h"
+#include "latency.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+
+#define RECORDER_MAX_DEVICES 32 // channels of a converted log
+
+
+bool recorder_enabled = false;
+
+static struct recorder_header * header = NULL;
+static struct recorder_entry * entries = NULL;
+static size_t mappedSize = 0;
+static uint32_t mask = 0;
+
+
+int recorder_open( const char * path, unsigned int capacity )
+{
+	if( header || !capacity || capacity > 0x80000000u )
+		return -1;
+	uint32_t size = 1;
+	while( size < capacity )
+		size <<= 1;
+
+	int fd = open( path, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+	if( fd < 0 )
+	{
+		fprintf( stderr, "Error: Unable to create recording %s!\n", path );
+		return -1;
+	}
+	// all pages are there up front, recording must not fault them in
+	int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+	flags |= MAP_POPULATE;
+#endif
+	size_t length = sizeof(struct recorder_header) + (size_t)size * sizeof(struct recorder_entry);
+	void * mapped = MAP_FAILED;
+	if( ftruncate( fd, length ) == 0 )
+		mapped = mmap( NULL, length, PROT_READ | PROT_WRITE, flags, fd, 0 );
+	close( fd );
+	if( mapped == MAP_FAILED )
+	{
+		fprintf( stderr, "Error: Unable to map recording %s!\n", path );
+		unlink( path );
+		return -1;
+	}
+
+	header = mapped;
+	entries = (struct recorder_entry *)( header + 1 );
+	mappedSize = length;
+	mask = size - 1;
+	header->magic = RECORDER_MAGIC;
+	header->version = RECORDER_VERSION;
+	header->entrySize = sizeof(struct recorder_entry);
+	header->capacity = size;
+	header->opened = latency_now();
+	recorder_enabled = true;
+	return 0;
+}
+
+
+void recorder_close( void )
+{
+	if( !header )
+		return;
+	recorder_enabled = false;
+	munmap( header, mappedSize ); // the kernel writes back the shared pages
+	header = NULL;
+	entries = NULL;
+}
+
+
+void recorder_add( const struct servusb * servusb, const unsigned char * data, uint16_t length, int result, int64_t start, int64_t end )
+{
+	if( !header || !length )
+		return;
+	uint64_t n = __atomic_fetch_add( &header->head, 1, __ATOMIC_RELAXED );
+	struct recorder_entry * entry = &entries[n & mask];
+	__atomic_store_n( &entry->sequence, 0, __ATOMIC_RELAXED ); // incomplete until the end
+	entry->time = start;
+	entry->latency = end - start > UINT32_MAX ? UINT32_MAX : end - start;
+	entry->result = result;
+	entry->bus = servusb->bus;
+	entry->dev = servusb->dev;
+	entry->report = data[0];
+	entry->length = length - 1 > RECORDER_PAYLOAD ? RECORDER_PAYLOAD : length - 1;
+	memcpy( entry->payload, data + 1, entry->length );
+	__atomic_store_n( &entry->sequence, (uint32_t)( n + 1 ), __ATOMIC_RELEASE );
+}
+
+
+int recorder_load( const char * path, struct recorder_entry ** loaded )
+{
+	FILE * file = fopen( path, "rb" );
+	if( !file )
+	{
+		fprintf( stderr, "Error: Unable to open recording %s!\n", path );
+		return -1;
+	}
+	struct recorder_header head;
+	if( fread( &head, sizeof(head), 1, file ) != 1 || head.magic != RECORDER_MAGIC || head.version != RECORDER_VERSION
+		|| head.entrySize != sizeof(struct recorder_entry) || !head.capacity || ( head.capacity & ( head.capacity - 1 ) ) )
+	{
+		fprintf( stderr, "Error: %s is no recording of this version and byte order!\n", path );
+		fclose( file );
+		return -1;
+	}
+	struct recorder_entry * ring = malloc( (size_t)head.capacity * sizeof(struct recorder_entry) );
+	if( !ring || fread( ring, sizeof(struct recorder_entry), head.capacity, file ) != head.capacity )
+	{
+		fprintf( stderr, "Error: Recording %s is truncated!\n", path );
+		free( ring );
+		fclose( file );
+		return -1;
+	}
+	fclose( file );
+
+	// oldest first - records cut short by a crash are left out
+	uint64_t first = head.head > head.capacity ? head.head - head.capacity : 0;
+	unsigned int count = head.head - first;
+	struct recorder_entry * ordered = malloc( ( count ? count : 1 ) * sizeof(struct recorder_entry) );
+	if( !ordered )
+	{
+		free( ring );
+		return -1;
+	}
+	unsigned int complete = 0;
+	for( uint64_t n = first; n < head.head; ++n )
+	{
+		const struct recorder_entry * entry = &ring[n & ( head.capacity - 1 )];
+		if( entry->sequence == (uint32_t)( n + 1 ) )
+			ordered[complete++] = *entry;
+	}
+	free( ring );
+	*loaded = ordered;
+	return complete;
+}
+
+
+struct track
+{
+	uint8_t bus;
+	uint8_t dev;
+	bool started;
+	uint8_t value;
+	double keyframe; // time of the last keyframe written
+	double seen;     // time of the last setpoint
+};
+
+
+static int compareTracks( const void * a, const void * b )
+{
+	const struct track * x = a;
+	const struct track * y = b;
+	return ( x->bus << 8 | x->dev ) - ( y->bus << 8 | y->dev );
+}
+
+
+static bool isSetpoint( const struct recorder_entry * entry )
+{
+	return entry->report == SERVUSB_REPORT_ID_DATA && entry->result >= 0 && entry->length;
+}
+
+
+static struct track * findTrack( struct track * tracks, unsigned int count, const struct recorder_entry * entry )
+{
+	for( unsigned int i = 0; i < count; ++i )
+		if( tracks[i].bus == entry->bus && tracks[i].dev == entry->dev )
+			return &tracks[i];
+	return NULL;
+}
+
+
+static void keyframe( FILE * file, struct track * tracks, struct track * track, double time, uint8_t value )
+{
+	if( time < track->keyframe )
+		time = track->keyframe; // threads may have recorded slightly out of order
+	fprintf( file, "%u %.6f %u linear\n", (unsigned int)( track - tracks ), time, value );
+	track->keyframe = time;
+}
+
+
+int recorder_writeAnimation( FILE * file, const struct recorder_entry * entries, unsigned int count )
+{
+	struct track tracks[RECORDER_MAX_DEVICES];
+	unsigned int devices = 0;
+	for( unsigned int i = 0; i < count; ++i )
+	{
+		if( !isSetpoint( &entries[i] ) || findTrack( tracks, devices, &entries[i] ) )
+			continue;
+		if( devices == RECORDER_MAX_DEVICES )
+		{
+			fprintf( stderr, "Error: Only the first %d devices can be converted!\n", RECORDER_MAX_DEVICES );
+			break;
+		}
+		memset( &tracks[devices], 0, sizeof(struct track) );
+		tracks[devices].bus = entries[i].bus;
+		tracks[devices].dev = entries[i].dev;
+		devices++;
+	}
+	if( !devices )
+	{
+		fprintf( stderr, "Error: The recording has no positions!\n" );
+		return -1;
+	}
+	qsort( tracks, devices, sizeof(struct track), compareTracks );
+
+	fprintf( file, "# channel time value - converted from a ServUSB recording, first servo of every device\n" );
+	for( unsigned int i = 0; i < devices; ++i )
+		fprintf( file, "# channel %u: bus %u, device %u\n", i, tracks[i].bus, tracks[i].dev );
+	int64_t zero = entries[0].time;
+	for( unsigned int i = 0; i < count; ++i )
+	{
+		const struct recorder_entry * entry = &entries[i];
+		struct track * track = isSetpoint( entry ) ? findTrack( tracks, devices, entry ) : NULL;
+		if( !track )
+			continue;
+		double time = ( entry->time - zero ) / 1e9;
+		uint8_t value = entry->payload[0];
+		if( !track->started )
+		{
+			keyframe( file, tracks, track, time, value );
+			track->started = true;
+		} else if( value != track->value ) {
+			// the previous setpoint holds until a millisecond before, then a ramp
+			if( time - 0.001 > track->keyframe )
+				keyframe( file, tracks, track, time - 0.001, track->value );
+			keyframe( file, tracks, track, time, value );
+		}
+		track->value = value;
+		track->seen = time;
+	}
+	for( unsigned int i = 0; i < devices; ++i )
+		if( tracks[i].seen > tracks[i].keyframe )
+			keyframe( file, tracks, &tracks[i], tracks[i].seen, tracks[i].value );
+	return 0;
+}
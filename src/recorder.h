@@ -0,0 +1,73 @@
+#ifndef _RECORDER_H_
+#define _RECORDER_H_
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+
+// Flight recorder of every report sent to a device.
+//
+// The log is a ring of fixed size records in a file which is created at its full
+// size and mapped shared, so recording takes a clock read and a few stores without
+// any allocation or system call, and whatever was recorded survives a crash of the
+// process. The file is in host byte order:
+//   struct recorder_header, then capacity times struct recorder_entry
+
+
+#define RECORDER_MAGIC   0x52465653 // "SVFR" in a little endian file
+#define RECORDER_VERSION 1
+#define RECORDER_PAYLOAD 8 // report bytes kept after the report ID, enough for all channels
+
+
+struct recorder_header
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t entrySize;
+	uint32_t capacity; // a power of two
+	uint32_t reserved;
+	uint64_t head;     // number of records ever added
+	int64_t opened;    // CLOCK_MONOTONIC ns
+};
+
+
+struct recorder_entry
+{
+	int64_t time;      // CLOCK_MONOTONIC ns when the transfer started
+	uint32_t latency;  // ns the transfer took
+	int32_t result;    // bytes transferred or a negative libusb error code
+	uint32_t sequence; // low bits of the record number plus one, written last
+	uint8_t bus;
+	uint8_t dev;
+	uint8_t report;
+	uint8_t length;    // payload bytes, the report was cut off if more were sent
+	uint8_t payload[RECORDER_PAYLOAD];
+};
+
+
+struct servusb;
+
+
+extern bool recorder_enabled;
+
+
+// Creates path with room for capacity records (rounded up to a power of two) and
+// starts recording. Returns 0 or -1 after printing the reason.
+int recorder_open( const char * path, unsigned int capacity );
+void recorder_close( void );
+
+void recorder_add( const struct servusb * servusb, const unsigned char * data, uint16_t length, int result, int64_t start, int64_t end );
+
+// Reads the complete records of a log, oldest first, into a malloc()ed array.
+// Returns the number of records or -1 after printing the reason.
+int recorder_load( const char * path, struct recorder_entry ** entries );
+
+// Writes the successful position reports as an animation file for --animate, one
+// channel per device ordered by bus and device number, with time 0 at the first
+// record. Every setpoint is held until the next one.
+int recorder_writeAnimation( FILE * file, const struct recorder_entry * entries, unsigned int count );
+
+
+#endif
@@ -0,0 +1,128 @@
+#define _GNU_SOURCE
+
+#include "rtloop.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <malloc.h>
+
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+
+#include <libusb.h>
+
+
+#define PREFAULT_STACK_SIZE ( 256 * 1024 )
+
+
+static void prefaultStack( void )
+{
+	volatile unsigned char stack[PREFAULT_STACK_SIZE];
+	for( size_t i = 0; i < sizeof(stack); i += 4096 )
+		stack[i] = 0;
+}
+
+
+void rtloop_prepare( const struct rtloop_config * config )
+{
+	if( config->lock )
+	{
+		// keep freed memory in the locked heap instead of returning it to the system
+		mallopt( M_TRIM_THRESHOLD, -1 );
+		mallopt( M_MMAP_MAX, 0 );
+		if( mlockall( MCL_CURRENT | MCL_FUTURE ) )
+			fprintf( stderr, "Warning: Could not lock memory: %s\n", strerror(errno) );
+		prefaultStack();
+	}
+	if( config->cpu >= 0 )
+	{
+		cpu_set_t cpus;
+		CPU_ZERO( &cpus );
+		CPU_SET( config->cpu, &cpus );
+		int err = pthread_setaffinity_np( pthread_self(), sizeof(cpus), &cpus );
+		if( err )
+			fprintf( stderr, "Warning: Could not pin loop to CPU %d: %s\n", config->cpu, strerror(err) );
+	}
+	if( config->priority > 0 )
+	{
+		struct sched_param param;
+		memset( &param, 0, sizeof(param) );
+		param.sched_priority = config->priority;
+		int err = pthread_setschedparam( pthread_self(), SCHED_FIFO, &param );
+		if( err )
+			fprintf( stderr, "Warning: Could not set SCHED_FIFO priority %d: %s\n", config->priority, strerror(err) );
+	}
+}
+
+
+static struct timespec fromNanoseconds( int64_t nanoseconds )
+{
+	struct timespec time;
+	time.tv_sec = nanoseconds / 1000000000;
+	time.tv_nsec = nanoseconds % 1000000000;
+	return time;
+}
+
+
+int rtloop_run( const struct rtloop_config * config, void (*cycle)( void * user ), void * user, const int * running, struct rtloop_stats * stats )
+{
+	memset( stats, 0, sizeof(*stats) );
+
+	int fd = timerfd_create( CLOCK_MONOTONIC, TFD_CLOEXEC );
+	if( fd < 0 )
+	{
+		fprintf( stderr, "Error: Unable to create timer: %s\n", strerror(errno) );
+		return LIBUSB_ERROR_OTHER;
+	}
+
+	// start on the next full period, so several loops with the same period tick together
+	int64_t period = (int64_t)config->period * 1000;
+	int64_t start = ( latency_now() / period + 1 ) * period;
+	struct itimerspec timer;
+	timer.it_value = fromNanoseconds( start );
+	timer.it_interval = fromNanoseconds( period );
+	if( timerfd_settime( fd, TFD_TIMER_ABSTIME, &timer, NULL ) )
+	{
+		fprintf( stderr, "Error: Unable to start timer: %s\n", strerror(errno) );
+		close( fd );
+		return LIBUSB_ERROR_OTHER;
+	}
+
+	int64_t expected = start - period;
+	while( __atomic_load_n( running, __ATOMIC_RELAXED ) )
+	{
+		uint64_t expirations;
+		if( read( fd, &expirations, sizeof(expirations) ) != sizeof(expirations) )
+		{
+			if( errno == EINTR )
+				continue;
+			fprintf( stderr, "Error: Unable to read timer: %s\n", strerror(errno) );
+			close( fd );
+			return LIBUSB_ERROR_OTHER;
+		}
+		expected += expirations * period;
+		stats->overruns += expirations - 1;
+		stats->cycles++;
+		latency_add( &stats->jitter, latency_now() - expected );
+
+		int64_t begin = trace_begin();
+		cycle( user );
+		trace_end( TRACE_CYCLE, begin, expirations - 1 ); // periods missed before this one
+	}
+
+	close( fd );
+	return 0;
+}
+
+
+void rtloop_print( const struct rtloop_stats * stats )
+{
+	printf( "%llu cycles, %llu overruns.\n", (unsigned long long)stats->cycles, (unsigned long long)stats->overruns );
+	latency_print( &stats->jitter, "Wake up jitter" );
+}
@@ -0,0 +1,39 @@
+#ifndef _RTLOOP_H_
+#define _RTLOOP_H_
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "latency.h"
+
+
+struct rtloop_config
+{
+	unsigned int period; // in microseconds
+	int priority;        // SCHED_FIFO priority, 0 keeps the default scheduler
+	int cpu;             // CPU to pin the loop to, -1 for any
+	bool lock;           // lock all memory and pre-fault the stack
+};
+
+
+struct rtloop_stats
+{
+	struct latency jitter; // wake up time relative to the ideal period grid
+	uint64_t cycles;
+	uint64_t overruns;     // periods missed completely because a cycle took too long
+};
+
+
+// Applies scheduling, affinity and memory locking to the calling thread.
+// Failing to do so is only reported, the loop still runs without.
+void rtloop_prepare( const struct rtloop_config * config );
+
+// Calls cycle() every period, driven by a timerfd, until *running becomes 0.
+// Returns a negative libusb error code if the timer can't be set up.
+int rtloop_run( const struct rtloop_config * config, void (*cycle)( void * user ), void * user, const int * running, struct rtloop_stats * stats );
+
+void rtloop_print( const struct rtloop_stats * stats );
+
+
+#endif
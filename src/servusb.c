@@ -0,0 +1,734 @@
+#define _DEFAULT_SOURCE
+
+#include "servusb.h"
+#include "trace.h"
+#include "latency.h"
+#ifdef SERVUSB_HAVE_RECORDER
+#include "recorder.h"
+#endif
+#ifdef SERVUSB_HAVE_USBFS
+#include "devcache.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#ifdef SERVUSB_HAVE_USBFS
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#endif
+
+
+static const struct servusb_transport * const transports[] =
+{
+	&servusb_transport_libusb,
+#ifdef SERVUSB_HAVE_HIDRAW
+	&servusb_transport_hidraw,
+#endif
+#ifdef SERVUSB_HAVE_KINEMATICS
+	&servusb_transport_emulated,
+#endif
+};
+
+
+const struct servusb_transport * servusb_findTransport( const char * name )
+{
+	for( unsigned int i = 0; i < sizeof(transports) / sizeof(transports[0]); ++i )
+		if( !strcmp( transports[i]->name, name ) )
+			return transports[i];
+	return NULL;
+}
+
+
+int servusb_open( struct servusb ** servusb, const struct servusb_transport * transport, int bus, int dev )
+{
+	struct servusb * s = calloc( 1, sizeof(struct servusb) );
+	if( !s )
+		return LIBUSB_ERROR_NO_MEM;
+	s->transport = transport;
+	s->bus = bus;
+	s->dev = dev;
+	s->fd = -1;
+	s->reconnectTimeout = SERVUSB_RECONNECT_TIMEOUT;
+	s->enabled = -1;
+	int err = transport->open( s );
+	if( err )
+	{
+		if( err == LIBUSB_ERROR_NOT_FOUND && dev < 0 && bus < 0 )
+			fprintf( stderr, "Error: Could not find ServUSB!\n" );
+		else if( err == LIBUSB_ERROR_NOT_FOUND )
+			fprintf( stderr, "Error: Could not find ServUSB on bus %d device %d!\n", bus, dev );
+		free( s );
+		return err;
+	}
+	s->connected = true;
+	*servusb = s;
+	return 0;
+}
+
+
+void servusb_close( struct servusb * servusb )
+{
+	if( servusb->connected )
+		servusb->transport->close( servusb );
+	free( servusb );
+}
+
+
+// what the device would be doing if it had never gone away
+static void remember( struct servusb * servusb, const unsigned char * data, uint16_t length )
+{
+	if( data[0] == SERVUSB_REPORT_ID_CONTROL && length >= 2 )
+	{
+		servusb->enabled = data[1] & SERVUSB_CONTROL_ENABLE_BIT;
+	}
+	else if( data[0] == SERVUSB_REPORT_ID_DATA && length >= 2 )
+	{
+		uint8_t count = length - 1 < SERVUSB_MAX_CHANNELS ? length - 1 : SERVUSB_MAX_CHANNELS;
+		memcpy( servusb->positions, data + 1, count );
+		if( count > servusb->channels )
+			servusb->channels = count;
+	}
+}
+
+
+// A transfer which failed on the way, as opposed to the firmware stalling or answering a
+// shorter report - reconnecting would only replay the state and fail again.
+static bool isGone( int err )
+{
+	return err == LIBUSB_ERROR_NO_DEVICE || err == LIBUSB_ERROR_IO;
+}
+
+
+// Control and short data reports go out as vendor requests if the firmware takes them,
+// SETUP and STATUS only instead of a data stage in between.
+static int transfer( struct servusb * servusb, unsigned char * data, uint16_t length )
+{
+	if( servusb->vendorRequests && servusb->transport->vendorRequest && length >= 2 )
+	{
+		int err = 1;
+		if( data[0] == SERVUSB_REPORT_ID_CONTROL )
+		{
+			err = servusb->transport->vendorRequest( servusb, SERVUSB_REQUEST_SET_ENABLED, data[1], 0 );
+		}
+		else if( data[0] == SERVUSB_REPORT_ID_DATA && length <= 1 + SERVUSB_REQUEST_MAX_POSITIONS )
+		{
+			uint16_t value = data[1] | ( length > 2 ? data[2] << 8 : 0 );
+			uint16_t index = ( length > 3 ? data[3] : 0 ) | ( length - 1 ) << 8;
+			err = servusb->transport->vendorRequest( servusb, SERVUSB_REQUEST_SET_POSITIONS, value, index );
+		}
+		if( err <= 0 )
+			return err ? err : length;
+	}
+	return servusb->transport->setFeature( servusb, data, length );
+}
+
+
+int servusb_setFeature( struct servusb * servusb, unsigned char * data, uint16_t length )
+{
+#ifdef SERVUSB_HAVE_RECORDER
+	int64_t start = recorder_enabled ? latency_now() : 0;
+#endif
+	int transferred = LIBUSB_ERROR_NO_DEVICE;
+	if( servusb->connected )
+		transferred = transfer( servusb, data, length );
+	if( isGone( transferred ) && !servusb_reconnect( servusb ) )
+		transferred = transfer( servusb, data, length );
+	if( transferred >= 0 )
+		remember( servusb, data, length );
+#ifdef SERVUSB_HAVE_RECORDER
+	if( recorder_enabled )
+		recorder_add( servusb, data, length, transferred, start, latency_now() );
+#endif
+	return transferred;
+}
+
+
+int servusb_getFeature( struct servusb * servusb, unsigned char * data, uint16_t length )
+{
+	int transferred = LIBUSB_ERROR_NO_DEVICE;
+	if( servusb->connected )
+		transferred = servusb->transport->getFeature( servusb, data, length );
+	if( isGone( transferred ) && !servusb_reconnect( servusb ) )
+		transferred = servusb->transport->getFeature( servusb, data, length );
+	return transferred;
+}
+
+
+int servusb_reconnect( struct servusb * servusb )
+{
+	if( servusb->connected )
+		servusb->transport->close( servusb );
+	servusb->connected = false;
+	if( !servusb->reconnectTimeout || !servusb->port[0] )
+		return LIBUSB_ERROR_NO_DEVICE;
+
+	// the device comes back at the same port but usually with another device number
+	int64_t deadline = latency_now() + servusb->reconnectTimeout * 1000000ll;
+	int err;
+	while( ( err = servusb->transport->open( servusb ) ) )
+	{
+		if( latency_now() >= deadline )
+		{
+			fprintf( stderr, "Error: ServUSB at port %s did not come back!\n", servusb->port );
+			return err;
+		}
+		struct timespec pause = { 0, 2000000 }; // re-enumeration takes a few milliseconds
+		nanosleep( &pause, NULL );
+	}
+	servusb->connected = true;
+
+	// the device starts up in its power-on state, which needn't be what the host left it in
+	if( servusb->channels )
+	{
+		unsigned char data[1 + SERVUSB_MAX_CHANNELS] = { SERVUSB_REPORT_ID_DATA };
+		memcpy( data + 1, servusb->positions, servusb->channels );
+		err = servusb->transport->setFeature( servusb, data, 1 + servusb->channels );
+	}
+	if( err >= 0 && servusb->enabled >= 0 )
+	{
+		unsigned char data[2] = { SERVUSB_REPORT_ID_CONTROL, servusb->enabled ? SERVUSB_CONTROL_ENABLE_BIT : 0 };
+		err = servusb->transport->setFeature( servusb, data, sizeof(data) );
+	}
+	if( err < 0 )
+	{
+		servusb->transport->close( servusb );
+		servusb->connected = false;
+		return err;
+	}
+	servusb->reconnects++;
+	fprintf( stderr, "Reconnected to ServUSB at port %s (bus %d, device %d).\n", servusb->port, servusb->bus, servusb->dev );
+	return 0;
+}
+
+
+int servusb_setPosition( struct servusb * servusb, uint8_t position )
+{
+	unsigned char data[2] = { SERVUSB_REPORT_ID_DATA, position };
+	return servusb_setFeature( servusb, data, sizeof(data) );
+}
+
+
+int servusb_setPositions( struct servusb * servusb, const uint8_t * positions, uint8_t count )
+{
+	unsigned char data[1 + SERVUSB_MAX_CHANNELS] = { SERVUSB_REPORT_ID_DATA };
+	if( count > SERVUSB_MAX_CHANNELS )
+		return LIBUSB_ERROR_INVALID_PARAM;
+	memcpy( data + 1, positions, count );
+	return servusb_setFeature( servusb, data, 1 + count );
+}
+
+
+int servusb_setEnabled( struct servusb * servusb, bool enabled )
+{
+	unsigned char data[2] = { SERVUSB_REPORT_ID_CONTROL, enabled ? SERVUSB_CONTROL_ENABLE_BIT : 0x00 };
+	return servusb_setFeature( servusb, data, sizeof(data) );
+}
+
+
+int servusb_getFrame( struct servusb * servusb, struct servusb_frame * frame )
+{
+	unsigned char data[5] = { SERVUSB_REPORT_ID_FRAME }; // the device cuts off the positions following
+	int transferred = servusb_getFeature( servusb, data, sizeof(data) );
+	if( transferred < 0 )
+		return transferred;
+	if( transferred < (int)sizeof(data) )
+		return LIBUSB_ERROR_NOT_SUPPORTED; // firmware built without SOF=1
+	frame->frame = data[1] | data[2] << 8;
+	frame->update = data[3] | data[4] << 8;
+	return transferred;
+}
+
+
+int servusb_schedulePositions( struct servusb * servusb, uint16_t frame, const uint8_t * positions, uint8_t count )
+{
+	unsigned char data[5 + SERVUSB_MAX_CHANNELS] = { SERVUSB_REPORT_ID_FRAME, frame, frame >> 8 };
+	if( !count || count > SERVUSB_MAX_CHANNELS )
+		return LIBUSB_ERROR_INVALID_PARAM;
+	memcpy( data + 5, positions, count );
+	return servusb_setFeature( servusb, data, 5 + count );
+}
+
+
+int servusb_setPowerOn( struct servusb * servusb, bool enabled, const uint8_t * positions, uint8_t count )
+{
+	unsigned char data[2 + SERVUSB_MAX_CHANNELS] = { SERVUSB_REPORT_ID_POWER_ON, enabled ? SERVUSB_CONTROL_ENABLE_BIT : 0x00 };
+	if( count > SERVUSB_MAX_CHANNELS )
+		return LIBUSB_ERROR_INVALID_PARAM;
+	memcpy( data + 2, positions, count );
+	return servusb_setFeature( servusb, data, 2 + count );
+}
+
+
+int servusb_getPowerOn( struct servusb * servusb, bool * enabled, uint8_t * positions, uint8_t count )
+{
+	unsigned char data[2 + SERVUSB_MAX_CHANNELS] = { SERVUSB_REPORT_ID_POWER_ON };
+	if( count > SERVUSB_MAX_CHANNELS )
+		return LIBUSB_ERROR_INVALID_PARAM;
+	int transferred = servusb_getFeature( servusb, data, 2 + count );
+	if( transferred < 0 )
+		return transferred;
+	if( transferred < 2 + count )
+		return LIBUSB_ERROR_NOT_SUPPORTED; // firmware without the report or with fewer servos
+	*enabled = data[1] & SERVUSB_CONTROL_ENABLE_BIT;
+	memcpy( positions, data + 2, count );
+	return transferred;
+}
+
+
+int servusb_getJitter( struct servusb * servusb, struct servusb_jitter * jitter )
+{
+	unsigned char data[23] = { SERVUSB_REPORT_ID_JITTER }; // layout of struct jitter in firmware/jitter.h
+	int transferred = servusb_getFeature( servusb, data, sizeof(data) );
+	if( transferred < 0 )
+		return transferred;
+	if( transferred < (int)sizeof(data) )
+		return LIBUSB_ERROR_NOT_SUPPORTED; // firmware without the report
+	jitter->tickNs = data[1] | data[2] << 8;
+	jitter->pulses = data[3] | data[4] << 8;
+	for( unsigned int i = 0; i < 8; ++i )
+		jitter->histogram[i] = data[5 + 2 * i] | data[6 + 2 * i] << 8;
+	jitter->shortest = (int8_t)data[21];
+	jitter->longest = (int8_t)data[22];
+
+	// the next reading covers what happens from now on
+	unsigned char clear[2] = { SERVUSB_REPORT_ID_JITTER };
+	int cleared = servusb_setFeature( servusb, clear, sizeof(clear) );
+	return cleared < 0 ? cleared : transferred;
+}
+
+
+int servusb_getStatus( struct servusb * servusb, struct servusb_status * status )
+{
+	// layout of struct status in firmware/status.h, as long as the servos of the device make it
+	unsigned char data[15 + 2 * SERVUSB_MAX_CHANNELS] = { SERVUSB_REPORT_ID_STATUS };
+	int transferred = servusb_getFeature( servusb, data, sizeof(data) );
+	if( transferred < 0 )
+		return transferred;
+	uint8_t channels = transferred >= 15 ? data[13] : 0;
+	if( transferred < 15 || channels > SERVUSB_MAX_CHANNELS || transferred < 15 + 2 * channels )
+		return LIBUSB_ERROR_NOT_SUPPORTED; // firmware without the report
+	status->version = data[1] | data[2] << 8;
+	status->clockKHz = data[3] | data[4] << 8;
+	status->frameUs = data[5] | data[6] << 8;
+	status->minUs = data[7] | data[8] << 8;
+	status->maxUs = data[9] | data[10] << 8;
+	status->flags = data[11];
+	status->enabled = data[12] & SERVUSB_CONTROL_ENABLE_BIT;
+	status->channels = channels;
+	status->scheduled = data[14];
+	memcpy( status->commanded, data + 15, channels );
+	memcpy( status->pulsed, data + 15 + channels, channels );
+	return transferred;
+}
+
+
+////////////////////////////////////////////////////////////////
+// libusb transport
+
+static int usb_list( int bus, int dev, struct servusb_address * addresses, int max )
+{
+	int err;
+	libusb_context * ctx;
+	int64_t start = trace_begin();
+	err = libusb_init( &ctx );
+	trace_end( TRACE_INIT, start, err );
+	if( err )
+	{
+		fprintf( stderr, "Error: Unable to initialize libusb: %s (%d)\n", libusb_strerror(err), err );
+		return err;
+	}
+
+	libusb_device ** list;
+	start = trace_begin();
+	ssize_t num_devs = libusb_get_device_list( ctx, &list );
+	if( num_devs < 0 )
+	{
+		err = num_devs;
+		fprintf( stderr, "Error: Could not get any devices: %s (%d)\n", libusb_strerror(err), err );
+		libusb_exit( ctx );
+		return err;
+	}
+	trace_end( TRACE_ENUMERATE, start, num_devs );
+
+	int found = 0;
+	start = trace_begin();
+	for( int i = 0; i < num_devs && found < max; ++i )
+	{
+		uint8_t bnum = libusb_get_bus_number( list[i] );
+		uint8_t dnum = libusb_get_device_address( list[i] );
+		if( (bus != -1 && bus != bnum) || (dev != -1 && dev != dnum))
+			continue;
+
+		struct libusb_device_descriptor desc;
+		libusb_get_device_descriptor( list[i], &desc );
+		if( (desc.idVendor != SERVUSB_VENDOR_ID) || (desc.idProduct != SERVUSB_PRODUCT_ID) )
+			continue;
+
+		addresses[found].bus = bnum;
+		addresses[found].dev = dnum;
+		found++;
+	}
+	trace_end( TRACE_DESCRIPTORS, start, found );
+	libusb_free_device_list( list, 1 );
+	libusb_exit( ctx );
+	return found;
+}
+
+
+// "bus-port.port..." like the device's name in /sys/bus/usb/devices
+static void portPath( libusb_device * dev, char path[SERVUSB_PORT_MAX] )
+{
+	uint8_t ports[7];
+	int count = libusb_get_port_numbers( dev, ports, sizeof(ports) );
+	int length = snprintf( path, SERVUSB_PORT_MAX, "%d", libusb_get_bus_number( dev ) );
+	for( int i = 0; i < count && length < SERVUSB_PORT_MAX; ++i )
+		length += snprintf( path + length, SERVUSB_PORT_MAX - length, "%c%d", i ? '.' : '-', ports[i] );
+}
+
+
+static void claim( struct servusb * servusb )
+{
+	int64_t start = trace_begin();
+	int err = libusb_detach_kernel_driver( servusb->handle, SERVUSB_INTERFACE );
+	trace_end( TRACE_DETACH, start, err );
+	start = trace_begin();
+	err = libusb_set_configuration( servusb->handle, SERVUSB_CONFIGURATION );
+	trace_end( TRACE_CONFIGURE, start, err );
+	if( err )
+	{
+		fprintf( stderr, "Warning: Could not set configuration: %s (%d)\n", libusb_strerror(err), err );
+	}
+	start = trace_begin();
+	err = libusb_claim_interface( servusb->handle, SERVUSB_INTERFACE );
+	trace_end( TRACE_CLAIM, start, err );
+	if( err )
+	{
+		fprintf( stderr, "Warning: Could not claim interface: %s (%d)\n", libusb_strerror(err), err );
+	}
+}
+
+
+#ifdef SERVUSB_HAVE_USBFS
+// Fast path on Linux: the device node of a known bus and device number is opened directly
+// and handed to libusb, which then reads only this one descriptor instead of enumerating.
+
+#define USB_DEVICE_MAJOR 189 // minor numbers are ( bus - 1 ) * 128 + device - 1
+
+// the port of a device from the link sysfs has for its device node
+static int portOfNode( int bus, int dev, char port[SERVUSB_PORT_MAX] )
+{
+	char link[64];
+	char path[PATH_MAX];
+	snprintf( link, sizeof(link), "/sys/dev/char/%d:%d", USB_DEVICE_MAJOR, ( bus - 1 ) * 128 + dev - 1 );
+	if( !realpath( link, path ) )
+		return -1;
+	const char * name = strrchr( path, '/' );
+	if( !name || strlen( name + 1 ) >= SERVUSB_PORT_MAX )
+		return -1;
+	strcpy( port, name + 1 );
+	return 0;
+}
+
+
+// the current bus and device number of whatever is at a port
+static int addressOfPort( const char * port, int * bus, int * dev )
+{
+	char path[PATH_MAX];
+	int values[2];
+	static const char * const names[2] = { "busnum", "devnum" };
+	for( unsigned int i = 0; i < 2; ++i )
+	{
+		snprintf( path, sizeof(path), "/sys/bus/usb/devices/%s/%s", port, names[i] );
+		FILE * file = fopen( path, "r" );
+		if( !file )
+			return -1;
+		int read = fscanf( file, "%d", &values[i] );
+		fclose( file );
+		if( read != 1 )
+			return -1;
+	}
+	*bus = values[0];
+	*dev = values[1];
+	return 0;
+}
+
+
+static int initWithoutDiscovery( libusb_context ** ctx )
+{
+#if defined(LIBUSB_API_VERSION) && LIBUSB_API_VERSION >= 0x0100010A
+	struct libusb_init_option option = { .option = LIBUSB_OPTION_NO_DEVICE_DISCOVERY };
+	return libusb_init_context( ctx, &option, 1 );
+#else
+	return libusb_init( ctx ); // older libusb still scans sysfs, but reads no descriptors
+#endif
+}
+
+
+// Returns 0 or LIBUSB_ERROR_NOT_FOUND without any message if there is no ServUSB at bus and dev.
+static int openNode( struct servusb * servusb, int bus, int dev )
+{
+	char node[32];
+	snprintf( node, sizeof(node), "/dev/bus/usb/%03d/%03d", bus, dev );
+	int64_t start = trace_begin();
+	int fd = open( node, O_RDWR | O_CLOEXEC );
+	trace_end( TRACE_OPEN, start, fd < 0 ? LIBUSB_ERROR_NOT_FOUND : 0 );
+	if( fd < 0 )
+		return LIBUSB_ERROR_NOT_FOUND;
+
+	start = trace_begin();
+	int err = initWithoutDiscovery( &servusb->ctx );
+	trace_end( TRACE_INIT, start, err );
+	if( err )
+	{
+		close( fd );
+		return LIBUSB_ERROR_NOT_FOUND;
+	}
+	struct libusb_device_descriptor desc;
+	start = trace_begin();
+	err = libusb_wrap_sys_device( servusb->ctx, fd, &servusb->handle );
+	if( !err )
+		err = libusb_get_device_descriptor( libusb_get_device( servusb->handle ), &desc );
+	if( !err && ( desc.idVendor != SERVUSB_VENDOR_ID || desc.idProduct != SERVUSB_PRODUCT_ID ) )
+		err = LIBUSB_ERROR_NOT_FOUND; // something else got this device number
+	trace_end( TRACE_DESCRIPTORS, start, err );
+	if( err )
+	{
+		if( servusb->handle )
+			libusb_close( servusb->handle );
+		servusb->handle = NULL;
+		libusb_exit( servusb->ctx );
+		close( fd );
+		return LIBUSB_ERROR_NOT_FOUND;
+	}
+
+	if( portOfNode( bus, dev, servusb->port ) )
+		portPath( libusb_get_device( servusb->handle ), servusb->port );
+	servusb->vendorRequests = desc.bcdDevice >= SERVUSB_REQUEST_VERSION;
+	servusb->bus = bus;
+	servusb->dev = dev;
+	servusb->fd = fd; // libusb does not close it
+	return 0;
+}
+
+
+// bus and device number to try without enumerating, from the selector, the port or the cache
+static bool knownAddress( const struct servusb * servusb, int * bus, int * dev )
+{
+	if( servusb->port[0] )
+		return !addressOfPort( servusb->port, bus, dev );
+	*bus = servusb->bus;
+	*dev = servusb->dev;
+	if( *bus >= 0 && *dev >= 0 )
+		return true;
+	struct devcache_entry cached;
+	if( devcache_lookup( *bus, *dev, &cached ) )
+		return false;
+	// the same device again if it is still at its port, even with another device number
+	int selectorBus = *bus;
+	int selectorDev = *dev;
+	if( addressOfPort( cached.port, bus, dev ) )
+	{
+		*bus = cached.bus;
+		*dev = cached.dev;
+	}
+	return ( selectorBus < 0 || selectorBus == *bus ) && ( selectorDev < 0 || selectorDev == *dev );
+}
+#endif
+
+
+static int usb_open( struct servusb * servusb )
+{
+	int err;
+	servusb->handle = NULL;
+#ifdef SERVUSB_HAVE_USBFS
+	int selectorBus = servusb->bus;
+	int selectorDev = servusb->dev;
+	bool reconnecting = servusb->port[0];
+	int knownBus, knownDev;
+	if( knownAddress( servusb, &knownBus, &knownDev ) && !openNode( servusb, knownBus, knownDev ) )
+	{
+		claim( servusb );
+		return 0;
+	}
+#endif
+
+	int64_t start = trace_begin();
+	err = libusb_init( &servusb->ctx );
+	trace_end( TRACE_INIT, start, err );
+	if( err )
+	{
+		fprintf( stderr, "Error: Unable to initialize libusb: %s (%d)\n", libusb_strerror(err), err );
+		return err;
+	}
+
+	// get USB device
+	libusb_device ** list;
+	start = trace_begin();
+	ssize_t num_devs = libusb_get_device_list( servusb->ctx, &list );
+	if( num_devs < 0 )
+	{
+		err = num_devs;
+		fprintf( stderr, "Error: Could not get any devices: %s (%d)\n", libusb_strerror(err), err );
+		libusb_exit( servusb->ctx );
+		return err;
+	}
+	trace_end( TRACE_ENUMERATE, start, num_devs );
+
+	libusb_device * match = NULL;
+	start = trace_begin();
+	for( int i = 0; i < num_devs && !match; ++i )
+	{
+		libusb_device * dev = list[i];
+		uint8_t bnum = libusb_get_bus_number( dev );
+		uint8_t dnum = libusb_get_device_address( dev );
+
+		char port[SERVUSB_PORT_MAX];
+		portPath( dev, port );
+		if( servusb->port[0] )
+		{
+			if( strcmp( servusb->port, port ) )
+				continue; // reconnecting and it's not at the same port - continue with next device
+		}
+		else if( (servusb->bus != -1 && servusb->bus != bnum) || (servusb->dev != -1 && servusb->dev != dnum))
+			continue; // bus and/or device number given and it doesn't match - continue with next device
+
+		struct libusb_device_descriptor desc;
+		libusb_get_device_descriptor( dev, &desc );
+		if( (desc.idVendor != SERVUSB_VENDOR_ID) || (desc.idProduct != SERVUSB_PRODUCT_ID) )
+			continue; // device is not ServUSB - continue with next device
+		strcpy( servusb->port, port );
+		servusb->vendorRequests = desc.bcdDevice >= SERVUSB_REQUEST_VERSION;
+
+		servusb->bus = bnum;
+		servusb->dev = dnum;
+		match = dev;
+	}
+	trace_end( TRACE_DESCRIPTORS, start, match ? 0 : LIBUSB_ERROR_NOT_FOUND );
+	if( match )
+	{
+		start = trace_begin();
+		err = libusb_open( match, &servusb->handle );
+		trace_end( TRACE_OPEN, start, err );
+		if( err )
+		{
+			fprintf( stderr, "Error: Unable to open usb device: %s (%d)\n", libusb_strerror(err), err );
+			libusb_free_device_list( list, 0 );
+			libusb_exit( servusb->ctx );
+			return err;
+		}
+	}
+	libusb_free_device_list( list, 0 );
+	if( !servusb->handle )
+	{
+		libusb_exit( servusb->ctx );
+		return LIBUSB_ERROR_NOT_FOUND;
+	}
+
+#ifdef SERVUSB_HAVE_USBFS
+	if( !reconnecting && ( selectorBus < 0 || selectorDev < 0 ) )
+	{ // the next time this selector skips the enumeration
+		struct devcache_entry found = { servusb->bus, servusb->dev };
+		strcpy( found.port, servusb->port );
+		devcache_store( selectorBus, selectorDev, &found );
+	}
+#endif
+	claim( servusb );
+	return 0;
+}
+
+
+static void usb_close( struct servusb * servusb )
+{
+	int64_t start = trace_begin();
+	libusb_close( servusb->handle );
+	libusb_exit( servusb->ctx );
+#ifdef SERVUSB_HAVE_USBFS
+	if( servusb->fd >= 0 )
+		close( servusb->fd ); // opened by openNode()
+	servusb->fd = -1;
+#endif
+	trace_end( TRACE_CLOSE, start, 0 );
+}
+
+
+static int usb_setFeature( struct servusb * servusb, unsigned char * data, uint16_t length )
+{
+	int64_t start = trace_begin();
+	int transferred = libusb_control_transfer( servusb->handle,
+		LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_INTERFACE, // request type
+		USBRQ_HID_SET_REPORT,                                                        // request
+		USB_HID_REPORT_TYPE_FEATURE << 8 | data[0],                                 // value report type|id
+		0,                                                                         // index
+		data, length,
+		1000
+		);
+	trace_end( TRACE_SET_REPORT, start, transferred < 0 ? transferred : data[0] );
+	if( transferred < 0 )
+	{
+		fprintf( stderr, "Error: Transfer failed: %s (%d)\n", libusb_strerror(transferred), transferred );
+		return transferred;
+	}
+	if( transferred != length )
+	{ // the device is there, it didn't take the whole report
+		fprintf( stderr, "Error: Incomplete transfer - sent %d bytes but expected %d\n", transferred, length );
+		return LIBUSB_ERROR_PIPE;
+	}
+	return transferred;
+}
+
+
+static int usb_vendorRequest( struct servusb * servusb, uint8_t request, uint16_t value, uint16_t index )
+{
+	int64_t start = trace_begin();
+	int err = libusb_control_transfer( servusb->handle,
+		LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE, // request type
+		request,
+		value,
+		index,
+		NULL, 0,
+		1000
+		);
+	trace_end( TRACE_VENDOR_REQUEST, start, err < 0 ? err : request );
+	if( err < 0 )
+	{
+		fprintf( stderr, "Error: Transfer failed: %s (%d)\n", libusb_strerror(err), err );
+		return err;
+	}
+	return 0;
+}
+
+
+static int usb_getFeature( struct servusb * servusb, unsigned char * data, uint16_t length )
+{
+	int64_t start = trace_begin();
+	int transferred = libusb_control_transfer( servusb->handle,
+		LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_INTERFACE, // request type
+		USBRQ_HID_GET_REPORT,                                                       // request
+		USB_HID_REPORT_TYPE_FEATURE << 8 | data[0],                                // value report type|id
+		0,                                                                        // index
+		data, length,
+		1000
+		);
+	trace_end( TRACE_GET_REPORT, start, transferred < 0 ? transferred : data[0] );
+	if( transferred < 0 )
+	{
+		fprintf( stderr, "Error: Transfer failed: %s (%d)\n", libusb_strerror(transferred), transferred );
+		return transferred;
+	}
+	return transferred; // a shorter report is the firmware's answer, the caller checks the length
+}
+
+
+const struct servusb_transport servusb_transport_libusb =
+{
+	"libusb",
+	usb_list,
+	usb_open,
+	usb_close,
+	usb_setFeature,
+	usb_getFeature,
+	usb_vendorRequest,
+};
@@ -0,0 +1,208 @@
+#ifndef _SERVUSB_H_
+#define _SERVUSB_H_
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <libusb.h>
+
+
+#define SERVUSB_VENDOR_ID  0x16c0
+#define SERVUSB_PRODUCT_ID 0x05df
+
+#define SERVUSB_CONFIGURATION 1
+#define SERVUSB_INTERFACE 0
+
+#define SERVUSB_REPORT_ID_CONTROL 0x01
+#define SERVUSB_REPORT_ID_DATA    0x02
+#define SERVUSB_REPORT_ID_STATS   0x03
+#define SERVUSB_REPORT_ID_FRAME   0x04 // firmware built with SOF=1 only
+#define SERVUSB_REPORT_ID_POWER_ON 0x05
+#define SERVUSB_REPORT_ID_JITTER  0x06
+#define SERVUSB_REPORT_ID_STATUS  0x07 // firmware 1.02 and later
+
+#define SERVUSB_STATUS_PPM           0x01 // PPM stream instead of servo pulses
+#define SERVUSB_STATUS_RC_OSCILLATOR 0x02 // no crystal
+#define SERVUSB_STATUS_COUNT_SOF     0x04 // built with SOF=1, positions can be scheduled
+
+#define SERVUSB_CONTROL_ENABLE_BIT 0x01
+
+// Vendor requests without a data stage, the values travel in wValue and wIndex (firmware 1.01 and later)
+#define SERVUSB_REQUEST_SET_ENABLED   0x01 // wValue low byte as the control report
+#define SERVUSB_REQUEST_SET_POSITIONS 0x02 // up to three positions in wValue low, high and wIndex low, their number in wIndex high
+#define SERVUSB_REQUEST_MAX_POSITIONS 3
+#define SERVUSB_REQUEST_VERSION       0x0101 // bcdDevice of the first firmware taking them
+
+#define SERVUSB_MAX_CHANNELS 8 // channels of the PPM firmware, the servo firmware has one (crystal) or three (crystal-less)
+
+#define SERVUSB_RECONNECT_TIMEOUT 1000 // milliseconds to wait for a device which went away
+
+
+#define USBRQ_HID_GET_REPORT    0x01
+#define USBRQ_HID_SET_REPORT    0x09
+
+#define USB_HID_REPORT_TYPE_INPUT   1
+#define USB_HID_REPORT_TYPE_OUTPUT  2
+#define USB_HID_REPORT_TYPE_FEATURE 3
+
+
+struct servusb;
+
+
+struct servusb_address
+{
+	int bus;
+	int dev;
+};
+
+
+// A way to talk to the device. All functions return negative libusb error codes on failure.
+struct servusb_transport
+{
+	const char * name;
+	// stores up to max addresses of ServUSBs matching bus and dev (-1 matches any), returns the number found
+	int (*list)( int bus, int dev, struct servusb_address * addresses, int max );
+	// Opens the first ServUSB matching servusb->bus and servusb->dev (-1 matches any) and fills in
+	// both and servusb->port. If servusb->port is set already, only a ServUSB at that port matches.
+	// Returns LIBUSB_ERROR_NOT_FOUND without any message if there is none.
+	int (*open)( struct servusb * servusb );
+	void (*close)( struct servusb * servusb );
+	// data[0] is the report ID, returns the number of bytes transferred. A device which takes
+	// fewer bytes fails with LIBUSB_ERROR_PIPE, one which answers with a shorter report (or
+	// none, for a report ID it doesn't know) returns what it sent. LIBUSB_ERROR_NO_DEVICE and
+	// LIBUSB_ERROR_IO only mean the device is gone or the transfer failed on the way.
+	int (*setFeature)( struct servusb * servusb, unsigned char * data, uint16_t length );
+	int (*getFeature)( struct servusb * servusb, unsigned char * data, uint16_t length );
+	// SERVUSB_REQUEST_* without a data stage, returns 0 - NULL if the transport can't send them
+	int (*vendorRequest)( struct servusb * servusb, uint8_t request, uint16_t value, uint16_t index );
+};
+
+// libusb - detaches the kernel driver and claims the interface (portable)
+extern const struct servusb_transport servusb_transport_libusb;
+#ifdef SERVUSB_HAVE_HIDRAW
+// Linux hidraw - the kernel driver stays bound, a report is a single ioctl, no vendor requests
+extern const struct servusb_transport servusb_transport_hidraw;
+#endif
+#ifdef SERVUSB_HAVE_KINEMATICS
+// no hardware - servos moving like the kinematics model says (see emulated.h)
+extern const struct servusb_transport servusb_transport_emulated;
+#endif
+
+
+// SERVUSB_REPORT_ID_FRAME - frame numbers count the milliseconds since the device powered up
+struct servusb_frame
+{
+	uint16_t frame;  // now
+	uint16_t update; // the last servo update started in this frame
+};
+
+
+// SERVUSB_REPORT_ID_JITTER - how far the pulses came out from their programmed length
+struct servusb_jitter
+{
+	uint16_t tickNs;       // length of a tick in nanoseconds
+	uint16_t pulses;       // pulses measured, stops at 65535 together with the histogram
+	uint16_t histogram[8]; // pulses off by 0, 1, 2, 3, 4-7, 8-15, 16-31 and 32 or more ticks
+	int8_t shortest;       // largest deviation towards a shorter pulse in ticks (negative)
+	int8_t longest;        // largest deviation towards a longer pulse
+};
+
+
+// SERVUSB_REPORT_ID_STATUS - all a device has to say about itself, in one transfer
+struct servusb_status
+{
+	uint16_t version;  // firmware version as bcdDevice, 0x0102 is 1.02
+	uint16_t clockKHz;
+	uint16_t frameUs;  // time between servo updates or PPM frames
+	uint16_t minUs;    // pulse length of position 0
+	uint16_t maxUs;    // pulse length of position 255
+	uint8_t flags;     // SERVUSB_STATUS_*
+	bool enabled;
+	uint8_t channels;
+	uint8_t scheduled; // setpoints waiting for their frame
+	uint8_t commanded[SERVUSB_MAX_CHANNELS]; // latest positions set or scheduled
+	uint8_t pulsed[SERVUSB_MAX_CHANNELS];    // positions of the pulses going out now
+};
+
+
+#define SERVUSB_PORT_MAX 32
+
+
+struct servusb
+{
+	const struct servusb_transport * transport;
+	int bus;
+	int dev;
+	char port[SERVUSB_PORT_MAX]; // port path as in sysfs, e.g. "1-1.2" - stays the same when the device number changes
+	// reconnecting
+	bool connected;
+	int reconnectTimeout;        // in milliseconds, 0 disables reconnecting
+	unsigned int reconnects;     // successful ones
+	int enabled;                 // last state set, restored after reconnecting (-1 if never set)
+	uint8_t channels;            // number of positions set
+	uint8_t positions[SERVUSB_MAX_CHANNELS];
+	bool vendorRequests;         // the firmware takes SERVUSB_REQUEST_*, set by the transport's open()
+	// libusb transport
+	libusb_context * ctx;
+	libusb_device_handle * handle;
+	// hidraw transport
+	int fd;
+};
+
+
+// returns NULL if there is no transport of that name
+const struct servusb_transport * servusb_findTransport( const char * name );
+
+static inline int servusb_list( const struct servusb_transport * transport, int bus, int dev, struct servusb_address * addresses, int max )
+{
+	return transport->list( bus, dev, addresses, max );
+}
+
+// opens a ServUSB on the given bus and device number (-1 matches any)
+int servusb_open( struct servusb ** servusb, const struct servusb_transport * transport, int bus, int dev );
+void servusb_close( struct servusb * servusb );
+
+
+// If the device is gone (LIBUSB_ERROR_NO_DEVICE or LIBUSB_ERROR_IO), both reconnect and
+// retry once, so a USB reset or a glitch of a hub only shows in servusb->reconnects.
+// getFeature() returns the length of the report the device sent, which may be shorter.
+int servusb_setFeature( struct servusb * servusb, unsigned char * data, uint16_t length );
+int servusb_getFeature( struct servusb * servusb, unsigned char * data, uint16_t length );
+
+// Closes the device and waits up to servusb->reconnectTimeout for a ServUSB at the same port,
+// then restores the last enable state and positions set. Returns 0 or a libusb error code,
+// the next transfer tries again.
+int servusb_reconnect( struct servusb * servusb );
+
+
+int servusb_setPosition( struct servusb * servusb, uint8_t position );
+// sets the first count servos of a device with several (up to SERVUSB_MAX_CHANNELS)
+int servusb_setPositions( struct servusb * servusb, const uint8_t * positions, uint8_t count );
+int servusb_setEnabled( struct servusb * servusb, bool enabled );
+
+// Device time base of firmware counting USB frames. Scheduled positions are applied at the
+// first servo update in or after the given frame, so they take effect at a known time no
+// matter how late the transfer was. Fails with LIBUSB_ERROR_PIPE if the device has four
+// setpoints waiting already, reading the frame with LIBUSB_ERROR_NOT_SUPPORTED on firmware
+// built without SOF=1.
+int servusb_getFrame( struct servusb * servusb, struct servusb_frame * frame );
+int servusb_schedulePositions( struct servusb * servusb, uint16_t frame, const uint8_t * positions, uint8_t count );
+
+// What the first count servos do at power-up, before any host shows up. The device saves it
+// in its EEPROM. On firmware without it, setting fails with LIBUSB_ERROR_PIPE (the device
+// stalls) and reading it back with LIBUSB_ERROR_NOT_SUPPORTED, as it does for more servos
+// than the device has.
+int servusb_setPowerOn( struct servusb * servusb, bool enabled, const uint8_t * positions, uint8_t count );
+int servusb_getPowerOn( struct servusb * servusb, bool * enabled, uint8_t * positions, uint8_t count );
+
+// Reads the pulse jitter measured since the last reading and clears it. Fails with
+// LIBUSB_ERROR_NOT_SUPPORTED on firmware without the report.
+int servusb_getJitter( struct servusb * servusb, struct servusb_jitter * jitter );
+
+// Reads the status in a single transfer, so polling many devices takes one round trip each.
+// Fails with LIBUSB_ERROR_NOT_SUPPORTED on firmware older than 1.02.
+int servusb_getStatus( struct servusb * servusb, struct servusb_status * status );
+
+
+#endif
@@ -0,0 +1,373 @@
+#include "servusb_async.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+
+#include <errno.h>
+
+
+namespace servusb_async
+{
+
+
+////////////////////////////////////////////////////////////////
+// executor
+
+namespace
+{
+
+// Fire and forget coroutine frame keeping a spawned task alive until it is done.
+struct detached
+{
+	struct promise_type
+	{
+		detached get_return_object() { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+};
+
+} // namespace
+
+
+executor::executor()
+{
+	int err = libusb_init( &ctx );
+	if( err )
+		throw std::runtime_error( std::string( "Unable to initialize libusb: " ) + libusb_strerror( (libusb_error)err ) );
+
+	const libusb_pollfd ** fds = libusb_get_pollfds( ctx );
+	if( fds )
+	{
+		for( const libusb_pollfd ** fd = fds; *fd; ++fd )
+			usbfds.push_back( { (*fd)->fd, (*fd)->events, 0 } );
+		libusb_free_pollfds( fds );
+	}
+	libusb_set_pollfd_notifiers( ctx, pollfdAdded, pollfdRemoved, this );
+}
+
+
+executor::~executor()
+{
+	libusb_set_pollfd_notifiers( ctx, nullptr, nullptr, nullptr );
+	libusb_exit( ctx );
+}
+
+
+void executor::pollfdAdded( int fd, short events, void * user )
+{
+	executor * self = static_cast< executor * >( user );
+	self->usbfds.push_back( { fd, events, 0 } );
+}
+
+
+void executor::pollfdRemoved( int fd, void * user )
+{
+	executor * self = static_cast< executor * >( user );
+	std::erase_if( self->usbfds, [fd]( const pollfd & p ) { return p.fd == fd; } );
+}
+
+
+std::vector< servusb_address > executor::list( int bus, int dev )
+{
+	std::vector< servusb_address > addresses;
+	libusb_device ** list;
+	ssize_t num_devs = libusb_get_device_list( ctx, &list );
+	if( num_devs < 0 )
+	{
+		fprintf( stderr, "Error: Could not get any devices: %s (%d)\n", libusb_strerror( (libusb_error)num_devs ), (int)num_devs );
+		return addresses;
+	}
+	for( ssize_t i = 0; i < num_devs; ++i )
+	{
+		uint8_t bnum = libusb_get_bus_number( list[i] );
+		uint8_t dnum = libusb_get_device_address( list[i] );
+		if( (bus != -1 && bus != bnum) || (dev != -1 && dev != dnum) )
+			continue;
+
+		libusb_device_descriptor desc;
+		if( libusb_get_device_descriptor( list[i], &desc ) )
+			continue;
+		if( (desc.idVendor != SERVUSB_VENDOR_ID) || (desc.idProduct != SERVUSB_PRODUCT_ID) )
+			continue;
+
+		addresses.push_back( { bnum, dnum } );
+	}
+	libusb_free_device_list( list, 1 );
+	return addresses;
+}
+
+
+static detached runDetached( executor & owner, task< void > task, unsigned int & active )
+{
+	co_await owner.schedule(); // don't start running inside spawn()
+	co_await std::move( task );
+	--active;
+}
+
+
+void executor::spawn( task< void > && task )
+{
+	++active;
+	runDetached( *this, std::move( task ), active );
+}
+
+
+int executor::run()
+{
+	while( active )
+	{
+		while( !ready.empty() )
+		{
+			std::coroutine_handle<> handle = ready.front();
+			ready.pop_front();
+			handle.resume();
+		}
+		if( !active )
+			break;
+		if( !pending && waiters.empty() )
+		{
+			fprintf( stderr, "Error: %u tasks are waiting for nothing\n", active );
+			return LIBUSB_ERROR_OTHER;
+		}
+		int err = wait();
+		if( err )
+			return err;
+	}
+	return 0;
+}
+
+
+// blocks until a USB event, a user file descriptor or a libusb timeout is due
+int executor::wait()
+{
+	std::vector< pollfd > fds;
+	fds.reserve( usbfds.size() + waiters.size() );
+	fds.insert( fds.end(), usbfds.begin(), usbfds.end() );
+	for( const waiter & w : waiters )
+		fds.push_back( { w.awaiter->fd, w.awaiter->events, 0 } );
+
+	int timeout = -1;
+	timeval next;
+	int haveTimeout = libusb_get_next_timeout( ctx, &next );
+	if( haveTimeout < 0 )
+		return haveTimeout;
+	if( haveTimeout )
+		timeout = next.tv_sec * 1000 + ( next.tv_usec + 999 ) / 1000;
+
+	int n = ::poll( fds.data(), fds.size(), timeout );
+	if( n < 0 )
+		return errno == EINTR ? 0 : LIBUSB_ERROR_IO;
+
+	bool usb = !n && haveTimeout;
+	for( size_t i = 0; i < usbfds.size(); ++i )
+		usb |= fds[i].revents != 0;
+	if( usb )
+	{ // completion callbacks only queue the coroutines, nothing runs inside libusb
+		timeval zero = { 0, 0 };
+		int err = libusb_handle_events_timeout_completed( ctx, &zero, nullptr );
+		if( err && err != LIBUSB_ERROR_INTERRUPTED )
+			return err;
+	}
+
+	// libusb may have changed its fds during the callbacks, the waiters come after them in fds
+	size_t offset = fds.size() - waiters.size();
+	size_t kept = 0;
+	for( size_t i = 0; i < waiters.size(); ++i )
+	{
+		short revents = fds[offset + i].revents;
+		if( revents )
+		{
+			waiters[i].awaiter->revents = revents;
+			ready.push_back( waiters[i].handle );
+		}
+		else
+			waiters[kept++] = waiters[i];
+	}
+	waiters.resize( kept );
+	return 0;
+}
+
+
+////////////////////////////////////////////////////////////////
+// transfers
+
+bool transfer_awaiter::await_suspend( std::coroutine_handle<> handle )
+{
+	continuation = handle;
+	transfer = libusb_alloc_transfer( 0 );
+	// malloc() as libusb frees it with the transfer
+	unsigned char * buffer = transfer ? static_cast< unsigned char * >( malloc( LIBUSB_CONTROL_SETUP_SIZE + data.size() ) ) : nullptr;
+	if( !buffer )
+	{
+		libusb_free_transfer( transfer );
+		transfer = nullptr;
+		result = LIBUSB_ERROR_NO_MEM;
+		return false;
+	}
+	libusb_fill_control_setup( buffer, requestType, request, value, 0, data.size() );
+	if( !( requestType & LIBUSB_ENDPOINT_IN ) )
+		std::copy( data.begin(), data.end(), buffer + LIBUSB_CONTROL_SETUP_SIZE );
+	libusb_fill_control_transfer( transfer, this->handle, buffer, completed, this, 1000 );
+	transfer->flags = LIBUSB_TRANSFER_FREE_BUFFER;
+
+	int err = libusb_submit_transfer( transfer );
+	if( err )
+	{
+		libusb_free_transfer( transfer );
+		transfer = nullptr;
+		fprintf( stderr, "Error: Transfer failed: %s (%d)\n", libusb_strerror( (libusb_error)err ), err );
+		result = err;
+		return false; // resume right away with the error
+	}
+	owner.pending++;
+	return true;
+}
+
+
+void LIBUSB_CALL transfer_awaiter::completed( libusb_transfer * transfer )
+{
+	transfer_awaiter * self = static_cast< transfer_awaiter * >( transfer->user_data );
+	switch( transfer->status )
+	{
+	case LIBUSB_TRANSFER_COMPLETED:
+		if( self->requestType & LIBUSB_ENDPOINT_IN )
+			std::copy_n( libusb_control_transfer_get_data( transfer ), transfer->actual_length, self->data.begin() );
+		self->result = transfer->actual_length;
+		break;
+	case LIBUSB_TRANSFER_TIMED_OUT: self->result = LIBUSB_ERROR_TIMEOUT; break;
+	case LIBUSB_TRANSFER_STALL:     self->result = LIBUSB_ERROR_PIPE; break;
+	case LIBUSB_TRANSFER_NO_DEVICE: self->result = LIBUSB_ERROR_NO_DEVICE; break;
+	case LIBUSB_TRANSFER_OVERFLOW:  self->result = LIBUSB_ERROR_OVERFLOW; break;
+	case LIBUSB_TRANSFER_CANCELLED: self->result = LIBUSB_ERROR_INTERRUPTED; break;
+	default:                        self->result = LIBUSB_ERROR_IO; break;
+	}
+	self->owner.pending--;
+	self->owner.ready.push_back( self->continuation );
+}
+
+
+int transfer_awaiter::await_resume()
+{
+	if( transfer )
+	{
+		libusb_free_transfer( transfer ); // frees the buffer too
+		transfer = nullptr;
+	}
+	if( result >= 0 && result != (int)data.size() )
+	{
+		fprintf( stderr, "Error: Incomplete transfer - %d bytes but expected %d\n", result, (int)data.size() );
+		return LIBUSB_ERROR_IO;
+	}
+	return result;
+}
+
+
+////////////////////////////////////////////////////////////////
+// device
+
+task< int > device::open( int bus, int dev )
+{
+	close();
+	libusb_device ** list;
+	ssize_t num_devs = libusb_get_device_list( owner.ctx, &list );
+	if( num_devs < 0 )
+	{
+		fprintf( stderr, "Error: Could not get any devices: %s (%d)\n", libusb_strerror( (libusb_error)num_devs ), (int)num_devs );
+		co_return num_devs;
+	}
+
+	for( ssize_t i = 0; i < num_devs && !handle; ++i )
+	{
+		uint8_t bnum = libusb_get_bus_number( list[i] );
+		uint8_t dnum = libusb_get_device_address( list[i] );
+		if( (bus != -1 && bus != bnum) || (dev != -1 && dev != dnum) )
+			continue;
+
+		libusb_device_descriptor desc;
+		if( libusb_get_device_descriptor( list[i], &desc ) )
+			continue;
+		if( (desc.idVendor != SERVUSB_VENDOR_ID) || (desc.idProduct != SERVUSB_PRODUCT_ID) )
+			continue;
+
+		int err = libusb_open( list[i], &handle );
+		if( err )
+		{
+			fprintf( stderr, "Error: Unable to open usb device: %s (%d)\n", libusb_strerror( (libusb_error)err ), err );
+			libusb_free_device_list( list, 1 );
+			co_return err;
+		}
+		address = { bnum, dnum };
+	}
+	libusb_free_device_list( list, 1 );
+	if( !handle )
+	{
+		if( dev < 0 && bus < 0 )
+			fprintf( stderr, "Error: Could not find ServUSB!\n" );
+		else
+			fprintf( stderr, "Error: Could not find ServUSB on bus %d device %d!\n", bus, dev );
+		co_return LIBUSB_ERROR_NOT_FOUND;
+	}
+
+	libusb_detach_kernel_driver( handle, SERVUSB_INTERFACE );
+	int err = libusb_set_configuration( handle, SERVUSB_CONFIGURATION );
+	if( err )
+		fprintf( stderr, "Warning: Could not set configuration: %s (%d)\n", libusb_strerror( (libusb_error)err ), err );
+	err = libusb_claim_interface( handle, SERVUSB_INTERFACE );
+	if( err )
+		fprintf( stderr, "Warning: Could not claim interface: %s (%d)\n", libusb_strerror( (libusb_error)err ), err );
+	co_return 0;
+}
+
+
+void device::close()
+{
+	if( !handle )
+		return;
+	libusb_release_interface( handle, SERVUSB_INTERFACE );
+	libusb_close( handle );
+	handle = nullptr;
+	address = { -1, -1 };
+}
+
+
+transfer_awaiter device::setFeature( std::span< unsigned char > data )
+{
+	return { owner, handle,
+		(uint8_t)( LIBUSB_ENDPOINT_OUT | (uint8_t)LIBUSB_REQUEST_TYPE_CLASS | (uint8_t)LIBUSB_RECIPIENT_INTERFACE ),
+		USBRQ_HID_SET_REPORT,
+		(uint16_t)( USB_HID_REPORT_TYPE_FEATURE << 8 | data[0] ),
+		data };
+}
+
+
+transfer_awaiter device::getFeature( std::span< unsigned char > data )
+{
+	return { owner, handle,
+		(uint8_t)( LIBUSB_ENDPOINT_IN | (uint8_t)LIBUSB_REQUEST_TYPE_CLASS | (uint8_t)LIBUSB_RECIPIENT_INTERFACE ),
+		USBRQ_HID_GET_REPORT,
+		(uint16_t)( USB_HID_REPORT_TYPE_FEATURE << 8 | data[0] ),
+		data };
+}
+
+
+task< int > device::setPosition( uint8_t position )
+{
+	unsigned char data[2] = { SERVUSB_REPORT_ID_DATA, position };
+	co_return co_await setFeature( data );
+}
+
+
+task< int > device::setEnabled( bool enabled )
+{
+	unsigned char data[2] = { SERVUSB_REPORT_ID_CONTROL, (unsigned char)( enabled ? SERVUSB_CONTROL_ENABLE_BIT : 0x00 ) };
+	co_return co_await setFeature( data );
+}
+
+
+} // namespace servusb_async
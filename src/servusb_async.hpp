@@ -0,0 +1,256 @@
+#ifndef _SERVUSB_ASYNC_HPP_
+#define _SERVUSB_ASYNC_HPP_
+
+
+// C++20 coroutine interface to ServUSBs.
+//
+// A single threaded executor owns a libusb context and waits on its pollfds,
+// so any number of devices and operations in flight can be written as straight
+// line coroutines:
+//
+//	servusb_async::task<void> sweep( servusb_async::executor & executor, servusb_address address )
+//	{
+//		servusb_async::device device( executor );
+//		if( co_await device.open( address.bus, address.dev ) < 0 )
+//			co_return;
+//		co_await device.setEnabled( true );
+//		for( int position = 0; position < 256; ++position )
+//			co_await device.setPosition( position );
+//	}
+//
+//	servusb_async::executor executor;
+//	for( auto address : executor.list() )
+//		executor.spawn( sweep( executor, address ) );
+//	executor.run();
+//
+// Like the C interface all operations return negative libusb error codes on failure.
+
+
+extern "C"
+{
+#include "servusb.h"
+}
+
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include <poll.h>
+
+
+namespace servusb_async
+{
+
+
+class executor;
+
+
+// Lazily started coroutine returning T, resumes its awaiter when done.
+template< typename T >
+class task
+{
+public:
+	struct promise_type;
+	using handle_type = std::coroutine_handle< promise_type >;
+
+	struct final_awaiter
+	{
+		bool await_ready() noexcept { return false; }
+		std::coroutine_handle<> await_suspend( handle_type handle ) noexcept
+		{
+			auto continuation = handle.promise().continuation;
+			return continuation ? continuation : std::noop_coroutine();
+		}
+		void await_resume() noexcept {}
+	};
+
+	struct promise_base
+	{
+		std::coroutine_handle<> continuation;
+		std::exception_ptr exception;
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		final_awaiter final_suspend() noexcept { return {}; }
+		void unhandled_exception() { exception = std::current_exception(); }
+	};
+
+	struct promise_type : promise_base
+	{
+		T value{};
+		task get_return_object() { return task( handle_type::from_promise( *this ) ); }
+		void return_value( T v ) { value = std::move( v ); }
+	};
+
+	task( task && other ) noexcept : handle( std::exchange( other.handle, nullptr ) ) {}
+	task & operator=( task && other ) noexcept
+	{
+		if( this != &other )
+		{
+			if( handle )
+				handle.destroy();
+			handle = std::exchange( other.handle, nullptr );
+		}
+		return *this;
+	}
+	~task() { if( handle ) handle.destroy(); }
+
+	bool await_ready() const noexcept { return !handle || handle.done(); }
+	std::coroutine_handle<> await_suspend( std::coroutine_handle<> awaiter ) noexcept
+	{
+		handle.promise().continuation = awaiter;
+		return handle; // symmetric transfer, runs the task right away without growing the stack
+	}
+	T await_resume()
+	{
+		if( handle.promise().exception )
+			std::rethrow_exception( handle.promise().exception );
+		return std::move( handle.promise().value );
+	}
+
+private:
+	explicit task( handle_type h ) : handle( h ) {}
+	handle_type handle;
+};
+
+
+template<>
+struct task< void >::promise_type : task< void >::promise_base
+{
+	task get_return_object() { return task( handle_type::from_promise( *this ) ); }
+	void return_void() {}
+};
+
+template<>
+inline void task< void >::await_resume()
+{
+	if( handle.promise().exception )
+		std::rethrow_exception( handle.promise().exception );
+}
+
+
+class executor
+{
+public:
+	// throws std::runtime_error if libusb can't be initialized
+	executor();
+	~executor();
+	executor( const executor & ) = delete;
+	executor & operator=( const executor & ) = delete;
+
+	// ServUSBs matching bus and dev (-1 matches any)
+	std::vector< servusb_address > list( int bus = -1, int dev = -1 );
+
+	// Starts a task owned by the executor, it runs within the next run().
+	void spawn( task< void > && task );
+	// Runs until all spawned tasks are done. Returns 0 or a libusb error code if
+	// waiting for events failed.
+	int run();
+
+	// co_await executor.schedule() lets other ready coroutines run first
+	struct schedule_awaiter
+	{
+		executor & owner;
+		bool await_ready() const noexcept { return false; }
+		void await_suspend( std::coroutine_handle<> handle ) { owner.ready.push_back( handle ); }
+		void await_resume() const noexcept {}
+	};
+	schedule_awaiter schedule() { return { *this }; }
+
+	// co_await executor.poll( fd, POLLIN ) waits for a file descriptor next to the USB events,
+	// returns the revents
+	struct poll_awaiter
+	{
+		executor & owner;
+		int fd;
+		short events;
+		short revents = 0;
+		bool await_ready() const noexcept { return false; }
+		void await_suspend( std::coroutine_handle<> handle ) { owner.waiters.push_back( { this, handle } ); }
+		short await_resume() const noexcept { return revents; }
+	};
+	poll_awaiter poll( int fd, short events ) { return { *this, fd, events }; }
+
+	libusb_context * context() const { return ctx; }
+
+private:
+	friend class device;
+	friend struct transfer_awaiter;
+
+	struct waiter
+	{
+		poll_awaiter * awaiter;
+		std::coroutine_handle<> handle;
+	};
+
+	int wait();
+	static void pollfdAdded( int fd, short events, void * user );
+	static void pollfdRemoved( int fd, void * user );
+
+	libusb_context * ctx;
+	std::deque< std::coroutine_handle<> > ready;
+	std::vector< waiter > waiters;
+	std::vector< pollfd > usbfds;
+	unsigned int active = 0;  // spawned tasks not done yet
+	unsigned int pending = 0; // transfers submitted but not completed
+};
+
+
+// Awaits a single control transfer, results in the number of bytes transferred
+// or a libusb error code.
+struct transfer_awaiter
+{
+	executor & owner;
+	libusb_device_handle * handle;
+	uint8_t requestType;
+	uint8_t request;
+	uint16_t value;
+	std::span< unsigned char > data;
+	libusb_transfer * transfer = nullptr;
+	std::coroutine_handle<> continuation;
+	int result = 0;
+
+	bool await_ready() const noexcept { return false; }
+	bool await_suspend( std::coroutine_handle<> handle );
+	int await_resume();
+
+private:
+	static void LIBUSB_CALL completed( libusb_transfer * transfer );
+};
+
+
+class device
+{
+public:
+	explicit device( executor & owner ) : owner( owner ) {}
+	~device() { close(); }
+	device( device && other ) noexcept : owner( other.owner ), handle( std::exchange( other.handle, nullptr ) ), address( other.address ) {}
+	device( const device & ) = delete;
+	device & operator=( const device & ) = delete;
+
+	// opens the first ServUSB matching bus and dev (-1 matches any), like servusb_open()
+	task< int > open( int bus = -1, int dev = -1 );
+	void close();
+	bool isOpen() const { return handle; }
+	servusb_address getAddress() const { return address; }
+
+	// data[0] is the report ID, results in the number of bytes transferred
+	transfer_awaiter setFeature( std::span< unsigned char > data );
+	transfer_awaiter getFeature( std::span< unsigned char > data );
+
+	task< int > setPosition( uint8_t position );
+	task< int > setEnabled( bool enabled );
+
+private:
+	executor & owner;
+	libusb_device_handle * handle = nullptr;
+	servusb_address address = { -1, -1 };
+};
+
+
+} // namespace servusb_async
+
+
+#endif
@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <getopt.h>
+
+#include "recorder.h"
+
+
+// Companion of servusb --record: lists the records of a log or converts it into an
+// animation file, which servusb --animate plays back against the devices.
+
+
+void print_usage( int argc, char ** argv )
+{
+	printf
+	(
+		"Lists the reports in a ServUSB recording or converts it into an animation for servusb --animate.\n"
+		"Usage: %s [-a] [--animation] file\n",
+		argv[0]
+	);
+}
+
+
+static void print_entry( const struct recorder_entry * entry )
+{
+	printf( "%" PRId64 ".%09" PRId64 " %3u:%-3u report %u %6" PRIu32 " ns %4" PRId32 " ",
+		entry->time / 1000000000, entry->time % 1000000000, entry->bus, entry->dev, entry->report, entry->latency, entry->result );
+	for( unsigned int i = 0; i < entry->length; ++i )
+		printf( " %02x", entry->payload[i] );
+	printf( "\n" );
+}
+
+
+int main( int argc, char ** argv )
+{
+	static struct option long_options[] =
+	{
+		{ "animation", no_argument, 0, 'a' },
+		{ 0,           0,           0, 0   }
+	};
+
+	bool animation = false;
+	int opt = 0;
+	int option_index = 0;
+	while( ( opt = getopt_long( argc, argv, "a", long_options, &option_index ) ) != -1 )
+	{
+		switch( opt )
+		{
+		case 'a':
+			animation = true;
+			break;
+		default:
+			print_usage( argc, argv );
+			return EXIT_FAILURE;
+		}
+	}
+	if( optind + 1 != argc )
+	{
+		print_usage( argc, argv );
+		return EXIT_FAILURE;
+	}
+
+	struct recorder_entry * entries;
+	int count = recorder_load( argv[optind], &entries );
+	if( count < 0 )
+		return EXIT_FAILURE;
+	int err = 0;
+	if( animation )
+		err = recorder_writeAnimation( stdout, entries, count );
+	else
+		for( int i = 0; i < count; ++i )
+			print_entry( &entries[i] );
+	free( entries );
+	return err ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,152 @@
+#ifndef _SERVUSB_SHM_H_
+#define _SERVUSB_SHM_H_
+
+// Shared memory setpoint table served by "servusb --shm=NAME".
+//
+// The table holds one slot per ServUSB. Producers update a slot with
+// servusb_shm_write(), which is a seqlock write and needs no system call.
+// Several producers may write the same slot, they are serialized by the sequence.
+// The servusb process polls the sequences and sends changed slots to the devices.
+//
+// Producers which must not override each other (say a sequencer, a manual override
+// and a safety supervisor) write lanes of their own with servusb_shm_write_lane().
+// Of the lanes holding a lease, the one with the highest number drives the device:
+// when its lease runs out or it is released, the next lower one takes over. With no
+// lane held the device keeps its last setpoint. Leases are CLOCK_MONOTONIC deadlines
+// in nanoseconds, the clock is shared by all processes of the machine.
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h> // clock_gettime() needs _POSIX_C_SOURCE or _DEFAULT_SOURCE
+
+
+#define SERVUSB_SHM_MAGIC   0x55567253 // "SrVU"
+#define SERVUSB_SHM_VERSION 2
+
+#define SERVUSB_SHM_LANES    4          // lane n overrides lanes 0 to n-1
+#define SERVUSB_SHM_RELEASED 0          // lease of a lane which doesn't drive the device
+#define SERVUSB_SHM_FOREVER  INT64_MAX  // lease held until released
+
+
+// Setpoint of one producer, a seqlock of its own.
+struct servusb_shm_lane
+{
+	uint32_t sequence;     // odd while a producer is writing, incremented by 2 per update
+	uint8_t position;
+	uint8_t enabled;
+	uint8_t reserved[2];
+	int64_t expires;       // lease, SERVUSB_SHM_RELEASED, a deadline or SERVUSB_SHM_FOREVER
+};
+
+
+// One cache line written by servusb and one for the lanes, so producers of different
+// devices don't contend.
+struct servusb_shm_slot
+{
+	uint32_t sent;         // sequence of the last update sent to the device (written by servusb)
+	uint32_t errors;       // failed transfers (written by servusb)
+	int32_t bus;           // USB address of the device (written by servusb, constant)
+	int32_t dev;
+	int32_t owner;         // lane of the last update sent, -1 for none yet (written by servusb)
+	uint8_t reserved[64 - 5 * 4];
+	struct servusb_shm_lane lane[SERVUSB_SHM_LANES];
+};
+
+
+struct servusb_shm
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t slots;
+	uint8_t reserved[64 - 3 * 4];
+	struct servusb_shm_slot slot[];
+};
+
+
+static inline uint64_t servusb_shm_size( uint32_t slots )
+{
+	return sizeof(struct servusb_shm) + (uint64_t)slots * sizeof(struct servusb_shm_slot);
+}
+
+
+// CLOCK_MONOTONIC in nanoseconds, as the leases are given
+static inline int64_t servusb_shm_now( void )
+{
+	struct timespec now;
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return now.tv_sec * 1000000000ll + now.tv_nsec;
+}
+
+
+// Sets the setpoint of a lane and its lease, SERVUSB_SHM_RELEASED gives the device
+// back to the lower lanes.
+static inline void servusb_shm_write_lane( struct servusb_shm_slot * slot, unsigned int lane, uint8_t position, bool enabled, int64_t expires )
+{
+	struct servusb_shm_lane * target = &slot->lane[lane];
+	uint32_t sequence = __atomic_load_n( &target->sequence, __ATOMIC_RELAXED );
+	for( ;; )
+	{
+		if( !( sequence & 1 ) && __atomic_compare_exchange_n( &target->sequence, &sequence, sequence + 1, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED ) )
+			break;
+		sequence = __atomic_load_n( &target->sequence, __ATOMIC_RELAXED ); // another producer is writing
+	}
+	__atomic_thread_fence( __ATOMIC_RELEASE ); // odd sequence becomes visible before the data
+	__atomic_store_n( &target->position, position, __ATOMIC_RELAXED );
+	__atomic_store_n( &target->enabled, enabled, __ATOMIC_RELAXED );
+	__atomic_store_n( &target->expires, expires, __ATOMIC_RELAXED );
+	__atomic_store_n( &target->sequence, sequence + 2, __ATOMIC_RELEASE );
+}
+
+
+// Reads a consistent copy of a lane, returns its sequence.
+static inline uint32_t servusb_shm_read_lane( const struct servusb_shm_slot * slot, unsigned int lane, uint8_t * position, bool * enabled, int64_t * expires )
+{
+	const struct servusb_shm_lane * source = &slot->lane[lane];
+	uint32_t before, after;
+	do
+	{
+		before = __atomic_load_n( &source->sequence, __ATOMIC_ACQUIRE );
+		*position = __atomic_load_n( &source->position, __ATOMIC_RELAXED );
+		*enabled = __atomic_load_n( &source->enabled, __ATOMIC_RELAXED );
+		*expires = __atomic_load_n( &source->expires, __ATOMIC_RELAXED );
+		__atomic_thread_fence( __ATOMIC_ACQUIRE );
+		after = __atomic_load_n( &source->sequence, __ATOMIC_RELAXED );
+	} while( ( before & 1 ) || before != after );
+	return before;
+}
+
+
+// Without arbitration: lane 0, held until released.
+static inline void servusb_shm_write( struct servusb_shm_slot * slot, uint8_t position, bool enabled )
+{
+	servusb_shm_write_lane( slot, 0, position, enabled, SERVUSB_SHM_FOREVER );
+}
+
+
+static inline uint32_t servusb_shm_read( const struct servusb_shm_slot * slot, uint8_t * position, bool * enabled )
+{
+	int64_t expires;
+	return servusb_shm_read_lane( slot, 0, position, enabled, &expires );
+}
+
+
+// Finds the highest lane holding a lease at the given time and reads its setpoint and
+// sequence. Returns the lane or -1 if none is held. Looks at SERVUSB_SHM_LANES lanes at
+// most and never waits for anything but a producer in the middle of its write.
+static inline int servusb_shm_arbitrate( const struct servusb_shm_slot * slot, int64_t now, uint8_t * position, bool * enabled, uint32_t * sequence )
+{
+	for( int lane = SERVUSB_SHM_LANES - 1; lane >= 0; --lane )
+	{
+		if( !__atomic_load_n( &slot->lane[lane].sequence, __ATOMIC_RELAXED ) ) // never written
+			continue;
+		int64_t expires;
+		*sequence = servusb_shm_read_lane( slot, lane, position, enabled, &expires );
+		if( expires != SERVUSB_SHM_RELEASED && expires > now )
+			return lane;
+	}
+	return -1;
+}
+
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef _SERVUSB_UDP_H_
+#define _SERVUSB_UDP_H_
+
+// Setpoint datagrams served by "servusb --udp=[host:]port".
+//
+// Each datagram sets one ServUSB, numbered in the order the server lists them when it
+// starts. Senders count the sequence up by one per datagram. The server drops datagrams
+// not newer than the last one it took for a device (duplicates and ones overtaken on the
+// way), and of those arriving during a transfer only the newest per device is sent.
+// A sender starting over sets SERVUSB_UDP_FLAG_RESET to have its sequence taken as is.
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+
+#define SERVUSB_UDP_VERSION 1
+#define SERVUSB_UDP_SIZE    8 // bytes per datagram
+
+#define SERVUSB_UDP_FLAG_ENABLE 0x01 // servo enabled, otherwise disabled
+#define SERVUSB_UDP_FLAG_RESET  0x02 // sequence starts over
+
+
+// Datagram layout: version, device, position, flags, then the sequence in little endian.
+struct servusb_udp_setpoint
+{
+	uint8_t device;
+	uint8_t position;
+	uint8_t flags;    // SERVUSB_UDP_FLAG_*
+	uint32_t sequence;
+};
+
+
+static inline void servusb_udp_pack( uint8_t datagram[SERVUSB_UDP_SIZE], const struct servusb_udp_setpoint * setpoint )
+{
+	datagram[0] = SERVUSB_UDP_VERSION;
+	datagram[1] = setpoint->device;
+	datagram[2] = setpoint->position;
+	datagram[3] = setpoint->flags;
+	for( unsigned int i = 0; i < 4; ++i )
+		datagram[4 + i] = setpoint->sequence >> ( 8 * i );
+}
+
+
+// false if the datagram is no setpoint of this version
+static inline bool servusb_udp_unpack( const uint8_t * datagram, size_t length, struct servusb_udp_setpoint * setpoint )
+{
+	if( length != SERVUSB_UDP_SIZE || datagram[0] != SERVUSB_UDP_VERSION )
+		return false;
+	setpoint->device = datagram[1];
+	setpoint->position = datagram[2];
+	setpoint->flags = datagram[3];
+	setpoint->sequence = 0;
+	for( unsigned int i = 0; i < 4; ++i )
+		setpoint->sequence |= (uint32_t)datagram[4 + i] << ( 8 * i );
+	return true;
+}
+
+
+// true if sequence comes after last, counting on across the wrap around
+static inline bool servusb_udp_newer( uint32_t sequence, uint32_t last )
+{
+	return (int32_t)( sequence - last ) > 0;
+}
+
+
+#endif
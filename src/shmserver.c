@@ -0,0 +1,244 @@
+#define _DEFAULT_SOURCE
+
+#include "shmserver.h"
+#include "trace.h"
+#include "servusb_shm.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+#define SHMSERVER_MAX_DEVICES 64
+
+
+struct device
+{
+	struct servusb * servusb;
+	int lane;          // lane of the last update picked up, -1 for none
+	uint32_t seen;     // its sequence
+	int position;      // last position sent, -1 if unknown
+	int enabled;       // last enable state sent, -1 if unknown
+};
+
+
+struct server
+{
+	const struct shmserver_config * config;
+	struct servusb_shm * shm;
+	struct device devices[SHMSERVER_MAX_DEVICES];
+	unsigned int count;
+	int running;
+	struct rtloop_stats stats;
+};
+
+
+static int sendSlot( struct device * device, uint8_t position, bool enabled, bool force )
+{
+	int err;
+	if( force || position != device->position || ( enabled && device->enabled != 1 ) )
+	{ // position first, so a servo being enabled starts in its new position
+		err = servusb_setPosition( device->servusb, position );
+		if( err < 0 )
+			return err;
+		device->position = position;
+	}
+	if( enabled != device->enabled )
+	{
+		err = servusb_setEnabled( device->servusb, enabled );
+		if( err < 0 )
+			return err;
+		device->enabled = enabled;
+	}
+	return 0;
+}
+
+
+static void cycle( void * argument )
+{
+	struct server * server = argument;
+	int64_t now = servusb_shm_now();
+	for( unsigned int i = 0; i < server->count; ++i )
+	{
+		struct servusb_shm_slot * slot = &server->shm->slot[i];
+		struct device * device = &server->devices[i];
+		uint8_t position;
+		bool enabled;
+		uint32_t sequence;
+		int lane = servusb_shm_arbitrate( slot, now, &position, &enabled, &sequence );
+		if( lane < 0 ) // nobody holds the device, it keeps its last setpoint
+			continue;
+		bool changed = lane != device->lane || sequence != device->seen; // a lane taking over sends its setpoint
+		if( !changed && !server->config->fixedRate )
+			continue;
+		device->lane = lane;
+		device->seen = sequence;
+		if( sendSlot( device, position, enabled, server->config->fixedRate ) < 0 )
+		{
+			device->position = device->enabled = -1; // resend everything with the next update
+			__atomic_fetch_add( &slot->errors, 1, __ATOMIC_RELAXED );
+			continue;
+		}
+		__atomic_store_n( &slot->owner, lane, __ATOMIC_RELAXED );
+		__atomic_store_n( &slot->sent, sequence, __ATOMIC_RELEASE );
+	}
+}
+
+
+static void * sender( void * argument )
+{
+	struct server * server = argument;
+	rtloop_prepare( &server->config->loop );
+	rtloop_run( &server->config->loop, cycle, server, &server->running, &server->stats );
+	return NULL;
+}
+
+
+int shmserver_run( const struct servusb_transport * transport, int bus, int dev, const struct shmserver_config * config )
+{
+	const char * name = config->name;
+	struct server server;
+	memset( &server, 0, sizeof(server) );
+	server.config = config;
+
+	struct servusb_address addresses[SHMSERVER_MAX_DEVICES];
+	int found = servusb_list( transport, bus, dev, addresses, SHMSERVER_MAX_DEVICES );
+	if( found < 0 )
+		return found;
+	if( !found )
+	{
+		fprintf( stderr, "Error: Could not find ServUSB!\n" );
+		return LIBUSB_ERROR_NOT_FOUND;
+	}
+
+	int err = 0;
+	for( int i = 0; i < found; ++i )
+	{
+		err = servusb_open( &server.devices[i].servusb, transport, addresses[i].bus, addresses[i].dev );
+		if( err )
+			goto close_devices;
+		server.devices[i].position = -1;
+		server.devices[i].enabled = -1;
+		server.devices[i].lane = -1;
+		server.count++;
+	}
+
+	uint64_t size = servusb_shm_size( server.count );
+	int fd = shm_open( name, O_CREAT | O_RDWR, 0660 );
+	if( fd < 0 )
+	{
+		fprintf( stderr, "Error: Unable to create shared memory %s: %s\n", name, strerror(errno) );
+		err = LIBUSB_ERROR_ACCESS;
+		goto close_devices;
+	}
+	if( ftruncate( fd, size ) < 0 || ( server.shm = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 ) ) == MAP_FAILED )
+	{
+		fprintf( stderr, "Error: Unable to map shared memory %s: %s\n", name, strerror(errno) );
+		close( fd );
+		shm_unlink( name );
+		err = LIBUSB_ERROR_NO_MEM;
+		goto close_devices;
+	}
+	close( fd );
+
+	memset( server.shm, 0, size );
+	server.shm->version = SERVUSB_SHM_VERSION;
+	server.shm->slots = server.count;
+	for( unsigned int i = 0; i < server.count; ++i )
+	{
+		server.shm->slot[i].bus = server.devices[i].servusb->bus;
+		server.shm->slot[i].dev = server.devices[i].servusb->dev;
+		server.shm->slot[i].owner = -1;
+		printf( "Slot %u: servo on bus %d, device %d.\n", i, server.shm->slot[i].bus, server.shm->slot[i].dev );
+	}
+	__atomic_store_n( &server.shm->magic, SERVUSB_SHM_MAGIC, __ATOMIC_RELEASE ); // table is ready
+
+	// only the main thread handles the signals
+	sigset_t signals;
+	sigemptyset( &signals );
+	sigaddset( &signals, SIGINT );
+	sigaddset( &signals, SIGTERM );
+	sigaddset( &signals, SIGUSR1 );
+	pthread_sigmask( SIG_BLOCK, &signals, NULL );
+
+	server.running = 1;
+	pthread_t thread;
+	if( pthread_create( &thread, NULL, sender, &server ) )
+	{
+		fprintf( stderr, "Error: Unable to start sender thread!\n" );
+		err = LIBUSB_ERROR_OTHER;
+	} else {
+		printf( "Serving %u slots in shared memory %s.\n", server.count, name );
+		int signal;
+		while( !sigwait( &signals, &signal ) && signal == SIGUSR1 )
+			trace_flush(); // trace so far on request
+		__atomic_store_n( &server.running, 0, __ATOMIC_RELAXED );
+		pthread_join( thread, NULL );
+		rtloop_print( &server.stats );
+		for( unsigned int i = 0; i < server.count; ++i )
+			printf( "Slot %u: %u errors, %u reconnects.\n", i, server.shm->slot[i].errors, server.devices[i].servusb->reconnects );
+	}
+	pthread_sigmask( SIG_UNBLOCK, &signals, NULL );
+
+	munmap( server.shm, size );
+	shm_unlink( name );
+
+close_devices:
+	for( unsigned int i = 0; i < server.count; ++i )
+		servusb_close( server.devices[i].servusb );
+	return err;
+}
+
+
+int shmserver_submit( const char * name, int bus, int dev, unsigned int lane, int lease, uint8_t position, bool enabled )
+{
+	int fd = shm_open( name, O_RDWR, 0 );
+	if( fd < 0 )
+	{
+		fprintf( stderr, "Error: Unable to open shared memory %s, is \"servusb --shm=%s\" running? %s\n", name, name, strerror(errno) );
+		return LIBUSB_ERROR_NOT_FOUND;
+	}
+	struct stat info;
+	struct servusb_shm * shm = MAP_FAILED;
+	if( !fstat( fd, &info ) && (uint64_t)info.st_size >= sizeof(struct servusb_shm) )
+		shm = mmap( NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+	close( fd );
+	if( shm == MAP_FAILED )
+	{
+		fprintf( stderr, "Error: Unable to map shared memory %s!\n", name );
+		return LIBUSB_ERROR_NO_MEM;
+	}
+
+	int written = 0;
+	if( __atomic_load_n( &shm->magic, __ATOMIC_ACQUIRE ) != SERVUSB_SHM_MAGIC || shm->version != SERVUSB_SHM_VERSION
+		|| servusb_shm_size( shm->slots ) > (uint64_t)info.st_size )
+	{
+		fprintf( stderr, "Error: Shared memory %s is no setpoint table of this version!\n", name );
+		written = LIBUSB_ERROR_NOT_SUPPORTED;
+	} else {
+		int64_t expires = lease < 0 ? SERVUSB_SHM_FOREVER : lease ? servusb_shm_now() + lease * 1000000ll : SERVUSB_SHM_RELEASED;
+		for( unsigned int i = 0; i < shm->slots; ++i )
+		{
+			struct servusb_shm_slot * slot = &shm->slot[i];
+			if( ( bus >= 0 && slot->bus != bus ) || ( dev >= 0 && slot->dev != dev ) )
+				continue;
+			servusb_shm_write_lane( slot, lane, position, enabled, expires );
+			written++;
+		}
+		if( !written )
+		{
+			fprintf( stderr, "Error: Could not find ServUSB!\n" );
+			written = LIBUSB_ERROR_NOT_FOUND;
+		}
+	}
+	munmap( shm, info.st_size );
+	return written;
+}
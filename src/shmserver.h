@@ -0,0 +1,32 @@
+#ifndef _SHMSERVER_H_
+#define _SHMSERVER_H_
+
+
+#include <stdbool.h>
+
+#include "servusb.h"
+#include "rtloop.h"
+
+
+struct shmserver_config
+{
+	const char * name;        // of the POSIX shared memory object
+	struct rtloop_config loop;
+	bool fixedRate;           // send every slot every period instead of changed slots only
+};
+
+
+// Creates the POSIX shared memory table (see servusb_shm.h) with one slot per ServUSB
+// matching bus and dev (-1 matches any). A sender thread wakes up every period and
+// sends the freshest setpoint of the slots to the devices.
+// Runs until SIGINT or SIGTERM. Returns a negative libusb error code on failure.
+int shmserver_run( const struct servusb_transport * transport, int bus, int dev, const struct shmserver_config * config );
+
+// Writes a setpoint into a lane of the slots served in shared memory name by a running
+// shmserver_run() for the ServUSBs matching bus and dev, see servusb_shm.h for how the
+// lanes are arbitrated. The lease is in milliseconds, -1 holds the lane until released and
+// 0 releases it. Returns the number of slots written or a negative libusb error code.
+int shmserver_submit( const char * name, int bus, int dev, unsigned int lane, int lease, uint8_t position, bool enabled );
+
+
+#endif
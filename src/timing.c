@@ -0,0 +1,146 @@
+#include "timing.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+
+// Aggregate file, text: the magic line, "runs N", then per phase
+// "count total min max name" with the times in nanoseconds.
+#define TIMING_MAGIC "servusb timing 1"
+
+#define TIMING_OTHER  TRACE_EVENTS       // time of the run outside of the traced phases
+#define TIMING_RUN    ( TRACE_EVENTS + 1 ) // the whole run
+#define TIMING_PHASES ( TRACE_EVENTS + 2 )
+
+
+struct totals
+{
+	uint64_t runs;
+	struct trace_phase phases[TIMING_PHASES];
+};
+
+
+static const char * phaseName( unsigned int phase )
+{
+	if( phase < TRACE_EVENTS )
+		return trace_getName( phase );
+	return phase == TIMING_OTHER ? "other" : "run";
+}
+
+
+static void add( struct trace_phase * phase, const struct trace_phase * more )
+{
+	if( !more->count )
+		return;
+	if( !phase->count || more->min < phase->min )
+		phase->min = more->min;
+	if( more->max > phase->max )
+		phase->max = more->max;
+	phase->total += more->total;
+	phase->count += more->count;
+}
+
+
+static void addSample( struct trace_phase * phase, int64_t duration )
+{
+	struct trace_phase sample = { 1, duration, duration, duration };
+	add( phase, &sample );
+}
+
+
+static void printTable( const struct trace_phase * phases, uint64_t runs )
+{
+	double run = phases[TIMING_RUN].total > 0 ? phases[TIMING_RUN].total : 1;
+	printf( "%-15s %9s %10s %10s %10s %10s %6s\n", "Phase", "Count/run", "ms/run", "Mean us", "Min us", "Max us", "Share" );
+	for( unsigned int i = 0; i < TIMING_PHASES; ++i )
+	{
+		const struct trace_phase * phase = &phases[i];
+		if( !phase->count )
+			continue;
+		printf( "%-15s %9.2f %10.3f %10.1f %10.1f %10.1f %5.1f%%\n", phaseName( i ),
+			(double)phase->count / runs, phase->total / 1e6 / runs, phase->total / 1e3 / phase->count,
+			phase->min / 1e3, phase->max / 1e3, 100.0 * phase->total / run );
+	}
+}
+
+
+static int load( FILE * file, struct totals * totals )
+{
+	char line[128];
+	if( !fgets( line, sizeof(line), file ) )
+		return feof( file ) ? 0 : -1; // empty, no runs yet
+	if( strcmp( line, TIMING_MAGIC "\n" ) )
+		return -1;
+	if( fscanf( file, "runs %" SCNu64 "\n", &totals->runs ) != 1 )
+		return -1;
+	struct trace_phase phase;
+	char name[32];
+	while( fscanf( file, "%" SCNu64 " %" SCNd64 " %" SCNd64 " %" SCNd64 " %31[^\n]\n", &phase.count, &phase.total, &phase.min, &phase.max, name ) == 5 )
+	{ // phases this build doesn't know are dropped
+		for( unsigned int i = 0; i < TIMING_PHASES; ++i )
+			if( !strcmp( name, phaseName( i ) ) )
+				add( &totals->phases[i], &phase );
+	}
+	return feof( file ) ? 0 : -1;
+}
+
+
+static int save( const char * path, const struct totals * totals )
+{
+	FILE * file = fopen( path, "w" );
+	if( !file )
+		return -1;
+	fprintf( file, TIMING_MAGIC "\nruns %" PRIu64 "\n", totals->runs );
+	for( unsigned int i = 0; i < TIMING_PHASES; ++i )
+	{
+		const struct trace_phase * phase = &totals->phases[i];
+		if( phase->count )
+			fprintf( file, "%" PRIu64 " %" PRId64 " %" PRId64 " %" PRId64 " %s\n", phase->count, phase->total, phase->min, phase->max, phaseName( i ) );
+	}
+	return fclose( file ) ? -1 : 0;
+}
+
+
+int timing_print( int64_t begin, const char * aggregate )
+{
+	int64_t end = latency_now();
+	struct trace_phase phases[TIMING_PHASES];
+	memset( phases, 0, sizeof(phases) );
+	trace_summarize( phases );
+	int64_t traced = 0;
+	for( unsigned int i = 0; i < TRACE_EVENTS; ++i )
+		traced += phases[i].total;
+	addSample( &phases[TIMING_OTHER], end - begin > traced ? end - begin - traced : 0 ); // threads may overlap
+	addSample( &phases[TIMING_RUN], end - begin );
+	printf( "Timing of this run:\n" );
+	printTable( phases, 1 );
+	if( !aggregate )
+		return 0;
+
+	struct totals totals;
+	memset( &totals, 0, sizeof(totals) );
+	FILE * file = fopen( aggregate, "r" );
+	if( file )
+	{
+		int err = load( file, &totals );
+		fclose( file );
+		if( err )
+		{
+			fprintf( stderr, "Error: %s is no timing file!\n", aggregate );
+			return -1;
+		}
+	}
+	totals.runs++;
+	for( unsigned int i = 0; i < TIMING_PHASES; ++i )
+		add( &totals.phases[i], &phases[i] );
+	if( save( aggregate, &totals ) )
+	{
+		fprintf( stderr, "Error: Unable to write timing to %s!\n", aggregate );
+		return -1;
+	}
+	printf( "Timing over %" PRIu64 " runs:\n", totals.runs );
+	printTable( totals.phases, totals.runs );
+	return 0;
+}
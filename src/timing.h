@@ -0,0 +1,20 @@
+#ifndef _TIMING_H_
+#define _TIMING_H_
+
+
+#include <stdint.h>
+
+
+// Where the time of a run went: the trace events recorded so far, added up per phase,
+// and what the run spent outside of them. With a file, the phases of each run are added
+// to it as well and the breakdown is printed over all runs it has seen, which averages
+// out the noise and shows what only the first run after plugging in pays (detaching the
+// kernel driver, a configuration reset).
+
+
+// Prints the breakdown of the run which started at begin (latency_now()) and, if aggregate
+// is not NULL, adds it to that file and prints the breakdown of all runs in it. Returns 0 or -1.
+int timing_print( int64_t begin, const char * aggregate );
+
+
+#endif
@@ -0,0 +1,259 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+
+// Binary trace file, all little endian:
+//   "SVTR", uint16 version (1), uint16 number of event names, uint32 number of events
+//   event names in enum trace_event order, each NUL terminated
+//   per event: int64 start (CLOCK_MONOTONIC ns), uint32 duration (ns), uint16 event,
+//              uint16 thread, int32 argument
+#define TRACE_MAGIC   "SVTR"
+#define TRACE_VERSION 1
+
+
+struct entry
+{
+	int64_t start;
+	uint32_t duration;
+	uint16_t event;
+	int32_t argument;
+};
+
+
+// Written by its thread only, read by whoever flushes. Rings stay around after
+// their thread is gone so its events can still be written.
+struct ring
+{
+	struct ring * next;
+	uint16_t thread;
+	uint32_t mask;
+	uint64_t head; // number of events ever recorded
+	struct entry entries[];
+};
+
+
+bool trace_enabled = false;
+
+static const char * tracePath = NULL;
+static uint32_t traceCapacity = 0;
+static struct ring * rings = NULL;
+static uint16_t threads = 0;
+static __thread struct ring * threadRing = NULL;
+
+static const char * const names[TRACE_EVENTS] =
+{
+	"init",
+	"enumerate",
+	"descriptors",
+	"open",
+	"detach",
+	"configure",
+	"claim",
+	"set report",
+	"get report",
+	"vendor request",
+	"close",
+	"cycle",
+};
+
+
+int trace_enable( const char * path, unsigned int capacity )
+{
+	if( !capacity || capacity > 0x80000000u )
+		return -1;
+	uint32_t size = 1;
+	while( size < capacity )
+		size <<= 1;
+	tracePath = path;
+	traceCapacity = size;
+	trace_enabled = true;
+	return 0;
+}
+
+
+static struct ring * addRing( void )
+{
+	struct ring * ring = calloc( 1, sizeof(struct ring) + traceCapacity * sizeof(struct entry) );
+	if( !ring )
+		return NULL;
+	ring->thread = __atomic_fetch_add( &threads, 1, __ATOMIC_RELAXED );
+	ring->mask = traceCapacity - 1;
+	ring->next = __atomic_load_n( &rings, __ATOMIC_RELAXED );
+	while( !__atomic_compare_exchange_n( &rings, &ring->next, ring, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED ) )
+		;
+	return ring;
+}
+
+
+void trace_record( enum trace_event event, int64_t start, int64_t end, int32_t argument )
+{
+	struct ring * ring = threadRing;
+	if( !ring )
+	{
+		ring = threadRing = addRing();
+		if( !ring )
+			return;
+	}
+	uint64_t head = ring->head;
+	struct entry * entry = &ring->entries[head & ring->mask];
+	entry->start = start;
+	entry->duration = end - start > UINT32_MAX ? UINT32_MAX : end - start;
+	entry->event = event;
+	entry->argument = argument;
+	__atomic_store_n( &ring->head, head + 1, __ATOMIC_RELEASE ); // publish the entry
+}
+
+
+const char * trace_getName( enum trace_event event )
+{
+	return event < TRACE_EVENTS ? names[event] : "unknown";
+}
+
+
+int64_t trace_summarize( struct trace_phase phases[TRACE_EVENTS] )
+{
+	memset( phases, 0, TRACE_EVENTS * sizeof(struct trace_phase) );
+	int64_t earliest = 0;
+	for( struct ring * ring = __atomic_load_n( &rings, __ATOMIC_ACQUIRE ); ring; ring = ring->next )
+	{
+		uint64_t head = __atomic_load_n( &ring->head, __ATOMIC_ACQUIRE );
+		uint64_t first = head < traceCapacity ? 0 : head - traceCapacity;
+		for( uint64_t n = first; n < head; ++n )
+		{
+			const struct entry * entry = &ring->entries[n & ring->mask];
+			if( entry->event >= TRACE_EVENTS )
+				continue;
+			struct trace_phase * phase = &phases[entry->event];
+			if( !phase->count || entry->duration < phase->min )
+				phase->min = entry->duration;
+			if( entry->duration > phase->max )
+				phase->max = entry->duration;
+			phase->total += entry->duration;
+			phase->count++;
+			if( !earliest || entry->start < earliest )
+				earliest = entry->start;
+		}
+	}
+	return earliest;
+}
+
+
+static void put( unsigned char * buffer, uint64_t value, unsigned int bytes )
+{
+	for( unsigned int i = 0; i < bytes; ++i, value >>= 8 )
+		buffer[i] = value;
+}
+
+
+static int writeBinary( FILE * file, struct ring * const * list, const uint64_t * heads, unsigned int count )
+{
+	uint32_t total = 0;
+	for( unsigned int i = 0; i < count; ++i )
+		total += heads[i] < traceCapacity ? heads[i] : traceCapacity;
+
+	unsigned char header[12];
+	memcpy( header, TRACE_MAGIC, 4 );
+	put( header + 4, TRACE_VERSION, 2 );
+	put( header + 6, TRACE_EVENTS, 2 );
+	put( header + 8, total, 4 );
+	fwrite( header, sizeof(header), 1, file );
+	for( unsigned int i = 0; i < TRACE_EVENTS; ++i )
+		fwrite( names[i], strlen( names[i] ) + 1, 1, file );
+
+	for( unsigned int i = 0; i < count; ++i )
+	{
+		uint64_t first = heads[i] < traceCapacity ? 0 : heads[i] - traceCapacity;
+		for( uint64_t n = first; n < heads[i]; ++n )
+		{
+			const struct entry * entry = &list[i]->entries[n & list[i]->mask];
+			unsigned char record[20];
+			put( record, entry->start, 8 );
+			put( record + 8, entry->duration, 4 );
+			put( record + 12, entry->event, 2 );
+			put( record + 14, list[i]->thread, 2 );
+			put( record + 16, (uint32_t)entry->argument, 4 );
+			fwrite( record, sizeof(record), 1, file );
+		}
+	}
+	return 0;
+}
+
+
+static int writeJson( FILE * file, struct ring * const * list, const uint64_t * heads, unsigned int count )
+{
+	const char * separator = "";
+	fprintf( file, "{\"traceEvents\":[" );
+	for( unsigned int i = 0; i < count; ++i )
+	{
+		uint64_t first = heads[i] < traceCapacity ? 0 : heads[i] - traceCapacity;
+		for( uint64_t n = first; n < heads[i]; ++n )
+		{
+			const struct entry * entry = &list[i]->entries[n & list[i]->mask];
+			fprintf( file, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%" PRId64 ".%03d,\"dur\":%" PRIu32 ".%03d,\"args\":{\"argument\":%" PRId32 "}}",
+				separator, trace_getName( entry->event ), list[i]->thread,
+				entry->start / 1000, (int)( entry->start % 1000 ), entry->duration / 1000, (int)( entry->duration % 1000 ),
+				entry->argument );
+			separator = ",";
+		}
+	}
+	fprintf( file, "\n]}\n" );
+	return 0;
+}
+
+
+int trace_write( const char * path )
+{
+	if( !traceCapacity )
+		return -1;
+
+	// snapshot of the rings and how far each one got
+	unsigned int count = 0;
+	struct ring * first = __atomic_load_n( &rings, __ATOMIC_ACQUIRE );
+	for( struct ring * ring = first; ring; ring = ring->next )
+		count++;
+	struct ring ** list = malloc( ( count ? count : 1 ) * sizeof(struct ring *) );
+	uint64_t * heads = malloc( ( count ? count : 1 ) * sizeof(uint64_t) );
+	if( !list || !heads )
+	{
+		free( list );
+		free( heads );
+		return -1;
+	}
+	unsigned int i = count;
+	for( struct ring * ring = first; ring; ring = ring->next )
+	{ // newest ring first in the list, oldest thread first in the file
+		--i;
+		list[i] = ring;
+		heads[i] = __atomic_load_n( &ring->head, __ATOMIC_ACQUIRE );
+	}
+
+	int err = -1;
+	FILE * file = fopen( path, "wb" );
+	if( !file )
+	{
+		fprintf( stderr, "Error: Unable to write trace to %s!\n", path );
+	} else {
+		size_t length = strlen( path );
+		if( length > 5 && !strcmp( path + length - 5, ".json" ) )
+			err = writeJson( file, list, heads, count );
+		else
+			err = writeBinary( file, list, heads, count );
+		if( fclose( file ) )
+			err = -1;
+	}
+	free( list );
+	free( heads );
+	return err;
+}
+
+
+int trace_flush( void )
+{
+	if( !tracePath )
+		return -1;
+	return trace_write( tracePath );
+}
@@ -0,0 +1,83 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "latency.h"
+
+
+// Host side tracing of the phases of talking to a device.
+//
+// Every thread records into a ring buffer of its own, so recording takes two
+// clock reads and a few stores without any locking. The newest events of all
+// threads are written out on request, as Chrome trace JSON (chrome://tracing,
+// Perfetto) if the file name ends in .json, otherwise in the binary format
+// described in trace.c.
+
+
+enum trace_event
+{
+	TRACE_INIT,       // libusb_init()
+	TRACE_ENUMERATE,  // getting the list of devices
+	TRACE_DESCRIPTORS, // looking through their device descriptors for a ServUSB
+	TRACE_OPEN,       // opening a device
+	TRACE_DETACH,     // detaching the kernel driver
+	TRACE_CONFIGURE,  // setting the configuration, which may reset it on the device
+	TRACE_CLAIM,      // claiming the interface
+	TRACE_SET_REPORT, // argument is the report ID or a negative error code
+	TRACE_GET_REPORT, // argument is the report ID or a negative error code
+	TRACE_VENDOR_REQUEST, // argument is the request or a negative error code
+	TRACE_CLOSE,
+	TRACE_CYCLE,      // one cycle of a realtime loop
+	TRACE_EVENTS
+};
+
+
+extern bool trace_enabled;
+
+
+// Starts recording up to capacity events per thread (rounded up to a power of two),
+// trace_flush() writes them to path. Returns 0 or -1.
+int trace_enable( const char * path, unsigned int capacity );
+
+// Writes the recorded events of all threads to the file given to trace_enable().
+// Threads may go on recording, events they overwrite meanwhile may be garbled.
+int trace_flush( void );
+int trace_write( const char * path );
+
+void trace_record( enum trace_event event, int64_t start, int64_t end, int32_t argument );
+
+const char * trace_getName( enum trace_event event );
+
+
+// time spent in one kind of event, in nanoseconds
+struct trace_phase
+{
+	uint64_t count;
+	int64_t total;
+	int64_t min;
+	int64_t max;
+};
+
+// Adds up the events of all threads still in their rings, per event. Returns the start of
+// the earliest one, 0 if there are none.
+int64_t trace_summarize( struct trace_phase phases[TRACE_EVENTS] );
+
+
+// start of a span, 0 if tracing is off
+static inline int64_t trace_begin( void )
+{
+	return trace_enabled ? latency_now() : 0;
+}
+
+
+static inline void trace_end( enum trace_event event, int64_t start, int32_t argument )
+{
+	if( trace_enabled && start )
+		trace_record( event, start, latency_now(), argument );
+}
+
+
+#endif
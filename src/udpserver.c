@@ -0,0 +1,318 @@
+#define _DEFAULT_SOURCE
+
+#include "udpserver.h"
+#include "servusb_udp.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+
+
+#define UDPSERVER_MAX_DEVICES 64
+
+
+struct device
+{
+	struct servusb * servusb;
+	bool seen;         // a datagram was taken, sequence is valid
+	uint32_t sequence; // of the last datagram taken
+	bool pending;      // taken but not sent yet
+	uint8_t pendingPosition;
+	bool pendingEnabled;
+	int64_t received;  // latency_now() when the pending datagram came in
+	int position;      // last position sent, -1 if unknown
+	int enabled;       // last enable state sent, -1 if unknown
+};
+
+
+struct udpserver
+{
+	struct device devices[UDPSERVER_MAX_DEVICES];
+	unsigned int count;
+	int socket;
+	int wake;          // eventfd written by udpserver_stop()
+	int epoll;
+	struct udpserver_stats stats;
+};
+
+
+static int sendSetpoint( struct device * device )
+{
+	int err;
+	bool enabled = device->pendingEnabled;
+	if( device->pendingPosition != device->position || ( enabled && device->enabled != 1 ) )
+	{ // position first, so a servo being enabled starts in its new position
+		err = servusb_setPosition( device->servusb, device->pendingPosition );
+		if( err < 0 )
+			return err;
+		device->position = device->pendingPosition;
+	}
+	if( enabled != device->enabled )
+	{
+		err = servusb_setEnabled( device->servusb, enabled );
+		if( err < 0 )
+			return err;
+		device->enabled = enabled;
+	}
+	return 0;
+}
+
+
+// takes everything queued, a newer datagram for a device replaces the pending one
+static int receive( struct udpserver * server )
+{
+	for( ;; )
+	{
+		uint8_t datagram[64]; // longer ones are cut short and don't fit anyway
+		ssize_t length = recv( server->socket, datagram, sizeof(datagram), 0 );
+		if( length < 0 )
+		{
+			if( errno == EAGAIN || errno == EWOULDBLOCK )
+				return 0;
+			if( errno == EINTR )
+				continue;
+			fprintf( stderr, "Error: Unable to receive setpoints: %s\n", strerror(errno) );
+			return LIBUSB_ERROR_IO;
+		}
+		int64_t now = latency_now();
+		server->stats.datagrams++;
+
+		struct servusb_udp_setpoint setpoint;
+		if( !servusb_udp_unpack( datagram, length, &setpoint ) || setpoint.device >= server->count )
+		{
+			server->stats.invalid++;
+			continue;
+		}
+		struct device * device = &server->devices[setpoint.device];
+		if( device->seen && !( setpoint.flags & SERVUSB_UDP_FLAG_RESET ) && !servusb_udp_newer( setpoint.sequence, device->sequence ) )
+		{
+			server->stats.dropped++;
+			continue;
+		}
+		if( device->pending )
+			server->stats.coalesced++;
+		device->seen = true;
+		device->sequence = setpoint.sequence;
+		device->pending = true;
+		device->pendingPosition = setpoint.position;
+		device->pendingEnabled = setpoint.flags & SERVUSB_UDP_FLAG_ENABLE;
+		device->received = now;
+	}
+}
+
+
+static void forward( struct udpserver * server )
+{
+	for( unsigned int i = 0; i < server->count; ++i )
+	{
+		struct device * device = &server->devices[i];
+		if( !device->pending )
+			continue;
+		device->pending = false;
+		if( sendSetpoint( device ) < 0 )
+		{
+			device->position = device->enabled = -1; // resend everything with the next datagram
+			server->stats.errors++;
+			continue;
+		}
+		latency_add( &server->stats.latency, latency_now() - device->received );
+		server->stats.updates++;
+	}
+}
+
+
+int udpserver_open( struct udpserver ** result, const struct servusb_transport * transport, int bus, int dev, const struct udpserver_config * config )
+{
+	struct servusb_address addresses[UDPSERVER_MAX_DEVICES];
+	int found = servusb_list( transport, bus, dev, addresses, UDPSERVER_MAX_DEVICES );
+	if( found < 0 )
+		return found;
+	if( !found )
+	{
+		fprintf( stderr, "Error: Could not find ServUSB!\n" );
+		return LIBUSB_ERROR_NOT_FOUND;
+	}
+
+	struct udpserver * server = calloc( 1, sizeof(struct udpserver) );
+	if( !server )
+		return LIBUSB_ERROR_NO_MEM;
+	server->socket = server->wake = server->epoll = -1;
+	latency_reset( &server->stats.latency );
+
+	int err = 0;
+	for( int i = 0; i < found; ++i )
+	{
+		err = servusb_open( &server->devices[i].servusb, transport, addresses[i].bus, addresses[i].dev );
+		if( err )
+			goto error;
+		server->devices[i].position = -1;
+		server->devices[i].enabled = -1;
+		server->count++;
+	}
+
+	struct addrinfo hints;
+	memset( &hints, 0, sizeof(hints) );
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_flags = AI_PASSIVE;
+	struct addrinfo * resolved;
+	int gai = getaddrinfo( config->host, config->port, &hints, &resolved );
+	if( gai )
+	{
+		fprintf( stderr, "Error: Unable to resolve %s:%s: %s\n", config->host ? config->host : "*", config->port, gai_strerror(gai) );
+		err = LIBUSB_ERROR_NOT_FOUND;
+		goto error;
+	}
+	for( struct addrinfo * address = resolved; address; address = address->ai_next )
+	{
+		server->socket = socket( address->ai_family, address->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, address->ai_protocol );
+		if( server->socket < 0 )
+			continue;
+		if( !bind( server->socket, address->ai_addr, address->ai_addrlen ) )
+			break;
+		close( server->socket );
+		server->socket = -1;
+	}
+	freeaddrinfo( resolved );
+	if( server->socket < 0 )
+	{
+		fprintf( stderr, "Error: Unable to listen on %s:%s: %s\n", config->host ? config->host : "*", config->port, strerror(errno) );
+		err = LIBUSB_ERROR_BUSY;
+		goto error;
+	}
+
+	server->wake = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+	server->epoll = epoll_create1( EPOLL_CLOEXEC );
+	struct epoll_event watch = { .events = EPOLLIN };
+	if( server->wake < 0 || server->epoll < 0 || epoll_ctl( server->epoll, EPOLL_CTL_ADD, server->socket, &watch ) < 0
+		|| epoll_ctl( server->epoll, EPOLL_CTL_ADD, server->wake, &watch ) < 0 )
+	{
+		fprintf( stderr, "Error: Unable to poll the socket: %s\n", strerror(errno) );
+		err = LIBUSB_ERROR_OTHER;
+		goto error;
+	}
+
+	*result = server;
+	return 0;
+
+error:
+	udpserver_close( server );
+	return err;
+}
+
+
+void udpserver_close( struct udpserver * server )
+{
+	if( server->epoll >= 0 )
+		close( server->epoll );
+	if( server->wake >= 0 )
+		close( server->wake );
+	if( server->socket >= 0 )
+		close( server->socket );
+	for( unsigned int i = 0; i < server->count; ++i )
+		servusb_close( server->devices[i].servusb );
+	free( server );
+}
+
+
+uint16_t udpserver_getPort( const struct udpserver * server )
+{
+	struct sockaddr_storage address;
+	socklen_t length = sizeof(address);
+	if( getsockname( server->socket, (struct sockaddr *)&address, &length ) )
+		return 0;
+	if( address.ss_family == AF_INET6 )
+		return ntohs( ( (struct sockaddr_in6 *)&address )->sin6_port );
+	return ntohs( ( (struct sockaddr_in *)&address )->sin_port );
+}
+
+
+int udpserver_serve( struct udpserver * server )
+{
+	for( ;; )
+	{
+		// coalesce everything queued since the last transfers - only the newest setpoint per device is sent
+		int err = receive( server );
+		if( err < 0 )
+			return err;
+		uint64_t stops;
+		bool stopping = read( server->wake, &stops, sizeof(stops) ) == sizeof(stops); // after the datagrams which came before
+		forward( server );
+		if( stopping )
+			return 0;
+
+		struct epoll_event event;
+		if( epoll_wait( server->epoll, &event, 1, -1 ) < 0 && errno != EINTR )
+		{
+			fprintf( stderr, "Error: Unable to poll the socket: %s\n", strerror(errno) );
+			return LIBUSB_ERROR_OTHER;
+		}
+	}
+}
+
+
+void udpserver_stop( struct udpserver * server )
+{
+	uint64_t stop = 1;
+	ssize_t written = write( server->wake, &stop, sizeof(stop) ); // only fails if 2^64 stops are pending
+	(void)written;
+}
+
+
+const struct udpserver_stats * udpserver_getStats( const struct udpserver * server )
+{
+	return &server->stats;
+}
+
+
+void udpserver_print( const struct udpserver_stats * stats )
+{
+	printf( "%llu datagrams, %llu invalid, %llu dropped out of order, %llu coalesced, %llu updates sent, %llu errors.\n",
+		(unsigned long long)stats->datagrams, (unsigned long long)stats->invalid, (unsigned long long)stats->dropped,
+		(unsigned long long)stats->coalesced, (unsigned long long)stats->updates, (unsigned long long)stats->errors );
+	latency_print( &stats->latency, "Datagram to transfer complete" );
+}
+
+
+static struct udpserver * running;
+
+
+static void stop( int signal )
+{
+	udpserver_stop( running );
+}
+
+
+int udpserver_run( const struct servusb_transport * transport, int bus, int dev, const struct udpserver_config * config )
+{
+	int err = udpserver_open( &running, transport, bus, dev, config );
+	if( err )
+		return err;
+
+	struct sigaction action;
+	memset( &action, 0, sizeof(action) );
+	action.sa_handler = stop;
+	sigaction( SIGINT, &action, NULL );
+	sigaction( SIGTERM, &action, NULL );
+
+	for( unsigned int i = 0; i < running->count; ++i )
+		printf( "Device %u: servo on bus %d, device %d.\n", i, running->devices[i].servusb->bus, running->devices[i].servusb->dev );
+	printf( "Serving %u devices on UDP port %u.\n", running->count, udpserver_getPort( running ) );
+	err = udpserver_serve( running );
+	udpserver_print( &running->stats );
+
+	signal( SIGINT, SIG_DFL );
+	signal( SIGTERM, SIG_DFL );
+	udpserver_close( running );
+	running = NULL;
+	return err;
+}
@@ -0,0 +1,56 @@
+#ifndef _UDPSERVER_H_
+#define _UDPSERVER_H_
+
+
+#include <stdint.h>
+
+#include "servusb.h"
+#include "latency.h"
+
+
+struct udpserver_config
+{
+	const char * host;  // address to listen on, NULL for all
+	const char * port;  // UDP port or service name, "0" for any free one
+};
+
+
+struct udpserver_stats
+{
+	uint64_t datagrams;  // received
+	uint64_t invalid;    // no setpoint or for a device not served
+	uint64_t dropped;    // not newer than the last one taken for the device
+	uint64_t coalesced;  // replaced by a newer one before they were sent
+	uint64_t updates;    // setpoints sent
+	uint64_t errors;     // failed transfers
+	struct latency latency; // datagram received to transfer complete
+};
+
+
+struct udpserver;
+
+
+// Opens every ServUSB matching bus and dev (-1 matches any) and binds the socket, datagrams
+// sent from now on are served. Returns 0 or a negative libusb error code.
+int udpserver_open( struct udpserver ** server, const struct servusb_transport * transport, int bus, int dev, const struct udpserver_config * config );
+void udpserver_close( struct udpserver * server );
+
+// the port bound, for config->port "0"
+uint16_t udpserver_getPort( const struct udpserver * server );
+
+// Receives datagrams and sends the newest setpoint per device over the open handles until
+// udpserver_stop(). Datagrams which arrived before the stop are served first. Returns 0 or
+// a negative libusb error code.
+int udpserver_serve( struct udpserver * server );
+// wakes udpserver_serve() up to return, async-signal-safe
+void udpserver_stop( struct udpserver * server );
+
+const struct udpserver_stats * udpserver_getStats( const struct udpserver * server );
+void udpserver_print( const struct udpserver_stats * stats );
+
+// Opens, serves until SIGINT or SIGTERM, then prints the statistics and the latency.
+// Returns a negative libusb error code on failure.
+int udpserver_run( const struct servusb_transport * transport, int bus, int dev, const struct udpserver_config * config );
+
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef _AVR_EEPROM_H_
+#define _AVR_EEPROM_H_
+
+// Host replacement for avr-libc's <avr/eeprom.h> - EEMEM variables are plain memory,
+// which keeps its contents over sim_reset() like the EEPROM does. Writes complete at once.
+
+
+#include <stdint.h>
+
+
+#define EEMEM
+
+
+extern unsigned int eeprom_writes; // counted by sim.c for the tests
+
+
+static inline uint8_t eeprom_read_byte( const uint8_t * address )
+{
+	return *address;
+}
+
+
+static inline void eeprom_write_byte( uint8_t * address, uint8_t value )
+{
+	*address = value;
+	eeprom_writes++;
+}
+
+
+#define eeprom_is_ready() 1
+
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef _AVR_INTERRUPT_H_
+#define _AVR_INTERRUPT_H_
+
+// Host replacement for avr-libc's <avr/interrupt.h> - an ISR becomes a plain
+// function named after its vector, which the simulator calls on a compare match.
+
+
+#include <avr/io.h>
+
+
+#define ISR( vector, ... ) \
+	void vector( void ); \
+	void vector( void )
+
+#define sei() ( SREG |= _BV(SREG_I) )
+#define cli() ( SREG &= ~_BV(SREG_I) )
+
+
+#endif
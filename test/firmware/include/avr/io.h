@@ -0,0 +1,121 @@
+#ifndef _AVR_IO_H_
+#define _AVR_IO_H_
+
+// Host replacement for avr-libc's <avr/io.h> - models the ATtiny85 registers used
+// by the firmware as plain variables, which are driven by the simulator in sim.c.
+
+
+#include <stdint.h>
+
+
+#define _BV(bit) (1 << (bit))
+
+
+extern volatile uint8_t SREG;
+
+extern volatile uint8_t DDRB;
+extern volatile uint8_t PORTB;
+extern volatile uint8_t PINB;
+
+extern volatile uint8_t MCUCR;
+extern volatile uint8_t MCUSR;
+extern volatile uint8_t GIMSK;
+extern volatile uint8_t GIFR;
+
+extern volatile uint8_t TIMSK;
+extern volatile uint8_t TIFR;
+
+extern volatile uint8_t TCCR0A;
+extern volatile uint8_t TCCR0B;
+extern volatile uint8_t TCNT0;
+extern volatile uint8_t OCR0A;
+extern volatile uint8_t OCR0B;
+
+extern volatile uint8_t TCCR1;
+extern volatile uint8_t TCNT1;
+extern volatile uint8_t OCR1A;
+extern volatile uint8_t OCR1B;
+extern volatile uint8_t OCR1C;
+
+
+// SREG
+#define SREG_I  7
+
+// PORTB / DDRB / PINB
+#define PB5     5
+#define PB4     4
+#define PB3     3
+#define PB2     2
+#define PB1     1
+#define PB0     0
+#define DDB5    5
+#define DDB4    4
+#define DDB3    3
+#define DDB2    2
+#define DDB1    1
+#define DDB0    0
+#define PINB5   5
+#define PINB4   4
+#define PINB3   3
+#define PINB2   2
+#define PINB1   1
+#define PINB0   0
+
+// MCUCR
+#define ISC01   1
+#define ISC00   0
+
+// MCUSR
+#define WDRF    3
+#define BORF    2
+#define EXTRF   1
+#define PORF    0
+
+// GIMSK / GIFR
+#define INT0    6
+#define PCIE    5
+#define INTF0   6
+#define PCIF    5
+
+// TIMSK / TIFR
+#define OCIE1A  6
+#define OCIE1B  5
+#define OCIE0A  4
+#define OCIE0B  3
+#define TOIE1   2
+#define TOIE0   1
+#define OCF1A   6
+#define OCF1B   5
+#define OCF0A   4
+#define OCF0B   3
+#define TOV1    2
+#define TOV0    1
+
+// TCCR0A
+#define COM0A1  7
+#define COM0A0  6
+#define COM0B1  5
+#define COM0B0  4
+#define WGM01   1
+#define WGM00   0
+
+// TCCR0B
+#define FOC0A   7
+#define FOC0B   6
+#define WGM02   3
+#define CS02    2
+#define CS01    1
+#define CS00    0
+
+// TCCR1
+#define CTC1    7
+#define PWM1A   6
+#define COM1A1  5
+#define COM1A0  4
+#define CS13    3
+#define CS12    2
+#define CS11    1
+#define CS10    0
+
+
+#endif
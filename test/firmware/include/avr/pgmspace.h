@@ -0,0 +1,15 @@
+#ifndef _AVR_PGMSPACE_H_
+#define _AVR_PGMSPACE_H_
+
+// Host replacement for avr-libc's <avr/pgmspace.h> - flash is ordinary memory.
+
+
+#include <stdint.h>
+
+
+#define PROGMEM
+
+#define pgm_read_byte( address ) ( *(const uint8_t *)(address) )
+
+
+#endif
@@ -0,0 +1,7 @@
+#ifndef _AVR_POWER_H_
+#define _AVR_POWER_H_
+
+// Host replacement for avr-libc's <avr/power.h>.
+
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef _AVR_SLEEP_H_
+#define _AVR_SLEEP_H_
+
+// Host replacement for avr-libc's <avr/sleep.h>.
+
+
+#define sleep_enable()
+#define sleep_disable()
+#define sleep_cpu()
+
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef _AVR_WDT_H_
+#define _AVR_WDT_H_
+
+// Host replacement for avr-libc's <avr/wdt.h> - there is no watchdog to feed.
+
+
+#define wdt_reset()
+#define wdt_disable()
+#define wdt_enable( timeout )
+
+
+#endif
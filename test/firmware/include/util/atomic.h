@@ -0,0 +1,17 @@
+#ifndef _UTIL_ATOMIC_H_
+#define _UTIL_ATOMIC_H_
+
+// Host replacement for avr-libc's <util/atomic.h>.
+
+
+#include <avr/io.h>
+
+
+#define ATOMIC_RESTORESTATE uint8_t sim_sreg_save = SREG
+#define ATOMIC_FORCEON      uint8_t sim_sreg_save = SREG | _BV(SREG_I)
+
+#define ATOMIC_BLOCK( type ) \
+	for( type, sim_atomic_once = ( SREG &= ~_BV(SREG_I), 1 ); sim_atomic_once; SREG = sim_sreg_save, sim_atomic_once = 0 )
+
+
+#endif
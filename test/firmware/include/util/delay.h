@@ -0,0 +1,17 @@
+#ifndef _UTIL_DELAY_H_
+#define _UTIL_DELAY_H_
+
+// Host replacement for avr-libc's <util/delay.h> - busy waiting advances the
+// simulated clock instead, so the timers keep running while the firmware waits.
+
+
+#include <stdint.h>
+
+
+void sim_run( uint32_t cycles );
+
+#define _delay_ms( ms ) sim_run( (uint32_t)( (ms) * ( (F_CPU) / 1000 ) ) )
+#define _delay_us( us ) sim_run( (uint32_t)( (us) * ( (F_CPU) / 1000000 ) ) )
+
+
+#endif
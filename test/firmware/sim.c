@@ -0,0 +1,287 @@
+#include "sim.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+
+volatile uint8_t SREG;
+
+volatile uint8_t DDRB;
+volatile uint8_t PORTB;
+volatile uint8_t PINB;
+
+volatile uint8_t MCUCR;
+volatile uint8_t MCUSR;
+volatile uint8_t GIMSK;
+volatile uint8_t GIFR;
+
+volatile uint8_t TIMSK;
+volatile uint8_t TIFR;
+
+volatile uint8_t TCCR0A;
+volatile uint8_t TCCR0B;
+volatile uint8_t TCNT0;
+volatile uint8_t OCR0A;
+volatile uint8_t OCR0B;
+
+volatile uint8_t TCCR1;
+volatile uint8_t TCNT1;
+volatile uint8_t OCR1A;
+volatile uint8_t OCR1B;
+volatile uint8_t OCR1C;
+
+unsigned int eeprom_writes = 0;
+
+
+// interrupt service routines provided by the firmware
+void TIM1_COMPA_vect( void );
+void TIM0_COMPA_vect( void );
+
+
+struct interrupt
+{
+	uint8_t bit; // in TIMSK and TIFR
+	void (*vector)( void );
+};
+
+// ordered by priority (vector number)
+static const struct interrupt interrupts[] =
+{
+	{ OCIE1A, TIM1_COMPA_vect },
+	{ OCIE0A, TIM0_COMPA_vect },
+};
+
+
+struct pin
+{
+	uint32_t count;
+	uint32_t width;
+	uint32_t period;
+	uint64_t start;
+};
+
+
+static uint64_t cycles = 0;
+
+static int16_t timer0ClearAt = -1; // TCNT0 value that matched OCR0A in CTC mode, counter clears on the next tick
+static int16_t timer1ClearAt = -1; // TCNT1 value that matched OCR1C in CTC mode, counter clears on the next tick
+
+static uint8_t pinState = 0;
+static struct pin pins[8];
+
+static uint32_t epilogue = 0;
+static uint8_t running = 0;  // handlers in progress, nested ones included
+static uint32_t nested = 0;
+
+
+void sim_reset( void )
+{
+	SREG = 0;
+	DDRB = PORTB = PINB = 0;
+	MCUCR = GIMSK = GIFR = 0;
+	MCUSR = _BV(PORF);
+	TIMSK = TIFR = 0;
+	TCCR0A = TCCR0B = TCNT0 = OCR0A = OCR0B = 0;
+	TCCR1 = TCNT1 = OCR1A = OCR1B = OCR1C = 0;
+
+	cycles = 0;
+	timer0ClearAt = -1;
+	timer1ClearAt = -1;
+	pinState = 0;
+	memset( pins, 0, sizeof(pins) );
+	epilogue = 0;
+	nested = 0;
+}
+
+
+uint64_t sim_getCycles( void )
+{
+	return cycles;
+}
+
+
+void sim_setEpilogue( uint32_t cycles )
+{
+	epilogue = cycles;
+}
+
+
+uint32_t sim_getNested( void )
+{
+	return nested;
+}
+
+
+static uint32_t timer0Prescaler( void )
+{
+	switch( TCCR0B & ( _BV(CS02) | _BV(CS01) | _BV(CS00) ) )
+	{
+	case 1: return 1;
+	case 2: return 8;
+	case 3: return 64;
+	case 4: return 256;
+	case 5: return 1024;
+	}
+	return 0; // stopped (or external clock source, which is never connected)
+}
+
+
+static uint32_t timer1Prescaler( void )
+{
+	uint8_t select = TCCR1 & ( _BV(CS13) | _BV(CS12) | _BV(CS11) | _BV(CS10) );
+	if( !select )
+		return 0; // stopped
+	return (uint32_t)1 << ( select - 1 );
+}
+
+
+static void sampleOutputs( void )
+{
+	uint8_t state = PORTB & DDRB;
+	uint8_t changed = state ^ pinState;
+	for( uint8_t i = 0; changed; ++i, changed >>= 1 )
+	{
+		if( !( changed & 1 ) )
+			continue;
+		struct pin * pin = &pins[i];
+		if( state & _BV(i) )
+		{ // rising edge
+			if( pin->count )
+				pin->period = cycles - pin->start;
+			pin->start = cycles;
+		} else { // falling edge
+			pin->width = cycles - pin->start;
+			pin->count++;
+		}
+	}
+	pinState = state;
+}
+
+
+static void dispatchInterrupts( void )
+{
+	uint8_t pending;
+	while( ( SREG & _BV(SREG_I) ) && ( pending = TIFR & TIMSK ) )
+	{
+		for( uint8_t i = 0; i < sizeof(interrupts) / sizeof(interrupts[0]); ++i )
+		{
+			if( !( pending & _BV(interrupts[i].bit) ) )
+				continue;
+			TIFR &= ~_BV(interrupts[i].bit); // flag is cleared when the vector is executed
+			if( running )
+				nested++;
+			running++;
+			SREG &= ~_BV(SREG_I);             // ISRs run with interrupts disabled
+			interrupts[i].vector();
+			bool interruptible = SREG & _BV(SREG_I);
+			SREG |= _BV(SREG_I);
+			sampleOutputs();
+			if( interruptible && running == 1 && epilogue )
+				sim_run( epilogue );
+			running--;
+			break;
+		}
+	}
+}
+
+
+static void timer0Tick( void )
+{
+	if( timer0ClearAt >= 0 && TCNT0 == timer0ClearAt )
+		TCNT0 = 0;
+	else
+		TCNT0++;
+	timer0ClearAt = -1;
+
+	if( TCNT0 == OCR0A )
+	{
+		TIFR |= _BV(OCF0A);
+		if( TCCR0A & _BV(WGM01) )
+			timer0ClearAt = TCNT0;
+	}
+	if( TCNT0 == OCR0B )
+		TIFR |= _BV(OCF0B);
+}
+
+
+static void timer1Tick( void )
+{
+	if( timer1ClearAt >= 0 && TCNT1 == timer1ClearAt )
+		TCNT1 = 0;
+	else
+		TCNT1++;
+	timer1ClearAt = -1;
+
+	if( TCNT1 == OCR1A )
+		TIFR |= _BV(OCF1A);
+	if( TCNT1 == OCR1B )
+		TIFR |= _BV(OCF1B);
+	if( ( TCCR1 & _BV(CTC1) ) && TCNT1 == OCR1C )
+		timer1ClearAt = TCNT1;
+}
+
+
+// the prescalers are free running, so a timer ticks whenever the clock is a multiple of its prescaler
+static uint64_t nextTick( uint32_t prescaler )
+{
+	return ( cycles / prescaler + 1 ) * prescaler;
+}
+
+
+void sim_run( uint32_t duration )
+{
+	uint64_t end = cycles + duration;
+	sampleOutputs();
+	dispatchInterrupts(); // something might have been enabled since the last run
+	while( cycles < end )
+	{
+		uint32_t prescaler0 = timer0Prescaler();
+		uint32_t prescaler1 = timer1Prescaler();
+		if( !prescaler0 )
+			timer0ClearAt = -1; // a stopped timer starts counting from whatever was written to TCNT0
+		if( !prescaler1 )
+			timer1ClearAt = -1;
+		uint64_t next = end;
+		if( prescaler0 && nextTick( prescaler0 ) < next )
+			next = nextTick( prescaler0 );
+		if( prescaler1 && nextTick( prescaler1 ) < next )
+			next = nextTick( prescaler1 );
+		cycles = next;
+		if( prescaler0 && cycles % prescaler0 == 0 )
+			timer0Tick();
+		if( prescaler1 && cycles % prescaler1 == 0 )
+			timer1Tick();
+		dispatchInterrupts();
+	}
+}
+
+
+void sim_runUntilIdle( void )
+{
+	while( timer0Prescaler() )
+		sim_run( 64 );
+}
+
+
+uint32_t sim_getPulseCount( uint8_t pin )
+{
+	return pins[pin].count;
+}
+
+
+uint32_t sim_getLastPulseWidth( uint8_t pin )
+{
+	return pins[pin].width;
+}
+
+
+uint64_t sim_getLastPulseStart( uint8_t pin )
+{
+	return pins[pin].start;
+}
+
+
+uint32_t sim_getLastPulsePeriod( uint8_t pin )
+{
+	return pins[pin].period;
+}
@@ -0,0 +1,39 @@
+#ifndef _SIM_H_
+#define _SIM_H_
+
+
+#include <stdint.h>
+
+#include <avr/io.h>
+
+
+// Resets the simulated ATtiny85 to its power-on register state and the clock to zero.
+void sim_reset( void );
+
+// Advances the simulated clock by the given number of CPU cycles, clocking the timers
+// and calling the firmware's interrupt service routines whenever they would fire.
+void sim_run( uint32_t cycles );
+
+// Runs until Timer/Counter0 is stopped, i.e. until a pulse in progress has completed.
+void sim_runUntilIdle( void );
+
+uint64_t sim_getCycles( void );
+
+// Makes a handler which returns with interrupts enabled (ISR_NOBLOCK, the Timer0 handler
+// behind timer0.c) take the given number of cycles from there to its reti, as if it was
+// interrupted in its epilogue. The timers run on meanwhile and interrupts coming due nest
+// into it, those return right away. 0, the default after sim_reset(), returns right away.
+void sim_setEpilogue( uint32_t cycles );
+
+// interrupts taken while a handler was running, since sim_reset()
+uint32_t sim_getNested( void );
+
+
+// Pulse statistics of an output pin on PORTB, updated whenever an ISR changes the pin.
+uint32_t sim_getPulseCount( uint8_t pin );
+uint32_t sim_getLastPulseWidth( uint8_t pin );  // in CPU cycles
+uint64_t sim_getLastPulseStart( uint8_t pin );  // in CPU cycles since sim_reset()
+uint32_t sim_getLastPulsePeriod( uint8_t pin ); // in CPU cycles between the last two rising edges
+
+
+#endif
@@ -0,0 +1,194 @@
+#include "test.h"
+#include "sim.h"
+
+#include "servo.h"
+#include "stats.h"
+#include "jitter.h"
+
+
+#define FRAME       ( (uint32_t)( 0.02 * (F_CPU) ) )    // nominal cycles between two frames
+#define MIN_PULSE   ( (uint32_t)( 0.0008 * (F_CPU) ) )  // nominal cycles of the shortest pulse
+#define MAX_PULSE   ( (uint32_t)( 0.00216 * (F_CPU) ) ) // nominal cycles of the longest pulse
+#define TICK        64                                  // timer0 resolution in cycles
+
+
+static const uint8_t pins[] = { PB0, PB3, PB4 };
+
+
+static void setUp( void )
+{
+	sim_reset();
+	memset( &stats, 0, sizeof(stats) );
+	jitter_reset();
+	servo_init();
+	SREG |= _BV(SREG_I);
+}
+
+
+static uint32_t expectedWidth( uint8_t position )
+{
+	return MIN_PULSE + (uint64_t)( MAX_PULSE - MIN_PULSE ) * position / 255;
+}
+
+
+static void test_init( void )
+{
+	setUp();
+	for( unsigned int i = 0; i < SERVO_CHANNELS; ++i )
+		TEST_ASSERT( DDRB & _BV(pins[i]) );
+	TEST_ASSERT( !( DDRB & ( _BV(PB1) | _BV(PB2) ) ) ); // USB data lines are left alone
+	sim_run( 3 * FRAME );
+	for( unsigned int i = 0; i < SERVO_CHANNELS; ++i )
+		TEST_ASSERT_EQUAL( 0, sim_getPulseCount( pins[i] ) );
+}
+
+
+static void test_positionRoundTrip( void )
+{
+	setUp();
+	for( unsigned int channel = 0; channel < SERVO_CHANNELS; ++channel )
+		for( unsigned int position = 0; position <= 255; ++position )
+		{
+			servo_setPosition( channel, position );
+			TEST_ASSERT_EQUAL( position, servo_getPosition( channel ) );
+		}
+	servo_setPosition( SERVO_CHANNELS, 1 ); // ignored
+	TEST_ASSERT_EQUAL( 0, servo_getPosition( SERVO_CHANNELS ) );
+}
+
+
+static void test_pulseWidth( void )
+{ // the whole range fits although it is longer than 255 ticks at 16.5 MHz
+	setUp();
+	servo_enable();
+	for( unsigned int position = 0; position <= 255; position += 5 )
+	{
+		for( unsigned int channel = 0; channel < SERVO_CHANNELS; ++channel )
+			servo_setPosition( channel, ( position + 85 * channel ) % 256 );
+		sim_run( FRAME * 11 / 10 );
+		sim_runUntilIdle();
+		for( unsigned int channel = 0; channel < SERVO_CHANNELS; ++channel )
+		{
+			uint32_t width = sim_getLastPulseWidth( pins[channel] );
+			uint32_t expected = expectedWidth( ( position + 85 * channel ) % 256 );
+			TEST_ASSERT( width + 2 * TICK >= expected && width <= expected + 2 * TICK );
+		}
+	}
+}
+
+
+static void test_sequence( void )
+{ // servos are pulsed one after the other within each frame
+	setUp();
+	for( unsigned int channel = 0; channel < SERVO_CHANNELS; ++channel )
+		servo_setPosition( channel, 255 );
+	servo_enable();
+	sim_run( 10 * FRAME );
+	sim_runUntilIdle();
+	for( unsigned int channel = 0; channel < SERVO_CHANNELS; ++channel )
+	{
+		TEST_ASSERT( sim_getPulseCount( pins[channel] ) >= 9 );
+		uint32_t period = sim_getLastPulsePeriod( pins[channel] );
+		TEST_ASSERT( period >= FRAME * 99 / 100 && period <= FRAME * 101 / 100 );
+		if( channel )
+		{
+			uint64_t previousEnd = sim_getLastPulseStart( pins[channel - 1] ) + sim_getLastPulseWidth( pins[channel - 1] );
+			TEST_ASSERT( sim_getLastPulseStart( pins[channel] ) >= previousEnd );
+			TEST_ASSERT( sim_getLastPulseStart( pins[channel] ) <= previousEnd + TICK );
+		}
+	}
+	TEST_ASSERT_EQUAL( 0, stats.overruns );
+	TEST_ASSERT_EQUAL( 0, stats.latePulses );
+	TEST_ASSERT_EQUAL( jitter.pulses, jitter.histogram[0] );
+}
+
+
+// a late end of one pulse is a late start of the next one, which comes out shorter
+static void test_jitter( void )
+{
+	setUp();
+	for( unsigned int channel = 0; channel < SERVO_CHANNELS; ++channel )
+		servo_setPosition( channel, 128 );
+	servo_enable();
+	sim_run( 2 * FRAME );
+	sim_runUntilIdle();
+	uint32_t width = sim_getLastPulseWidth( pins[0] );
+	TEST_ASSERT_EQUAL( 0, jitter.longest );
+
+	sim_run( FRAME - ( sim_getCycles() - sim_getLastPulseStart( pins[0] ) ) + width - 2 * TICK );
+	TEST_ASSERT( PORTB & _BV(pins[0]) );
+	SREG &= ~_BV(SREG_I);
+	sim_run( width + 10 * TICK - ( sim_getCycles() - sim_getLastPulseStart( pins[0] ) ) );
+	SREG |= _BV(SREG_I);
+	sim_runUntilIdle();
+	uint32_t longer = ( sim_getLastPulseWidth( pins[0] ) - width + TICK / 2 ) / TICK;
+	uint32_t shorter = ( width - sim_getLastPulseWidth( pins[1] ) + TICK / 2 ) / TICK;
+	TEST_ASSERT( longer >= 9 && longer <= 11 );
+	TEST_ASSERT_EQUAL( longer, shorter );
+	TEST_ASSERT_EQUAL( longer, jitter.longest );
+	TEST_ASSERT_EQUAL( -(int)shorter, jitter.shortest );
+	TEST_ASSERT_EQUAL( 2, jitter.histogram[5] );
+}
+
+
+// start and width of the first pulses of each servo, with the handlers taking the given
+// number of cycles to return after enabling interrupts
+#define RECORDED 4
+
+static void recordPulses( uint32_t epilogue, uint64_t start[RECORDED][SERVO_CHANNELS], uint32_t width[RECORDED][SERVO_CHANNELS] )
+{
+	setUp();
+	for( unsigned int channel = 0; channel < SERVO_CHANNELS; ++channel )
+		servo_setPosition( channel, 255 * channel / SERVO_CHANNELS );
+	servo_enable();
+	sim_setEpilogue( epilogue );
+	uint32_t counts[SERVO_CHANNELS] = { 0 };
+	while( counts[SERVO_CHANNELS - 1] < RECORDED )
+	{
+		TEST_ASSERT( sim_getCycles() < ( RECORDED + 2 ) * (uint64_t)FRAME );
+		sim_run( TICK );
+		for( unsigned int channel = 0; channel < SERVO_CHANNELS; ++channel )
+		{
+			uint32_t count = sim_getPulseCount( pins[channel] );
+			if( count == counts[channel] || count > RECORDED )
+				continue;
+			TEST_ASSERT_EQUAL( counts[channel] + 1, count ); // none missed between two looks
+			start[count - 1][channel] = sim_getLastPulseStart( pins[channel] );
+			width[count - 1][channel] = sim_getLastPulseWidth( pins[channel] );
+			counts[channel] = count;
+		}
+	}
+}
+
+
+// Timer0 interrupts coming in while the handlers are still returning - the Timer1 one from
+// starting a frame, the Timer0 one after its edges - nest without moving an edge
+static void test_nested( void )
+{
+	static uint64_t start[RECORDED][SERVO_CHANNELS], nestedStart[RECORDED][SERVO_CHANNELS];
+	static uint32_t width[RECORDED][SERVO_CHANNELS], nestedWidth[RECORDED][SERVO_CHANNELS];
+	recordPulses( 0, start, width );
+	TEST_ASSERT_EQUAL( 0, sim_getNested() );
+	recordPulses( MAX_PULSE, nestedStart, nestedWidth ); // the next compare match comes first
+	TEST_ASSERT( sim_getNested() >= RECORDED * SERVO_CHANNELS );
+	TEST_ASSERT( !memcmp( start, nestedStart, sizeof(start) ) );
+	TEST_ASSERT( !memcmp( width, nestedWidth, sizeof(width) ) );
+	TEST_ASSERT_EQUAL( 0, stats.overruns );
+	TEST_ASSERT_EQUAL( 0, stats.latePulses );
+	TEST_ASSERT_EQUAL( jitter.pulses, jitter.histogram[0] );
+}
+
+
+int main( int argc, char ** argv )
+{
+	static const struct test tests[] =
+	{
+		TEST( test_init ),
+		TEST( test_positionRoundTrip ),
+		TEST( test_pulseWidth ),
+		TEST( test_sequence ),
+		TEST( test_jitter ),
+		TEST( test_nested ),
+	};
+	return test_run( tests, sizeof(tests) / sizeof(tests[0]), argc, argv );
+}
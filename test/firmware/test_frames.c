@@ -0,0 +1,266 @@
+#include "test.h"
+#include "sim.h"
+
+#include "usbdrv/usbdrv.h"
+#include "servo.h"
+#include "stats.h"
+#include "frame.h"
+#include "status.h"
+
+
+#define SERVUSB_REPORT_ID_CONTROL 0x01
+#define SERVUSB_REPORT_ID_FRAME   0x04
+#define SERVUSB_REPORT_ID_STATUS  0x07
+
+#define SERVUSB_CONTROL_ENABLE_BIT 0x01
+
+#define USB_HID_REPORT_TYPE_FEATURE 3
+
+#define USB_FRAME   ( (uint32_t)( 0.001 * (F_CPU) ) ) // cycles between two keep-alives
+#define MIN_PULSE   ( (uint32_t)( 0.0008 * (F_CPU) ) )
+#define MAX_PULSE   ( (uint32_t)( 0.00216 * (F_CPU) ) )
+#define TICK        64
+
+
+static void setUp( void )
+{
+	sim_reset();
+	memset( &stats, 0, sizeof(stats) );
+	usbSofCount = 0;
+	frameBase = 0;
+	frameSofCount = 0;
+	servo_init();
+	SREG |= _BV(SREG_I);
+}
+
+
+// lets the given number of USB frames pass, with the main loop folding in the count now and then
+static void runFrames( unsigned int frames )
+{
+	for( unsigned int i = 0; i < frames; ++i )
+	{
+		sim_run( USB_FRAME );
+		usbSofCount++;
+		if( i % 100 == 99 )
+			frame_update();
+	}
+	frame_update();
+}
+
+
+static usbMsgLen_t setup( uint8_t type, uint8_t request, uint8_t reportID )
+{
+	usbRequest_t rq;
+	memset( &rq, 0, sizeof(rq) );
+	rq.bmRequestType = type | USBRQ_RCPT_INTERFACE;
+	rq.bRequest = request;
+	rq.wValue.bytes[0] = reportID;
+	rq.wValue.bytes[1] = USB_HID_REPORT_TYPE_FEATURE;
+	return usbFunctionSetup( (uchar *)&rq );
+}
+
+
+static uint8_t schedule( uint16_t frame, const uint8_t * positions, uint8_t count )
+{
+	uint8_t data[8] = { SERVUSB_REPORT_ID_FRAME, frame, frame >> 8, 0, 0 };
+	memcpy( data + 5, positions, count );
+	setup( USBRQ_TYPE_CLASS | USBRQ_DIR_HOST_TO_DEVICE, USBRQ_HID_SET_REPORT, SERVUSB_REPORT_ID_FRAME );
+	return usbFunctionWrite( data, 5 + count );
+}
+
+
+struct frameReport
+{
+	uint8_t length;
+	uint16_t frame;
+	uint16_t update;
+	uint8_t positions[SERVO_CHANNELS];
+};
+
+
+static struct frameReport getFrame( void )
+{
+	struct frameReport report;
+	uint8_t data[8] = { 0 };
+	setup( USBRQ_TYPE_CLASS | USBRQ_DIR_DEVICE_TO_HOST, USBRQ_HID_GET_REPORT, SERVUSB_REPORT_ID_FRAME );
+	report.length = usbFunctionRead( data, 8 );
+	report.frame = data[1] | data[2] << 8;
+	report.update = data[3] | data[4] << 8;
+	memcpy( report.positions, data + 5, SERVO_CHANNELS );
+	return report;
+}
+
+
+static struct status getStatus( void )
+{
+	uint8_t report[1 + sizeof(struct status)];
+	setup( USBRQ_TYPE_CLASS | USBRQ_DIR_DEVICE_TO_HOST, USBRQ_HID_GET_REPORT, SERVUSB_REPORT_ID_STATUS );
+	for( uint8_t length = 0; length < sizeof(report); ) // in chunks of 8 bytes
+		length += usbFunctionRead( report + length, sizeof(report) - length < 8 ? sizeof(report) - length : 8 );
+	struct status status;
+	memcpy( &status, report + 1, sizeof(status) );
+	return status;
+}
+
+
+static void enable( void )
+{
+	uint8_t data[2] = { SERVUSB_REPORT_ID_CONTROL, SERVUSB_CONTROL_ENABLE_BIT };
+	setup( USBRQ_TYPE_CLASS | USBRQ_DIR_HOST_TO_DEVICE, USBRQ_HID_SET_REPORT, SERVUSB_REPORT_ID_CONTROL );
+	usbFunctionWrite( data, sizeof(data) );
+}
+
+
+static uint32_t expectedWidth( uint8_t position )
+{
+	return MIN_PULSE + (uint64_t)( MAX_PULSE - MIN_PULSE ) * position / 255;
+}
+
+
+static void test_frameCounter( void )
+{
+	setUp();
+	struct frameReport report = getFrame();
+	TEST_ASSERT_EQUAL( 5 + SERVO_CHANNELS, report.length );
+	TEST_ASSERT_EQUAL( 0, report.frame );
+	runFrames( 1000 ); // usbSofCount wraps several times
+	TEST_ASSERT_EQUAL( 1000, getFrame().frame );
+	usbSofCount += 7; // counted but not folded in yet
+	TEST_ASSERT_EQUAL( 1007, getFrame().frame );
+	frameBase = 0xfffe;
+	frameSofCount = usbSofCount;
+	runFrames( 3 );
+	TEST_ASSERT_EQUAL( 1, getFrame().frame );
+}
+
+
+static void test_scheduledPositions( void )
+{
+	setUp();
+	enable();
+	runFrames( 30 );
+	static const uint8_t positions[] = { 255, 128, 0 };
+	uint16_t due = getFrame().frame + 50;
+	TEST_ASSERT_EQUAL( 1, schedule( due, positions, SERVO_CHANNELS ) );
+
+	// nothing moves before the frame
+	while( getFrame().frame < due - 1 )
+	{
+		runFrames( 1 );
+		TEST_ASSERT_EQUAL( 0, servo_getPosition( 0 ) );
+	}
+	TEST_ASSERT( sim_getLastPulseWidth( PB0 ) <= expectedWidth( 0 ) + 2 * TICK );
+
+	// the first update in or after the frame takes them over
+	runFrames( 21 );
+	struct frameReport report = getFrame();
+	TEST_ASSERT( report.update >= due && report.update < due + 20 );
+	sim_runUntilIdle();
+	for( unsigned int i = 0; i < SERVO_CHANNELS; ++i )
+	{
+		TEST_ASSERT_EQUAL( positions[i], servo_getPosition( i ) );
+		TEST_ASSERT_EQUAL( positions[i], report.positions[i] );
+	}
+	uint32_t width = sim_getLastPulseWidth( PB0 );
+	TEST_ASSERT( width + TICK >= expectedWidth( 255 ) && width <= expectedWidth( 255 ) + 2 * TICK );
+}
+
+
+static void test_shortReportKeepsPositions( void )
+{
+	setUp();
+	enable();
+	for( unsigned int i = 0; i < SERVO_CHANNELS; ++i )
+		servo_setPosition( i, 10 + i );
+	static const uint8_t position = 99;
+	TEST_ASSERT_EQUAL( 1, schedule( 5, &position, 1 ) );
+	runFrames( 30 );
+	TEST_ASSERT_EQUAL( 99, servo_getPosition( 0 ) );
+	for( unsigned int i = 1; i < SERVO_CHANNELS; ++i )
+		TEST_ASSERT_EQUAL( 10 + i, servo_getPosition( i ) );
+
+	uint8_t data[8] = { SERVUSB_REPORT_ID_FRAME, 0, 0, 0, 0 };
+	setup( USBRQ_TYPE_CLASS | USBRQ_DIR_HOST_TO_DEVICE, USBRQ_HID_SET_REPORT, SERVUSB_REPORT_ID_FRAME );
+	TEST_ASSERT_EQUAL( 0xff, usbFunctionWrite( data, 5 ) ); // no position at all
+}
+
+
+static void test_scheduleOrderAndLimit( void )
+{
+	setUp();
+	enable();
+	uint8_t positions[SERVO_CHANNELS] = { 0 };
+	for( unsigned int i = 0; i < SERVO_SCHEDULE; ++i )
+	{
+		positions[0] = 100 + i;
+		TEST_ASSERT_EQUAL( 1, schedule( 100 + 20 * i, positions, SERVO_CHANNELS ) );
+	}
+	TEST_ASSERT_EQUAL( 0xff, schedule( 1000, positions, SERVO_CHANNELS ) ); // full
+	TEST_ASSERT_EQUAL( 1, stats.stalls );
+
+	for( unsigned int i = 0; i < SERVO_SCHEDULE; ++i )
+	{
+		while( getFrame().frame < 100 + 20 * i + 20 )
+			runFrames( 1 );
+		TEST_ASSERT_EQUAL( 100 + i, servo_getPosition( 0 ) );
+	}
+
+	// late ones are applied at the next update, the ring is reused
+	for( unsigned int round = 0; round < 3; ++round )
+	{
+		positions[0] = round;
+		TEST_ASSERT_EQUAL( 1, schedule( 0, positions, SERVO_CHANNELS ) );
+		runFrames( 20 );
+		TEST_ASSERT_EQUAL( round, servo_getPosition( 0 ) );
+	}
+}
+
+
+// the status tells the setpoint waiting for its frame apart from the one pulsed
+static void test_statusSchedule( void )
+{
+	setUp();
+	enable();
+	for( unsigned int i = 0; i < SERVO_CHANNELS; ++i )
+		servo_setPosition( i, 10 + i );
+	uint8_t positions[SERVO_CHANNELS] = { 0 };
+	positions[0] = 200;
+	TEST_ASSERT_EQUAL( 1, schedule( 100, positions, SERVO_CHANNELS ) );
+	positions[0] = 210;
+	TEST_ASSERT_EQUAL( 1, schedule( 200, positions, SERVO_CHANNELS ) );
+
+	struct status status = getStatus();
+	TEST_ASSERT( status.flags & STATUS_FLAG_COUNT_SOF );
+	TEST_ASSERT_EQUAL( 2, status.scheduled );
+	TEST_ASSERT_EQUAL( 210, status.commanded[0] );
+	TEST_ASSERT_EQUAL( 10, status.pulsed[0] );
+	for( unsigned int i = 1; i < SERVO_CHANNELS; ++i )
+	{
+		TEST_ASSERT_EQUAL( 0, status.commanded[i] );
+		TEST_ASSERT_EQUAL( 10 + i, status.pulsed[i] );
+	}
+
+	runFrames( 120 );
+	status = getStatus();
+	TEST_ASSERT_EQUAL( 1, status.scheduled );
+	TEST_ASSERT_EQUAL( 210, status.commanded[0] );
+	TEST_ASSERT_EQUAL( 200, status.pulsed[0] );
+	runFrames( 100 );
+	status = getStatus();
+	TEST_ASSERT_EQUAL( 0, status.scheduled );
+	TEST_ASSERT_EQUAL( 210, status.pulsed[0] );
+}
+
+
+int main( int argc, char ** argv )
+{
+	static const struct test tests[] =
+	{
+		TEST( test_frameCounter ),
+		TEST( test_scheduledPositions ),
+		TEST( test_shortReportKeepsPositions ),
+		TEST( test_scheduleOrderAndLimit ),
+		TEST( test_statusSchedule ),
+	};
+	return test_run( tests, sizeof(tests) / sizeof(tests[0]), argc, argv );
+}
@@ -0,0 +1,239 @@
+#include "test.h"
+#include "sim.h"
+
+#include "usbdrv/usbdrv.h"
+#include "servo.h"
+#include "stats.h"
+#include "jitter.h"
+
+
+#define SERVUSB_REPORT_ID_DATA 0x02
+
+#define USB_HID_REPORT_TYPE_FEATURE 3
+
+#define FRAME       ( (uint32_t)( 0.0225 * (F_CPU) ) ) // nominal cycles between two frames
+#define PULSE       ( (uint32_t)( 0.0003 * (F_CPU) ) ) // nominal cycles of a separator pulse
+#define MIN_CHANNEL ( (uint32_t)( 0.001 * (F_CPU) ) )  // nominal cycles of the shortest channel
+#define MAX_CHANNEL ( (uint32_t)( 0.002 * (F_CPU) ) )  // nominal cycles of the longest channel
+#define TICK        64                                 // timer0 resolution in cycles
+#define STEP        8                                  // cycles between looking at the pin
+
+
+static void setUp( void )
+{
+	sim_reset();
+	memset( &stats, 0, sizeof(stats) );
+	jitter_reset();
+	servo_init();
+	SREG |= _BV(SREG_I);
+}
+
+
+static uint32_t expectedChannel( uint8_t position )
+{
+	return MIN_CHANNEL + (uint64_t)( MAX_CHANNEL - MIN_CHANNEL ) * position / 255;
+}
+
+
+// separator pulses on PB0 in one frame and the start of the next one
+struct edges
+{
+	unsigned int pulses;
+	uint64_t rising[SERVO_CHANNELS + 2];
+	uint64_t falling[SERVO_CHANNELS + 2];
+	uint64_t next;
+};
+
+
+static void recordFrame( struct edges * edges )
+{
+	memset( edges, 0, sizeof(*edges) );
+	// wait for the sync gap
+	uint64_t low = sim_getCycles();
+	while( sim_getCycles() - low < MAX_CHANNEL * 2 )
+	{
+		sim_run( STEP );
+		if( PORTB & _BV(PB0) )
+			low = sim_getCycles();
+	}
+	bool high = false;
+	uint64_t end = sim_getCycles() + 3 * FRAME;
+	while( sim_getCycles() < end )
+	{
+		sim_run( STEP );
+		uint64_t cycles = sim_getCycles();
+		bool now = PORTB & _BV(PB0);
+		if( now && !high )
+		{
+			if( edges->pulses && cycles - edges->falling[edges->pulses - 1] > MAX_CHANNEL )
+			{ // after the sync gap
+				edges->next = cycles;
+				return;
+			}
+			if( edges->pulses == sizeof(edges->rising) / sizeof(edges->rising[0]) )
+				return;
+			edges->rising[edges->pulses] = cycles;
+		}
+		if( !now && high )
+			edges->falling[edges->pulses++] = cycles;
+		high = now;
+	}
+}
+
+
+static void test_init( void )
+{
+	setUp();
+	TEST_ASSERT( DDRB & _BV(PB0) );
+	TEST_ASSERT( !( DDRB & ( _BV(PB1) | _BV(PB2) ) ) ); // USB data lines are left alone
+	sim_run( 3 * FRAME );
+	TEST_ASSERT_EQUAL( 0, sim_getPulseCount( PB0 ) );
+}
+
+
+static void test_frame( void )
+{
+	setUp();
+	for( unsigned int channel = 0; channel < SERVO_CHANNELS; ++channel )
+		servo_setPosition( channel, channel * 255 / ( SERVO_CHANNELS - 1 ) );
+	servo_enable();
+	struct edges edges;
+	recordFrame( &edges );
+
+	// a separator pulse per channel and the closing one
+	TEST_ASSERT_EQUAL( SERVO_CHANNELS + 1, edges.pulses );
+	for( unsigned int i = 0; i < edges.pulses; ++i )
+	{
+		uint32_t width = edges.falling[i] - edges.rising[i];
+		TEST_ASSERT( width + 2 * TICK >= PULSE && width <= PULSE + 2 * TICK );
+	}
+	for( unsigned int channel = 0; channel < SERVO_CHANNELS; ++channel )
+	{
+		uint32_t length = edges.rising[channel + 1] - edges.rising[channel];
+		uint32_t expected = expectedChannel( channel * 255 / ( SERVO_CHANNELS - 1 ) );
+		TEST_ASSERT( length + 2 * TICK + STEP >= expected && length <= expected + 2 * TICK + STEP );
+	}
+	uint32_t sync = edges.next - edges.falling[SERVO_CHANNELS];
+	TEST_ASSERT( sync >= (uint32_t)( 0.004 * (F_CPU) ) );
+	uint32_t period = edges.next - edges.rising[0];
+	TEST_ASSERT( period >= FRAME * 99 / 100 && period <= FRAME * 101 / 100 );
+	TEST_ASSERT_EQUAL( 0, stats.overruns );
+	TEST_ASSERT_EQUAL( 0, stats.latePulses );
+	TEST_ASSERT( jitter.pulses >= SERVO_CHANNELS ); // every channel is measured
+	TEST_ASSERT_EQUAL( jitter.pulses, jitter.histogram[0] );
+}
+
+
+static void test_longestFrame( void )
+{ // all channels at 2 ms still leave a sync gap
+	setUp();
+	for( unsigned int channel = 0; channel < SERVO_CHANNELS; ++channel )
+		servo_setPosition( channel, 255 );
+	servo_enable();
+	sim_run( 10 * FRAME );
+	struct edges edges;
+	recordFrame( &edges );
+	TEST_ASSERT_EQUAL( SERVO_CHANNELS + 1, edges.pulses );
+	TEST_ASSERT( edges.next - edges.falling[SERVO_CHANNELS] >= (uint32_t)( 0.004 * (F_CPU) ) );
+	TEST_ASSERT_EQUAL( 0, stats.overruns );
+}
+
+
+static usbMsgLen_t setup( uint8_t type, uint8_t request, uint16_t length )
+{
+	usbRequest_t rq;
+	memset( &rq, 0, sizeof(rq) );
+	rq.bmRequestType = type | USBRQ_RCPT_INTERFACE;
+	rq.bRequest = request;
+	rq.wValue.bytes[0] = SERVUSB_REPORT_ID_DATA;
+	rq.wValue.bytes[1] = USB_HID_REPORT_TYPE_FEATURE;
+	rq.wLength.word = length;
+	return usbFunctionSetup( (uchar *)&rq );
+}
+
+
+// start and width of the first separator pulses, with the handlers taking the given number
+// of cycles to return after enabling interrupts
+#define RECORDED ( 3 * ( SERVO_CHANNELS + 1 ) )
+
+static void recordPulses( uint32_t epilogue, uint64_t start[RECORDED], uint32_t width[RECORDED] )
+{
+	setUp();
+	for( unsigned int channel = 0; channel < SERVO_CHANNELS; ++channel )
+		servo_setPosition( channel, channel * 255 / ( SERVO_CHANNELS - 1 ) );
+	servo_enable();
+	sim_setEpilogue( epilogue );
+	uint32_t recorded = 0;
+	while( recorded < RECORDED )
+	{
+		TEST_ASSERT( sim_getCycles() < 5 * (uint64_t)FRAME );
+		sim_run( TICK );
+		uint32_t count = sim_getPulseCount( PB0 );
+		if( count == recorded )
+			continue;
+		TEST_ASSERT_EQUAL( recorded + 1, count ); // none missed between two looks
+		start[recorded] = sim_getLastPulseStart( PB0 );
+		width[recorded] = sim_getLastPulseWidth( PB0 );
+		recorded = count;
+	}
+}
+
+
+// Timer0 interrupts coming in while the handlers are still returning - the Timer1 one from
+// starting a frame, the Timer0 one after its edges - nest without moving an edge
+static void test_nested( void )
+{
+	uint64_t start[RECORDED], nestedStart[RECORDED];
+	uint32_t width[RECORDED], nestedWidth[RECORDED];
+	recordPulses( 0, start, width );
+	TEST_ASSERT_EQUAL( 0, sim_getNested() );
+	recordPulses( PULSE + 2 * TICK, nestedStart, nestedWidth ); // the end of a separator pulse comes first
+	TEST_ASSERT( sim_getNested() >= RECORDED );
+	TEST_ASSERT( !memcmp( start, nestedStart, sizeof(start) ) );
+	TEST_ASSERT( !memcmp( width, nestedWidth, sizeof(width) ) );
+	TEST_ASSERT_EQUAL( 0, stats.overruns );
+	TEST_ASSERT_EQUAL( 0, stats.latePulses );
+	TEST_ASSERT_EQUAL( jitter.pulses, jitter.histogram[0] );
+}
+
+
+static void test_dataReportChunks( void )
+{ // 8 channels take more than the 8 bytes V-USB hands over at once
+	setUp();
+	uint8_t report[1 + SERVO_CHANNELS];
+	report[0] = SERVUSB_REPORT_ID_DATA;
+	for( unsigned int i = 0; i < SERVO_CHANNELS; ++i )
+		report[1 + i] = 30 * i + 1;
+	TEST_ASSERT_EQUAL( USB_NO_MSG, setup( USBRQ_TYPE_CLASS | USBRQ_DIR_HOST_TO_DEVICE, USBRQ_HID_SET_REPORT, sizeof(report) ) );
+	TEST_ASSERT_EQUAL( 0, usbFunctionWrite( report, 8 ) );
+	TEST_ASSERT_EQUAL( 1, usbFunctionWrite( report + 8, sizeof(report) - 8 ) );
+	for( unsigned int i = 0; i < SERVO_CHANNELS; ++i )
+		TEST_ASSERT_EQUAL( 30 * i + 1, servo_getPosition( i ) );
+
+	uint8_t data[16] = { 0 };
+	TEST_ASSERT_EQUAL( USB_NO_MSG, setup( USBRQ_TYPE_CLASS | USBRQ_DIR_DEVICE_TO_HOST, USBRQ_HID_GET_REPORT, sizeof(report) ) );
+	TEST_ASSERT_EQUAL( 8, usbFunctionRead( data, 8 ) );
+	TEST_ASSERT_EQUAL( sizeof(report) - 8, usbFunctionRead( data + 8, 8 ) );
+	TEST_ASSERT( !memcmp( report, data, sizeof(report) ) );
+
+	// a short report sets the first channels only
+	report[1] = 200;
+	TEST_ASSERT_EQUAL( USB_NO_MSG, setup( USBRQ_TYPE_CLASS | USBRQ_DIR_HOST_TO_DEVICE, USBRQ_HID_SET_REPORT, 2 ) );
+	TEST_ASSERT_EQUAL( 1, usbFunctionWrite( report, 2 ) );
+	TEST_ASSERT_EQUAL( 200, servo_getPosition( 0 ) );
+	TEST_ASSERT_EQUAL( 31, servo_getPosition( 1 ) );
+}
+
+
+int main( int argc, char ** argv )
+{
+	static const struct test tests[] =
+	{
+		TEST( test_init ),
+		TEST( test_frame ),
+		TEST( test_longestFrame ),
+		TEST( test_nested ),
+		TEST( test_dataReportChunks ),
+	};
+	return test_run( tests, sizeof(tests) / sizeof(tests[0]), argc, argv );
+}
@@ -0,0 +1,444 @@
+#include "test.h"
+#include "sim.h"
+
+#include "usbdrv/usbdrv.h"
+#include "servo.h"
+#include "stats.h"
+#include "jitter.h"
+#include "poweron.h"
+#include "status.h"
+
+#include <avr/eeprom.h>
+
+
+#define SERVUSB_REPORT_ID_CONTROL 0x01
+#define SERVUSB_REPORT_ID_DATA    0x02
+#define SERVUSB_REPORT_ID_STATS   0x03
+#define SERVUSB_REPORT_ID_POWER_ON 0x05
+#define SERVUSB_REPORT_ID_JITTER  0x06
+#define SERVUSB_REPORT_ID_STATUS  0x07
+
+#define SERVUSB_CONTROL_ENABLE_BIT 0x01
+
+#define SERVUSB_REQUEST_SET_ENABLED   0x01
+#define SERVUSB_REQUEST_SET_POSITIONS 0x02
+
+#define USB_HID_REPORT_TYPE_FEATURE 3
+
+
+static void setUp( void )
+{
+	sim_reset();
+	memset( &stats, 0, sizeof(stats) );
+	jitter_reset();
+	servo_init();
+}
+
+
+// the setup packet is passed as usbRequest_t, whose layout differs from the 8 wire bytes on the host
+static usbMsgLen_t setup( uint8_t type, uint8_t request, uint8_t reportType, uint8_t reportID )
+{
+	usbRequest_t rq;
+	memset( &rq, 0, sizeof(rq) );
+	rq.bmRequestType = type | USBRQ_RCPT_INTERFACE;
+	rq.bRequest = request;
+	rq.wValue.bytes[0] = reportID;
+	rq.wValue.bytes[1] = reportType;
+	return usbFunctionSetup( (uchar *)&rq );
+}
+
+
+static uint8_t setReport( uint8_t reportID, uint8_t value )
+{
+	if( setup( USBRQ_TYPE_CLASS | USBRQ_DIR_HOST_TO_DEVICE, USBRQ_HID_SET_REPORT, USB_HID_REPORT_TYPE_FEATURE, reportID ) != USB_NO_MSG )
+		return 0xfe;
+	uint8_t data[2] = { reportID, value };
+	return usbFunctionWrite( data, sizeof(data) );
+}
+
+
+static uint8_t getReport( uint8_t reportID, uint8_t * data )
+{
+	if( setup( USBRQ_TYPE_CLASS | USBRQ_DIR_DEVICE_TO_HOST, USBRQ_HID_GET_REPORT, USB_HID_REPORT_TYPE_FEATURE, reportID ) != USB_NO_MSG )
+		return 0xfe;
+	return usbFunctionRead( data, 8 );
+}
+
+
+static void test_setupDispatch( void )
+{
+	setUp();
+	for( unsigned int id = 0; id <= 255; ++id )
+	{
+		TEST_ASSERT_EQUAL( USB_NO_MSG, setup( USBRQ_TYPE_CLASS | USBRQ_DIR_HOST_TO_DEVICE, USBRQ_HID_SET_REPORT, USB_HID_REPORT_TYPE_FEATURE, id ) );
+		TEST_ASSERT_EQUAL( USB_NO_MSG, setup( USBRQ_TYPE_CLASS | USBRQ_DIR_DEVICE_TO_HOST, USBRQ_HID_GET_REPORT, USB_HID_REPORT_TYPE_FEATURE, id ) );
+		TEST_ASSERT_EQUAL( 0, setup( USBRQ_TYPE_VENDOR | USBRQ_DIR_HOST_TO_DEVICE, USBRQ_HID_SET_REPORT, USB_HID_REPORT_TYPE_FEATURE, id ) );
+		TEST_ASSERT_EQUAL( 0, setup( USBRQ_TYPE_CLASS | USBRQ_DIR_HOST_TO_DEVICE, USBRQ_HID_SET_IDLE, 0, id ) );
+	}
+}
+
+
+static void test_shortWriteStalls( void )
+{
+	setUp();
+	uint8_t data[2] = { SERVUSB_REPORT_ID_DATA, 42 };
+	setup( USBRQ_TYPE_CLASS | USBRQ_DIR_HOST_TO_DEVICE, USBRQ_HID_SET_REPORT, USB_HID_REPORT_TYPE_FEATURE, SERVUSB_REPORT_ID_DATA );
+	TEST_ASSERT_EQUAL( 0xff, usbFunctionWrite( data, 0 ) );
+	TEST_ASSERT_EQUAL( 0xff, usbFunctionWrite( data, 1 ) );
+	TEST_ASSERT_EQUAL( 0, servo_getPosition( 0 ) );
+}
+
+
+static void test_dataReport( void )
+{
+	setUp();
+	for( unsigned int position = 0; position <= 255; ++position )
+	{
+		uint8_t data[8] = { 0 };
+		TEST_ASSERT_EQUAL( 1, setReport( SERVUSB_REPORT_ID_DATA, position ) );
+		TEST_ASSERT_EQUAL( position, servo_getPosition( 0 ) );
+		TEST_ASSERT_EQUAL( 1 + SERVO_CHANNELS, getReport( SERVUSB_REPORT_ID_DATA, data ) );
+		TEST_ASSERT_EQUAL( SERVUSB_REPORT_ID_DATA, data[0] );
+		TEST_ASSERT_EQUAL( position, data[1] );
+	}
+}
+
+
+static void test_dataReportChannels( void )
+{
+	setUp();
+	uint8_t report[1 + SERVO_CHANNELS];
+	report[0] = SERVUSB_REPORT_ID_DATA;
+	for( unsigned int i = 0; i < SERVO_CHANNELS; ++i )
+		report[1 + i] = 10 + 20 * i;
+	setup( USBRQ_TYPE_CLASS | USBRQ_DIR_HOST_TO_DEVICE, USBRQ_HID_SET_REPORT, USB_HID_REPORT_TYPE_FEATURE, SERVUSB_REPORT_ID_DATA );
+	TEST_ASSERT_EQUAL( 1, usbFunctionWrite( report, sizeof(report) ) );
+
+	uint8_t data[8] = { 0 };
+	TEST_ASSERT_EQUAL( 1 + SERVO_CHANNELS, getReport( SERVUSB_REPORT_ID_DATA, data ) );
+	for( unsigned int i = 0; i < SERVO_CHANNELS; ++i )
+	{
+		TEST_ASSERT_EQUAL( 10 + 20 * i, servo_getPosition( i ) );
+		TEST_ASSERT_EQUAL( 10 + 20 * i, data[1 + i] );
+	}
+
+	// the single servo report of older hosts only moves the first one
+	TEST_ASSERT_EQUAL( 1, setReport( SERVUSB_REPORT_ID_DATA, 200 ) );
+	TEST_ASSERT_EQUAL( 200, servo_getPosition( 0 ) );
+	for( unsigned int i = 1; i < SERVO_CHANNELS; ++i )
+		TEST_ASSERT_EQUAL( 10 + 20 * i, servo_getPosition( i ) );
+}
+
+
+static void test_controlReport( void )
+{
+	setUp();
+	for( unsigned int value = 0; value <= 255; ++value )
+	{
+		uint8_t data[8] = { 0 };
+		bool enable = value & SERVUSB_CONTROL_ENABLE_BIT;
+		TEST_ASSERT_EQUAL( 1, setReport( SERVUSB_REPORT_ID_CONTROL, value ) );
+		TEST_ASSERT_EQUAL( enable, servo_isEnabled() );
+		TEST_ASSERT_EQUAL( 2, getReport( SERVUSB_REPORT_ID_CONTROL, data ) );
+		TEST_ASSERT_EQUAL( SERVUSB_REPORT_ID_CONTROL, data[0] );
+		TEST_ASSERT_EQUAL( enable ? SERVUSB_CONTROL_ENABLE_BIT : 0, data[1] );
+	}
+}
+
+
+static void test_unknownReport( void )
+{
+	setUp();
+	setReport( SERVUSB_REPORT_ID_DATA, 99 );
+	setReport( SERVUSB_REPORT_ID_CONTROL, SERVUSB_CONTROL_ENABLE_BIT );
+	for( unsigned int id = 0; id <= 255; ++id )
+	{
+		if( id == SERVUSB_REPORT_ID_CONTROL || id == SERVUSB_REPORT_ID_DATA || id == SERVUSB_REPORT_ID_STATS || id == SERVUSB_REPORT_ID_POWER_ON || id == SERVUSB_REPORT_ID_JITTER || id == SERVUSB_REPORT_ID_STATUS )
+			continue;
+		uint8_t data[8] = { 0 };
+		TEST_ASSERT_EQUAL( 1, setReport( id, 0 ) ); // accepted and ignored
+		TEST_ASSERT_EQUAL( 0, getReport( id, data ) );
+		TEST_ASSERT_EQUAL( 99, servo_getPosition( 0 ) );
+		TEST_ASSERT( servo_isEnabled() );
+	}
+}
+
+
+static usbMsgLen_t vendorRequest( uint8_t request, uint8_t value0, uint8_t value1, uint8_t index0, uint8_t index1 )
+{
+	usbRequest_t rq;
+	memset( &rq, 0, sizeof(rq) );
+	rq.bmRequestType = USBRQ_TYPE_VENDOR | USBRQ_RCPT_DEVICE | USBRQ_DIR_HOST_TO_DEVICE;
+	rq.bRequest = request;
+	rq.wValue.bytes[0] = value0;
+	rq.wValue.bytes[1] = value1;
+	rq.wIndex.bytes[0] = index0;
+	rq.wIndex.bytes[1] = index1;
+	return usbFunctionSetup( (uchar *)&rq );
+}
+
+
+// the same as the reports, done without a data stage
+static void test_vendorRequests( void )
+{
+	setUp();
+	TEST_ASSERT_EQUAL( 0, vendorRequest( SERVUSB_REQUEST_SET_ENABLED, SERVUSB_CONTROL_ENABLE_BIT, 0, 0, 0 ) );
+	TEST_ASSERT( servo_isEnabled() );
+	TEST_ASSERT_EQUAL( 0, vendorRequest( SERVUSB_REQUEST_SET_ENABLED, 0xfe, 0, 0, 0 ) );
+	TEST_ASSERT( !servo_isEnabled() );
+
+	static const uint8_t positions[3] = { 11, 22, 33 };
+	for( unsigned int count = 0; count <= 3; ++count )
+	{
+		for( unsigned int i = 0; i < SERVO_CHANNELS; ++i )
+			servo_setPosition( i, 99 );
+		TEST_ASSERT_EQUAL( 0, vendorRequest( SERVUSB_REQUEST_SET_POSITIONS, positions[0], positions[1], positions[2], count ) );
+		for( unsigned int i = 0; i < SERVO_CHANNELS && i < 3; ++i )
+			TEST_ASSERT_EQUAL( i < count ? positions[i] : 99, servo_getPosition( i ) );
+	}
+	TEST_ASSERT_EQUAL( 6, stats.setReports );
+	TEST_ASSERT_EQUAL( 0, stats.unknownReports );
+
+	TEST_ASSERT_EQUAL( 0, vendorRequest( 0x03, 1, 2, 3, 4 ) );
+	TEST_ASSERT_EQUAL( 1, stats.unknownReports );
+	TEST_ASSERT_EQUAL( 11, servo_getPosition( 0 ) );
+}
+
+
+static void test_reportsDrivePulses( void )
+{
+	setUp();
+	SREG |= _BV(SREG_I);
+	setReport( SERVUSB_REPORT_ID_DATA, 255 );
+	setReport( SERVUSB_REPORT_ID_CONTROL, SERVUSB_CONTROL_ENABLE_BIT );
+	sim_run( (uint32_t)( 0.1 * (F_CPU) ) );
+	TEST_ASSERT( sim_getPulseCount( PB0 ) >= 4 );
+	setReport( SERVUSB_REPORT_ID_CONTROL, 0 );
+	sim_runUntilIdle();
+	uint32_t count = sim_getPulseCount( PB0 );
+	sim_run( (uint32_t)( 0.1 * (F_CPU) ) );
+	TEST_ASSERT_EQUAL( count, sim_getPulseCount( PB0 ) );
+}
+
+
+// stored by the main loop, applied at the next power-up
+static void test_powerOnReport( void )
+{
+	setUp();
+	poweron_init(); // blank EEPROM
+	TEST_ASSERT( !servo_isEnabled() );
+	uint8_t data[8] = { 0 };
+	TEST_ASSERT_EQUAL( 1 + POWERON_SIZE, getReport( SERVUSB_REPORT_ID_POWER_ON, data ) );
+	TEST_ASSERT_EQUAL( SERVUSB_REPORT_ID_POWER_ON, data[0] );
+	for( unsigned int i = 0; i < POWERON_SIZE; ++i )
+		TEST_ASSERT_EQUAL( 0, data[1 + i] );
+
+	uint8_t report[1 + POWERON_SIZE] = { SERVUSB_REPORT_ID_POWER_ON, SERVUSB_CONTROL_ENABLE_BIT };
+	for( unsigned int i = 0; i < SERVO_CHANNELS; ++i )
+		report[2 + i] = 200 - 50 * i;
+	setup( USBRQ_TYPE_CLASS | USBRQ_DIR_HOST_TO_DEVICE, USBRQ_HID_SET_REPORT, USB_HID_REPORT_TYPE_FEATURE, SERVUSB_REPORT_ID_POWER_ON );
+	TEST_ASSERT_EQUAL( 1, usbFunctionWrite( report, sizeof(report) ) );
+	TEST_ASSERT( !servo_isEnabled() ); // only stored
+	TEST_ASSERT_EQUAL( 0, servo_getPosition( 0 ) );
+	TEST_ASSERT_EQUAL( 1 + POWERON_SIZE, getReport( SERVUSB_REPORT_ID_POWER_ON, data ) );
+	TEST_ASSERT( !memcmp( report, data, sizeof(report) ) );
+
+	// one byte per main loop iteration, nothing once it is all there
+	eeprom_writes = 0;
+	for( unsigned int i = 0; i < 2 * POWERON_SIZE; ++i )
+		poweron_update();
+	TEST_ASSERT_EQUAL( 2 + SERVO_CHANNELS, eeprom_writes ); // the magic, the control byte and the positions
+
+	// power cycle - pulsing without a host
+	setUp();
+	poweron_init();
+	TEST_ASSERT( servo_isEnabled() );
+	for( unsigned int i = 0; i < SERVO_CHANNELS; ++i )
+		TEST_ASSERT_EQUAL( 200 - 50 * i, servo_getPosition( i ) );
+	SREG |= _BV(SREG_I);
+	sim_run( (uint32_t)( 0.05 * (F_CPU) ) );
+	TEST_ASSERT( sim_getPulseCount( PB0 ) >= 2 );
+
+	// setting the same again writes nothing, a short report only changes the first bytes
+	eeprom_writes = 0;
+	setup( USBRQ_TYPE_CLASS | USBRQ_DIR_HOST_TO_DEVICE, USBRQ_HID_SET_REPORT, USB_HID_REPORT_TYPE_FEATURE, SERVUSB_REPORT_ID_POWER_ON );
+	TEST_ASSERT_EQUAL( 1, usbFunctionWrite( report, sizeof(report) ) );
+	poweron_update();
+	TEST_ASSERT_EQUAL( 0, eeprom_writes );
+	TEST_ASSERT_EQUAL( 1, setReport( SERVUSB_REPORT_ID_POWER_ON, 0 ) );
+	for( unsigned int i = 0; i < 2 * POWERON_SIZE; ++i )
+		poweron_update();
+	TEST_ASSERT_EQUAL( 3, eeprom_writes ); // clearing the magic, the control byte and the magic again
+	setUp();
+	poweron_init();
+	TEST_ASSERT( !servo_isEnabled() );
+	TEST_ASSERT_EQUAL( 200, servo_getPosition( 0 ) );
+
+	// power loss halfway through a rewrite - neither the old nor a mix of both
+	setup( USBRQ_TYPE_CLASS | USBRQ_DIR_HOST_TO_DEVICE, USBRQ_HID_SET_REPORT, USB_HID_REPORT_TYPE_FEATURE, SERVUSB_REPORT_ID_POWER_ON );
+	TEST_ASSERT_EQUAL( 1, usbFunctionWrite( report, sizeof(report) ) );
+	poweron_update();
+	poweron_update();
+	setUp();
+	poweron_init();
+	TEST_ASSERT( !servo_isEnabled() );
+	for( unsigned int i = 0; i < SERVO_CHANNELS; ++i )
+		TEST_ASSERT_EQUAL( 0, servo_getPosition( i ) );
+}
+
+
+// reads a longer report in chunks of 8 bytes, like V-USB does for longer transfers
+static uint8_t getChunked( uint8_t reportID, void * result, uint8_t size )
+{
+	uint8_t report[32];
+	if( setup( USBRQ_TYPE_CLASS | USBRQ_DIR_DEVICE_TO_HOST, USBRQ_HID_GET_REPORT, USB_HID_REPORT_TYPE_FEATURE, reportID ) != USB_NO_MSG )
+		return 0;
+	uint8_t length = 0;
+	while( length < 1 + size )
+	{
+		uint8_t chunk[8];
+		uint8_t requested = 1 + size - length < 8 ? 1 + size - length : 8;
+		uint8_t read = usbFunctionRead( chunk, requested );
+		memcpy( report + length, chunk, read );
+		length += read;
+		if( read < requested )
+			break;
+	}
+	memcpy( result, report + 1, size );
+	return report[0] == reportID ? length : 0;
+}
+
+
+static uint8_t getStats( struct stats * result )
+{
+	return getChunked( SERVUSB_REPORT_ID_STATS, result, sizeof(*result) );
+}
+
+
+static void test_statsReport( void )
+{
+	setUp();
+	struct stats reported;
+	TEST_ASSERT_EQUAL( 1 + sizeof(struct stats), getStats( &reported ) );
+	TEST_ASSERT_EQUAL( 1, reported.getReports ); // the snapshot includes its own request
+
+	for( unsigned int i = 0; i < 1000; ++i )
+		setReport( SERVUSB_REPORT_ID_DATA, i );
+	uint8_t data[8];
+	setup( USBRQ_TYPE_CLASS | USBRQ_DIR_HOST_TO_DEVICE, USBRQ_HID_SET_REPORT, USB_HID_REPORT_TYPE_FEATURE, SERVUSB_REPORT_ID_DATA );
+	usbFunctionWrite( data, 1 );
+	setReport( 0x42, 0 );
+	getReport( 0x43, data );
+	stats.frames = 0x12345678;
+	stats.polls = 0xdeadbeef;
+
+	TEST_ASSERT_EQUAL( 1 + sizeof(struct stats), getStats( &reported ) );
+	TEST_ASSERT_EQUAL( 1002, reported.setReports );
+	TEST_ASSERT_EQUAL( 3, reported.getReports );
+	TEST_ASSERT_EQUAL( 1, reported.stalls );
+	TEST_ASSERT_EQUAL( 2, reported.unknownReports );
+	TEST_ASSERT_EQUAL( 0x12345678, reported.frames );
+	TEST_ASSERT_EQUAL( 0xdeadbeef, reported.polls );
+
+	// the stats report is read only
+	TEST_ASSERT_EQUAL( 1, setReport( SERVUSB_REPORT_ID_STATS, 0 ) );
+	TEST_ASSERT_EQUAL( 1003, stats.setReports );
+}
+
+
+static void test_jitterReport( void )
+{
+	setUp();
+	setReport( SERVUSB_REPORT_ID_DATA, 60 );
+	setReport( SERVUSB_REPORT_ID_CONTROL, SERVUSB_CONTROL_ENABLE_BIT );
+	SREG |= _BV(SREG_I);
+	sim_run( 5 * 0.02 * (F_CPU) );
+	SREG &= ~_BV(SREG_I);
+	jitter.histogram[3] = 0x1234;
+	jitter.longest = 3;
+	jitter.shortest = -2;
+
+	struct jitter reported;
+	TEST_ASSERT_EQUAL( 1 + sizeof(struct jitter), getChunked( SERVUSB_REPORT_ID_JITTER, &reported, sizeof(reported) ) );
+	TEST_ASSERT_EQUAL( jitter.tickNs, reported.tickNs );
+	TEST_ASSERT( reported.pulses >= 4 );
+	TEST_ASSERT_EQUAL( reported.pulses, reported.histogram[0] );
+	TEST_ASSERT_EQUAL( 0x1234, reported.histogram[3] );
+	TEST_ASSERT_EQUAL( 3, reported.longest );
+	TEST_ASSERT_EQUAL( -2, reported.shortest );
+
+	// writing it starts over
+	TEST_ASSERT_EQUAL( 1, setReport( SERVUSB_REPORT_ID_JITTER, 0 ) );
+	TEST_ASSERT_EQUAL( 1 + sizeof(struct jitter), getChunked( SERVUSB_REPORT_ID_JITTER, &reported, sizeof(reported) ) );
+	TEST_ASSERT_EQUAL( jitter.tickNs, reported.tickNs );
+	TEST_ASSERT_EQUAL( 0, reported.pulses );
+	TEST_ASSERT_EQUAL( 0, reported.histogram[0] );
+	TEST_ASSERT_EQUAL( 0, reported.histogram[3] );
+	TEST_ASSERT_EQUAL( 0, reported.longest );
+	TEST_ASSERT_EQUAL( 0, reported.shortest );
+}
+
+
+// what the control and data reports say, and what the firmware is, in one transfer
+static void test_statusReport( void )
+{
+	setUp();
+	uint8_t report[1 + SERVO_CHANNELS];
+	report[0] = SERVUSB_REPORT_ID_DATA;
+	for( unsigned int i = 0; i < SERVO_CHANNELS; ++i )
+		report[1 + i] = 10 + 20 * i;
+	setup( USBRQ_TYPE_CLASS | USBRQ_DIR_HOST_TO_DEVICE, USBRQ_HID_SET_REPORT, USB_HID_REPORT_TYPE_FEATURE, SERVUSB_REPORT_ID_DATA );
+	usbFunctionWrite( report, sizeof(report) );
+	setReport( SERVUSB_REPORT_ID_CONTROL, SERVUSB_CONTROL_ENABLE_BIT );
+
+	struct status reported;
+	TEST_ASSERT_EQUAL( 1 + sizeof(struct status), getChunked( SERVUSB_REPORT_ID_STATUS, &reported, sizeof(reported) ) );
+	TEST_ASSERT_EQUAL( 0x0102, reported.version );
+	TEST_ASSERT_EQUAL( F_CPU / 1000, reported.clockKHz );
+	TEST_ASSERT_EQUAL( 20000, reported.frameUs );
+	TEST_ASSERT_EQUAL( 800, reported.minUs );
+	TEST_ASSERT_EQUAL( 2160, reported.maxUs );
+#ifdef SERVUSB_RC_OSCILLATOR
+	TEST_ASSERT_EQUAL( STATUS_FLAG_RC_OSCILLATOR, reported.flags );
+#else
+	TEST_ASSERT_EQUAL( 0, reported.flags );
+#endif
+	TEST_ASSERT_EQUAL( SERVUSB_CONTROL_ENABLE_BIT, reported.control );
+	TEST_ASSERT_EQUAL( SERVO_CHANNELS, reported.channels );
+	TEST_ASSERT_EQUAL( 0, reported.scheduled );
+	for( unsigned int i = 0; i < SERVO_CHANNELS; ++i )
+	{
+		TEST_ASSERT_EQUAL( 10 + 20 * i, reported.commanded[i] );
+		TEST_ASSERT_EQUAL( 10 + 20 * i, reported.pulsed[i] );
+	}
+
+	setReport( SERVUSB_REPORT_ID_CONTROL, 0 );
+	TEST_ASSERT_EQUAL( 1 + sizeof(struct status), getChunked( SERVUSB_REPORT_ID_STATUS, &reported, sizeof(reported) ) );
+	TEST_ASSERT_EQUAL( 0, reported.control );
+
+	// the status report is read only
+	TEST_ASSERT_EQUAL( 1, setReport( SERVUSB_REPORT_ID_STATUS, SERVUSB_CONTROL_ENABLE_BIT ) );
+	TEST_ASSERT( !servo_isEnabled() );
+	TEST_ASSERT_EQUAL( 0, stats.unknownReports );
+}
+
+
+int main( int argc, char ** argv )
+{
+	static const struct test tests[] =
+	{
+		TEST( test_setupDispatch ),
+		TEST( test_shortWriteStalls ),
+		TEST( test_dataReport ),
+		TEST( test_dataReportChannels ),
+		TEST( test_controlReport ),
+		TEST( test_unknownReport ),
+		TEST( test_vendorRequests ),
+		TEST( test_reportsDrivePulses ),
+		TEST( test_powerOnReport ),
+		TEST( test_statsReport ),
+		TEST( test_jitterReport ),
+		TEST( test_statusReport ),
+	};
+	return test_run( tests, sizeof(tests) / sizeof(tests[0]), argc, argv );
+}
@@ -0,0 +1,211 @@
+#include "test.h"
+#include "sim.h"
+
+#include "servo.h"
+#include "stats.h"
+#include "jitter.h"
+
+
+#define SERVO_PIN   PB0
+#define FRAME       ( (uint32_t)( 0.02 * (F_CPU) ) )    // nominal cycles between two pulses
+#define MIN_PULSE   ( (uint32_t)( 0.0008 * (F_CPU) ) )  // nominal cycles of the shortest pulse
+#define MAX_PULSE   ( (uint32_t)( 0.00216 * (F_CPU) ) ) // nominal cycles of the longest pulse
+#define TICK        64                                  // timer0 resolution in cycles
+
+
+static void setUp( void )
+{
+	sim_reset();
+	memset( &stats, 0, sizeof(stats) );
+	jitter_reset();
+	servo_init();
+	SREG |= _BV(SREG_I);
+}
+
+
+static void test_init( void )
+{
+	setUp();
+	TEST_ASSERT( DDRB & _BV(DDB0) );
+	TEST_ASSERT( TIMSK & _BV(OCIE0A) );
+	TEST_ASSERT( !servo_isEnabled() );
+	TEST_ASSERT_EQUAL( 0, TCCR0B ); // pulse generator is stopped until the first frame
+	sim_run( 5 * FRAME );
+	TEST_ASSERT_EQUAL( 0, sim_getPulseCount( SERVO_PIN ) );
+}
+
+
+static void test_firstPulse( void )
+{
+	setUp();
+	servo_enable();
+	sim_run( FRAME * 11 / 10 );
+	TEST_ASSERT_EQUAL( 1, sim_getPulseCount( SERVO_PIN ) );
+	TEST_ASSERT( sim_getLastPulseWidth( SERVO_PIN ) <= MIN_PULSE + 2 * TICK );
+}
+
+
+static void test_positionRoundTrip( void )
+{
+	setUp();
+	for( unsigned int position = 0; position <= 255; ++position )
+	{
+		servo_setPosition( 0, position );
+		TEST_ASSERT_EQUAL( position, servo_getPosition( 0 ) );
+	}
+}
+
+
+static void test_pulseWidth( void )
+{
+	setUp();
+	servo_enable();
+	uint32_t previousWidth = 0;
+	for( unsigned int position = 0; position <= 255; ++position )
+	{
+		servo_setPosition( 0, position );
+		uint32_t count = sim_getPulseCount( SERVO_PIN );
+		sim_run( FRAME * 11 / 10 );
+		sim_runUntilIdle();
+		TEST_ASSERT( sim_getPulseCount( SERVO_PIN ) >= count + 1 );
+
+		uint32_t width = sim_getLastPulseWidth( SERVO_PIN );
+		uint32_t expected = ( OCR0A + 1 + position ) * TICK; // OCR0A is back at the minimum pulse length
+		TEST_ASSERT( width + TICK >= expected && width <= expected + TICK );
+		TEST_ASSERT( width + TICK >= MIN_PULSE );
+		TEST_ASSERT( width <= MAX_PULSE + 2 * TICK );
+		TEST_ASSERT( width > previousWidth );
+		previousWidth = width;
+	}
+}
+
+
+static void test_framePeriod( void )
+{
+	setUp();
+	servo_setPosition( 0, 127 );
+	servo_enable();
+	sim_run( 10 * FRAME );
+	TEST_ASSERT( sim_getPulseCount( SERVO_PIN ) >= 9 );
+	uint32_t period = sim_getLastPulsePeriod( SERVO_PIN );
+	TEST_ASSERT( period >= FRAME * 99 / 100 && period <= FRAME * 101 / 100 );
+}
+
+
+static void test_enableDisable( void )
+{
+	setUp();
+	servo_setPosition( 0, 200 );
+	for( unsigned int i = 0; i < 64; ++i )
+	{
+		servo_setEnabled( true );
+		TEST_ASSERT( servo_isEnabled() );
+		uint32_t count = sim_getPulseCount( SERVO_PIN );
+		sim_run( 3 * FRAME );
+		TEST_ASSERT( sim_getPulseCount( SERVO_PIN ) >= count + 2 );
+
+		// disabling stops the frames but a pulse in progress completes at full length
+		servo_setEnabled( false );
+		TEST_ASSERT( !servo_isEnabled() );
+		sim_runUntilIdle();
+		TEST_ASSERT( !( PORTB & _BV(PB0) ) );
+		count = sim_getPulseCount( SERVO_PIN );
+		sim_run( 3 * FRAME );
+		TEST_ASSERT_EQUAL( count, sim_getPulseCount( SERVO_PIN ) );
+		TEST_ASSERT( sim_getLastPulseWidth( SERVO_PIN ) + TICK >= ( OCR0A + 1 + 200 ) * TICK );
+
+		sim_run( FRAME / 7 ); // vary the phase at which the servo gets enabled again
+	}
+}
+
+
+static void test_stats( void )
+{
+	setUp();
+	servo_setPosition( 0, 100 );
+	servo_enable();
+	sim_run( 10 * FRAME );
+	TEST_ASSERT( stats.frames >= 9 && stats.frames <= 10 );
+	TEST_ASSERT_EQUAL( stats.frames, sim_getPulseCount( SERVO_PIN ) + ( PORTB & _BV(PB0) ? 1 : 0 ) );
+	TEST_ASSERT_EQUAL( 0, stats.latePulses );
+	TEST_ASSERT_EQUAL( 0, stats.overruns );
+
+	// block interrupts across the end of a pulse, like a long running USB interrupt would
+	sim_runUntilIdle();
+	sim_run( FRAME - ( sim_getCycles() - sim_getLastPulseStart( SERVO_PIN ) ) + 2048 );
+	TEST_ASSERT( PORTB & _BV(PB0) );
+	SREG &= ~_BV(SREG_I);
+	sim_run( 12000 ); // past the end of the minimum pulse length
+	SREG |= _BV(SREG_I);
+	sim_runUntilIdle();
+	TEST_ASSERT_EQUAL( 1, stats.latePulses );
+}
+
+
+// the histogram holds how much later than programmed the pulses ended
+static void test_jitter( void )
+{
+	setUp();
+	TEST_ASSERT_EQUAL( (uint16_t)( 64e9 / (F_CPU) + 0.5 ), jitter.tickNs );
+	servo_setPosition( 0, 100 );
+	servo_enable();
+	sim_run( 10 * FRAME );
+	sim_runUntilIdle();
+	uint32_t pulses = sim_getPulseCount( SERVO_PIN );
+	uint32_t width = sim_getLastPulseWidth( SERVO_PIN );
+	TEST_ASSERT_EQUAL( pulses, jitter.pulses );
+	TEST_ASSERT_EQUAL( pulses, jitter.histogram[0] );
+	TEST_ASSERT_EQUAL( 0, jitter.longest );
+	TEST_ASSERT_EQUAL( 0, jitter.shortest );
+
+	// hold off the end of a pulse by about 5 ticks
+	sim_run( FRAME - ( sim_getCycles() - sim_getLastPulseStart( SERVO_PIN ) ) + width - 2 * TICK );
+	TEST_ASSERT( PORTB & _BV(PB0) );
+	SREG &= ~_BV(SREG_I);
+	sim_run( width + 5 * TICK - ( sim_getCycles() - sim_getLastPulseStart( SERVO_PIN ) ) );
+	SREG |= _BV(SREG_I);
+	sim_runUntilIdle();
+	uint32_t longer = ( sim_getLastPulseWidth( SERVO_PIN ) - width + TICK / 2 ) / TICK;
+	TEST_ASSERT( longer >= 4 && longer <= 6 );
+	TEST_ASSERT_EQUAL( longer, jitter.longest );
+	TEST_ASSERT_EQUAL( 1, jitter.histogram[4] );
+	TEST_ASSERT_EQUAL( pulses + 1, jitter.pulses );
+
+	// holding off a stage until the counter is past the next one costs a whole counter cycle
+	sim_run( FRAME - ( sim_getCycles() - sim_getLastPulseStart( SERVO_PIN ) ) + 2048 );
+	SREG &= ~_BV(SREG_I);
+	sim_run( width + 10 * TICK - ( sim_getCycles() - sim_getLastPulseStart( SERVO_PIN ) ) );
+	SREG |= _BV(SREG_I);
+	sim_runUntilIdle();
+	TEST_ASSERT( sim_getLastPulseWidth( SERVO_PIN ) >= width + 255 * TICK );
+	TEST_ASSERT_EQUAL( 127, jitter.longest );
+	TEST_ASSERT_EQUAL( 1, jitter.histogram[7] );
+
+	// the histogram stays as it was once full
+	uint16_t onTime = jitter.histogram[0];
+	jitter.pulses = 0xffff;
+	sim_run( 2 * FRAME );
+	TEST_ASSERT_EQUAL( 0xffff, jitter.pulses );
+	TEST_ASSERT_EQUAL( onTime, jitter.histogram[0] );
+	jitter_reset();
+	TEST_ASSERT_EQUAL( 0, jitter.pulses );
+	TEST_ASSERT_EQUAL( 0, jitter.longest );
+	TEST_ASSERT_EQUAL( (uint16_t)( 64e9 / (F_CPU) + 0.5 ), jitter.tickNs );
+}
+
+
+int main( int argc, char ** argv )
+{
+	static const struct test tests[] =
+	{
+		TEST( test_init ),
+		TEST( test_firstPulse ),
+		TEST( test_positionRoundTrip ),
+		TEST( test_pulseWidth ),
+		TEST( test_framePeriod ),
+		TEST( test_enableDisable ),
+		TEST( test_stats ),
+		TEST( test_jitter ),
+	};
+	return test_run( tests, sizeof(tests) / sizeof(tests[0]), argc, argv );
+}
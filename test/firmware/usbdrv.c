@@ -0,0 +1,19 @@
+// Host stand-in for the parts of V-USB referenced by firmware/main.c - the bit-banged
+// driver itself can't run here, the tests call the usbFunction*() callbacks directly.
+
+#include "usbdrv/usbdrv.h"
+
+
+#if USB_COUNT_SOF
+volatile uchar usbSofCount; // the tests count frames themselves
+#endif
+
+
+void usbInit( void )
+{
+}
+
+
+void usbPoll( void )
+{
+}
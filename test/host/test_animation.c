@@ -0,0 +1,178 @@
+#define _DEFAULT_SOURCE
+
+#include "test.h"
+
+#include "animation.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+
+static void test_holdOutside( void )
+{
+	struct animation * animation = animation_create( 1, 255 );
+	TEST_ASSERT( animation );
+	TEST_ASSERT_EQUAL( 0, animation_addKeyframe( animation, 0, 1.0f, 100, ANIMATION_LINEAR ) );
+	TEST_ASSERT_EQUAL( 0, animation_addKeyframe( animation, 0, 2.0f, 200, ANIMATION_LINEAR ) );
+	animation_evaluate( animation, 0.0f );
+	TEST_ASSERT_EQUAL( 100, animation_getPositions( animation )[0] );
+	animation_evaluate( animation, 3.0f );
+	TEST_ASSERT_EQUAL( 200, animation_getPositions( animation )[0] );
+	animation_destroy( animation );
+}
+
+
+static void test_linear( void )
+{
+	struct animation * animation = animation_create( 1, 255 );
+	animation_addKeyframe( animation, 0, 0.0f, 0, ANIMATION_LINEAR );
+	animation_addKeyframe( animation, 0, 1.0f, 200, ANIMATION_LINEAR );
+	animation_addKeyframe( animation, 0, 2.0f, 100, ANIMATION_LINEAR );
+	TEST_ASSERT_EQUAL( 2.0f, animation_getDuration( animation ) );
+	for( int i = 0; i <= 20; ++i )
+	{
+		float t = i * 0.1f;
+		float expected = t <= 1 ? 200 * t : 200 - 100 * ( t - 1 );
+		animation_evaluate( animation, t );
+		int position = animation_getPositions( animation )[0];
+		TEST_ASSERT( position >= (int)expected - 1 && position <= (int)expected + 1 );
+	}
+	animation_destroy( animation );
+}
+
+
+static void test_ease( void )
+{
+	struct animation * animation = animation_create( 1, 255 );
+	animation_addKeyframe( animation, 0, 0.0f, 0, ANIMATION_EASE );
+	animation_addKeyframe( animation, 0, 1.0f, 255, ANIMATION_EASE );
+	for( int i = 0; i <= 10; ++i )
+	{
+		float u = i * 0.1f;
+		float expected = 255 * u * u * ( 3 - 2 * u );
+		animation_evaluate( animation, u );
+		int position = animation_getPositions( animation )[0];
+		TEST_ASSERT( position >= (int)expected - 1 && position <= (int)expected + 1 );
+	}
+	animation_destroy( animation );
+}
+
+
+static void test_cubic( void )
+{ // evenly spaced keyframes on a straight line stay on it
+	struct animation * animation = animation_create( 1, 255 );
+	for( int k = 0; k <= 4; ++k )
+		animation_addKeyframe( animation, 0, k, 50 * k, ANIMATION_CUBIC );
+	for( int i = 0; i <= 40; ++i )
+	{
+		float t = i * 0.1f;
+		animation_evaluate( animation, t );
+		int position = animation_getPositions( animation )[0];
+		int expected = 50 * t + 0.5f;
+		TEST_ASSERT( position >= expected - 1 && position <= expected + 1 );
+	}
+	animation_destroy( animation );
+}
+
+
+static void test_clamp( void )
+{ // a spline overshooting the range is clamped instead of wrapping
+	struct animation * animation = animation_create( 1, 255 );
+	animation_addKeyframe( animation, 0, 0.0f, 0, ANIMATION_CUBIC );
+	animation_addKeyframe( animation, 0, 1.0f, 255, ANIMATION_CUBIC );
+	animation_addKeyframe( animation, 0, 2.0f, 0, ANIMATION_CUBIC );
+	animation_addKeyframe( animation, 0, 3.0f, -255, ANIMATION_CUBIC );
+	for( int i = 0; i <= 30; ++i )
+	{
+		animation_evaluate( animation, i * 0.1f );
+		TEST_ASSERT( animation_getPositions( animation )[0] <= 255 );
+	}
+	animation_evaluate( animation, 3.0f );
+	TEST_ASSERT_EQUAL( 0, animation_getPositions( animation )[0] );
+	animation_destroy( animation );
+}
+
+
+static void test_channels( void )
+{ // channel count not a multiple of the SIMD width, each with its own timing
+	enum { CHANNELS = 13 };
+	struct animation * animation = animation_create( CHANNELS, 255 );
+	TEST_ASSERT_EQUAL( CHANNELS, animation_getChannels( animation ) );
+	for( unsigned int c = 0; c < CHANNELS; ++c )
+	{
+		animation_addKeyframe( animation, c, 0.0f, 0, ANIMATION_LINEAR );
+		animation_addKeyframe( animation, c, 1.0f + c, 10 * c, ANIMATION_LINEAR );
+	}
+	TEST_ASSERT_EQUAL( -1, animation_addKeyframe( animation, CHANNELS, 0.0f, 0, ANIMATION_LINEAR ) );
+	TEST_ASSERT_EQUAL( -1, animation_addKeyframe( animation, 0, 0.5f, 0, ANIMATION_LINEAR ) ); // going back in time
+	TEST_ASSERT_EQUAL( 1.0f + CHANNELS - 1, animation_getDuration( animation ) );
+	animation_evaluate( animation, 1.0f );
+	const uint16_t * positions = animation_getPositions( animation );
+	for( unsigned int c = 0; c < CHANNELS; ++c )
+	{
+		int expected = 10.0f * c / ( 1.0f + c ) + 0.5f;
+		TEST_ASSERT_EQUAL( expected, positions[c] );
+	}
+	animation_evaluate( animation, 100.0f );
+	for( unsigned int c = 0; c < CHANNELS; ++c )
+		TEST_ASSERT_EQUAL( 10 * c, positions[c] );
+	animation_destroy( animation );
+}
+
+
+static void test_load( void )
+{
+	char path[] = "/tmp/servusb_animationXXXXXX";
+	int fd = mkstemp( path );
+	TEST_ASSERT( fd >= 0 );
+	FILE * file = fdopen( fd, "w" );
+	fprintf( file, "# channel time value\n0 0 10\n\n1 0 20 ease\n0 1 30 cubic # comment\n" );
+	fclose( file );
+
+	struct animation * animation = animation_create( 2, 255 );
+	TEST_ASSERT_EQUAL( 0, animation_load( animation, path ) );
+	animation_evaluate( animation, 2.0f );
+	TEST_ASSERT_EQUAL( 30, animation_getPositions( animation )[0] );
+	TEST_ASSERT_EQUAL( 20, animation_getPositions( animation )[1] );
+	animation_destroy( animation );
+
+	animation = animation_create( 1, 255 ); // channel 1 has nothing to drive
+	TEST_ASSERT_EQUAL( -1, animation_load( animation, path ) );
+	animation_destroy( animation );
+	unlink( path );
+}
+
+
+// a channel the file leaves out reports 0, which the player must not send
+static void test_unanimated( void )
+{
+	struct animation * animation = animation_create( 3, 255 );
+	animation_addKeyframe( animation, 0, 0.0f, 10, ANIMATION_LINEAR );
+	animation_addKeyframe( animation, 2, 1.0f, 30, ANIMATION_LINEAR );
+	TEST_ASSERT( animation_isAnimated( animation, 0 ) );
+	TEST_ASSERT( !animation_isAnimated( animation, 1 ) );
+	TEST_ASSERT( animation_isAnimated( animation, 2 ) );
+	TEST_ASSERT( !animation_isAnimated( animation, 3 ) );
+	animation_evaluate( animation, 2.0f );
+	TEST_ASSERT_EQUAL( 10, animation_getPositions( animation )[0] );
+	TEST_ASSERT_EQUAL( 0, animation_getPositions( animation )[1] );
+	TEST_ASSERT_EQUAL( 30, animation_getPositions( animation )[2] );
+	animation_destroy( animation );
+}
+
+
+int main( int argc, char ** argv )
+{
+	static const struct test tests[] =
+	{
+		TEST( test_holdOutside ),
+		TEST( test_linear ),
+		TEST( test_ease ),
+		TEST( test_cubic ),
+		TEST( test_clamp ),
+		TEST( test_channels ),
+		TEST( test_load ),
+		TEST( test_unanimated ),
+	};
+	return test_run( tests, sizeof(tests) / sizeof(tests[0]), argc, argv );
+}
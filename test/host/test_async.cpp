@@ -0,0 +1,158 @@
+#include "test.h"
+
+#include "servusb_async.hpp"
+
+#include <stdexcept>
+
+#include <unistd.h>
+
+
+using servusb_async::executor;
+using servusb_async::task;
+
+
+static task< int > square( executor & executor, int x )
+{
+	co_await executor.schedule();
+	co_return x * x;
+}
+
+
+static task< void > sumOfSquares( executor & executor, int n, int & result )
+{
+	for( int i = 1; i <= n; ++i )
+		result += co_await square( executor, i );
+}
+
+
+static void test_nested( void )
+{
+	executor executor;
+	int result = 0;
+	executor.spawn( sumOfSquares( executor, 10, result ) );
+	TEST_ASSERT_EQUAL( 0, result ); // nothing runs before run()
+	TEST_ASSERT_EQUAL( 0, executor.run() );
+	TEST_ASSERT_EQUAL( 385, result );
+}
+
+
+#define TASKS 10000
+#define STEPS 10
+
+static task< void > step( executor & executor, unsigned int & done, bool & inOrder )
+{
+	for( unsigned int s = 0; s < STEPS; ++s )
+	{
+		// all tasks take turns, so every one finished the previous step before anyone starts the next
+		inOrder &= done / TASKS == s;
+		++done;
+		co_await executor.schedule();
+	}
+}
+
+
+static void test_manyTasks( void )
+{
+	executor executor;
+	unsigned int done = 0;
+	bool inOrder = true;
+	for( int i = 0; i < TASKS; ++i )
+		executor.spawn( step( executor, done, inOrder ) );
+	TEST_ASSERT_EQUAL( 0, executor.run() );
+	TEST_ASSERT_EQUAL( TASKS * STEPS, done );
+	TEST_ASSERT( inOrder );
+}
+
+
+static task< void > reader( executor & executor, int fd, char & received )
+{
+	short revents = co_await executor.poll( fd, POLLIN );
+	if( revents & POLLIN )
+		(void)!read( fd, &received, 1 );
+}
+
+
+static task< void > writer( executor & executor, int fd )
+{
+	for( int i = 0; i < 3; ++i )
+		co_await executor.schedule(); // the reader is already waiting
+	(void)!write( fd, "x", 1 );
+}
+
+
+static void test_poll( void )
+{
+	int fds[2];
+	TEST_ASSERT_EQUAL( 0, pipe( fds ) );
+	executor executor;
+	char received = 0;
+	executor.spawn( reader( executor, fds[0], received ) );
+	executor.spawn( writer( executor, fds[1] ) );
+	TEST_ASSERT_EQUAL( 0, executor.run() );
+	TEST_ASSERT_EQUAL( 'x', received );
+	close( fds[0] );
+	close( fds[1] );
+}
+
+
+static task< int > fail( void )
+{
+	throw std::runtime_error( "fail" );
+	co_return 0;
+}
+
+
+static task< void > catcher( bool & caught )
+{
+	try
+	{
+		co_await fail();
+	}
+	catch( const std::runtime_error & )
+	{
+		caught = true;
+	}
+}
+
+
+static void test_exception( void )
+{
+	executor executor;
+	bool caught = false;
+	executor.spawn( catcher( caught ) );
+	TEST_ASSERT_EQUAL( 0, executor.run() );
+	TEST_ASSERT( caught );
+}
+
+
+static task< void > openMissing( executor & executor, int & result )
+{
+	servusb_async::device device( executor );
+	result = co_await device.open( 255, 255 ); // USB addresses end at 127
+	if( device.isOpen() )
+		result = 1;
+}
+
+
+static void test_openMissing( void )
+{
+	executor executor;
+	int result = 0;
+	executor.spawn( openMissing( executor, result ) );
+	TEST_ASSERT_EQUAL( 0, executor.run() );
+	TEST_ASSERT_EQUAL( LIBUSB_ERROR_NOT_FOUND, result );
+}
+
+
+int main( int argc, char ** argv )
+{
+	static const struct test tests[] =
+	{
+		TEST( test_nested ),
+		TEST( test_manyTasks ),
+		TEST( test_poll ),
+		TEST( test_exception ),
+		TEST( test_openMissing ),
+	};
+	return test_run( tests, sizeof(tests) / sizeof(tests[0]), argc, argv );
+}
@@ -0,0 +1,111 @@
+#define _DEFAULT_SOURCE
+
+#include "test.h"
+
+#include <unistd.h>
+#include <limits.h>
+
+#include "devcache.h"
+
+
+static char directory[] = "/tmp/servusb_cacheXXXXXX";
+static char path[PATH_MAX];
+
+
+static void setUp( void )
+{
+	unlink( path );
+	rmdir( directory );
+}
+
+
+static void store( int bus, int dev, int foundBus, int foundDev, const char * port )
+{
+	struct devcache_entry entry = { foundBus, foundDev };
+	strcpy( entry.port, port );
+	devcache_store( bus, dev, &entry );
+}
+
+
+static void test_lookup( void )
+{
+	setUp();
+	struct devcache_entry found;
+	TEST_ASSERT_EQUAL( -1, devcache_lookup( -1, -1, &found ) );
+
+	store( -1, -1, 1, 4, "1-1.2" ); // creates the directory
+	store( 3, -1, 3, 9, "3-2" );
+	TEST_ASSERT_EQUAL( 0, devcache_lookup( -1, -1, &found ) );
+	TEST_ASSERT_EQUAL( 1, found.bus );
+	TEST_ASSERT_EQUAL( 4, found.dev );
+	TEST_ASSERT( !strcmp( "1-1.2", found.port ) );
+	TEST_ASSERT_EQUAL( 0, devcache_lookup( 3, -1, &found ) );
+	TEST_ASSERT_EQUAL( 9, found.dev );
+	TEST_ASSERT_EQUAL( -1, devcache_lookup( -1, 9, &found ) );
+
+	// a selector finding another device replaces its entry
+	store( -1, -1, 1, 7, "1-1.3" );
+	TEST_ASSERT_EQUAL( 0, devcache_lookup( -1, -1, &found ) );
+	TEST_ASSERT_EQUAL( 7, found.dev );
+	TEST_ASSERT( !strcmp( "1-1.3", found.port ) );
+	FILE * file = fopen( path, "r" );
+	TEST_ASSERT( file );
+	char line[128];
+	unsigned int lines = 0;
+	while( fgets( line, sizeof(line), file ) )
+		lines++;
+	fclose( file );
+	TEST_ASSERT_EQUAL( 3, lines ); // comment and two entries
+}
+
+
+// the least recently used selectors fall out
+static void test_limit( void )
+{
+	setUp();
+	for( int dev = 1; dev <= DEVCACHE_ENTRIES + 4; ++dev )
+		store( -1, dev, 1, dev, "1-1" );
+	struct devcache_entry found;
+	for( int dev = 1; dev <= 4; ++dev )
+		TEST_ASSERT_EQUAL( -1, devcache_lookup( -1, dev, &found ) );
+	for( int dev = 5; dev <= DEVCACHE_ENTRIES + 4; ++dev )
+		TEST_ASSERT_EQUAL( 0, devcache_lookup( -1, dev, &found ) );
+}
+
+
+// garbage is ignored, nothing is written if there is no place for the cache
+static void test_broken( void )
+{
+	setUp();
+	store( -1, -1, 1, 4, "1-1.2" );
+	FILE * file = fopen( path, "w" );
+	TEST_ASSERT( file );
+	fprintf( file, "garbage\n-1 -1 1\n2 -1 2 5 2-1\n" );
+	fclose( file );
+	struct devcache_entry found;
+	TEST_ASSERT_EQUAL( -1, devcache_lookup( -1, -1, &found ) );
+	TEST_ASSERT_EQUAL( 0, devcache_lookup( 2, -1, &found ) );
+
+	setenv( "XDG_CACHE_HOME", "/nonexistent/servusb", 1 );
+	store( -1, -1, 1, 4, "1-1.2" );
+	TEST_ASSERT_EQUAL( -1, devcache_lookup( -1, -1, &found ) );
+	setenv( "XDG_CACHE_HOME", directory, 1 );
+}
+
+
+int main( int argc, char ** argv )
+{
+	static const struct test tests[] =
+	{
+		TEST( test_lookup ),
+		TEST( test_limit ),
+		TEST( test_broken ),
+	};
+	if( !mkdtemp( directory ) )
+		return EXIT_FAILURE;
+	setenv( "XDG_CACHE_HOME", directory, 1 );
+	snprintf( path, sizeof(path), "%s/servusb-devices", directory );
+	int result = test_run( tests, sizeof(tests) / sizeof(tests[0]), argc, argv );
+	setUp();
+	return result;
+}
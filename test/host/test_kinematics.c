@@ -0,0 +1,222 @@
+#include "test.h"
+
+#include "kinematics.h"
+#include "emulated.h"
+#include "servusb.h"
+
+
+#define MS 1000000ll // nanoseconds
+
+
+static const struct kinematics_type fast = { "fast", 1000, 1, 0.02f }; // 100 positions in 100 ms
+static const struct kinematics_type slow = { "slow", 500, 1, 0.02f };
+
+
+static bool near( float expected, float actual )
+{
+	return actual > expected - 0.01f && actual < expected + 0.01f;
+}
+
+
+static bool nearTime( int64_t expected, int64_t actual )
+{
+	return actual > expected - 10000 && actual < expected + 10000; // 10 us
+}
+
+
+static void test_types( void )
+{
+	struct kinematics_type custom;
+	const struct kinematics_type * standard = kinematics_findType( "standard", &custom );
+	TEST_ASSERT( standard && !strcmp( "standard", standard->name ) );
+	TEST_ASSERT( kinematics_findType( "micro", &custom )->slewRate > standard->slewRate );
+	TEST_ASSERT( kinematics_findType( "digital", &custom )->deadband < standard->deadband );
+
+	TEST_ASSERT( kinematics_findType( "600,1.5", &custom ) == &custom );
+	TEST_ASSERT( near( 600, custom.slewRate ) );
+	TEST_ASSERT( near( 1.5f, custom.deadband ) );
+	TEST_ASSERT( near( standard->delay, custom.delay ) );
+	TEST_ASSERT( kinematics_findType( "600,0,0.01", &custom ) == &custom );
+	TEST_ASSERT( near( 0.01f, custom.delay ) );
+
+	TEST_ASSERT( !kinematics_findType( "turbo", &custom ) );
+	TEST_ASSERT( !kinematics_findType( "600", &custom ) );
+	TEST_ASSERT( !kinematics_findType( "0,1", &custom ) );
+}
+
+
+// the servo starts after the delay and turns at its slew rate
+static void test_slew( void )
+{
+	struct kinematics * kinematics = kinematics_create( 1, &fast );
+	kinematics_reset( kinematics, 0, 0 );
+	int64_t time = 1000 * MS;
+	kinematics_command( kinematics, 0, time, 100 );
+	TEST_ASSERT( near( 0, kinematics_getPosition( kinematics, 0, time ) ) );
+	TEST_ASSERT( near( 0, kinematics_getPosition( kinematics, 0, time + 20 * MS ) ) );
+	TEST_ASSERT( near( 50, kinematics_getPosition( kinematics, 0, time + 70 * MS ) ) );
+	TEST_ASSERT( near( 100, kinematics_getPosition( kinematics, 0, time + 120 * MS ) ) );
+	TEST_ASSERT( near( 100, kinematics_getPosition( kinematics, 0, time + 1000 * MS ) ) );
+	TEST_ASSERT( nearTime( time + 120 * MS, kinematics_getArrival( kinematics, 0 ) ) );
+
+	// turning around halfway
+	kinematics_command( kinematics, 0, time + 50 * MS, 0 );
+	TEST_ASSERT( near( 50, kinematics_getPosition( kinematics, 0, time + 70 * MS ) ) );
+	TEST_ASSERT( near( 40, kinematics_getPosition( kinematics, 0, time + 80 * MS ) ) );
+	TEST_ASSERT( nearTime( time + 120 * MS, kinematics_getArrival( kinematics, 0 ) ) );
+	kinematics_destroy( kinematics );
+}
+
+
+// a resting servo ignores setpoints within its deadband, a moving one follows them
+static void test_deadband( void )
+{
+	struct kinematics * kinematics = kinematics_create( 1, &fast );
+	kinematics_reset( kinematics, 0, 100 );
+	int64_t time = 1000 * MS;
+	kinematics_command( kinematics, 0, time, 100.8f );
+	TEST_ASSERT( near( 100, kinematics_getPosition( kinematics, 0, time + 100 * MS ) ) );
+	TEST_ASSERT( kinematics_getArrival( kinematics, 0 ) <= time );
+
+	kinematics_command( kinematics, 0, time + 100 * MS, 110 );
+	kinematics_command( kinematics, 0, time + 105 * MS, 110.5f ); // seen while moving
+	TEST_ASSERT( near( 110.5f, kinematics_getPosition( kinematics, 0, time + 200 * MS ) ) );
+	TEST_ASSERT( nearTime( time + 130500000, kinematics_getArrival( kinematics, 0 ) ) );
+	kinematics_destroy( kinematics );
+}
+
+
+// setpoints come faster than the delay, each one is seen in order
+static void test_pending( void )
+{
+	struct kinematics * kinematics = kinematics_create( 1, &fast );
+	kinematics_reset( kinematics, 0, 0 );
+	int64_t time = 1000 * MS;
+	for( unsigned int i = 1; i <= 20; ++i )
+	{ // 1000 per second, as fast as it goes - the servo follows the delay later
+		kinematics_command( kinematics, 0, time + i * 5 * MS, 5 * i );
+		float expected = i < 5 ? 0 : 5 * ( i - 4 ) - 5;
+		TEST_ASSERT( near( expected, kinematics_getPosition( kinematics, 0, time + i * 5 * MS ) ) );
+	}
+	TEST_ASSERT( near( 85, kinematics_getPosition( kinematics, 0, time + 110 * MS ) ) );
+	TEST_ASSERT( nearTime( time + 125 * MS, kinematics_getArrival( kinematics, 0 ) ) );
+	TEST_ASSERT( nearTime( time + 125 * MS, kinematics_getSettled( kinematics ) ) );
+	kinematics_destroy( kinematics );
+}
+
+
+// both servos arrive together, the slower one sets the pace
+static void test_plan( void )
+{
+	struct kinematics * kinematics = kinematics_create( 2, &fast );
+	kinematics_setType( kinematics, 1, &slow );
+	kinematics_reset( kinematics, 0, 200 );
+	kinematics_reset( kinematics, 1, 0 );
+	struct animation * animation = animation_create( 2, 255 );
+	float targets[2] = { 150, 100 };
+	int64_t start = 5000 * MS;
+	float duration = kinematics_plan( kinematics, start, targets, 2, animation, 0 );
+	TEST_ASSERT( near( 0.2f, duration ) );
+	animation_evaluate( animation, 0.1f );
+	TEST_ASSERT_EQUAL( 175, animation_getPositions( animation )[0] );
+	TEST_ASSERT_EQUAL( 50, animation_getPositions( animation )[1] );
+
+	// played every servo frame, each servo gets there within the delay and a frame after the end
+	for( unsigned int frame = 0; frame <= 10; ++frame )
+	{
+		animation_evaluate( animation, frame * 0.02f );
+		for( unsigned int i = 0; i < 2; ++i )
+			kinematics_command( kinematics, i, start + frame * 20 * MS, animation_getPositions( animation )[i] );
+	}
+	for( unsigned int i = 0; i < 2; ++i )
+	{
+		TEST_ASSERT( kinematics_getArrival( kinematics, i ) >= start + 220 * MS );
+		TEST_ASSERT( kinematics_getArrival( kinematics, i ) <= start + 240 * MS + MS );
+	}
+	TEST_ASSERT( near( 150, kinematics_getPosition( kinematics, 0, start + 300 * MS ) ) );
+	TEST_ASSERT( near( 100, kinematics_getPosition( kinematics, 1, start + 300 * MS ) ) );
+
+	// keyframes only go forward
+	TEST_ASSERT( kinematics_plan( kinematics, start, targets, 2, animation, 0.1f ) < 0 );
+	animation_destroy( animation );
+	kinematics_destroy( kinematics );
+}
+
+
+static int64_t now = 0;
+
+static int64_t fakeClock( void )
+{
+	return now;
+}
+
+
+// the emulated device moves its model, the same way every run
+static void test_emulated( void )
+{
+	emulated_setClock( fakeClock );
+	now = 1000 * MS;
+	struct servusb * servusb;
+	TEST_ASSERT_EQUAL( 0, servusb_open( &servusb, servusb_findTransport( "emulated" ), -1, -1 ) );
+	TEST_ASSERT_EQUAL( 1, servusb->dev );
+	struct kinematics * plant = emulated_getKinematics();
+	kinematics_setType( plant, 0, &fast );
+	kinematics_reset( plant, 0, 0 );
+
+	uint8_t positions[2] = { 100, 30 };
+	TEST_ASSERT( servusb_setPositions( servusb, positions, 2 ) >= 0 );
+	now += 500 * MS;
+	TEST_ASSERT( near( 0, kinematics_getPosition( plant, 0, now ) ) ); // not enabled yet
+	TEST_ASSERT( servusb_setEnabled( servusb, true ) >= 0 );
+	TEST_ASSERT( nearTime( now + 120 * MS, kinematics_getArrival( plant, 0 ) ) );
+	TEST_ASSERT( near( 50, kinematics_getPosition( plant, 0, now + 70 * MS ) ) );
+
+	// a single servo, the second position went nowhere
+	unsigned char data[3] = { SERVUSB_REPORT_ID_DATA };
+	TEST_ASSERT_EQUAL( 2, servusb_getFeature( servusb, data, sizeof(data) ) );
+	TEST_ASSERT_EQUAL( 100, data[1] );
+	struct servusb_status status;
+	TEST_ASSERT_EQUAL( 17, servusb_getStatus( servusb, &status ) ); // as long as the stock firmware sends it
+	TEST_ASSERT( status.enabled );
+	TEST_ASSERT_EQUAL( 1, status.channels );
+	TEST_ASSERT_EQUAL( 12000, status.clockKHz );
+	TEST_ASSERT_EQUAL( 20000, status.frameUs );
+	TEST_ASSERT_EQUAL( 100, status.commanded[0] );
+	TEST_ASSERT_EQUAL( 100, status.pulsed[0] );
+	TEST_ASSERT_EQUAL( 0, servusb->reconnects );
+	servusb_close( servusb );
+	TEST_ASSERT( servusb_open( &servusb, servusb_findTransport( "emulated" ), 1, -1 ) < 0 );
+	emulated_setClock( NULL );
+}
+
+
+// reports the firmware doesn't have fail without taking the device for gone
+static void test_missingReports( void )
+{
+	struct servusb * servusb;
+	TEST_ASSERT_EQUAL( 0, servusb_open( &servusb, servusb_findTransport( "emulated" ), -1, -1 ) );
+	bool enabled;
+	uint8_t positions[1];
+	TEST_ASSERT_EQUAL( LIBUSB_ERROR_NOT_SUPPORTED, servusb_getPowerOn( servusb, &enabled, positions, 1 ) );
+	struct servusb_jitter jitter;
+	TEST_ASSERT_EQUAL( LIBUSB_ERROR_NOT_SUPPORTED, servusb_getJitter( servusb, &jitter ) );
+	TEST_ASSERT_EQUAL( 0, servusb->reconnects );
+	TEST_ASSERT( servusb->connected );
+	servusb_close( servusb );
+}
+
+
+int main( int argc, char ** argv )
+{
+	static const struct test tests[] =
+	{
+		TEST( test_types ),
+		TEST( test_slew ),
+		TEST( test_deadband ),
+		TEST( test_pending ),
+		TEST( test_plan ),
+		TEST( test_emulated ),
+		TEST( test_missingReports ),
+	};
+	return test_run( tests, sizeof(tests) / sizeof(tests[0]), argc, argv );
+}
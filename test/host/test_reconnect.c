@@ -0,0 +1,301 @@
+#include "test.h"
+
+#include "servusb.h"
+#include "latency.h"
+
+
+// A ServUSB which can be unplugged, with a second one at another port
+struct fake
+{
+	const char * port;
+	int dev;           // changes whenever it enumerates
+	bool present;
+	int comesBackAfter; // failing open() calls before it is present again, -1 for never
+	bool enabled;
+	bool powerOnEnabled; // the state it starts up in
+	uint8_t positions[SERVUSB_MAX_CHANNELS];
+	uint16_t reportLength; // of the reports it answers with, 0 for as long as asked - older firmware
+};
+
+static struct fake fakes[2];
+static unsigned int opens;
+
+
+static void plug( struct fake * fake )
+{ // a device which just enumerated is at position 0, enabled as stored for power-on
+	memset( fake->positions, 0, sizeof(fake->positions) );
+	fake->enabled = fake->powerOnEnabled;
+	fake->present = true;
+	fake->dev++;
+}
+
+
+static void unplug( struct fake * fake, int comesBackAfter )
+{
+	fake->present = false;
+	fake->comesBackAfter = comesBackAfter;
+}
+
+
+static int fakeList( int bus, int dev, struct servusb_address * addresses, int max )
+{
+	return 0;
+}
+
+
+static int fakeOpen( struct servusb * servusb )
+{
+	opens++;
+	for( unsigned int i = 0; i < 2; ++i )
+	{
+		struct fake * fake = &fakes[i];
+		if( !fake->present && fake->comesBackAfter >= 0 && !fake->comesBackAfter-- )
+			plug( fake );
+		if( !fake->present )
+			continue;
+		if( servusb->port[0] ? strcmp( servusb->port, fake->port ) : servusb->dev != -1 && servusb->dev != fake->dev )
+			continue;
+		servusb->bus = 1;
+		servusb->dev = fake->dev;
+		strcpy( servusb->port, fake->port );
+		servusb->fd = i; // the session, stale once the device is unplugged
+		return 0;
+	}
+	return LIBUSB_ERROR_NOT_FOUND;
+}
+
+
+static void fakeClose( struct servusb * servusb )
+{
+	servusb->fd = -1;
+}
+
+
+static struct fake * session( struct servusb * servusb )
+{
+	if( servusb->fd < 0 || !fakes[servusb->fd].present || fakes[servusb->fd].dev != servusb->dev )
+		return NULL;
+	return &fakes[servusb->fd];
+}
+
+
+static int fakeSetFeature( struct servusb * servusb, unsigned char * data, uint16_t length )
+{
+	struct fake * fake = session( servusb );
+	if( !fake )
+		return LIBUSB_ERROR_NO_DEVICE;
+	if( data[0] == SERVUSB_REPORT_ID_CONTROL )
+		fake->enabled = data[1] & SERVUSB_CONTROL_ENABLE_BIT;
+	if( data[0] == SERVUSB_REPORT_ID_DATA )
+		memcpy( fake->positions, data + 1, length - 1 );
+	return length;
+}
+
+
+static int fakeGetFeature( struct servusb * servusb, unsigned char * data, uint16_t length )
+{
+	struct fake * fake = session( servusb );
+	if( !fake )
+		return LIBUSB_ERROR_IO;
+	if( fake->reportLength && length > fake->reportLength )
+		length = fake->reportLength;
+	memcpy( data + 1, fake->positions, length - 1 );
+	return length;
+}
+
+
+static unsigned int vendorRequests;
+
+
+static int fakeVendorRequest( struct servusb * servusb, uint8_t request, uint16_t value, uint16_t index )
+{
+	struct fake * fake = session( servusb );
+	if( !fake )
+		return LIBUSB_ERROR_NO_DEVICE;
+	vendorRequests++;
+	if( request == SERVUSB_REQUEST_SET_ENABLED )
+		fake->enabled = value & SERVUSB_CONTROL_ENABLE_BIT;
+	if( request == SERVUSB_REQUEST_SET_POSITIONS )
+	{
+		const uint8_t positions[SERVUSB_REQUEST_MAX_POSITIONS] = { value, value >> 8, index };
+		memcpy( fake->positions, positions, index >> 8 );
+	}
+	return 0;
+}
+
+
+static const struct servusb_transport fakeTransport =
+{
+	"fake",
+	fakeList,
+	fakeOpen,
+	fakeClose,
+	fakeSetFeature,
+	fakeGetFeature,
+	fakeVendorRequest,
+};
+
+
+static void setUp( void )
+{
+	memset( fakes, 0, sizeof(fakes) );
+	fakes[0].port = "1-1.2";
+	fakes[0].dev = 4;
+	fakes[1].port = "1-1.3";
+	fakes[1].dev = 5;
+	plug( &fakes[0] );
+	plug( &fakes[1] );
+	opens = 0;
+	vendorRequests = 0;
+}
+
+
+static void test_restoresState( void )
+{
+	setUp();
+	struct servusb * servusb;
+	TEST_ASSERT_EQUAL( 0, servusb_open( &servusb, &fakeTransport, -1, 5 ) );
+	TEST_ASSERT( !strcmp( "1-1.2", servusb->port ) );
+	static const uint8_t positions[] = { 10, 20, 30 };
+	TEST_ASSERT( servusb_setPositions( servusb, positions, 3 ) >= 0 );
+	TEST_ASSERT( servusb_setEnabled( servusb, true ) >= 0 );
+
+	// reset while idle - the next transfer finds it again, restored
+	unplug( &fakes[0], 3 );
+	int64_t start = latency_now();
+	TEST_ASSERT_EQUAL( 2, servusb_setPosition( servusb, 99 ) );
+	TEST_ASSERT( latency_now() - start < 100000000 );
+	TEST_ASSERT_EQUAL( 1, servusb->reconnects );
+	TEST_ASSERT_EQUAL( 6, servusb->dev );
+	TEST_ASSERT( fakes[0].enabled );
+	TEST_ASSERT_EQUAL( 99, fakes[0].positions[0] );
+	TEST_ASSERT_EQUAL( 20, fakes[0].positions[1] );
+	TEST_ASSERT_EQUAL( 30, fakes[0].positions[2] );
+	TEST_ASSERT( !fakes[1].enabled ); // the other one at another port is left alone
+
+	// reads reconnect as well
+	unplug( &fakes[0], 0 );
+	unsigned char data[4] = { SERVUSB_REPORT_ID_DATA };
+	TEST_ASSERT_EQUAL( 4, servusb_getFeature( servusb, data, sizeof(data) ) );
+	TEST_ASSERT_EQUAL( 99, data[1] );
+	TEST_ASSERT_EQUAL( 2, servusb->reconnects );
+	servusb_close( servusb );
+}
+
+
+static void test_givesUp( void )
+{
+	setUp();
+	struct servusb * servusb;
+	TEST_ASSERT_EQUAL( 0, servusb_open( &servusb, &fakeTransport, -1, -1 ) );
+	servusb->reconnectTimeout = 20;
+	TEST_ASSERT( servusb_setEnabled( servusb, true ) >= 0 );
+
+	unplug( &fakes[0], -1 );
+	int64_t start = latency_now();
+	TEST_ASSERT( servusb_setPosition( servusb, 1 ) < 0 );
+	int64_t elapsed = latency_now() - start;
+	TEST_ASSERT( elapsed >= 20000000 && elapsed < 200000000 );
+	TEST_ASSERT( !servusb->connected );
+	TEST_ASSERT_EQUAL( 0, servusb->reconnects );
+
+	// back later - the next transfer picks it up
+	unplug( &fakes[0], 0 );
+	TEST_ASSERT_EQUAL( 2, servusb_setPosition( servusb, 1 ) );
+	TEST_ASSERT_EQUAL( 1, servusb->reconnects );
+	TEST_ASSERT( fakes[0].enabled );
+
+	// disabled
+	servusb->reconnectTimeout = 0;
+	unplug( &fakes[0], 0 );
+	opens = 0;
+	TEST_ASSERT_EQUAL( LIBUSB_ERROR_NO_DEVICE, servusb_setPosition( servusb, 2 ) );
+	TEST_ASSERT_EQUAL( 0, opens );
+	servusb_close( servusb );
+}
+
+
+// a device stored to start up enabled is disabled again if the host left it disabled
+static void test_restoresDisabled( void )
+{
+	setUp();
+	fakes[0].powerOnEnabled = true;
+	struct servusb * servusb;
+	TEST_ASSERT_EQUAL( 0, servusb_open( &servusb, &fakeTransport, -1, -1 ) );
+	TEST_ASSERT( servusb_setEnabled( servusb, false ) >= 0 );
+
+	unplug( &fakes[0], 0 );
+	TEST_ASSERT_EQUAL( 2, servusb_setPosition( servusb, 7 ) );
+	TEST_ASSERT_EQUAL( 1, servusb->reconnects );
+	TEST_ASSERT( !fakes[0].enabled );
+	TEST_ASSERT_EQUAL( 7, fakes[0].positions[0] );
+	servusb_close( servusb );
+}
+
+
+// a shorter report is the firmware's answer, the device is still there
+static void test_shortReply( void )
+{
+	setUp();
+	struct servusb * servusb;
+	TEST_ASSERT_EQUAL( 0, servusb_open( &servusb, &fakeTransport, -1, -1 ) );
+	TEST_ASSERT( servusb_setPosition( servusb, 42 ) >= 0 );
+	fakes[0].reportLength = 2;
+	opens = 0;
+
+	unsigned char data[4] = { SERVUSB_REPORT_ID_DATA };
+	TEST_ASSERT_EQUAL( 2, servusb_getFeature( servusb, data, sizeof(data) ) );
+	TEST_ASSERT_EQUAL( 42, data[1] );
+	struct servusb_frame frame;
+	TEST_ASSERT_EQUAL( LIBUSB_ERROR_NOT_SUPPORTED, servusb_getFrame( servusb, &frame ) );
+	TEST_ASSERT_EQUAL( 0, opens );
+	TEST_ASSERT_EQUAL( 0, servusb->reconnects );
+	TEST_ASSERT( servusb->connected );
+	servusb_close( servusb );
+}
+
+
+// firmware which takes them gets control and short data reports as vendor requests
+static void test_vendorRequests( void )
+{
+	setUp();
+	struct servusb * servusb;
+	TEST_ASSERT_EQUAL( 0, servusb_open( &servusb, &fakeTransport, -1, -1 ) );
+	TEST_ASSERT( servusb_setEnabled( servusb, true ) >= 0 );
+	TEST_ASSERT_EQUAL( 0, vendorRequests );
+
+	servusb->vendorRequests = true;
+	static const uint8_t positions[] = { 10, 20, 30, 40 };
+	TEST_ASSERT_EQUAL( 2, servusb_setEnabled( servusb, false ) );
+	TEST_ASSERT( !fakes[0].enabled );
+	TEST_ASSERT_EQUAL( 4, servusb_setPositions( servusb, positions, 3 ) );
+	TEST_ASSERT_EQUAL( 2, vendorRequests );
+	TEST_ASSERT_EQUAL( 30, fakes[0].positions[2] );
+	TEST_ASSERT_EQUAL( 2, servusb_setPosition( servusb, 5 ) );
+	TEST_ASSERT_EQUAL( 5, fakes[0].positions[0] );
+	TEST_ASSERT_EQUAL( 20, fakes[0].positions[1] );
+	TEST_ASSERT_EQUAL( 5, servusb_setPositions( servusb, positions, 4 ) ); // too many for a request
+	TEST_ASSERT_EQUAL( 3, vendorRequests );
+	TEST_ASSERT_EQUAL( 40, fakes[0].positions[3] );
+
+	// restored the same way after reconnecting
+	unplug( &fakes[0], 0 );
+	TEST_ASSERT_EQUAL( 2, servusb_setEnabled( servusb, true ) );
+	TEST_ASSERT( fakes[0].enabled );
+	TEST_ASSERT_EQUAL( 10, fakes[0].positions[0] );
+	servusb_close( servusb );
+}
+
+
+int main( int argc, char ** argv )
+{
+	static const struct test tests[] =
+	{
+		TEST( test_restoresState ),
+		TEST( test_givesUp ),
+		TEST( test_restoresDisabled ),
+		TEST( test_shortReply ),
+		TEST( test_vendorRequests ),
+	};
+	return test_run( tests, sizeof(tests) / sizeof(tests[0]), argc, argv );
+}
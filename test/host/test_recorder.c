@@ -0,0 +1,197 @@
+#define _DEFAULT_SOURCE
+
+#include "test.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "recorder.h"
+#include "servusb.h"
+#include "animation.h"
+#include "latency.h"
+
+
+#define CAPACITY 256
+#define THREADS  4
+#define RECORDS  50 // per thread, all fit the ring
+
+
+static char path[] = "/tmp/servusb_recordXXXXXX";
+
+
+static void create( void )
+{
+	strcpy( path, "/tmp/servusb_recordXXXXXX" );
+	int fd = mkstemp( path );
+	if( fd >= 0 )
+		close( fd );
+	recorder_open( path, CAPACITY );
+}
+
+
+static void add( uint8_t dev, int64_t time, uint8_t position )
+{
+	struct servusb servusb;
+	servusb.bus = 1;
+	servusb.dev = dev;
+	unsigned char data[2] = { SERVUSB_REPORT_ID_DATA, position };
+	recorder_add( &servusb, data, sizeof(data), sizeof(data), time, time + 300000 );
+}
+
+
+static void * sender( void * argument )
+{
+	struct servusb servusb;
+	servusb.bus = 2;
+	servusb.dev = (uintptr_t)argument;
+	for( unsigned int i = 0; i < RECORDS; ++i )
+	{
+		unsigned char data[4] = { SERVUSB_REPORT_ID_DATA, i, 1, 2 };
+		recorder_add( &servusb, data, sizeof(data), i % 2 ? sizeof(data) : LIBUSB_ERROR_IO, latency_now(), latency_now() );
+	}
+	return NULL;
+}
+
+
+static void test_threads( void )
+{
+	create();
+	pthread_t threads[THREADS];
+	for( uintptr_t i = 0; i < THREADS; ++i )
+		TEST_ASSERT_EQUAL( 0, pthread_create( &threads[i], NULL, sender, (void *)( i + 1 ) ) );
+	for( unsigned int i = 0; i < THREADS; ++i )
+		pthread_join( threads[i], NULL );
+	recorder_close();
+
+	struct recorder_entry * entries;
+	int count = recorder_load( path, &entries );
+	unlink( path );
+	TEST_ASSERT_EQUAL( THREADS * RECORDS, count );
+	unsigned int perThread[THREADS + 1] = {0};
+	for( int i = 0; i < count; ++i )
+	{
+		const struct recorder_entry * entry = &entries[i];
+		TEST_ASSERT_EQUAL( 2, entry->bus );
+		TEST_ASSERT( entry->dev >= 1 && entry->dev <= THREADS );
+		TEST_ASSERT_EQUAL( SERVUSB_REPORT_ID_DATA, entry->report );
+		TEST_ASSERT_EQUAL( 3, entry->length );
+		TEST_ASSERT_EQUAL( perThread[entry->dev], entry->payload[0] );
+		TEST_ASSERT_EQUAL( 2, entry->payload[2] );
+		TEST_ASSERT_EQUAL( entry->payload[0] % 2 ? 4 : LIBUSB_ERROR_IO, entry->result );
+		perThread[entry->dev]++;
+	}
+	free( entries );
+}
+
+
+// the newest records survive, one cut short by a crash is left out
+static void test_wrap( void )
+{
+	create();
+	for( unsigned int i = 0; i < CAPACITY + 10; ++i )
+		add( 3, 1000 * i, i );
+	struct recorder_entry * entries;
+	TEST_ASSERT_EQUAL( CAPACITY, recorder_load( path, &entries ) ); // while still recording
+	TEST_ASSERT_EQUAL( 10000, entries[0].time );
+	TEST_ASSERT_EQUAL( 300000, entries[0].latency );
+	free( entries );
+
+	struct recorder_header header;
+	FILE * file = fopen( path, "r+b" );
+	TEST_ASSERT( file );
+	TEST_ASSERT_EQUAL( 1, fread( &header, sizeof(header), 1, file ) );
+	TEST_ASSERT_EQUAL( CAPACITY + 10, header.head );
+	fclose( file );
+	recorder_close();
+
+	// pretend the process died while writing the last one
+	file = fopen( path, "r+b" );
+	TEST_ASSERT( file );
+	struct recorder_entry torn;
+	long offset = sizeof(struct recorder_header) + ( ( CAPACITY + 9 ) % CAPACITY ) * sizeof(struct recorder_entry);
+	fseek( file, offset, SEEK_SET );
+	TEST_ASSERT_EQUAL( 1, fread( &torn, sizeof(torn), 1, file ) );
+	torn.sequence = 0;
+	fseek( file, offset, SEEK_SET );
+	fwrite( &torn, sizeof(torn), 1, file );
+	fclose( file );
+	TEST_ASSERT_EQUAL( CAPACITY - 1, recorder_load( path, &entries ) );
+	TEST_ASSERT_EQUAL( ( CAPACITY + 8 ) % 256, entries[CAPACITY - 2].payload[0] );
+	free( entries );
+	unlink( path );
+}
+
+
+// the converted log plays back the setpoints each device was sent
+static void test_animation( void )
+{
+	struct recorder_entry entries[] =
+	{
+		{ 5000000000, 1, 2, 1, 1, 7, SERVUSB_REPORT_ID_DATA, 1, { 10 } },
+		{ 5010000000, 1, 2, 2, 1, 4, SERVUSB_REPORT_ID_DATA, 1, { 200 } },
+		{ 5020000000, 1, 2, 3, 1, 7, SERVUSB_REPORT_ID_DATA, 1, { 10 } },
+		{ 5030000000, 1, 2, 4, 1, 7, SERVUSB_REPORT_ID_CONTROL, 1, { 1 } },
+		{ 5500000000, 1, LIBUSB_ERROR_IO, 5, 1, 7, SERVUSB_REPORT_ID_DATA, 1, { 99 } },
+		{ 6000000000, 1, 2, 6, 1, 7, SERVUSB_REPORT_ID_DATA, 1, { 50 } },
+		{ 6010000000, 1, 2, 7, 1, 4, SERVUSB_REPORT_ID_DATA, 1, { 100 } },
+		{ 7000000000, 1, 2, 8, 1, 7, SERVUSB_REPORT_ID_DATA, 1, { 50 } },
+	};
+	char animationPath[] = "/tmp/servusb_animationXXXXXX";
+	int fd = mkstemp( animationPath );
+	TEST_ASSERT( fd >= 0 );
+	FILE * file = fdopen( fd, "w" );
+	TEST_ASSERT_EQUAL( 0, recorder_writeAnimation( file, entries, sizeof(entries) / sizeof(entries[0]) ) );
+	fclose( file );
+
+	struct animation * animation = animation_create( 2, 255 );
+	TEST_ASSERT_EQUAL( 0, animation_load( animation, animationPath ) );
+	unlink( animationPath );
+	TEST_ASSERT( animation_getDuration( animation ) >= 1.999f && animation_getDuration( animation ) <= 2.001f );
+	static const struct { float time; uint16_t device4; uint16_t device7; } expected[] =
+	{
+		{ 0.0f,   200, 10 }, // device 4 (channel 0) holds its first setpoint from the start
+		{ 0.01f,  200, 10 },
+		{ 0.5f,   200, 10 }, // the failed transfer does not count
+		{ 0.998f, 200, 10 },
+		{ 1.0f,   200, 50 },
+		{ 1.005f, 200, 50 },
+		{ 1.02f,  100, 50 },
+		{ 2.0f,   100, 50 },
+	};
+	for( unsigned int i = 0; i < sizeof(expected) / sizeof(expected[0]); ++i )
+	{
+		animation_evaluate( animation, expected[i].time );
+		TEST_ASSERT_EQUAL( expected[i].device4, animation_getPositions( animation )[0] );
+		TEST_ASSERT_EQUAL( expected[i].device7, animation_getPositions( animation )[1] );
+	}
+	animation_destroy( animation );
+}
+
+
+// recording stays on in the realtime loops, it must not add to a transfer - only reported,
+// the time depends on the machine the tests run on
+static void test_cost( void )
+{
+	create();
+	const unsigned int records = 100000;
+	int64_t start = latency_now();
+	for( unsigned int i = 0; i < records; ++i )
+		add( 1, latency_now(), i );
+	int64_t perRecord = ( latency_now() - start ) / records;
+	printf( "%lld ns per record\n", (long long)perRecord );
+	recorder_close();
+	unlink( path );
+}
+
+
+int main( int argc, char ** argv )
+{
+	static const struct test tests[] =
+	{
+		TEST( test_threads ),
+		TEST( test_wrap ),
+		TEST( test_animation ),
+		TEST( test_cost ),
+	};
+	return test_run( tests, sizeof(tests) / sizeof(tests[0]), argc, argv );
+}
@@ -0,0 +1,64 @@
+#include "test.h"
+
+#include "rtloop.h"
+
+
+#define PERIOD 2000 // microseconds
+
+
+struct counter
+{
+	int running;
+	unsigned int cycles;
+	unsigned int stopAfter;
+	int64_t busy; // nanoseconds to spend in each cycle
+};
+
+
+static void cycle( void * user )
+{
+	struct counter * counter = user;
+	int64_t end = latency_now() + counter->busy;
+	while( latency_now() < end )
+		;
+	if( ++counter->cycles >= counter->stopAfter )
+		counter->running = 0;
+}
+
+
+static void test_period( void )
+{
+	struct rtloop_config config = { PERIOD, 0, -1, false };
+	struct rtloop_stats stats;
+	struct counter counter = { 1, 0, 20, 0 };
+	int64_t start = latency_now();
+	TEST_ASSERT_EQUAL( 0, rtloop_run( &config, cycle, &counter, &counter.running, &stats ) );
+	int64_t elapsed = latency_now() - start;
+	TEST_ASSERT_EQUAL( 20, counter.cycles );
+	TEST_ASSERT_EQUAL( 20, stats.cycles );
+	TEST_ASSERT_EQUAL( 20, stats.jitter.count );
+	TEST_ASSERT( stats.jitter.min >= 0 ); // never early
+	TEST_ASSERT( elapsed >= ( 20 + stats.overruns - 1 ) * PERIOD * 1000ll );
+}
+
+
+static void test_overruns( void )
+{
+	struct rtloop_config config = { PERIOD, 0, -1, false };
+	struct rtloop_stats stats;
+	struct counter counter = { 1, 0, 5, PERIOD * 1000ll * 5 / 2 }; // each cycle takes 2.5 periods
+	TEST_ASSERT_EQUAL( 0, rtloop_run( &config, cycle, &counter, &counter.running, &stats ) );
+	TEST_ASSERT_EQUAL( 5, stats.cycles );
+	TEST_ASSERT( stats.overruns >= 4 ); // at least one period lost after every cycle but the last
+}
+
+
+int main( int argc, char ** argv )
+{
+	static const struct test tests[] =
+	{
+		TEST( test_period ),
+		TEST( test_overruns ),
+	};
+	return test_run( tests, sizeof(tests) / sizeof(tests[0]), argc, argv );
+}
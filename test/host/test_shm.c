@@ -0,0 +1,124 @@
+#define _DEFAULT_SOURCE
+
+#include "test.h"
+
+#include <pthread.h>
+#include <stddef.h>
+
+#include "servusb_shm.h"
+
+
+#define PRODUCERS 4
+#define UPDATES   200000
+
+
+static struct servusb_shm * shm;
+static int done;
+
+
+// every update keeps enabled equal to the lowest bit of position - a torn read breaks that
+static void * producer( void * argument )
+{
+	uintptr_t id = (uintptr_t)argument;
+	for( unsigned int i = 0; i < UPDATES; ++i )
+	{
+		uint8_t position = i * PRODUCERS + id;
+		servusb_shm_write( &shm->slot[0], position, position & 1 );
+		servusb_shm_write( &shm->slot[1 + id], position, position & 1 );
+	}
+	return NULL;
+}
+
+
+static void test_layout( void )
+{
+	TEST_ASSERT_EQUAL( 64, sizeof(struct servusb_shm) );
+	TEST_ASSERT_EQUAL( 16, sizeof(struct servusb_shm_lane) );
+	TEST_ASSERT_EQUAL( 128, sizeof(struct servusb_shm_slot) );
+	TEST_ASSERT_EQUAL( 64, offsetof(struct servusb_shm_slot, lane) ); // lanes on a cache line of their own
+	TEST_ASSERT_EQUAL( 64 + 3 * 128, servusb_shm_size( 3 ) );
+}
+
+
+static void test_concurrentWriters( void )
+{
+	shm = calloc( 1, servusb_shm_size( 1 + PRODUCERS ) );
+	TEST_ASSERT( shm );
+
+	pthread_t threads[PRODUCERS];
+	for( uintptr_t i = 0; i < PRODUCERS; ++i )
+		TEST_ASSERT( !pthread_create( &threads[i], NULL, producer, (void *)i ) );
+
+	uint32_t previous = 0;
+	unsigned int reads = 0;
+	while( !__atomic_load_n( &done, __ATOMIC_RELAXED ) && reads < 10 * UPDATES )
+	{
+		uint8_t position;
+		bool enabled;
+		uint32_t sequence = servusb_shm_read( &shm->slot[0], &position, &enabled );
+		TEST_ASSERT( !( sequence & 1 ) );
+		TEST_ASSERT( sequence >= previous );
+		TEST_ASSERT_EQUAL( position & 1, enabled );
+		previous = sequence;
+		if( sequence == 2u * PRODUCERS * UPDATES )
+			__atomic_store_n( &done, 1, __ATOMIC_RELAXED );
+		reads++;
+	}
+
+	for( unsigned int i = 0; i < PRODUCERS; ++i )
+		pthread_join( threads[i], NULL );
+
+	// no update got lost, even with several producers per slot
+	TEST_ASSERT_EQUAL( 2u * PRODUCERS * UPDATES, shm->slot[0].lane[0].sequence );
+	for( unsigned int i = 0; i < PRODUCERS; ++i )
+		TEST_ASSERT_EQUAL( 2u * UPDATES, shm->slot[1 + i].lane[0].sequence );
+	free( shm );
+}
+
+
+// the highest lane holding a lease wins, the lower ones take over when it lets go
+static void test_arbitration( void )
+{
+	struct servusb_shm_slot * slot = calloc( 1, sizeof(struct servusb_shm_slot) );
+	TEST_ASSERT( slot );
+	uint8_t position;
+	bool enabled;
+	uint32_t sequence;
+	int64_t now = 1000;
+	TEST_ASSERT_EQUAL( -1, servusb_shm_arbitrate( slot, now, &position, &enabled, &sequence ) );
+
+	servusb_shm_write( slot, 10, true ); // sequencer
+	TEST_ASSERT_EQUAL( 0, servusb_shm_arbitrate( slot, now, &position, &enabled, &sequence ) );
+	TEST_ASSERT_EQUAL( 10, position );
+	TEST_ASSERT_EQUAL( 2, sequence );
+
+	servusb_shm_write_lane( slot, 2, 20, true, now + 500 ); // manual override for a while
+	servusb_shm_write( slot, 11, true );                     // doesn't get through meanwhile
+	TEST_ASSERT_EQUAL( 2, servusb_shm_arbitrate( slot, now, &position, &enabled, &sequence ) );
+	TEST_ASSERT_EQUAL( 20, position );
+
+	servusb_shm_write_lane( slot, 3, 0, false, SERVUSB_SHM_FOREVER ); // supervisor stops everything
+	TEST_ASSERT_EQUAL( 3, servusb_shm_arbitrate( slot, now, &position, &enabled, &sequence ) );
+	TEST_ASSERT( !enabled );
+	servusb_shm_write_lane( slot, 3, 0, false, SERVUSB_SHM_RELEASED );
+	TEST_ASSERT_EQUAL( 2, servusb_shm_arbitrate( slot, now + 499, &position, &enabled, &sequence ) );
+
+	// the override's lease runs out, the sequencer's latest setpoint takes over
+	TEST_ASSERT_EQUAL( 0, servusb_shm_arbitrate( slot, now + 500, &position, &enabled, &sequence ) );
+	TEST_ASSERT_EQUAL( 11, position );
+	TEST_ASSERT( enabled );
+	TEST_ASSERT_EQUAL( 4, sequence );
+	free( slot );
+}
+
+
+int main( int argc, char ** argv )
+{
+	static const struct test tests[] =
+	{
+		TEST( test_layout ),
+		TEST( test_concurrentWriters ),
+		TEST( test_arbitration ),
+	};
+	return test_run( tests, sizeof(tests) / sizeof(tests[0]), argc, argv );
+}
@@ -0,0 +1,215 @@
+#define _DEFAULT_SOURCE
+
+#include "test.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "timing.h"
+
+
+#define CAPACITY 64
+#define THREADS  4
+#define EVENTS   50 // per thread, fits the ring
+
+
+static uint64_t get( const unsigned char * data, unsigned int bytes )
+{
+	uint64_t value = 0;
+	while( bytes-- )
+		value = value << 8 | data[bytes];
+	return value;
+}
+
+
+static void * recorder( void * argument )
+{
+	uintptr_t id = (uintptr_t)argument;
+	for( unsigned int i = 0; i < EVENTS; ++i )
+	{
+		int64_t start = trace_begin();
+		trace_end( TRACE_SET_REPORT, start, id * 1000 + i );
+	}
+	return NULL;
+}
+
+
+static void test_threads( void )
+{
+	char path[] = "/tmp/servusb_traceXXXXXX";
+	int fd = mkstemp( path );
+	TEST_ASSERT( fd >= 0 );
+	close( fd );
+
+	// the main thread wraps its ring, the others don't
+	for( unsigned int i = 0; i < CAPACITY + 10; ++i )
+		trace_record( TRACE_CYCLE, 1000 + i, 1500 + i, i );
+	pthread_t threads[THREADS];
+	for( uintptr_t i = 0; i < THREADS; ++i )
+		TEST_ASSERT_EQUAL( 0, pthread_create( &threads[i], NULL, recorder, (void *)( i + 1 ) ) );
+	for( unsigned int i = 0; i < THREADS; ++i )
+		pthread_join( threads[i], NULL );
+	TEST_ASSERT_EQUAL( 0, trace_write( path ) );
+
+	FILE * file = fopen( path, "rb" );
+	unlink( path );
+	TEST_ASSERT( file );
+	static unsigned char data[65536];
+	size_t size = fread( data, 1, sizeof(data), file );
+	fclose( file );
+
+	TEST_ASSERT( size > 12 );
+	TEST_ASSERT( !memcmp( data, "SVTR", 4 ) );
+	TEST_ASSERT_EQUAL( 1, get( data + 4, 2 ) );
+	TEST_ASSERT_EQUAL( TRACE_EVENTS, get( data + 6, 2 ) );
+	unsigned int count = get( data + 8, 4 );
+	TEST_ASSERT_EQUAL( CAPACITY + THREADS * EVENTS, count );
+	const unsigned char * record = data + 12;
+	for( unsigned int i = 0; i < TRACE_EVENTS; ++i )
+		record += strlen( (const char *)record ) + 1;
+	TEST_ASSERT_EQUAL( size, record - data + count * 20 );
+
+	// oldest thread first, the main thread kept its newest events in order
+	unsigned int perThread[THREADS + 1] = {0};
+	for( unsigned int i = 0; i < count; ++i, record += 20 )
+	{
+		unsigned int event = get( record + 12, 2 );
+		unsigned int thread = get( record + 14, 2 );
+		int32_t argument = get( record + 16, 4 );
+		TEST_ASSERT( thread <= THREADS );
+		if( thread == 0 )
+		{
+			TEST_ASSERT_EQUAL( TRACE_CYCLE, event );
+			TEST_ASSERT_EQUAL( 10 + i, argument );
+			TEST_ASSERT_EQUAL( 1010 + i, get( record, 8 ) );
+			TEST_ASSERT_EQUAL( 500, get( record + 8, 4 ) );
+		} else {
+			TEST_ASSERT_EQUAL( TRACE_SET_REPORT, event );
+			TEST_ASSERT_EQUAL( perThread[thread], argument % 1000 );
+		}
+		perThread[thread]++;
+	}
+	TEST_ASSERT_EQUAL( CAPACITY, perThread[0] );
+}
+
+
+static void test_json( void )
+{
+	char path[] = "/tmp/servusb_traceXXXXXX.json";
+	int fd = mkstemps( path, 5 );
+	TEST_ASSERT( fd >= 0 );
+	close( fd );
+	trace_record( TRACE_OPEN, 2000123, 2001123, -4 );
+	TEST_ASSERT_EQUAL( 0, trace_write( path ) );
+
+	FILE * file = fopen( path, "r" );
+	unlink( path );
+	TEST_ASSERT( file );
+	static char text[65536];
+	size_t size = fread( text, 1, sizeof(text) - 1, file );
+	fclose( file );
+	text[size] = 0;
+	TEST_ASSERT( !strncmp( text, "{\"traceEvents\":[", 16 ) );
+	TEST_ASSERT( strstr( text, "{\"name\":\"open\",\"ph\":\"X\",\"pid\":1,\"tid\":0,\"ts\":2000.123,\"dur\":1.000,\"args\":{\"argument\":-4}}" ) );
+	TEST_ASSERT( strstr( text, "\"name\":\"cycle\"" ) );
+	TEST_ASSERT( !strcmp( text + size - 4, "\n]}\n" ) );
+}
+
+
+// recording must stay cheap enough to leave on in the realtime loops - only reported, the
+// time depends on the machine the tests run on
+static void test_cost( void )
+{
+	const unsigned int events = 100000;
+	int64_t start = latency_now();
+	for( unsigned int i = 0; i < events; ++i )
+	{
+		int64_t begin = trace_begin();
+		trace_end( TRACE_GET_REPORT, begin, i );
+	}
+	int64_t perEvent = ( latency_now() - start ) / events;
+	printf( "%lld ns per event\n", (long long)perEvent );
+}
+
+
+// per event over all threads, no other test records configuring
+static void test_summary( void )
+{
+	trace_record( TRACE_CONFIGURE, 5000, 5100, 0 );
+	trace_record( TRACE_CONFIGURE, 6000, 6300, 0 );
+	trace_record( TRACE_CONFIGURE, 7000, 7200, 0 );
+	struct trace_phase phases[TRACE_EVENTS];
+	TEST_ASSERT( trace_summarize( phases ) > 0 );
+	TEST_ASSERT_EQUAL( 3, phases[TRACE_CONFIGURE].count );
+	TEST_ASSERT_EQUAL( 600, phases[TRACE_CONFIGURE].total );
+	TEST_ASSERT_EQUAL( 100, phases[TRACE_CONFIGURE].min );
+	TEST_ASSERT_EQUAL( 300, phases[TRACE_CONFIGURE].max );
+	TEST_ASSERT_EQUAL( 0, phases[TRACE_DETACH].count );
+	TEST_ASSERT( !strcmp( "configure", trace_getName( TRACE_CONFIGURE ) ) );
+}
+
+
+// every run adds its phases to the file
+static void test_timing( void )
+{
+	char path[] = "/tmp/servusb_timingXXXXXX";
+	int fd = mkstemp( path );
+	TEST_ASSERT( fd >= 0 );
+	close( fd );
+	trace_record( TRACE_CONFIGURE, 5000, 5100, 0 );
+	struct trace_phase phases[TRACE_EVENTS];
+	trace_summarize( phases );
+	TEST_ASSERT_EQUAL( 0, timing_print( latency_now() - 1000000, path ) ); // an empty file has no runs yet
+	TEST_ASSERT_EQUAL( 0, timing_print( latency_now() - 3000000, path ) );
+
+	FILE * file = fopen( path, "r" );
+	TEST_ASSERT( file );
+	char line[128];
+	unsigned int configure = 0, run = 0;
+	long long runTotal = 0, runMax = 0;
+	TEST_ASSERT( fgets( line, sizeof(line), file ) && !strcmp( line, "servusb timing 1\n" ) );
+	TEST_ASSERT( fgets( line, sizeof(line), file ) && !strcmp( line, "runs 2\n" ) );
+	while( fgets( line, sizeof(line), file ) )
+	{
+		unsigned int count;
+		long long total, min, max;
+		char name[32];
+		TEST_ASSERT_EQUAL( 5, sscanf( line, "%u %lld %lld %lld %31[^\n]", &count, &total, &min, &max, name ) );
+		if( !strcmp( name, "configure" ) )
+			configure = count;
+		if( !strcmp( name, "run" ) )
+		{
+			run = count;
+			runTotal = total;
+			runMax = max;
+		}
+	}
+	fclose( file );
+	TEST_ASSERT_EQUAL( 2 * phases[TRACE_CONFIGURE].count, configure );
+	TEST_ASSERT_EQUAL( 2, run );
+	TEST_ASSERT( runTotal >= 4000000 && runMax >= 3000000 );
+
+	// anything else is left alone
+	file = fopen( path, "w" );
+	fprintf( file, "not timing\n" );
+	fclose( file );
+	TEST_ASSERT_EQUAL( -1, timing_print( latency_now(), path ) );
+	unlink( path );
+}
+
+
+int main( int argc, char ** argv )
+{
+	static const struct test tests[] =
+	{
+		TEST( test_threads ),
+		TEST( test_json ),
+		TEST( test_cost ),
+		TEST( test_summary ),
+		TEST( test_timing ),
+	};
+	if( trace_enable( NULL, CAPACITY ) )
+		return EXIT_FAILURE;
+	return test_run( tests, sizeof(tests) / sizeof(tests[0]), argc, argv );
+}
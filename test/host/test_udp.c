@@ -0,0 +1,176 @@
+#define _DEFAULT_SOURCE
+
+#include "test.h"
+
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "udpserver.h"
+#include "servusb_udp.h"
+#include "emulated.h"
+
+
+#define MS 1000000ll // nanoseconds
+
+
+static struct udpserver * server;
+static int sender = -1;
+
+
+static int64_t now = 0;
+
+static int64_t fakeClock( void )
+{
+	return now;
+}
+
+
+static void openServer( void )
+{
+	static const struct udpserver_config config = { "127.0.0.1", "0" };
+	emulated_setClock( fakeClock );
+	now = 1000 * MS;
+	TEST_ASSERT_EQUAL( 0, udpserver_open( &server, servusb_findTransport( "emulated" ), -1, -1, &config ) );
+	TEST_ASSERT( udpserver_getPort( server ) );
+
+	struct sockaddr_in address;
+	memset( &address, 0, sizeof(address) );
+	address.sin_family = AF_INET;
+	address.sin_port = htons( udpserver_getPort( server ) );
+	address.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+	sender = socket( AF_INET, SOCK_DGRAM, 0 );
+	TEST_ASSERT( sender >= 0 );
+	TEST_ASSERT( !connect( sender, (struct sockaddr *)&address, sizeof(address) ) );
+}
+
+
+static void closeServer( void )
+{
+	close( sender );
+	udpserver_close( server );
+	emulated_setClock( NULL );
+}
+
+
+static void sendSetpoint( uint8_t device, uint32_t sequence, uint8_t position, uint8_t flags )
+{
+	struct servusb_udp_setpoint setpoint = { device, position, flags, sequence };
+	uint8_t datagram[SERVUSB_UDP_SIZE];
+	servusb_udp_pack( datagram, &setpoint );
+	TEST_ASSERT_EQUAL( SERVUSB_UDP_SIZE, send( sender, datagram, sizeof(datagram), 0 ) );
+}
+
+
+// where the emulated servo ends up
+static float target( void )
+{
+	return kinematics_getPosition( emulated_getKinematics(), 0, now + 10000 * MS );
+}
+
+
+static void test_datagram( void )
+{
+	struct servusb_udp_setpoint setpoint = { 3, 200, SERVUSB_UDP_FLAG_ENABLE, 0x12345678 };
+	uint8_t datagram[SERVUSB_UDP_SIZE];
+	servusb_udp_pack( datagram, &setpoint );
+	TEST_ASSERT_EQUAL( SERVUSB_UDP_VERSION, datagram[0] );
+	TEST_ASSERT_EQUAL( 0x78, datagram[4] ); // little endian
+
+	struct servusb_udp_setpoint unpacked;
+	TEST_ASSERT( servusb_udp_unpack( datagram, sizeof(datagram), &unpacked ) );
+	TEST_ASSERT_EQUAL( 3, unpacked.device );
+	TEST_ASSERT_EQUAL( 200, unpacked.position );
+	TEST_ASSERT_EQUAL( SERVUSB_UDP_FLAG_ENABLE, unpacked.flags );
+	TEST_ASSERT_EQUAL( 0x12345678, unpacked.sequence );
+	TEST_ASSERT( !servusb_udp_unpack( datagram, sizeof(datagram) - 1, &unpacked ) );
+	datagram[0] = 0;
+	TEST_ASSERT( !servusb_udp_unpack( datagram, sizeof(datagram), &unpacked ) );
+
+	TEST_ASSERT( servusb_udp_newer( 1, 0 ) );
+	TEST_ASSERT( !servusb_udp_newer( 1, 1 ) );
+	TEST_ASSERT( !servusb_udp_newer( 0, 1 ) );
+	TEST_ASSERT( servusb_udp_newer( 2, 0xfffffffe ) ); // wrapped around
+}
+
+
+// datagrams queued during a transfer are coalesced, old ones dropped - served in one go
+// by stopping before serving
+static void test_ordering( void )
+{
+	openServer();
+	sendSetpoint( 0, 10, 50, SERVUSB_UDP_FLAG_ENABLE );
+	sendSetpoint( 0, 12, 70, SERVUSB_UDP_FLAG_ENABLE );
+	sendSetpoint( 0, 11, 60, SERVUSB_UDP_FLAG_ENABLE ); // overtaken
+	sendSetpoint( 0, 12, 60, SERVUSB_UDP_FLAG_ENABLE ); // duplicate
+	sendSetpoint( 1, 13, 60, SERVUSB_UDP_FLAG_ENABLE ); // no such device
+	udpserver_stop( server );
+	TEST_ASSERT_EQUAL( 0, udpserver_serve( server ) );
+	const struct udpserver_stats * stats = udpserver_getStats( server );
+	TEST_ASSERT_EQUAL( 5, stats->datagrams );
+	TEST_ASSERT_EQUAL( 1, stats->invalid );
+	TEST_ASSERT_EQUAL( 2, stats->dropped );
+	TEST_ASSERT_EQUAL( 1, stats->coalesced );
+	TEST_ASSERT_EQUAL( 1, stats->updates );
+	TEST_ASSERT_EQUAL( 1, stats->latency.count );
+	TEST_ASSERT_EQUAL( 70, target() );
+
+	// a sender starting over
+	sendSetpoint( 0, 1, 90, SERVUSB_UDP_FLAG_ENABLE );
+	sendSetpoint( 0, 0, 100, SERVUSB_UDP_FLAG_ENABLE | SERVUSB_UDP_FLAG_RESET );
+	sendSetpoint( 0, 1, 110, SERVUSB_UDP_FLAG_ENABLE );
+	udpserver_stop( server );
+	TEST_ASSERT_EQUAL( 0, udpserver_serve( server ) );
+	TEST_ASSERT_EQUAL( 3, stats->dropped );
+	TEST_ASSERT_EQUAL( 2, stats->updates );
+	TEST_ASSERT_EQUAL( 110, target() );
+	closeServer();
+}
+
+
+static void * serve( void * argument )
+{
+	return (void *)(intptr_t)udpserver_serve( server );
+}
+
+
+// a server waiting on the socket, every setpoint gets through and its latency is measured
+static void test_loopback( void )
+{
+	openServer();
+	pthread_t thread;
+	TEST_ASSERT( !pthread_create( &thread, NULL, serve, NULL ) );
+	for( uint32_t i = 1; i <= 50; ++i )
+	{
+		sendSetpoint( 0, i, i, SERVUSB_UDP_FLAG_ENABLE );
+		usleep( 200 );
+	}
+	udpserver_stop( server );
+	void * err;
+	pthread_join( thread, &err );
+	TEST_ASSERT_EQUAL( 0, (intptr_t)err );
+
+	const struct udpserver_stats * stats = udpserver_getStats( server );
+	TEST_ASSERT_EQUAL( 50, stats->datagrams );
+	TEST_ASSERT_EQUAL( 0, stats->dropped );
+	TEST_ASSERT_EQUAL( 50, stats->updates + stats->coalesced );
+	TEST_ASSERT_EQUAL( stats->updates, stats->latency.count );
+	TEST_ASSERT( stats->latency.min >= 0 && stats->latency.max < 1000 * MS );
+	TEST_ASSERT_EQUAL( 50, target() );
+	udpserver_print( stats );
+	closeServer();
+}
+
+
+int main( int argc, char ** argv )
+{
+	static const struct test tests[] =
+	{
+		TEST( test_datagram ),
+		TEST( test_ordering ),
+		TEST( test_loopback ),
+	};
+	return test_run( tests, sizeof(tests) / sizeof(tests[0]), argc, argv );
+}
@@ -0,0 +1,70 @@
+#ifndef _TEST_H_
+#define _TEST_H_
+
+// Minimal test harness - each test is a function
+// which returns early on the first failed assertion.
+
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+
+static unsigned int test_failures = 0;
+
+
+#define TEST_ASSERT( condition ) \
+	do { \
+		if( !(condition) ) \
+		{ \
+			fprintf( stderr, "%s:%d: Assertion failed: %s\n", __FILE__, __LINE__, #condition ); \
+			++test_failures; \
+			return; \
+		} \
+	} while( 0 )
+
+#define TEST_ASSERT_EQUAL( expected, actual ) \
+	do { \
+		long long test_expected = (expected); \
+		long long test_actual = (actual); \
+		if( test_expected != test_actual ) \
+		{ \
+			fprintf( stderr, "%s:%d: Assertion failed: %s == %s (%lld != %lld)\n", __FILE__, __LINE__, #expected, #actual, test_expected, test_actual ); \
+			++test_failures; \
+			return; \
+		} \
+	} while( 0 )
+
+
+struct test
+{
+	const char * name;
+	void (*function)( void );
+};
+
+#define TEST( function ) { #function, function }
+
+
+// Runs all tests, or only the one named on the command line, and returns the exit code.
+static int test_run( const struct test * tests, unsigned int count, int argc, char ** argv )
+{
+	unsigned int run = 0;
+	for( unsigned int i = 0; i < count; ++i )
+	{
+		if( argc > 1 && strcmp( argv[1], tests[i].name ) )
+			continue;
+		unsigned int failures = test_failures;
+		tests[i].function();
+		printf( "%s: %s\n", test_failures == failures ? "PASS" : "FAIL", tests[i].name );
+		++run;
+	}
+	if( !run )
+	{
+		fprintf( stderr, "No test named %s!\n", argc > 1 ? argv[1] : "" );
+		return EXIT_FAILURE;
+	}
+	return test_failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+#endif